@@ -0,0 +1,458 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+
+#define BYTES_IN_MB (1024 * 1024)
+/* Before what mmap and arena hand out, which stays 16-byte aligned */
+#define AL_HEADER 16
+#define MALLOCX_ZERO 0x40
+
+/* What we found in a dlopen'ed library */
+typedef struct {
+    void   *ad_lib;
+    void *(*ad_malloc)(size_t size);
+    void *(*ad_calloc)(size_t num, size_t size);
+    void  (*ad_free)(void *ptr);
+    size_t (*ad_usable_size)(void *ptr);
+    void *(*ad_mallocx)(size_t size, int flags);
+    void  (*ad_dallocx)(void *ptr, int flags);
+    size_t (*ad_sallocx)(const void *ptr, int flags);
+} al_dl_t;
+
+typedef struct al_chunk {
+    struct al_chunk *ac_next;
+    size_t           ac_bytes;
+} al_chunk_t;
+
+typedef struct {
+    uint64_t        ar_id;
+    size_t          ar_chunk_bytes;
+    pthread_mutex_t ar_lock;
+    al_chunk_t     *ar_chunks;
+} al_arena_t;
+
+/*
+ * Each thread bumps through a chunk of its own, so that only taking a
+ * new chunk locks. The arena's id, rather than its address, tells the
+ * chunk is from the arena at hand, since a new arena may get the
+ * address of a closed one.
+ */
+static __thread struct {
+    uint64_t ac_id;
+    char    *ac_next;
+    char    *ac_end;
+} al_cursor;
+
+static uint64_t al_arena_ids;
+
+typedef struct {
+    const char *ab_name;
+    int	      (*ab_open)(allocator_t *al, const char *arg, char *error,
+			 size_t error_size);
+    void      (*ab_close)(allocator_t *al);
+    void     *(*ab_malloc)(allocator_t *al, size_t size);
+    void     *(*ab_calloc)(allocator_t *al, size_t size);
+    void      (*ab_free)(allocator_t *al, void *ptr);
+    size_t    (*ab_usable_size)(allocator_t *al, void *ptr);
+} al_backend_t;
+
+static void *libc_malloc(allocator_t *al, size_t size) {
+
+    return malloc(size);
+}
+
+static void *libc_calloc(allocator_t *al, size_t size) {
+
+    return calloc(1, size);
+}
+
+static void libc_free(allocator_t *al, void *ptr) {
+
+    free(ptr);
+}
+
+static size_t libc_usable_size(allocator_t *al, void *ptr) {
+
+    return malloc_usable_size(ptr);
+}
+
+static int mk_open_default(allocator_t *al, const char *arg, char *error,
+			   size_t error_size) {
+
+    al->al_kind = MEMKIND_DEFAULT;
+    return 0;
+}
+
+static int mk_open_kmem(allocator_t *al, const char *arg, char *error,
+			size_t error_size) {
+
+    if (memkind_check_available(MEMKIND_DAX_KMEM_ALL) != 0) {
+	snprintf(error, error_size, "there are no DAX KMEM nodes");
+	return -1;
+    }
+    al->al_kind = MEMKIND_DAX_KMEM_ALL;
+    return 0;
+}
+
+static int mk_open_pmem(allocator_t *al, const char *arg, char *error,
+			size_t error_size) {
+
+    int err;
+
+    if (arg == NULL || arg[0] == '\0') {
+	snprintf(error, error_size, "pmem needs a directory");
+	return -1;
+    }
+    if ((err = memkind_create_pmem(arg, 0, &al->al_kind)) != 0) {
+	memkind_error_message(err, error, error_size);
+	return -1;
+    }
+    return 0;
+}
+
+static void mk_close_pmem(allocator_t *al) {
+
+    memkind_destroy_kind(al->al_kind);
+}
+
+static void *mk_malloc(allocator_t *al, size_t size) {
+
+    return memkind_malloc(al->al_kind, size);
+}
+
+static void *mk_calloc(allocator_t *al, size_t size) {
+
+    return memkind_calloc(al->al_kind, 1, size);
+}
+
+static void mk_free(allocator_t *al, void *ptr) {
+
+    memkind_free(al->al_kind, ptr);
+}
+
+static size_t mk_usable_size(allocator_t *al, void *ptr) {
+
+    return memkind_malloc_usable_size(al->al_kind, ptr);
+}
+
+/* Load the first of libs that loads, and point dest at its syms */
+static int dl_open(allocator_t *al, const char **libs, const char **syms,
+		   void ***dest, char *error, size_t error_size) {
+
+    al_dl_t *ad = (al_dl_t *)al->al_private;
+    int i;
+
+    for (i = 0; libs[i] != NULL && ad->ad_lib == NULL; i++)
+	ad->ad_lib = dlopen(libs[i], RTLD_NOW | RTLD_LOCAL);
+    if (ad->ad_lib == NULL) {
+	snprintf(error, error_size, "%s", dlerror());
+	free(ad);
+	return -1;
+    }
+    for (i = 0; syms[i] != NULL; i++)
+	if ((*dest[i] = dlsym(ad->ad_lib, syms[i])) == NULL) {
+	    snprintf(error, error_size, "%s", dlerror());
+	    dlclose(ad->ad_lib);
+	    free(ad);
+	    return -1;
+	}
+    return 0;
+}
+
+static void dl_close(allocator_t *al) {
+
+    al_dl_t *ad = (al_dl_t *)al->al_private;
+
+    dlclose(ad->ad_lib);
+    free(ad);
+}
+
+static int tc_open(allocator_t *al, const char *arg, char *error,
+		   size_t error_size) {
+
+    static const char *libs[] = {"libtcmalloc.so.4",
+				 "libtcmalloc_minimal.so.4", "libtcmalloc.so",
+				 "libtcmalloc_minimal.so", NULL};
+    static const char *syms[] = {"tc_malloc", "tc_calloc", "tc_free",
+				 "tc_malloc_size", NULL};
+    al_dl_t *ad;
+
+    if ((ad = (al_dl_t *)calloc(1, sizeof(al_dl_t))) == NULL) {
+	snprintf(error, error_size, "%s", strerror(ENOMEM));
+	return -1;
+    }
+    al->al_private = ad;
+    return dl_open(al, libs, syms,
+		   (void **[]){(void **)&ad->ad_malloc,
+			       (void **)&ad->ad_calloc,
+			       (void **)&ad->ad_free,
+			       (void **)&ad->ad_usable_size},
+		   error, error_size);
+}
+
+static void *tc_malloc(allocator_t *al, size_t size) {
+
+    return ((al_dl_t *)al->al_private)->ad_malloc(size);
+}
+
+static void *tc_calloc(allocator_t *al, size_t size) {
+
+    return ((al_dl_t *)al->al_private)->ad_calloc(1, size);
+}
+
+static void tc_free(allocator_t *al, void *ptr) {
+
+    ((al_dl_t *)al->al_private)->ad_free(ptr);
+}
+
+static size_t tc_usable_size(allocator_t *al, void *ptr) {
+
+    return ((al_dl_t *)al->al_private)->ad_usable_size(ptr);
+}
+
+/* The non-standard API, which a build with a prefix doesn't rename */
+static int je_open(allocator_t *al, const char *arg, char *error,
+		   size_t error_size) {
+
+    static const char *libs[] = {"libjemalloc.so.2", "libjemalloc.so", NULL};
+    static const char *syms[] = {"mallocx", "dallocx", "sallocx", NULL};
+    al_dl_t *ad;
+
+    if ((ad = (al_dl_t *)calloc(1, sizeof(al_dl_t))) == NULL) {
+	snprintf(error, error_size, "%s", strerror(ENOMEM));
+	return -1;
+    }
+    al->al_private = ad;
+    return dl_open(al, libs, syms,
+		   (void **[]){(void **)&ad->ad_mallocx,
+			       (void **)&ad->ad_dallocx,
+			       (void **)&ad->ad_sallocx},
+		   error, error_size);
+}
+
+static void *je_malloc(allocator_t *al, size_t size) {
+
+    return ((al_dl_t *)al->al_private)->ad_mallocx(size, 0);
+}
+
+static void *je_calloc(allocator_t *al, size_t size) {
+
+    return ((al_dl_t *)al->al_private)->ad_mallocx(size, MALLOCX_ZERO);
+}
+
+static void je_free(allocator_t *al, void *ptr) {
+
+    ((al_dl_t *)al->al_private)->ad_dallocx(ptr, 0);
+}
+
+static size_t je_usable_size(allocator_t *al, void *ptr) {
+
+    return ((al_dl_t *)al->al_private)->ad_sallocx(ptr, 0);
+}
+
+/* The header keeps the length of the mapping; it comes zeroed */
+static void *map_malloc(allocator_t *al, size_t size) {
+
+    size_t bytes = size + AL_HEADER;
+    char *ptr;
+
+    ptr = (char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+	return NULL;
+    *(size_t *)ptr = bytes;
+    return ptr + AL_HEADER;
+}
+
+static void map_free(allocator_t *al, void *ptr) {
+
+    char *base = (char *)ptr - AL_HEADER;
+
+    munmap(base, *(size_t *)base);
+}
+
+static size_t map_usable_size(allocator_t *al, void *ptr) {
+
+    return *(size_t *)((char *)ptr - AL_HEADER) - AL_HEADER;
+}
+
+static int arena_open(allocator_t *al, const char *arg, char *error,
+		      size_t error_size) {
+
+    al_arena_t *ar;
+    size_t mb = AL_ARENA_MB;
+
+    if (arg != NULL && (mb = strtoul(arg, NULL, 10)) == 0) {
+	snprintf(error, error_size, "arena chunks of %s MB", arg);
+	return -1;
+    }
+    if ((ar = (al_arena_t *)calloc(1, sizeof(al_arena_t))) == NULL) {
+	snprintf(error, error_size, "%s", strerror(ENOMEM));
+	return -1;
+    }
+    ar->ar_id = __atomic_add_fetch(&al_arena_ids, 1, __ATOMIC_RELAXED);
+    ar->ar_chunk_bytes = mb * BYTES_IN_MB;
+    pthread_mutex_init(&ar->ar_lock, NULL);
+    al->al_private = ar;
+    return 0;
+}
+
+static void arena_close(allocator_t *al) {
+
+    al_arena_t *ar = (al_arena_t *)al->al_private;
+    al_chunk_t *chunk, *next;
+
+    for (chunk = ar->ar_chunks; chunk != NULL; chunk = next) {
+	next = chunk->ac_next;
+	munmap(chunk, chunk->ac_bytes);
+    }
+    if (al_cursor.ac_id == ar->ar_id)
+	al_cursor.ac_id = 0;
+    pthread_mutex_destroy(&ar->ar_lock);
+    free(ar);
+}
+
+static al_chunk_t *arena_chunk(al_arena_t *ar, size_t bytes) {
+
+    al_chunk_t *chunk;
+
+    chunk = (al_chunk_t *)mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED)
+	return NULL;
+    chunk->ac_bytes = bytes;
+    pthread_mutex_lock(&ar->ar_lock);
+    chunk->ac_next = ar->ar_chunks;
+    ar->ar_chunks = chunk;
+    pthread_mutex_unlock(&ar->ar_lock);
+    return chunk;
+}
+
+/*
+ * Each object after a header with its size. One too big for a quarter
+ * of a chunk gets a chunk to itself, so that it doesn't cut short the
+ * thread's.
+ */
+static void *arena_malloc(allocator_t *al, size_t size) {
+
+    al_arena_t *ar = (al_arena_t *)al->al_private;
+    size_t bytes = AL_HEADER + ((size + AL_HEADER - 1) & ~(AL_HEADER - 1));
+    al_chunk_t *chunk;
+    char *ptr;
+
+    if (bytes > ar->ar_chunk_bytes / 4) {
+	if ((chunk = arena_chunk(ar, sizeof(al_chunk_t) + bytes)) == NULL)
+	    return NULL;
+	ptr = (char *)(chunk + 1);
+    } else {
+	if (al_cursor.ac_id != ar->ar_id ||
+	    (size_t)(al_cursor.ac_end - al_cursor.ac_next) < bytes) {
+	    if ((chunk = arena_chunk(ar, ar->ar_chunk_bytes)) == NULL)
+		return NULL;
+	    al_cursor.ac_id = ar->ar_id;
+	    al_cursor.ac_next = (char *)(chunk + 1);
+	    al_cursor.ac_end = (char *)chunk + ar->ar_chunk_bytes;
+	}
+	ptr = al_cursor.ac_next;
+	al_cursor.ac_next += bytes;
+    }
+    *(size_t *)ptr = size;
+    return ptr + AL_HEADER;
+}
+
+static void arena_free(allocator_t *al, void *ptr) {
+}
+
+static size_t arena_usable_size(allocator_t *al, void *ptr) {
+
+    return *(size_t *)((char *)ptr - AL_HEADER);
+}
+
+/* mmap and arena hand out fresh mappings, never reused: already zeroed */
+static const al_backend_t al_backends[] = {
+    {"malloc", NULL, NULL, libc_malloc, libc_calloc, libc_free,
+     libc_usable_size},
+    {"memkind", mk_open_default, NULL, mk_malloc, mk_calloc, mk_free,
+     mk_usable_size},
+    {"kmem", mk_open_kmem, NULL, mk_malloc, mk_calloc, mk_free,
+     mk_usable_size},
+    {"pmem", mk_open_pmem, mk_close_pmem, mk_malloc, mk_calloc, mk_free,
+     mk_usable_size},
+    {"tcmalloc", tc_open, dl_close, tc_malloc, tc_calloc, tc_free,
+     tc_usable_size},
+    {"jemalloc", je_open, dl_close, je_malloc, je_calloc, je_free,
+     je_usable_size},
+    {"mmap", NULL, NULL, map_malloc, map_malloc, map_free, map_usable_size},
+    {"arena", arena_open, arena_close, arena_malloc, arena_malloc,
+     arena_free, arena_usable_size},
+};
+
+#define AL_BACKENDS (int)(sizeof(al_backends) / sizeof(al_backends[0]))
+
+const char *al_names(void) {
+
+    return "malloc, memkind, kmem, pmem:DIR, tcmalloc, jemalloc, mmap or "
+	"arena[:MB]";
+}
+
+static const al_backend_t *al_backend(const allocator_t *al) {
+
+    int i;
+
+    for (i = 0; i < AL_BACKENDS; i++)
+	if (strcmp(al_backends[i].ab_name, al->al_name) == 0)
+	    return &al_backends[i];
+    return NULL;
+}
+
+allocator_t *al_open(const char *spec, char *error, size_t error_size) {
+
+    const char *colon = strchr(spec, ':');
+    size_t len = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
+    const al_backend_t *ab;
+    allocator_t *al;
+    int i;
+
+    for (i = 0; i < AL_BACKENDS; i++)
+	if (strlen(al_backends[i].ab_name) == len &&
+	    strncmp(al_backends[i].ab_name, spec, len) == 0)
+	    break;
+    if (i == AL_BACKENDS) {
+	snprintf(error, error_size, "unknown allocator %s", spec);
+	return NULL;
+    }
+    ab = &al_backends[i];
+    if ((al = (allocator_t *)calloc(1, sizeof(allocator_t))) == NULL) {
+	snprintf(error, error_size, "%s", strerror(ENOMEM));
+	return NULL;
+    }
+    al->al_name = ab->ab_name;
+    al->al_malloc = ab->ab_malloc;
+    al->al_calloc = ab->ab_calloc;
+    al->al_free = ab->ab_free;
+    al->al_usable_size = ab->ab_usable_size;
+    if (ab->ab_open != NULL &&
+	ab->ab_open(al, colon != NULL ? colon + 1 : NULL, error,
+		    error_size) != 0) {
+	free(al);
+	return NULL;
+    }
+    return al;
+}
+
+void al_close(allocator_t *al) {
+
+    const al_backend_t *ab = al_backend(al);
+
+    if (ab->ab_close != NULL)
+	ab->ab_close(al);
+    free(al);
+}
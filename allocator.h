@@ -0,0 +1,75 @@
+#ifndef _ALLOCATOR_H
+#define _ALLOCATOR_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#ifdef __linux__
+#include <memkind.h>
+#endif
+
+/*
+ * An allocator chosen at run time, so that a benchmark can be repeated
+ * over allocators without a build for each. The spec is one of:
+ *
+ *   malloc	glibc's
+ *   memkind	memkind's DRAM, MEMKIND_DEFAULT
+ *   kmem	memkind's DAX KMEM nodes, MEMKIND_DAX_KMEM_ALL
+ *   pmem:DIR	memkind's file-backed PMEM, from a file in DIR
+ *   tcmalloc	libtcmalloc, dlopen'ed
+ *   jemalloc	libjemalloc, dlopen'ed
+ *   mmap	an anonymous mapping of its own for every allocation
+ *   arena[:MB]	a bump pointer through chunks of MB, AL_ARENA_MB if not
+ *		given; frees are no-ops and the chunks go at al_close()
+ *
+ * The libraries that are dlopen'ed are looked up by their usual names,
+ * so LD_LIBRARY_PATH picks the build. They're loaded without replacing
+ * malloc, which everything else keeps using.
+ */
+#define AL_ARENA_MB 64
+#define AL_ERROR_SIZE 256
+
+typedef struct allocator allocator_t;
+
+struct allocator {
+    const char      *al_name;
+    void          *(*al_malloc)(allocator_t *al, size_t size);
+    void          *(*al_calloc)(allocator_t *al, size_t size);
+    void           (*al_free)(allocator_t *al, void *ptr);
+    size_t         (*al_usable_size)(allocator_t *al, void *ptr);
+    struct memkind  *al_kind;		/* the memkind backends' */
+    void            *al_private;	/* the others' */
+};
+
+/*
+ * NULL if the spec is unknown or its backend isn't available, with the
+ * reason in error.
+ */
+allocator_t *al_open(const char *spec, char *error, size_t error_size);
+/* Frees what the backend holds, not what it handed out */
+void         al_close(allocator_t *al);
+/* The specs, for help messages */
+const char  *al_names(void);
+
+static inline void *al_malloc(allocator_t *al, size_t size) {
+
+    return al->al_malloc(al, size);
+}
+
+/* Zeroed */
+static inline void *al_calloc(allocator_t *al, size_t size) {
+
+    return al->al_calloc(al, size);
+}
+
+static inline void al_free(allocator_t *al, void *ptr) {
+
+    if (ptr != NULL)
+	al->al_free(al, ptr);
+}
+
+static inline size_t al_usable_size(allocator_t *al, void *ptr) {
+
+    return al->al_usable_size(al, ptr);
+}
+
+#endif
@@ -0,0 +1,202 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hash_table.h"
+#include "mem_tier.h"
+
+/*
+ * Gets, removes and scans on the OLC B+tree while inserts split its
+ * leaves under them. Every inserter puts its own keys, spread over the
+ * whole key space so that splits land all over the tree, and publishes
+ * how many it has put. Readers look up published keys that stay and
+ * must find every one of them; removers take the published keys that go,
+ * and at the end those must be gone and the rest there.
+ */
+
+#define DEFAULT_INSERTERS 2
+#define DEFAULT_READERS 2
+#define DEFAULT_KEYS 200000
+#define VALUE_SIZE 8
+
+static ht_btree_t *bt;
+static int inserters = DEFAULT_INSERTERS;
+static size_t keys_per_inserter = DEFAULT_KEYS;
+static size_t *published;
+static volatile int inserting = 1;
+static size_t misses;
+
+/*
+ * Distinct, since an odd multiplier is a bijection, and scattered over
+ * the key space. Never 0, as x isn't.
+ */
+static size_t race_key(int inserter, size_t i) {
+
+    uint64_t x = (uint64_t)i * inserters + inserter + 1;
+
+    return (size_t)(x * 0x9E3779B97F4A7C15ULL);
+}
+
+/* Odd indexes are removed once they are published, even ones stay */
+#define STAYS(i) ((i) % 2 == 0)
+
+static void *run_inserter(void *arg) {
+
+    int t = (int)(intptr_t)arg;
+    size_t i;
+
+    for (i = 0; i < keys_per_inserter; i++) {
+	if (ht_btree_put(bt, race_key(t, i), VALUE_SIZE) == NULL)
+	    EXIT_MSG("Key %zu of inserter %d was there already\n", i, t);
+	__atomic_store_n(&published[t], i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *run_reader(void *arg) {
+
+    uint64_t rnd = 0x9E3779B97F4A7C15ULL * ((intptr_t)arg + 1);
+    size_t i, n, key, size, found, keys[1], sizes[1];
+    void *values[1];
+    int t;
+
+    while (__atomic_load_n(&inserting, __ATOMIC_ACQUIRE)) {
+	rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+	t = (int)((rnd >> 33) % inserters);
+	if ((n = __atomic_load_n(&published[t], __ATOMIC_ACQUIRE)) < 2)
+	    continue;
+	i = ((rnd >> 17) % (n / 2)) * 2;
+	key = race_key(t, i);
+	if (ht_btree_get(bt, key, &size) == NULL) {
+	    printf("Get missed key %zu of inserter %d\n", i, t);
+	    __atomic_fetch_add(&misses, 1, __ATOMIC_RELAXED);
+	}
+	found = ht_btree_scan(bt, key, 1, keys, values, sizes);
+	if (found != 1 || keys[0] != key) {
+	    printf("Scan missed key %zu of inserter %d\n", i, t);
+	    __atomic_fetch_add(&misses, 1, __ATOMIC_RELAXED);
+	}
+    }
+    return NULL;
+}
+
+/* One per inserter, behind it */
+static void *run_remover(void *arg) {
+
+    int t = (int)(intptr_t)arg;
+    size_t i = 1, n;
+
+    while (i < keys_per_inserter) {
+	n = __atomic_load_n(&published[t], __ATOMIC_ACQUIRE);
+	for (; i < n; i += 2)
+	    ht_btree_remove(bt, race_key(t, i), VALUE_SIZE);
+    }
+    return NULL;
+}
+
+static void usage(const char *progname) {
+
+    printf("usage: %s [OPTION]\n", progname);
+    printf("  --inserters=N\n"
+	   "     Threads that insert, each with a remover behind it.\n"
+	   "     Defaults to %d.\n", DEFAULT_INSERTERS);
+    printf("  --keys=N\n"
+	   "     Keys each inserter puts. Defaults to %d.\n", DEFAULT_KEYS);
+    printf("  --readers=N\n"
+	   "     Threads that get and scan. Defaults to %d.\n",
+	   DEFAULT_READERS);
+}
+
+int main(int argc, char **argv) {
+
+    pthread_t *threads;
+    char al_error[256];
+    int readers = DEFAULT_READERS, nthreads, c, ret, i, t;
+    size_t n, size, left = 0;
+
+    static struct option long_options[] = {
+	{"help", no_argument, 0, 'h'},
+	{"inserters", required_argument, 0, 'i'},
+	{"keys", required_argument, 0, 'k'},
+	{"readers", required_argument, 0, 'r'},
+	{0, 0, 0, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "hi:k:r:", long_options,
+			    NULL)) != -1) {
+	switch (c) {
+	case 'i':
+	    inserters = atoi(optarg);
+	    break;
+	case 'k':
+	    keys_per_inserter = strtoull(optarg, NULL, 10);
+	    break;
+	case 'r':
+	    readers = atoi(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	    exit(c == 'h' ? 0 : -1);
+	}
+    }
+    if (inserters < 1 || readers < 1)
+	EXIT_MSG("Need at least one inserter and one reader\n");
+
+    /* Everything in DRAM, so no PMEM kind is needed */
+    mt_policy = MT_DRAM;
+    if ((mt_dram_al = al_open("malloc", al_error, sizeof(al_error))) == NULL)
+	EXIT_MSG("Could not open allocator malloc: %s\n", al_error);
+    if ((bt = ht_btree_allocate(1)) == NULL)
+	EXIT_MSG("Could not allocate the B+tree\n");
+    published = (size_t *)calloc(inserters, sizeof(size_t));
+    nthreads = 2 * inserters + readers;
+    threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    if (published == NULL || threads == NULL)
+	EXIT_MSG("Failed to allocate memory: %s\n", strerror(errno));
+
+    for (i = 0; i < nthreads; i++) {
+	if (i < inserters)
+	    ret = pthread_create(&threads[i], NULL, run_inserter,
+				 (void *)(intptr_t)i);
+	else if (i < 2 * inserters)
+	    ret = pthread_create(&threads[i], NULL, run_remover,
+				 (void *)(intptr_t)(i - inserters));
+	else
+	    ret = pthread_create(&threads[i], NULL, run_reader,
+				 (void *)(intptr_t)i);
+	if (ret != 0)
+	    EXIT_MSG("pthread_create for %dth thread failed: %s\n", i,
+		     strerror(ret));
+    }
+    for (i = 0; i < 2 * inserters; i++)
+	pthread_join(threads[i], NULL);
+    __atomic_store_n(&inserting, 0, __ATOMIC_RELEASE);
+    for (; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+
+    /* Whatever a remove missed is still there */
+    for (t = 0; t < inserters; t++)
+	for (n = 0; n < keys_per_inserter; n++) {
+	    if ((ht_btree_get(bt, race_key(t, n), &size) != NULL) ==
+		STAYS(n))
+		continue;
+	    printf("Key %zu of inserter %d should %s\n", n, t,
+		   STAYS(n) ? "be there" : "be gone");
+	    left++;
+	}
+
+    ht_btree_print_stats(bt);
+    if (misses != 0 || left != 0) {
+	printf("FAILED: %zu keys missed while inserting, %zu wrong after\n",
+	       misses, left);
+	return 1;
+    }
+    printf("No inserted key was missed\n");
+    return 0;
+}
@@ -0,0 +1,421 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffer_pool.h"
+
+#define BP_NUM_PARTITIONS 64
+#define BP_MIN_BUCKETS 16
+#define BP_FRAME_ALIGN 4096
+
+#define BF_EMPTY 0
+#define BF_LOADING 1
+#define BF_VALID 2
+
+#define LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define CAS(ptr, expected, desired)                                     \
+    __atomic_compare_exchange_n(ptr, expected, desired, 0,              \
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+static inline uint64_t
+page_hash(off_t page) {
+
+    return ((uint64_t)page * 0x9E3779B97F4A7C15ULL) >> 16;
+}
+
+static inline bp_partition_t *
+page_partition(buffer_pool_t *bp, off_t page) {
+
+    return &bp->bp_partitions[page_hash(page) % BP_NUM_PARTITIONS];
+}
+
+static inline int32_t *
+page_bucket(buffer_pool_t *bp, bp_partition_t *part, off_t page) {
+
+    return &part->bpp_buckets[(page_hash(page) / BP_NUM_PARTITIONS) &
+                              (bp->bp_buckets_per_partition - 1)];
+}
+
+/* The caller holds the partition lock */
+static int32_t
+table_lookup(buffer_pool_t *bp, bp_partition_t *part, off_t page) {
+
+    int32_t idx = *page_bucket(bp, part, page);
+
+    while (idx >= 0 && bp->bp_frames[idx].bf_page != page)
+        idx = bp->bp_frames[idx].bf_next;
+    return idx;
+}
+
+static void
+table_insert(buffer_pool_t *bp, bp_partition_t *part, bp_frame_t *f) {
+
+    int32_t *head = page_bucket(bp, part, f->bf_page);
+
+    f->bf_next = *head;
+    *head = (int32_t)(f - bp->bp_frames);
+}
+
+static void
+table_remove(buffer_pool_t *bp, bp_partition_t *part, bp_frame_t *f) {
+
+    int32_t *link = page_bucket(bp, part, f->bf_page);
+    int32_t idx = (int32_t)(f - bp->bp_frames);
+
+    while (*link != idx)
+        link = &bp->bp_frames[*link].bf_next;
+    *link = f->bf_next;
+}
+
+static void
+frame_load(buffer_pool_t *bp, bp_frame_t *f) {
+
+    ssize_t ret;
+
+    ret = targets_pread(bp->bp_targets, f->bf_data, bp->bp_page_size,
+                        f->bf_page * bp->bp_page_size, NULL);
+    if (ret < 0) {
+        printf("Buffer pool failed to read page %" PRIu64 ": %s\n",
+               (uint64_t)f->bf_page, strerror(errno));
+        f->bf_error = 1;
+    }
+    else if ((size_t)ret < bp->bp_page_size) /* Past the end of file */
+        memset(f->bf_data + ret, 0, bp->bp_page_size - ret);
+    STORE(&f->bf_state, BF_VALID);
+}
+
+static int
+frame_write_back(buffer_pool_t *bp, bp_frame_t *f) {
+
+    if (targets_pwrite(bp->bp_targets, f->bf_data, bp->bp_page_size,
+                       f->bf_page * bp->bp_page_size, NULL) < 0) {
+        printf("Buffer pool failed to write page %" PRIu64 ": %s\n",
+               (uint64_t)f->bf_page, strerror(errno));
+        return -1;
+    }
+    f->bf_dirty = 0;
+    return 0;
+}
+
+/*
+ * Find a frame for a new page and return it with bf_pins set to -1, so
+ * that nobody else can pin it. Frames that were never used go first, then
+ * the CLOCK hand sweeps the pool: pinned frames are skipped and recently
+ * referenced ones get a second chance. A dirty victim is written back
+ * before it leaves the page table, so a thread that misses on that page
+ * afterwards reads the new contents from the file. If the write fails,
+ * the frame stays in the table, dirty, and the sweep goes on.
+ */
+static bp_frame_t *
+get_victim(buffer_pool_t *bp, bp_stats_t *stats) {
+
+    bp_frame_t *f;
+    bp_partition_t *part;
+    uint64_t n, sweeps = 0;
+    int expected;
+
+    n = __atomic_fetch_add(&bp->bp_next_unused, 1, __ATOMIC_RELAXED);
+    if (n < bp->bp_num_frames) {
+        f = &bp->bp_frames[n];
+        STORE(&f->bf_pins, -1);
+        return f;
+    }
+
+    while (1) {
+        n = __atomic_fetch_add(&bp->bp_clock_hand, 1, __ATOMIC_RELAXED);
+        f = &bp->bp_frames[n % bp->bp_num_frames];
+
+        /* Every frame is pinned; let the other threads make progress */
+        if (++sweeps % (2 * bp->bp_num_frames) == 0)
+            sched_yield();
+
+        if (LOAD(&f->bf_pins) != 0)
+            continue;
+        if (LOAD(&f->bf_ref)) {
+            STORE(&f->bf_ref, 0);
+            continue;
+        }
+        expected = 0;
+        if (!CAS(&f->bf_pins, &expected, -1))
+            continue;
+
+        if (f->bf_page >= 0) {
+            if (f->bf_dirty) {
+                /* The frame has the page's only copy; keep it for later */
+                if (frame_write_back(bp, f) != 0) {
+                    STORE(&f->bf_ref, 1);
+                    STORE(&f->bf_pins, 0);
+                    continue;
+                }
+                stats->bs_writebacks++;
+            }
+            part = page_partition(bp, f->bf_page);
+            pthread_mutex_lock(&part->bpp_lock);
+            table_remove(bp, part, f);
+            pthread_mutex_unlock(&part->bpp_lock);
+            f->bf_page = -1;
+            stats->bs_evictions++;
+        }
+        return f;
+    }
+}
+
+static void
+io_enqueue(buffer_pool_t *bp, bp_frame_t *f) {
+
+    int32_t idx = (int32_t)(f - bp->bp_frames);
+
+    f->bf_io_next = -1;
+    pthread_mutex_lock(&bp->bp_io_lock);
+    if (bp->bp_io_tail >= 0)
+        bp->bp_frames[bp->bp_io_tail].bf_io_next = idx;
+    else
+        bp->bp_io_head = idx;
+    bp->bp_io_tail = idx;
+    pthread_cond_signal(&bp->bp_io_cond);
+    pthread_mutex_unlock(&bp->bp_io_lock);
+}
+
+static void *
+io_thread(void *arg) {
+
+    buffer_pool_t *bp = (buffer_pool_t *)arg;
+    bp_frame_t *f;
+
+    while (1) {
+        pthread_mutex_lock(&bp->bp_io_lock);
+        while (bp->bp_io_head < 0 && !bp->bp_io_shutdown)
+            pthread_cond_wait(&bp->bp_io_cond, &bp->bp_io_lock);
+        if (bp->bp_io_head < 0) {
+            pthread_mutex_unlock(&bp->bp_io_lock);
+            return NULL;
+        }
+        f = &bp->bp_frames[bp->bp_io_head];
+        bp->bp_io_head = f->bf_io_next;
+        if (bp->bp_io_head < 0)
+            bp->bp_io_tail = -1;
+        pthread_mutex_unlock(&bp->bp_io_lock);
+
+        frame_load(bp, f);
+    }
+}
+
+/*
+ * Pin the page, reading it in on a miss. If the caller is about to
+ * overwrite the whole page we skip the read. With async set and I/O
+ * threads configured, the read is queued and the caller must bp_wait()
+ * before touching the data.
+ */
+static bp_frame_t *
+pin_page(buffer_pool_t *bp, off_t page, int overwrite, bp_stats_t *stats,
+         int async) {
+
+    bp_partition_t *part = page_partition(bp, page);
+    bp_frame_t *f;
+    int32_t idx;
+    int pins;
+
+retry:
+    pthread_mutex_lock(&part->bpp_lock);
+    if ((idx = table_lookup(bp, part, page)) >= 0) {
+        f = &bp->bp_frames[idx];
+        pins = LOAD(&f->bf_pins);
+        do {
+            if (pins < 0) {
+                /* Being evicted; wait until it's out of the table */
+                pthread_mutex_unlock(&part->bpp_lock);
+                sched_yield();
+                goto retry;
+            }
+        } while (!CAS(&f->bf_pins, &pins, pins + 1));
+        pthread_mutex_unlock(&part->bpp_lock);
+
+        STORE(&f->bf_ref, 1);
+        stats->bs_hits++;
+        if (!async)
+            bp_wait(f);
+        return f;
+    }
+    pthread_mutex_unlock(&part->bpp_lock);
+
+    /* Miss. Don't hold the partition lock while we evict. */
+    f = get_victim(bp, stats);
+
+    pthread_mutex_lock(&part->bpp_lock);
+    if (table_lookup(bp, part, page) >= 0) {
+        /* Somebody else brought the page in meanwhile */
+        pthread_mutex_unlock(&part->bpp_lock);
+        f->bf_state = BF_EMPTY;
+        STORE(&f->bf_pins, 0);
+        goto retry;
+    }
+    f->bf_page = page;
+    f->bf_dirty = 0;
+    f->bf_error = 0;
+    f->bf_ref = 1;
+    f->bf_state = overwrite ? BF_VALID : BF_LOADING;
+    STORE(&f->bf_pins, 1);
+    table_insert(bp, part, f);
+    pthread_mutex_unlock(&part->bpp_lock);
+
+    stats->bs_misses++;
+    if (!overwrite) {
+        if (async && bp->bp_num_io_threads > 0)
+            io_enqueue(bp, f);
+        else
+            frame_load(bp, f);
+    }
+    if (!async)
+        bp_wait(f);
+    return f;
+}
+
+bp_frame_t *
+bp_pin(buffer_pool_t *bp, off_t page, int overwrite, bp_stats_t *stats) {
+
+    return pin_page(bp, page, overwrite, stats, 0);
+}
+
+bp_frame_t *
+bp_pin_async(buffer_pool_t *bp, off_t page, int overwrite, bp_stats_t *stats) {
+
+    return pin_page(bp, page, overwrite, stats, 1);
+}
+
+/* Wait until a pinned frame's contents are valid. Returns -1 on I/O error. */
+int
+bp_wait(bp_frame_t *f) {
+
+    while (LOAD(&f->bf_state) == BF_LOADING)
+        sched_yield();
+    return f->bf_error ? -1 : 0;
+}
+
+void
+bp_unpin(bp_frame_t *f, int dirty) {
+
+    if (dirty)
+        f->bf_dirty = 1;
+    __atomic_fetch_sub(&f->bf_pins, 1, __ATOMIC_RELEASE);
+}
+
+/* Write back all dirty pages. Call only when no pages are pinned. */
+int
+bp_flush(buffer_pool_t *bp) {
+
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; i < bp->bp_num_frames; i++) {
+        bp_frame_t *f = &bp->bp_frames[i];
+        if (f->bf_page >= 0 && f->bf_dirty && frame_write_back(bp, f) != 0)
+            ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * Create a pool of pool_size bytes over the targets, which the caller
+ * has opened with O_DIRECT. The page size must be a multiple of the file
+ * system block size and divide the stripe unit. Returns NULL on failure.
+ */
+buffer_pool_t *
+bp_create(const targets_t *targets, size_t pool_size, size_t page_size,
+          int io_threads) {
+
+    buffer_pool_t *bp;
+    size_t i, nbuckets;
+
+    bp = (buffer_pool_t *) calloc(1, sizeof(buffer_pool_t));
+    if (bp == NULL)
+        return NULL;
+
+    bp->bp_targets = targets;
+    bp->bp_page_size = page_size;
+    bp->bp_num_frames = pool_size / page_size;
+    if (bp->bp_num_frames == 0)
+        goto error;
+
+    if (posix_memalign((void **)&bp->bp_memory, BP_FRAME_ALIGN,
+                       bp->bp_num_frames * page_size) != 0)
+        goto error;
+    bp->bp_frames = (bp_frame_t *)
+        calloc(bp->bp_num_frames, sizeof(bp_frame_t));
+    if (bp->bp_frames == NULL)
+        goto error;
+    for (i = 0; i < bp->bp_num_frames; i++) {
+        bp->bp_frames[i].bf_page = -1;
+        bp->bp_frames[i].bf_next = -1;
+        bp->bp_frames[i].bf_data = bp->bp_memory + i * page_size;
+    }
+
+    /* About two buckets per frame, so chains stay short */
+    nbuckets = BP_MIN_BUCKETS;
+    while (nbuckets * BP_NUM_PARTITIONS < 2 * bp->bp_num_frames)
+        nbuckets <<= 1;
+    bp->bp_buckets_per_partition = nbuckets;
+    bp->bp_partitions = (bp_partition_t *)
+        calloc(BP_NUM_PARTITIONS, sizeof(bp_partition_t));
+    if (bp->bp_partitions == NULL)
+        goto error;
+    for (i = 0; i < BP_NUM_PARTITIONS; i++) {
+        pthread_mutex_init(&bp->bp_partitions[i].bpp_lock, NULL);
+        bp->bp_partitions[i].bpp_buckets =
+            (int32_t *) malloc(nbuckets * sizeof(int32_t));
+        if (bp->bp_partitions[i].bpp_buckets == NULL)
+            goto error;
+        memset(bp->bp_partitions[i].bpp_buckets, 0xff,
+               nbuckets * sizeof(int32_t));
+    }
+
+    bp->bp_io_head = bp->bp_io_tail = -1;
+    pthread_mutex_init(&bp->bp_io_lock, NULL);
+    pthread_cond_init(&bp->bp_io_cond, NULL);
+    if (io_threads > 0) {
+        bp->bp_io_threads = (pthread_t *)
+            malloc(io_threads * sizeof(pthread_t));
+        if (bp->bp_io_threads == NULL)
+            goto error;
+        for (i = 0; i < (size_t)io_threads; i++) {
+            if (pthread_create(&bp->bp_io_threads[i], NULL, io_thread,
+                               bp) != 0)
+                goto error;
+            bp->bp_num_io_threads++;
+        }
+    }
+    return bp;
+
+error:
+    bp_destroy(bp);
+    return NULL;
+}
+
+void
+bp_destroy(buffer_pool_t *bp) {
+
+    int i;
+
+    pthread_mutex_lock(&bp->bp_io_lock);
+    bp->bp_io_shutdown = 1;
+    pthread_cond_broadcast(&bp->bp_io_cond);
+    pthread_mutex_unlock(&bp->bp_io_lock);
+    for (i = 0; i < bp->bp_num_io_threads; i++)
+        pthread_join(bp->bp_io_threads[i], NULL);
+
+    if (bp->bp_partitions != NULL)
+        for (i = 0; i < BP_NUM_PARTITIONS; i++)
+            free(bp->bp_partitions[i].bpp_buckets);
+    free(bp->bp_partitions);
+    free(bp->bp_frames);
+    free(bp->bp_memory);
+    free(bp->bp_io_threads);
+    free(bp);
+}
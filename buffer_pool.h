@@ -0,0 +1,74 @@
+#ifndef _BUFFER_POOL_H
+#define _BUFFER_POOL_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "file_targets.h"
+
+/*
+ * An application-managed page cache over O_DIRECT, the way a database
+ * buffer manager works: a fixed pool of page-sized frames, a partitioned
+ * page table, pinning, and CLOCK eviction with write-back of dirty pages.
+ * Misses are read either by the thread that takes them or, optionally,
+ * by a set of I/O threads so that a request spanning several pages can
+ * have all its misses in flight at once.
+ */
+
+typedef struct bp_frame {
+    off_t   bf_page;        /* page number, -1 if the frame is empty */
+    int     bf_pins;        /* -1 while the frame is being evicted */
+    int     bf_state;
+    int     bf_ref;         /* CLOCK reference bit */
+    int     bf_dirty;
+    int     bf_error;
+    int32_t bf_next;        /* next frame in the page table chain */
+    int32_t bf_io_next;     /* next frame in the I/O queue */
+    char   *bf_data;
+} bp_frame_t;
+
+typedef struct {
+    uint64_t bs_hits;
+    uint64_t bs_misses;
+    uint64_t bs_evictions;
+    uint64_t bs_writebacks;
+} bp_stats_t;
+
+typedef struct bp_partition {
+    pthread_mutex_t bpp_lock;
+    int32_t        *bpp_buckets;
+} bp_partition_t;
+
+typedef struct buffer_pool {
+    const targets_t *bp_targets;
+    size_t          bp_page_size;
+    size_t          bp_num_frames;
+    bp_frame_t     *bp_frames;
+    char           *bp_memory;
+    bp_partition_t *bp_partitions;
+    size_t          bp_buckets_per_partition;
+    uint64_t        bp_clock_hand;
+    uint64_t        bp_next_unused;
+    /* Asynchronous misses */
+    int             bp_num_io_threads;
+    pthread_t      *bp_io_threads;
+    pthread_mutex_t bp_io_lock;
+    pthread_cond_t  bp_io_cond;
+    int32_t         bp_io_head;
+    int32_t         bp_io_tail;
+    int             bp_io_shutdown;
+} buffer_pool_t;
+
+buffer_pool_t *bp_create(const targets_t *targets, size_t pool_size,
+                         size_t page_size, int io_threads);
+void           bp_destroy(buffer_pool_t *bp);
+int            bp_flush(buffer_pool_t *bp);
+bp_frame_t    *bp_pin(buffer_pool_t *bp, off_t page, int overwrite,
+                      bp_stats_t *stats);
+bp_frame_t    *bp_pin_async(buffer_pool_t *bp, off_t page, int overwrite,
+                            bp_stats_t *stats);
+int            bp_wait(bp_frame_t *f);
+void           bp_unpin(bp_frame_t *f, int dirty);
+
+#endif
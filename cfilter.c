@@ -0,0 +1,106 @@
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfilter.h"
+
+cfilter_t *cfilter_create(size_t keys) {
+
+    cfilter_t *cf;
+    uint64_t buckets = 1;
+
+    while (buckets * CFILTER_SLOTS * CFILTER_LOAD_PCT / 100 < keys)
+	buckets *= 2;
+    if ((cf = (cfilter_t *)calloc(1, sizeof(cfilter_t))) == NULL)
+	return NULL;
+    if ((cf->cf_buckets = (uint64_t *)calloc(buckets,
+					     sizeof(uint64_t))) == NULL) {
+	free(cf);
+	return NULL;
+    }
+    cf->cf_mask = buckets - 1;
+    return cf;
+}
+
+void cfilter_destroy(cfilter_t *cf) {
+
+    free(cf->cf_buckets);
+    free(cf);
+}
+
+size_t cfilter_bytes(const cfilter_t *cf) {
+
+    return (cf->cf_mask + 1) * sizeof(uint64_t);
+}
+
+static inline uint16_t cfilter_slot(uint64_t bucket, int i) {
+
+    return (uint16_t)(bucket >> (16 * i));
+}
+
+static inline void cfilter_set_slot(uint64_t *bucket, int i, uint16_t fp) {
+
+    *bucket = (*bucket & ~(0xffffULL << (16 * i))) |
+	((uint64_t)fp << (16 * i));
+}
+
+/* Returns 0 if fp went into an empty slot of the bucket */
+static int cfilter_insert(uint64_t *bucket, uint16_t fp) {
+
+    int i;
+
+    for (i = 0; i < CFILTER_SLOTS; i++)
+	if (cfilter_slot(*bucket, i) == 0) {
+	    cfilter_set_slot(bucket, i, fp);
+	    return 0;
+	}
+    return -1;
+}
+
+/*
+ * Kick a fingerprint out of a full bucket to its other bucket, and so on.
+ * The slot to kick comes from the fingerprint coming in, which is as good
+ * as random and needs no state.
+ */
+void cfilter_add(cfilter_t *cf, uint64_t hash) {
+
+    uint16_t fp = cfilter_fingerprint(hash), victim;
+    uint64_t b = hash & cf->cf_mask;
+    int kick, i;
+
+    cf->cf_items++;
+    if (cf->cf_overflowed)
+	return;
+    if (cfilter_insert(&cf->cf_buckets[b], fp) == 0)
+	return;
+    b = cfilter_alt(cf, b, fp);
+    for (kick = 0; kick < CFILTER_MAX_KICKS; kick++) {
+	if (cfilter_insert(&cf->cf_buckets[b], fp) == 0)
+	    return;
+	i = fp % CFILTER_SLOTS;
+	victim = cfilter_slot(cf->cf_buckets[b], i);
+	cfilter_set_slot(&cf->cf_buckets[b], i, fp);
+	fp = victim;
+	b = cfilter_alt(cf, b, fp);
+    }
+    cf->cf_overflowed = 1;
+}
+
+void cfilter_remove(cfilter_t *cf, uint64_t hash) {
+
+    uint16_t fp = cfilter_fingerprint(hash);
+    uint64_t b[2];
+    int j, i;
+
+    cf->cf_items--;
+    if (cf->cf_overflowed)
+	return;
+    b[0] = hash & cf->cf_mask;
+    b[1] = cfilter_alt(cf, b[0], fp);
+    for (j = 0; j < 2; j++)
+	for (i = 0; i < CFILTER_SLOTS; i++)
+	    if (cfilter_slot(cf->cf_buckets[b[j]], i) == fp) {
+		cfilter_set_slot(&cf->cf_buckets[b[j]], i, 0);
+		return;
+	    }
+}
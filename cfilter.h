@@ -0,0 +1,72 @@
+#ifndef _CFILTER_H
+#define _CFILTER_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/*
+ * A cuckoo filter, kept in DRAM whatever the table's placement: a key is
+ * a 16-bit fingerprint in one of two buckets of CFILTER_SLOTS, and can
+ * be taken out again, unlike a Bloom filter's bits. A bucket is one
+ * 64-bit word, which a test compares against the fingerprint all at
+ * once, and the two buckets don't depend on each other, so their misses
+ * overlap. Both come from the hash given: the first from its low bits,
+ * the fingerprint from its top 16, and the other bucket from the first
+ * and the fingerprint, so that a fingerprint can be moved between them
+ * without the key.
+ *
+ * An add that finds no room after CFILTER_MAX_KICKS moves overflows the
+ * filter, which then says yes to everything until it's rebuilt.
+ */
+#define CFILTER_SLOTS 4
+#define CFILTER_LOAD_PCT 90		/* sized for at most this full */
+#define CFILTER_MAX_KICKS 500
+
+typedef struct {
+    uint64_t *cf_buckets;
+    uint64_t  cf_mask;		/* buckets - 1, a power of two */
+    uint64_t  cf_items;
+    int       cf_overflowed;
+} cfilter_t;
+
+cfilter_t *cfilter_create(size_t keys);
+void       cfilter_destroy(cfilter_t *cf);
+size_t     cfilter_bytes(const cfilter_t *cf);
+void       cfilter_add(cfilter_t *cf, uint64_t hash);
+/* Only for a hash that was added */
+void       cfilter_remove(cfilter_t *cf, uint64_t hash);
+
+#define CFILTER_ONES 0x0001000100010001ULL
+#define CFILTER_HIGHS 0x8000800080008000ULL
+
+static inline uint16_t cfilter_fingerprint(uint64_t hash) {
+
+    uint16_t fp = (uint16_t)(hash >> 48);
+
+    return fp != 0 ? fp : 1;		/* 0 is an empty slot */
+}
+
+static inline uint64_t cfilter_alt(const cfilter_t *cf, uint64_t bucket,
+				   uint16_t fp) {
+
+    return (bucket ^ (fp * 0x5bd1e995ULL)) & cf->cf_mask;
+}
+
+/* Whether any 16-bit slot of the bucket holds fp */
+static inline int cfilter_bucket_has(uint64_t bucket, uint16_t fp) {
+
+    uint64_t x = bucket ^ (fp * CFILTER_ONES);
+
+    return ((x - CFILTER_ONES) & ~x & CFILTER_HIGHS) != 0;
+}
+
+static inline int cfilter_may_contain(const cfilter_t *cf, uint64_t hash) {
+
+    uint16_t fp = cfilter_fingerprint(hash);
+    uint64_t b1 = hash & cf->cf_mask, b2 = cfilter_alt(cf, b1, fp);
+
+    return cf->cf_overflowed || cfilter_bucket_has(cf->cf_buckets[b1], fp) ||
+	cfilter_bucket_has(cf->cf_buckets[b2], fp);
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "data_consumer.h"
+#include "nano_time.h"
+
+#define CACHE_LINE_SIZE 64
+#define CRC32C_POLY 0x82F63B78  /* reversed Castagnoli polynomial */
+
+static inline uint64_t
+load64(const char *p) {
+
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t
+consume_first_byte(const data_consumer_t *dc, const char *buf, size_t size) {
+
+    return buf[0];
+}
+
+static uint64_t
+consume_touch(const data_consumer_t *dc, const char *buf, size_t size) {
+
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < size; i += CACHE_LINE_SIZE)
+        sum += *(volatile const char *)&buf[i];
+    return sum;
+}
+
+static uint64_t
+consume_compute(const data_consumer_t *dc, const char *buf, size_t size) {
+
+    uint64_t deadline = nano_time() + size * dc->dc_ns_per_kb / 1024;
+
+    while (nano_time() < deadline)
+        ;
+    return buf[0];
+}
+
+/*
+ * CRC32C. The software version is the usual byte-at-a-time table lookup;
+ * the hardware version uses the SSE4.2 crc32 instruction eight bytes at
+ * a time. Both produce the same checksum.
+ */
+static uint32_t crc32c_table[256];
+
+static void
+crc32c_init_table(void) {
+
+    uint32_t crc;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        crc32c_table[i] = crc;
+    }
+}
+
+static uint64_t
+consume_crc32c_sw(const data_consumer_t *dc, const char *buf, size_t size) {
+
+    uint32_t crc = ~0U;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        crc = crc32c_table[(crc ^ (uint8_t)buf[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef __x86_64__
+__attribute__((target("sse4.2")))
+static uint64_t
+consume_crc32c_hw(const data_consumer_t *dc, const char *buf, size_t size) {
+
+    uint64_t crc = ~0U;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8)
+        crc = _mm_crc32_u64(crc, load64(&buf[i]));
+    for (; i < size; i++)
+        crc = _mm_crc32_u8((uint32_t)crc, (uint8_t)buf[i]);
+    return ~(uint32_t)crc;
+}
+#endif
+
+/*
+ * An xxHash (XXH3) style hash: eight 64-bit accumulators, each 64-byte
+ * stripe is xor-ed with a secret and folded in with a 32x32->64 multiply.
+ * The AVX2 version does the eight lanes in two vector registers and
+ * computes exactly the same value as the scalar one.
+ */
+#define XXH_STRIPE 64
+#define XXH_LANES 8
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+
+static const uint64_t xxh_secret[XXH_LANES] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL,
+    0x1f67b3b7a4a44072ULL, 0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL,
+    0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+};
+
+static uint64_t
+xxh_avalanche(uint64_t h) {
+
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t
+xxh_finish(uint64_t *acc, const char *tail, size_t tail_len, size_t size) {
+
+    uint64_t h = size * XXH_PRIME64_1;
+    size_t i;
+
+    for (i = 0; i < XXH_LANES; i++)
+        h += acc[i] * XXH_PRIME64_2;
+    for (i = 0; i < tail_len; i++)
+        h = (h ^ (uint8_t)tail[i]) * XXH_PRIME32_1;
+    return xxh_avalanche(h);
+}
+
+static uint64_t
+consume_xxhash_scalar(const data_consumer_t *dc, const char *buf,
+                      size_t size) {
+
+    uint64_t acc[XXH_LANES] = {0};
+    size_t i, lane;
+
+    for (i = 0; i + XXH_STRIPE <= size; i += XXH_STRIPE) {
+        for (lane = 0; lane < XXH_LANES; lane++) {
+            uint64_t data_val = load64(&buf[i + lane * 8]);
+            uint64_t data_key = data_val ^ xxh_secret[lane];
+            acc[lane ^ 1] += data_val;
+            acc[lane] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+        }
+    }
+    return xxh_finish(acc, &buf[i], size - i, size);
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static uint64_t
+consume_xxhash_avx2(const data_consumer_t *dc, const char *buf, size_t size) {
+
+    uint64_t acc[XXH_LANES];
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i key0 = _mm256_loadu_si256((const __m256i *)&xxh_secret[0]);
+    __m256i key1 = _mm256_loadu_si256((const __m256i *)&xxh_secret[4]);
+    size_t i;
+
+    for (i = 0; i + XXH_STRIPE <= size; i += XXH_STRIPE) {
+        __m256i d0 = _mm256_loadu_si256((const __m256i *)&buf[i]);
+        __m256i d1 = _mm256_loadu_si256((const __m256i *)&buf[i + 32]);
+        __m256i k0 = _mm256_xor_si256(d0, key0);
+        __m256i k1 = _mm256_xor_si256(d1, key1);
+
+        /* acc[lane] += lo32(key) * hi32(key) */
+        acc0 = _mm256_add_epi64(acc0,
+                   _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32)));
+        acc1 = _mm256_add_epi64(acc1,
+                   _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32)));
+        /* acc[lane ^ 1] += data */
+        acc0 = _mm256_add_epi64(acc0,
+                   _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc1 = _mm256_add_epi64(acc1,
+                   _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+    }
+    _mm256_storeu_si256((__m256i *)&acc[0], acc0);
+    _mm256_storeu_si256((__m256i *)&acc[4], acc1);
+    return xxh_finish(acc, &buf[i], size - i, size);
+}
+#endif
+
+/*
+ * Fill in the consumer from its spec, picking the fastest implementation
+ * this CPU supports. Returns zero on success, -1 on a malformed spec.
+ */
+int
+consumer_parse(const char *spec, data_consumer_t *dc) {
+
+    memset(dc, 0, sizeof(data_consumer_t));
+
+    if (strcmp(spec, "first") == 0) {
+        dc->dc_kind = CONSUME_FIRST_BYTE;
+        dc->dc_fn = consume_first_byte;
+        dc->dc_impl = "first byte";
+    }
+    else if (strcmp(spec, "touch") == 0) {
+        dc->dc_kind = CONSUME_TOUCH;
+        dc->dc_fn = consume_touch;
+        dc->dc_impl = "touch every cache line";
+    }
+    else if (strcmp(spec, "crc32c") == 0) {
+        dc->dc_kind = CONSUME_CRC32C;
+        crc32c_init_table();
+        dc->dc_fn = consume_crc32c_sw;
+        dc->dc_impl = "crc32c (software)";
+#ifdef __x86_64__
+        if (__builtin_cpu_supports("sse4.2")) {
+            dc->dc_fn = consume_crc32c_hw;
+            dc->dc_impl = "crc32c (sse4.2)";
+        }
+#endif
+    }
+    else if (strcmp(spec, "xxhash") == 0) {
+        dc->dc_kind = CONSUME_XXHASH;
+        dc->dc_fn = consume_xxhash_scalar;
+        dc->dc_impl = "xxhash (scalar)";
+#ifdef __x86_64__
+        if (__builtin_cpu_supports("avx2")) {
+            dc->dc_fn = consume_xxhash_avx2;
+            dc->dc_impl = "xxhash (avx2)";
+        }
+#endif
+    }
+    else if (strncmp(spec, "compute:", strlen("compute:")) == 0) {
+        dc->dc_kind = CONSUME_COMPUTE;
+        dc->dc_ns_per_kb = strtoull(spec + strlen("compute:"), NULL, 10);
+        dc->dc_fn = consume_compute;
+        dc->dc_impl = "synthetic compute";
+    }
+    else
+        return -1;
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef _DATA_CONSUMER_H
+#define _DATA_CONSUMER_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/*
+ * What the benchmark does with every block it reads (or is about to
+ * write), so that we measure I/O together with an application that
+ * actually looks at the bytes. The spec is one of:
+ *      first       -- add the first byte of the block (the old behavior)
+ *      touch       -- read one byte from every cache line
+ *      crc32c      -- CRC32C, using the SSE4.2 instruction if present
+ *      xxhash      -- xxHash-style multiply-accumulate hash, AVX2 if present
+ *      compute:NS  -- spin for NS nanoseconds per kilobyte
+ */
+typedef enum {CONSUME_FIRST_BYTE, CONSUME_TOUCH, CONSUME_CRC32C,
+              CONSUME_XXHASH, CONSUME_COMPUTE} consumer_kind_t;
+
+typedef struct data_consumer {
+    consumer_kind_t dc_kind;
+    uint64_t dc_ns_per_kb;
+    const char *dc_impl;    /* which implementation we picked */
+    uint64_t (*dc_fn)(const struct data_consumer *dc,
+                      const char *buf, size_t size);
+} data_consumer_t;
+
+int consumer_parse(const char *spec, data_consumer_t *dc);
+
+static inline uint64_t
+consume_data(const data_consumer_t *dc, const char *buf, size_t size) {
+
+    return dc->dc_fn(dc, buf, size);
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "epoch.h"
+
+#define CACHE_LINE_SIZE 64
+#define EPOCH_LISTS 3
+#define EPOCH_ADVANCE_INTERVAL 64	/* retires between advance attempts */
+
+#define LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+typedef struct {
+    void *er_ptr;
+    void (*er_free)(void *);
+} epoch_retired_t;
+
+typedef struct {
+    epoch_retired_t *el_items;
+    size_t el_count;
+    size_t el_capacity;
+    uint64_t el_epoch;		/* the epoch the items were retired in */
+} epoch_list_t;
+
+/*
+ * Every thread publishes the epoch it is in, or that it's in none; the
+ * rest of the record is its own.
+ */
+typedef struct {
+    uint64_t et_epoch;
+    int et_active;
+    int et_nesting;
+    uint64_t et_retires;
+    epoch_list_t et_lists[EPOCH_LISTS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) epoch_thread_t;
+
+static epoch_thread_t epoch_threads[EPOCH_MAX_THREADS];
+static int epoch_num_threads = 0;
+static uint64_t global_epoch = 0;
+static __thread epoch_thread_t *self = NULL;
+
+static epoch_thread_t *epoch_register(void) {
+
+    int idx = __atomic_fetch_add(&epoch_num_threads, 1, __ATOMIC_ACQ_REL);
+
+    if (idx >= EPOCH_MAX_THREADS) {
+	printf("No more than %d threads can use epochs.\n", EPOCH_MAX_THREADS);
+	_exit(-1);
+    }
+    return &epoch_threads[idx];
+}
+
+void epoch_enter(void) {
+
+    if (self == NULL)
+	self = epoch_register();
+    if (self->et_nesting++ > 0)
+	return;
+
+    STORE(&self->et_epoch, LOAD(&global_epoch));
+    STORE(&self->et_active, 1);
+    /* Announce ourselves before we read anything shared */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void) {
+
+    if (--self->et_nesting == 0)
+	STORE(&self->et_active, 0);
+}
+
+static void epoch_free_list(epoch_list_t *l) {
+
+    size_t i;
+
+    for (i = 0; i < l->el_count; i++)
+	l->el_items[i].er_free(l->el_items[i].er_ptr);
+    l->el_count = 0;
+}
+
+/* Move the global epoch on if every thread inside one has seen it */
+static void epoch_try_advance(void) {
+
+    uint64_t epoch = LOAD(&global_epoch);
+    int i, n = LOAD(&epoch_num_threads);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i < n && i < EPOCH_MAX_THREADS; i++)
+	if (LOAD(&epoch_threads[i].et_active) &&
+	    LOAD(&epoch_threads[i].et_epoch) != epoch)
+	    return;
+    __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+void epoch_retire(void *ptr, void (*free_fn)(void *)) {
+
+    uint64_t epoch;
+    epoch_list_t *l;
+
+    if (self == NULL)
+	self = epoch_register();
+
+    if (++self->et_retires % EPOCH_ADVANCE_INTERVAL == 0)
+	epoch_try_advance();
+
+    /*
+     * The list for this epoch was last used at least three epochs ago, so
+     * whatever is still on it can't be seen by anyone.
+     */
+    epoch = LOAD(&global_epoch);
+    l = &self->et_lists[epoch % EPOCH_LISTS];
+    if (l->el_epoch != epoch) {
+	epoch_free_list(l);
+	l->el_epoch = epoch;
+    }
+
+    if (l->el_count == l->el_capacity) {
+	l->el_capacity = l->el_capacity ? l->el_capacity * 2 : 64;
+	l->el_items = (epoch_retired_t *)
+	    realloc(l->el_items, l->el_capacity * sizeof(epoch_retired_t));
+	if (l->el_items == NULL) {
+	    printf("Could not grow the epoch retire list: %s\n",
+		   strerror(errno));
+	    _exit(-1);
+	}
+    }
+    l->el_items[l->el_count].er_ptr = ptr;
+    l->el_items[l->el_count].er_free = free_fn;
+    l->el_count++;
+}
+
+void epoch_reclaim_all(void) {
+
+    int i, j, n = LOAD(&epoch_num_threads);
+
+    for (i = 0; i < n && i < EPOCH_MAX_THREADS; i++)
+	for (j = 0; j < EPOCH_LISTS; j++)
+	    epoch_free_list(&epoch_threads[i].et_lists[j]);
+}
@@ -0,0 +1,24 @@
+#ifndef _EPOCH_H
+#define _EPOCH_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/*
+ * Epoch-based reclamation. Readers that follow pointers into a shared
+ * structure without locks do it between epoch_enter() and epoch_exit().
+ * A writer that unlinks an object hands it to epoch_retire() instead of
+ * freeing it; it is freed once the global epoch has moved on twice, which
+ * can only happen after every reader that might still see it has left.
+ * Threads register themselves the first time they enter. Enter and exit
+ * nest.
+ */
+#define EPOCH_MAX_THREADS 256
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *ptr, void (*free_fn)(void *));
+/* Free everything retired so far. Only when no thread is inside an epoch. */
+void epoch_reclaim_all(void);
+
+#endif
@@ -1,27 +1,56 @@
 #include <sys/types.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <string.h>
-#include <gperftools/tcmalloc.h>
+#include <unistd.h>
+
+#include "allocator.h"
 
 #define NUM_ITEMS 900*1024
 #define ITEM_SIZE 900*1024
 
 int
-main(void) {
+main(int argc, char **argv) {
 
-	int i, j;
-	void **buf_array = tc_malloc(NUM_ITEMS * sizeof(void*));
+	int i, j, c, option_index;
+	const char *spec = "tcmalloc";
+	char error_message[AL_ERROR_SIZE];
+	allocator_t *al;
+	void **buf_array;
 	char data_buffer[1024];
 
+	static struct option long_options[] = {
+		{"allocator", required_argument, 0, 'a'},
+		{0, 0, 0, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, "a:", long_options,
+				&option_index)) != -1) {
+		if (c != 'a') {
+			printf("usage: %s [--allocator=SPEC]\n"
+			       "SPEC is one of %s; defaults to tcmalloc.\n",
+			       argv[0], al_names());
+			_exit(-1);
+		}
+		spec = optarg;
+	}
+	if ((al = al_open(spec, error_message,
+			  sizeof(error_message))) == NULL) {
+		printf("%s\n", error_message);
+		_exit(-1);
+	}
+
+	buf_array = al_malloc(al, NUM_ITEMS * sizeof(void*));
 	for(i = 0; i < NUM_ITEMS; i++) {
-		buf_array[i] = tc_malloc(ITEM_SIZE);
+		buf_array[i] = al_malloc(al, ITEM_SIZE);
 		printf("Allocated address is: %p\n", buf_array[i]);
 		for (j = 0; j < ITEM_SIZE / 1024; j++)
 			memcpy((void*)(buf_array[i] + j*1024), data_buffer, 1024);
 	}
 
 	for(i = 0; i < NUM_ITEMS; i++) {
-		tc_free(buf_array[i]);
+		al_free(al, buf_array[i]);
 	}
-	tc_free(buf_array);
+	al_free(al, buf_array);
+	al_close(al);
 }
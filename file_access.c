@@ -30,11 +30,20 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "buffer_pool.h"
+#include "data_consumer.h"
+#include "file_targets.h"
+#include "latency_hist.h"
 #include "nano_time.h"
+#include "size_dist.h"
 
 #define BYTES_IN_GB (1024 * 1024 * 1024)
 #define DEFAULT_BLOCK_SIZE 8192
+#define DEFAULT_POOL_PAGE_SIZE 8192
+#define DEFAULT_POOL_SIZE_MB 1024
 #define DEFAULT_SIZE_DEVDAX_GB 32
+#define MAX_GROUPS 64
+#define MAX_GROUP_NAME 64
 #define NANOSECONDS_IN_SECOND 1000000000
 #define OS_PAGE_SIZE 4096
 
@@ -85,55 +94,178 @@ file_is_raw(const char *filename) {
 
 typedef struct {
     int tid;
-    int fd;
-    char *mapped_buffer;
+    targets_t *targets;
+    uint64_t *target_bytes;     /* bytes moved to or from every target */
     int read_mmap;
     int read_syscall;
     int write_mmap;
     int write_syscall;
+    int read_bufpool;
+    int write_bufpool;
+    buffer_pool_t *pool;
+    bp_stats_t bp_stats;
+    int zerocopy;
+    data_consumer_t consumer;
     off_t *offsets;
-    size_t block_size;
-    size_t chunk_size;
+    size_t *sizes;          /* per-request sizes, NULL if all are block_size */
+    size_t num_ops;
+    size_t block_size;      /* the largest request size */
+    size_t chunk_size;      /* total bytes transferred by this thread */
+    size_bucket_stats_t *size_stats;
+    latency_hist_t *lat_hist;   /* per-request latencies, if we keep them */
+    int timed_ops;              /* whether we time every request */
+    uint64_t op_interval_ns;    /* throttle to this many ns per request */
+    uint64_t deadline;          /* repeat the requests until this time */
+    uint64_t bytes_done;
+    uint64_t ops_done;
     int retval;
+    uint64_t token;         /* what the consumer computed, so it's not dead */
     uint64_t start_time;
     uint64_t end_time;
 } threadargs_t;
 
+/*
+ * A group of threads that share an engine, access pattern, request
+ * sizes, file range and request rate. Groups run concurrently against
+ * the same targets and are reported separately.
+ */
+typedef struct {
+    char name[MAX_GROUP_NAME];
+    int numthreads;
+    int read_mmap;
+    int read_syscall;
+    int write_mmap;
+    int write_syscall;
+    int read_bufpool;
+    int write_bufpool;
+    int randomaccess;
+    int directio;
+    char *sizedist_spec;
+    char *consumer_spec;
+    char *range_spec;
+    double rate;                /* requests per second per thread */
+    targets_t *targets;
+    size_dist_t size_dist;
+    data_consumer_t consumer;
+    off_t range_start;
+    size_t range_len;
+} group_t;
+
 void*    allocate_aligned_buffer(size_t block_size);
-uint64_t do_mmap_test(int fd, int tid, size_t block_size, size_t filesize, char *buf,
-              char optype, off_t *offsets, uint64_t *begin, uint64_t *end);
-uint64_t do_read_mmap_test(int fd, int tid, size_t block_size, size_t filesize,
-               char* buf, off_t *offs, uint64_t *begin, uint64_t *end);
-uint64_t do_read_syscall_test(int fd, int tid, size_t block_size, size_t filesize,
-                  off_t *offsets,  uint64_t *begin, uint64_t *end);
-uint64_t do_syscall_test(int fd, int tid, size_t block_size, size_t filesize,
-             char optype, off_t *offsets, uint64_t *begin, uint64_t *end);
-uint64_t do_write_mmap_test(int fd, int tid, size_t block_size, size_t filesize,
-                char* buf, off_t *offs, uint64_t *begin, uint64_t *end);
-uint64_t do_write_syscall_test(int fd, int tid, size_t block_size, size_t filesize,
-                   off_t *offsets,  uint64_t *begin, uint64_t *end);
+uint64_t do_bufpool_test(threadargs_t *t, char optype);
+uint64_t do_mmap_test(threadargs_t *t, char optype);
+uint64_t do_read_mmap_test(threadargs_t *t);
+uint64_t do_read_syscall_test(threadargs_t *t);
+uint64_t do_syscall_test(threadargs_t *t, char optype);
+uint64_t do_write_mmap_test(threadargs_t *t);
+uint64_t do_write_syscall_test(threadargs_t *t);
+void     generate_ops(threadargs_t *t, const size_dist_t *sd,
+                      off_t range_start, size_t range_len, int index,
+                      int numthreads, int randomaccess);
 size_t   get_filesize(const char* filename);
 size_t   get_fs_blocksize(const char* filename);
-char*    map_buffer(int fd, size_t size);
 char*    map_buffer_per_thread(const char* fname, off_t *offsets, int off_size,
 							   int *fd, int flags, mode_t mode);
+void     print_bufpool_stats(threadargs_t *threadargs, int numthreads,
+                            uint64_t elapsed_ns);
+int      parse_group(const char *spec, int index, group_t *g);
+int      parse_jobfile(const char *fname, group_t *groups, int *ngroups);
 void     print_help_message(const char* progname);
+void     print_size_breakdown(threadargs_t *threadargs, int numthreads);
+void     print_target_stats(threadargs_t *threadargs, int numthreads,
+                            uint64_t elapsed_ns);
+void     run_groups(targets_t *targets, group_t *groups, int ngroups,
+                    size_t block_size,
+                    size_t pool_size, size_t pool_page_size, int io_threads,
+                    uint64_t runtime_ns);
 void    *run_tests(void *);
 
 static int silent = 0;
 
+static int
+targets_are_devdax(const targets_t *tg) {
+
+    int i;
+
+    for (i = 0; i < tg->tg_count; i++)
+        if (file_is_devdax(tg->tg_names[i]))
+            return 1;
+    return 0;
+}
+
+/* The largest block size of the file systems the targets live on */
+static size_t
+targets_blocksize(const targets_t *tg) {
+
+    size_t blocksize, max = 0;
+    int i;
+
+    for (i = 0; i < tg->tg_count; i++)
+        if ((blocksize = get_fs_blocksize(tg->tg_names[i])) != -1 &&
+            blocksize > max)
+            max = blocksize;
+    return max;
+}
+
+/*
+ * Lay the targets out and return their logical size. Every target
+ * contributes as many bytes as the smallest one has; with more than one
+ * target that is rounded to the file system block size, so that every
+ * target starts on a block boundary.
+ */
+static size_t
+targets_filesize(targets_t *tg, size_t stripe) {
+
+    size_t size, min = -1, blocksize = targets_blocksize(tg);
+    int i;
+
+    for (i = 0; i < tg->tg_count; i++) {
+        if ((size = get_filesize(tg->tg_names[i])) == -1)
+            return -1;
+        if (size < min)
+            min = size;
+    }
+    if (tg->tg_count > 1 && blocksize > 0)
+        min -= min % blocksize;
+    targets_set_layout(tg, min, stripe);
+    return tg->tg_size;
+}
+
+/* A copy of the targets opened for the buffer pool or direct I/O */
+static targets_t *
+open_direct_targets(const targets_t *tg) {
+
+    targets_t *direct;
+
+    if ((direct = targets_clone(tg)) == NULL)
+        EXIT_MSG("Failed to allocate memory: %s\n", strerror(errno));
+    if (targets_open(direct, O_RDWR | O_DIRECT, 0) != 0)
+        EXIT_MSG("Could not open the targets with O_DIRECT.\n");
+    return direct;
+}
+
 int main(int argc, char **argv) {
 
     char *fname = (char*) DEFAULT_FNAME;
-    char *mapped_buffer = NULL;
-    int c, fd, flags = O_RDWR, i, numthreads = 1, ret, option_index;
-    static int directio, randomaccess = 0,
+    char *sizedist_spec = NULL, *consumer_spec = "first", fixed_spec[64];
+    int c, flags = O_RDWR, i, numthreads = 1, ret, option_index,
+        io_threads = 0, ngroups = 0, per_target;
+    static int directio, randomaccess = 0, affinity = 0,
         read_mmap = 0, read_syscall = 0,
-        write_mmap = 0, write_syscall = 0;
+        write_mmap = 0, write_syscall = 0, zerocopy = 0,
+        read_bufpool = 0, write_bufpool = 0;
+    int variable_sizes = 0;
     off_t *offsets = 0;
     size_t block_size = DEFAULT_BLOCK_SIZE, filesize, fs_blocksize,
-        new_file_size = 0, numblocks;
-    uint64_t min_start_time, max_end_time = 0;
+        new_file_size = 0, numblocks, total_bytes = 0, stripe = 0,
+        pool_size = (size_t)DEFAULT_POOL_SIZE_MB * 1024 * 1024,
+        pool_page_size = DEFAULT_POOL_PAGE_SIZE;
+    buffer_pool_t *pool = NULL;
+    targets_t *targets, *pool_targets = NULL;
+    data_consumer_t consumer;
+    size_dist_t size_dist;
+    group_t *groups;
+    uint64_t min_start_time, max_end_time = 0, runtime_ns = 0, deadline;
 
     pthread_t *threads;
     threadargs_t *threadargs;
@@ -143,25 +275,42 @@ int main(int argc, char **argv) {
     static struct option long_options[] =
         {
         /* These options set a flag. */
+        {"affinity", no_argument,  &affinity, 1},
         {"randomaccess", no_argument,  &randomaccess, 1},
+        {"readbufpool", no_argument,   &read_bufpool, 1},
         {"readmmap", no_argument,   &read_mmap, 1},
         {"readsyscall", no_argument,  &read_syscall, 1},
         {"silent", no_argument,  &silent, 1},
+        {"writebufpool", no_argument,   &write_bufpool, 1},
         {"writemmap", no_argument,   &write_mmap, 1},
         {"writesyscall", no_argument,  &write_syscall, 1},
+        {"zerocopy", no_argument,  &zerocopy, 1},
         /* These options may take an argument. */
         {"block", required_argument, 0, 'b'},
+        {"consume", required_argument, 0, 'c'},
         {"directio", no_argument, 0, 'd'},
         {"file", required_argument, 0, 'f'},
+        {"group", required_argument, 0, 'G'},
         {"help", no_argument, 0, 'h'},
+        {"iothreads", required_argument, 0, 'i'},
+        {"jobfile", required_argument, 0, 'j'},
+        {"pagesize", required_argument, 0, 'g'},
+        {"poolsize", required_argument, 0, 'p'},
+        {"runtime", required_argument, 0, 'r'},
         {"size", no_argument, 0, 's'},
+        {"sizedist", required_argument, 0, 'z'},
+        {"stripe", required_argument, 0, 'S'},
         {"threads", required_argument, 0, 't'},
         {0, 0, 0, 0}
     };
 
+    groups = (group_t *) calloc(MAX_GROUPS, sizeof(group_t));
+    if (groups == NULL)
+        EXIT_MSG("Failed to allocate memory: %s\n", strerror(errno));
+
     /* Read long options */
     while (1) {
-        c = getopt_long (argc, argv, "b:df:hs:t:",
+        c = getopt_long (argc, argv, "b:c:df:hs:t:",
                  long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -176,96 +325,189 @@ int main(int argc, char **argv) {
         case 'b':
             block_size = atoi(optarg);
             break;
+        case 'c':
+            consumer_spec = optarg;
+            break;
         case 'd':
 			directio = 1;
             break;
         case 'f':
             fname = optarg;
             break;
+        case 'g':
+            pool_page_size = parse_size(optarg);
+            break;
+        case 'G':
+            if (ngroups == MAX_GROUPS)
+                EXIT_MSG("No more than %d groups, please.\n", MAX_GROUPS);
+            if (parse_group(optarg, ngroups, &groups[ngroups]) != 0)
+                EXIT_MSG("Invalid group: %s\n", optarg);
+            ngroups++;
+            break;
         case 'h':
             print_help_message(argv[0]);
             _exit(0);
+        case 'i':
+            io_threads = atoi(optarg);
+            break;
+        case 'j':
+            if (parse_jobfile(optarg, groups, &ngroups) != 0)
+                EXIT_MSG("Invalid job file: %s\n", optarg);
+            break;
+        case 'p':
+            pool_size = parse_size(optarg);
+            break;
+        case 'r':
+            runtime_ns = (uint64_t)(atof(optarg) * NANOSECONDS_IN_SECOND);
+            break;
         case 's':
             new_file_size = (size_t)atoi(optarg);
             break;
+        case 'S':
+            stripe = parse_size(optarg);
+            break;
         case 't':
             numthreads = (int) (atoi(optarg));
             break;
+        case 'z':
+            sizedist_spec = optarg;
+            break;
         default:
             break;
         }
     }
 
-	if ((read_mmap || read_syscall || write_mmap || write_syscall) == 0)
+    if ((targets = targets_create(fname)) == NULL)
+        EXIT_MSG("Invalid file list: %s\n", fname);
+    if (affinity && stripe > 0)
+        EXIT_MSG("Thread affinity needs the targets concatenated, "
+                 "not striped.\n");
+    if (new_file_size > 0)
+        static_size_GB = new_file_size;
+
+    if (ngroups > 0) {
+        MSG_NOT_SILENT("pid: %d\n", getpid());
+        MSG_NOT_SILENT("Using file %s with %d thread groups\n",
+                       fname, ngroups);
+        if (affinity)
+            EXIT_MSG("Thread affinity does not apply to groups; give "
+                     "every group the range of its target instead.\n");
+        if (targets_filesize(targets, stripe) == -1)
+            EXIT_MSG("Cannot obtain file size for %s: %s"
+                     "File must exist prior to running group tests.\n",
+                     fname, strerror(errno));
+        if (targets_open(targets, flags, mode) != 0)
+            _exit(-1);
+        run_groups(targets, groups, ngroups, block_size,
+                   pool_size, pool_page_size, io_threads, runtime_ns);
+        targets_close(targets);
+        return 0;
+    }
+
+	if ((read_mmap || read_syscall || write_mmap || write_syscall ||
+		 read_bufpool || write_bufpool) == 0)
 		EXIT_MSG("Please tell me what test to run.\n");
 
+    if (consumer_parse(consumer_spec, &consumer) != 0)
+        EXIT_MSG("Invalid data consumer: %s\n", consumer_spec);
+    if (zerocopy && !(read_mmap || read_bufpool))
+        EXIT_MSG("Zero-copy consumption only applies to the readmmap "
+                 "and readbufpool tests.\n");
+
     MSG_NOT_SILENT("pid: %d\n", getpid());
     MSG_NOT_SILENT("Using file %s\n", fname);
 
-    if (new_file_size > 0)
-        static_size_GB = new_file_size;
-
-    if (file_is_devdax(fname))
+    if (targets_are_devdax(targets))
         MSG_NOT_SILENT("Will map area of %dGB\n", static_size_GB);
 
-    if ((filesize = get_filesize(fname)) == -1) {
-        if (read_mmap || read_syscall)
+    if ((filesize = targets_filesize(targets, stripe)) == -1) {
+        if (read_mmap || read_syscall || read_bufpool)
             EXIT_MSG("Cannot obtain file size for %s: %s"
                    "File must exist prior to running read tests.\n",
                    fname, strerror(errno));
     }
 
-    if (file_is_devdax(fname) && (read_syscall || write_syscall))
+    if (targets_are_devdax(targets) && (read_syscall || write_syscall))
         EXIT_MSG("Dev-dax mode does not support syscall experiments\n");
+    if (targets_are_devdax(targets) && (read_bufpool || write_bufpool))
+        EXIT_MSG("Dev-dax mode does not support buffer pool experiments\n");
+
+    if (sizedist_spec != NULL) {
+        if (size_dist_parse(sizedist_spec, &size_dist) != 0)
+            EXIT_MSG("Invalid size distribution: %s\n", sizedist_spec);
+        if (size_dist.sd_kind == SD_FIXED)
+            block_size = size_dist.sd_min;
+        else
+            variable_sizes = 1;
+    }
 
 	if (directio) {
 		MSG_NOT_SILENT("Will open file with the O_DIRECT flag.\n");
 		flags |= O_DIRECT;
-		fs_blocksize = get_fs_blocksize(fname);
-		if ((block_size / fs_blocksize < 1) || (block_size % fs_blocksize != 0))
+		fs_blocksize = targets_blocksize(targets);
+		/* Round the sizes we draw up to the file system block size */
+		if (variable_sizes)
+			size_dist_set_align(&size_dist, fs_blocksize);
+		else if ((block_size / fs_blocksize < 1) || (block_size % fs_blocksize != 0))
 			EXIT_MSG("To use O_DIRECT the block size must be a multiple of file system size, "
 					 "which appears to be %lu bytes. You supplied the block size of %lu bytes.\n",
 					 fs_blocksize, block_size);
+		if (stripe % fs_blocksize != 0)
+			EXIT_MSG("To use O_DIRECT the stripe size must be a multiple "
+					 "of the file system block size.\n");
 	}
 
-    fd = open((const char*)fname, flags, mode);
-    if (fd < 0)
-		EXIT_MSG("Could not open/create file %s: %s\n",
-               fname, strerror(errno));
+    if (targets_open(targets, flags, mode) != 0)
+        _exit(-1);
+    if (targets->tg_count > 1)
+        MSG_NOT_SILENT("%d targets of %zu bytes, %s.\n", targets->tg_count,
+                       targets->tg_target_size,
+                       stripe > 0 ? "striped" :
+                       affinity ? "one per thread" : "concatenated");
+
+    if (variable_sizes)
+        block_size = size_dist_max(&size_dist);
 
     if (block_size < 0 || block_size > filesize)
         EXIT_MSG("Invalid block size: %" PRIu64 " for file of size "
                "%" PRIu64 ". Block size must be greater than zero "
                "and no greater than the file size.\n",
                (uint_least64_t)block_size, (uint_least64_t)filesize);
-	MSG_NOT_SILENT("Using block size %lu bytes.\n", block_size);
-
-    /*
-     * Generate random block numbers for random file access.
-     * Sequential for sequential access.
-     */
-    numblocks = filesize / block_size;
-    if (filesize % block_size > 0)
-        numblocks++;
-
-    offsets = (off_t *) malloc(numblocks * sizeof(off_t));
-    if (offsets == 0)
-        EXIT_MSG("Failed to allocate memory: %s\n", strerror(errno));
-
-    for (size_t i = 0; i < numblocks; i++) {
-        if (randomaccess)
-            offsets[i] = ((int)random() % numblocks) * block_size;
-        else
-            offsets[i] = i*block_size;
-    }
+    if (variable_sizes)
+        MSG_NOT_SILENT("Using size distribution %s: %lu to %lu bytes.\n",
+                       sizedist_spec, size_dist_min(&size_dist), block_size);
+    else
+        MSG_NOT_SILENT("Using block size %lu bytes.\n", block_size);
+    MSG_NOT_SILENT("Consuming data with %s%s.\n", consumer.dc_impl,
+                   zerocopy ? ", directly from the mapping" : "");
 
     MSG_NOT_SILENT("Using %d threads\n", numthreads);
 
-    if (numblocks % numthreads != 0)
-        EXIT_MSG("We have %" PRIu64 " blocks and %d threads. "
-               "Threads must evenly divide blocks. "
-               "Please fix your arguments.\n",
-               (uint_least64_t)numblocks, numthreads);
+    if (read_bufpool || write_bufpool) {
+        fs_blocksize = targets_blocksize(targets);
+        if (pool_page_size == 0 || pool_page_size % fs_blocksize != 0)
+            EXIT_MSG("The buffer pool page size must be a multiple of the "
+                     "file system block size, which appears to be %lu "
+                     "bytes.\n", fs_blocksize);
+        if (stripe % fs_blocksize != 0)
+            EXIT_MSG("The buffer pool needs the stripe size to be a "
+                     "multiple of the file system block size.\n");
+        /* Every thread may pin all pages of a request at once */
+        if (pool_size / pool_page_size <
+            2 * numthreads * (block_size / pool_page_size + 2))
+            EXIT_MSG("A buffer pool of %lu bytes is too small for %d "
+                     "threads and %lu-byte requests.\n", pool_size,
+                     numthreads, block_size);
+        pool_targets = open_direct_targets(targets);
+        pool = bp_create(pool_targets, pool_size, pool_page_size,
+                         io_threads);
+        if (pool == NULL)
+            EXIT_MSG("Could not create a buffer pool of %lu bytes.\n",
+                     pool_size);
+        MSG_NOT_SILENT("Buffer pool of %lu %lu-byte frames, %s misses.\n",
+                       pool->bp_num_frames, pool_page_size,
+                       io_threads > 0 ? "asynchronous" : "synchronous");
+    }
 
     threads = (pthread_t*)malloc(numthreads * sizeof(pthread_t));
     threadargs =
@@ -274,22 +516,103 @@ int main(int argc, char **argv) {
         EXIT_MSG("Could not allocate thread array for %d threads.\n",
                numthreads);
 
-	if (read_mmap || write_mmap)
-		mapped_buffer = map_buffer(fd, filesize);
+    if (variable_sizes || affinity) {
+        if (!variable_sizes) {
+            snprintf(fixed_spec, sizeof(fixed_spec), "fixed:%zu", block_size);
+            size_dist_parse(fixed_spec, &size_dist);
+            size_dist_set_align(&size_dist, block_size);
+        }
+        /* With affinity, thread i works on target i % count only */
+        if (affinity && numthreads % targets->tg_count != 0)
+            EXIT_MSG("With thread affinity the number of threads must be a "
+                     "multiple of the number of targets, %d.\n",
+                     targets->tg_count);
+        per_target = affinity ? numthreads / targets->tg_count : numthreads;
+        if (affinity)
+            filesize = targets->tg_target_size;
+        if (filesize / per_target < size_dist_max(&size_dist))
+            EXIT_MSG("Each of %d threads must transfer at least %lu bytes, "
+                     "but the file is only %lu bytes.\n", per_target,
+                     size_dist_max(&size_dist), filesize);
+        for (i = 0; i < numthreads; i++) {
+            threadargs[i].tid = i;
+            if (affinity)
+                generate_ops(&threadargs[i], &size_dist,
+                             (i % targets->tg_count) * filesize, filesize,
+                             i / targets->tg_count, per_target, randomaccess);
+            else
+                generate_ops(&threadargs[i], &size_dist, 0, filesize, i,
+                             numthreads, randomaccess);
+            if (!variable_sizes) {
+                free(threadargs[i].sizes);
+                threadargs[i].sizes = NULL;
+            }
+        }
+    }
+    else {
+        /*
+         * Generate random block numbers for random file access.
+         * Sequential for sequential access.
+         */
+        numblocks = filesize / block_size;
+        if (filesize % block_size > 0)
+            numblocks++;
+
+        offsets = (off_t *) malloc(numblocks * sizeof(off_t));
+        if (offsets == 0)
+            EXIT_MSG("Failed to allocate memory: %s\n", strerror(errno));
+
+        for (size_t i = 0; i < numblocks; i++) {
+            if (randomaccess)
+                offsets[i] = ((int)random() % numblocks) * block_size;
+            else
+                offsets[i] = i*block_size;
+        }
+
+        if (numblocks % numthreads != 0)
+            EXIT_MSG("We have %" PRIu64 " blocks and %d threads. "
+                   "Threads must evenly divide blocks. "
+                   "Please fix your arguments.\n",
+                   (uint_least64_t)numblocks, numthreads);
+
+        for (i = 0; i < numthreads; i++) {
+            threadargs[i].offsets = &offsets[numblocks/numthreads * i];
+            threadargs[i].sizes = NULL;
+            threadargs[i].num_ops = numblocks/numthreads;
+            threadargs[i].chunk_size = filesize / numthreads;
+        }
+    }
 
+	if ((read_mmap || write_mmap) && targets_map(targets) != 0)
+		_exit(-1);
+
+    deadline = (runtime_ns > 0) ? nano_time() + runtime_ns : 0;
     for (i = 0; i < numthreads; i++) {
-        threadargs[i].fd = fd;
+        threadargs[i].targets = targets;
         threadargs[i].tid = i;
         threadargs[i].block_size = block_size;
-        threadargs[i].chunk_size = filesize / numthreads;
-		if (read_mmap || write_mmap)
-			threadargs[i].mapped_buffer = mapped_buffer;
 
-        threadargs[i].offsets = &offsets[numblocks/numthreads * i];
+        threadargs[i].size_stats = (size_bucket_stats_t *)
+            calloc(SIZE_DIST_BUCKETS, sizeof(size_bucket_stats_t));
+        threadargs[i].target_bytes = (uint64_t *)
+            calloc(targets->tg_count, sizeof(uint64_t));
+        if (threadargs[i].size_stats == NULL ||
+            threadargs[i].target_bytes == NULL)
+            EXIT_MSG("Could not allocate per-size statistics.\n");
+        threadargs[i].lat_hist = NULL;
+        threadargs[i].timed_ops = (threadargs[i].sizes != NULL);
+        threadargs[i].op_interval_ns = 0;
+        threadargs[i].deadline = deadline;
         threadargs[i].read_mmap = read_mmap;
         threadargs[i].read_syscall = read_syscall;
         threadargs[i].write_mmap = write_mmap;
         threadargs[i].write_syscall = write_syscall;
+        threadargs[i].read_bufpool = read_bufpool;
+        threadargs[i].write_bufpool = write_bufpool;
+        threadargs[i].pool = pool;
+        memset(&threadargs[i].bp_stats, 0, sizeof(bp_stats_t));
+        threadargs[i].zerocopy = zerocopy;
+        threadargs[i].consumer = consumer;
 
         int ret = pthread_create(&threads[i], NULL, run_tests,
                      &threadargs[i]);
@@ -316,102 +639,634 @@ int main(int argc, char **argv) {
             threadargs[i].start_time:min_start_time;
         max_end_time = (threadargs[i].end_time > max_end_time)?
             threadargs[i].end_time:max_end_time;
+        total_bytes += threadargs[i].bytes_done;
     }
     printf("%d: \t %.2f\n", numthreads,
-           (double)filesize/(double)(max_end_time-min_start_time)
+           (double)total_bytes/(double)(max_end_time-min_start_time)
            * NANOSECONDS_IN_SECOND / BYTES_IN_GB);
 
-    munmap(mapped_buffer, filesize);
-    close(fd);
+    if (targets->tg_count > 1)
+        print_target_stats(threadargs, numthreads,
+                           max_end_time - min_start_time);
+    if (variable_sizes)
+        print_size_breakdown(threadargs, numthreads);
+
+    if (pool != NULL) {
+        print_bufpool_stats(threadargs, numthreads,
+                            max_end_time - min_start_time);
+        /* Not timed, like the page cache writes the syscall tests leave */
+        if (write_bufpool && bp_flush(pool) != 0)
+            EXIT_MSG("Failed to flush the buffer pool.\n");
+        bp_destroy(pool);
+        targets_close(pool_targets);
+    }
+
+    targets_close(targets);
 }
 
+/**
+ * THREAD GROUPS
+ *
+ * A group is described by comma-separated key=value pairs:
+ *      name=NAME
+ *      engine=readmmap|readsyscall|writemmap|writesyscall|
+ *             readbufpool|writebufpool
+ *      threads=N
+ *      access=seq|random
+ *      block=SIZE or sizedist=SPEC
+ *      range=START:END (sizes or percentages of the file)
+ *      rate=N (requests per second per thread, 0 for no limit)
+ *      directio=0|1
+ *      consume=SPEC
+ * e.g., --group name=scan,engine=readsyscall,directio=1,block=1M
+ */
+int
+parse_group(const char *spec, int index, group_t *g) {
+
+    char *buf, *block = NULL, *pair, *value, *saveptr;
+
+    memset(g, 0, sizeof(group_t));
+    snprintf(g->name, MAX_GROUP_NAME, "group%d", index);
+    g->numthreads = 1;
+    g->consumer_spec = "first";
+
+    if ((buf = strdup(spec)) == NULL)
+        return -1;
+
+    for (pair = strtok_r(buf, ",", &saveptr); pair != NULL;
+         pair = strtok_r(NULL, ",", &saveptr)) {
+        if ((value = strchr(pair, '=')) == NULL) {
+            printf("Expected key=value, got %s\n", pair);
+            goto error;
+        }
+        *value++ = '\0';
+
+        if (strcmp(pair, "name") == 0)
+            snprintf(g->name, MAX_GROUP_NAME, "%s", value);
+        else if (strcmp(pair, "engine") == 0) {
+            if (strcmp(value, "readmmap") == 0)
+                g->read_mmap = 1;
+            else if (strcmp(value, "readsyscall") == 0)
+                g->read_syscall = 1;
+            else if (strcmp(value, "writemmap") == 0)
+                g->write_mmap = 1;
+            else if (strcmp(value, "writesyscall") == 0)
+                g->write_syscall = 1;
+            else if (strcmp(value, "readbufpool") == 0)
+                g->read_bufpool = 1;
+            else if (strcmp(value, "writebufpool") == 0)
+                g->write_bufpool = 1;
+            else {
+                printf("Unknown engine %s\n", value);
+                goto error;
+            }
+        }
+        else if (strcmp(pair, "threads") == 0)
+            g->numthreads = atoi(value);
+        else if (strcmp(pair, "access") == 0)
+            g->randomaccess = (strcmp(value, "random") == 0);
+        else if (strcmp(pair, "block") == 0) {
+            free(block);
+            if (asprintf(&block, "fixed:%s", value) < 0) {
+                block = NULL;
+                goto error;
+            }
+            g->sizedist_spec = block;
+        }
+        else if (strcmp(pair, "sizedist") == 0)
+            g->sizedist_spec = value;
+        else if (strcmp(pair, "range") == 0)
+            g->range_spec = value;
+        else if (strcmp(pair, "rate") == 0)
+            g->rate = atof(value);
+        else if (strcmp(pair, "directio") == 0)
+            g->directio = atoi(value);
+        else if (strcmp(pair, "consume") == 0)
+            g->consumer_spec = value;
+        else {
+            printf("Unknown group parameter %s\n", pair);
+            goto error;
+        }
+    }
+
+    if ((g->read_mmap + g->read_syscall + g->write_mmap + g->write_syscall +
+         g->read_bufpool + g->write_bufpool) != 1) {
+        printf("Group %s needs exactly one engine.\n", g->name);
+        goto error;
+    }
+    if (g->numthreads < 1)
+        goto error;
+    /* The group points into buf for the rest of the run */
+    if (g->sizedist_spec != block)
+        free(block);
+    return 0;
+
+error:
+    free(block);
+    free(buf);
+    return -1;
+}
+
+/* One group per line; empty lines and lines starting with '#' are skipped */
+int
+parse_jobfile(const char *fname, group_t *groups, int *ngroups) {
+
+    FILE *f;
+    char line[4096], *spec;
+
+    if ((f = fopen(fname, "r")) == NULL) {
+        printf("Could not open job file %s: %s\n", fname, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        spec = line + strspn(line, " \t");
+        if (*spec == '\0' || *spec == '#')
+            continue;
+        if (*ngroups == MAX_GROUPS) {
+            printf("More than %d groups in %s\n", MAX_GROUPS, fname);
+            fclose(f);
+            return -1;
+        }
+        if (parse_group(spec, *ngroups, &groups[*ngroups]) != 0) {
+            printf("Bad group in %s: %s\n", fname, spec);
+            fclose(f);
+            return -1;
+        }
+        (*ngroups)++;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* A range bound is a size or a percentage of the file size */
+static size_t
+parse_range_bound(const char *str, size_t filesize) {
+
+    size_t len = strlen(str);
+
+    if (len > 0 && str[len - 1] == '%')
+        return (size_t)(atof(str) / 100.0 * filesize);
+    return parse_size(str);
+}
+
+static int
+resolve_range(group_t *g, size_t filesize, size_t align) {
+
+    char *buf, *colon;
+    size_t start = 0, end = filesize;
+
+    if (g->range_spec != NULL) {
+        if ((buf = strdup(g->range_spec)) == NULL)
+            return -1;
+        if ((colon = strchr(buf, ':')) == NULL) {
+            free(buf);
+            return -1;
+        }
+        *colon = '\0';
+        start = parse_range_bound(buf, filesize);
+        end = parse_range_bound(colon + 1, filesize);
+        free(buf);
+    }
+    start -= start % align;
+    if (end > filesize)
+        end = filesize;
+    if (end <= start)
+        return -1;
+    g->range_start = start;
+    g->range_len = end - start;
+    return 0;
+}
+
+/*
+ * Run all groups at once against the same targets. Every group gets its
+ * own threads, offsets and sizes; mmap groups share one mapping of the
+ * targets and buffer pool groups share one pool, the way readers and
+ * writers share them in a real system. Direct I/O groups have their own
+ * file descriptors. Results are reported per group.
+ */
+void
+run_groups(targets_t *targets, group_t *groups, int ngroups,
+           size_t block_size, size_t pool_size, size_t pool_page_size,
+           int io_threads, uint64_t runtime_ns) {
+
+    buffer_pool_t *pool = NULL;
+    targets_t *pool_targets = NULL;
+    char default_spec[64];
+    int g, i, j, first, totalthreads = 0, need_mmap = 0, need_pool = 0, ret;
+    size_t align, fs_blocksize = targets_blocksize(targets), max_block = 0,
+        bytes, filesize = targets->tg_size;
+    uint64_t deadline, ops, min_start_time, max_end_time;
+    latency_hist_t hist;
+    bp_stats_t bp_total;
+    pthread_t *threads;
+    threadargs_t *threadargs;
+
+    snprintf(default_spec, sizeof(default_spec), "fixed:%zu", block_size);
+
+    for (g = 0; g < ngroups; g++) {
+        group_t *gr = &groups[g];
+
+        if (gr->sizedist_spec == NULL)
+            gr->sizedist_spec = default_spec;
+        if (size_dist_parse(gr->sizedist_spec, &gr->size_dist) != 0)
+            EXIT_MSG("Group %s: invalid size distribution %s\n",
+                     gr->name, gr->sizedist_spec);
+        if (consumer_parse(gr->consumer_spec, &gr->consumer) != 0)
+            EXIT_MSG("Group %s: invalid data consumer %s\n",
+                     gr->name, gr->consumer_spec);
+
+        if (targets_are_devdax(targets) && !(gr->read_mmap || gr->write_mmap))
+            EXIT_MSG("Group %s: dev-dax mode supports only mmap "
+                     "experiments\n", gr->name);
+
+        gr->targets = targets;
+        align = 1;
+        if (gr->directio && (gr->read_syscall || gr->write_syscall)) {
+            align = fs_blocksize;
+            if (targets->tg_stripe % align != 0)
+                EXIT_MSG("Group %s: to use O_DIRECT the stripe size must be "
+                         "a multiple of the file system block size.\n",
+                         gr->name);
+            size_dist_set_align(&gr->size_dist, align);
+            gr->targets = open_direct_targets(targets);
+        }
+
+        if (resolve_range(gr, filesize, align) != 0)
+            EXIT_MSG("Group %s: invalid range %s\n", gr->name,
+                     gr->range_spec);
+        if (gr->range_len / gr->numthreads < size_dist_max(&gr->size_dist))
+            EXIT_MSG("Group %s: the range of %zu bytes is too small for %d "
+                     "threads and %zu-byte requests\n", gr->name,
+                     gr->range_len, gr->numthreads,
+                     size_dist_max(&gr->size_dist));
+
+        if (size_dist_max(&gr->size_dist) > max_block)
+            max_block = size_dist_max(&gr->size_dist);
+        need_mmap |= gr->read_mmap || gr->write_mmap;
+        need_pool |= gr->read_bufpool || gr->write_bufpool;
+        totalthreads += gr->numthreads;
+
+        MSG_NOT_SILENT("Group %s: %d threads, %s access, sizes %s, "
+                       "bytes %" PRIu64 " to %" PRIu64 ", rate %s\n",
+                       gr->name, gr->numthreads,
+                       gr->randomaccess ? "random" : "sequential",
+                       gr->sizedist_spec, (uint64_t)gr->range_start,
+                       (uint64_t)(gr->range_start + gr->range_len),
+                       gr->rate > 0 ? "limited" : "unlimited");
+    }
+
+    if (need_mmap && targets_map(targets) != 0)
+        _exit(-1);
+    if (need_pool) {
+        if (pool_page_size == 0 || pool_page_size % fs_blocksize != 0)
+            EXIT_MSG("The buffer pool page size must be a multiple of the "
+                     "file system block size, which appears to be %lu "
+                     "bytes.\n", fs_blocksize);
+        if (targets->tg_stripe % fs_blocksize != 0)
+            EXIT_MSG("The buffer pool needs the stripe size to be a "
+                     "multiple of the file system block size.\n");
+        if (pool_size / pool_page_size <
+            2 * totalthreads * (max_block / pool_page_size + 2))
+            EXIT_MSG("A buffer pool of %lu bytes is too small for %d "
+                     "threads and %lu-byte requests.\n", pool_size,
+                     totalthreads, max_block);
+        pool_targets = open_direct_targets(targets);
+        pool = bp_create(pool_targets, pool_size, pool_page_size,
+                         io_threads);
+        if (pool == NULL)
+            EXIT_MSG("Could not create a buffer pool of %lu bytes.\n",
+                     pool_size);
+    }
+
+    threads = (pthread_t*)malloc(totalthreads * sizeof(pthread_t));
+    threadargs =
+        (threadargs_t*)calloc(totalthreads, sizeof(threadargs_t));
+    if (threads == NULL || threadargs == NULL)
+        EXIT_MSG("Could not allocate thread array for %d threads.\n",
+                 totalthreads);
+
+    for (g = 0, i = 0; g < ngroups; g++) {
+        group_t *gr = &groups[g];
+
+        for (j = 0; j < gr->numthreads; j++, i++) {
+            threadargs_t *t = &threadargs[i];
+
+            t->tid = i;
+            t->targets = gr->targets;
+            t->pool = pool;
+            t->read_mmap = gr->read_mmap;
+            t->read_syscall = gr->read_syscall;
+            t->write_mmap = gr->write_mmap;
+            t->write_syscall = gr->write_syscall;
+            t->read_bufpool = gr->read_bufpool;
+            t->write_bufpool = gr->write_bufpool;
+            t->consumer = gr->consumer;
+            t->block_size = size_dist_max(&gr->size_dist);
+            generate_ops(t, &gr->size_dist, gr->range_start, gr->range_len,
+                         j, gr->numthreads, gr->randomaccess);
+            /* Fixed-size groups don't need the per-size breakdown */
+            if (gr->size_dist.sd_kind == SD_FIXED)
+                t->sizes = NULL;
+            t->size_stats = (size_bucket_stats_t *)
+                calloc(SIZE_DIST_BUCKETS, sizeof(size_bucket_stats_t));
+            t->lat_hist = (latency_hist_t *) calloc(1, sizeof(latency_hist_t));
+            t->target_bytes = (uint64_t *)
+                calloc(targets->tg_count, sizeof(uint64_t));
+            if (t->size_stats == NULL || t->lat_hist == NULL ||
+                t->target_bytes == NULL)
+                EXIT_MSG("Could not allocate per-thread statistics.\n");
+            t->timed_ops = 1;
+            t->op_interval_ns = (gr->rate > 0) ?
+                (uint64_t)(NANOSECONDS_IN_SECOND / gr->rate) : 0;
+        }
+    }
+
+    deadline = (runtime_ns > 0) ? nano_time() + runtime_ns : 0;
+    for (i = 0; i < totalthreads; i++) {
+        threadargs[i].deadline = deadline;
+        ret = pthread_create(&threads[i], NULL, run_tests, &threadargs[i]);
+        if (ret != 0)
+            EXIT_MSG("pthread_create for %dth thread failed: %s\n",
+                     i, strerror(ret));
+    }
+    for (i = 0; i < totalthreads; i++) {
+        ret = pthread_join(threads[i], NULL);
+        if (ret != 0)
+            EXIT_MSG("Thread %d failed: %s\n", i, strerror(ret));
+    }
+
+    for (g = 0, first = 0; g < ngroups; first += groups[g].numthreads, g++) {
+        group_t *gr = &groups[g];
+
+        bytes = ops = max_end_time = 0;
+        min_start_time = threadargs[first].start_time;
+        memset(&hist, 0, sizeof(hist));
+        memset(&bp_total, 0, sizeof(bp_total));
+        for (i = first; i < first + gr->numthreads; i++) {
+            if (threadargs[i].start_time < min_start_time)
+                min_start_time = threadargs[i].start_time;
+            if (threadargs[i].end_time > max_end_time)
+                max_end_time = threadargs[i].end_time;
+            bytes += threadargs[i].bytes_done;
+            ops += threadargs[i].ops_done;
+            lat_hist_merge(&hist, threadargs[i].lat_hist);
+        }
+
+        printf("%s: %d: \t %.2f GB/s, %.0f ops/s\n", gr->name,
+               gr->numthreads, (double)bytes/(double)(max_end_time-min_start_time)
+               * NANOSECONDS_IN_SECOND / BYTES_IN_GB,
+               (double)ops/(double)(max_end_time-min_start_time)
+               * NANOSECONDS_IN_SECOND);
+        lat_hist_print(&hist, "\t");
+        if (targets->tg_count > 1)
+            print_target_stats(&threadargs[first], gr->numthreads,
+                               max_end_time - min_start_time);
+        if (gr->size_dist.sd_kind != SD_FIXED)
+            print_size_breakdown(&threadargs[first], gr->numthreads);
+        if (gr->read_bufpool || gr->write_bufpool)
+            print_bufpool_stats(&threadargs[first], gr->numthreads,
+                                max_end_time - min_start_time);
+    }
+
+    if (pool != NULL) {
+        if (bp_flush(pool) != 0)
+            EXIT_MSG("Failed to flush the buffer pool.\n");
+        bp_destroy(pool);
+        targets_close(pool_targets);
+    }
+    for (g = 0; g < ngroups; g++)
+        if (groups[g].targets != targets)
+            targets_close(groups[g].targets);
+}
+
+#define READ 1
+#define WRITE 2
+
 void *
 run_tests(void *args) {
 
     uint64_t retval;
-    threadargs_t t = *(threadargs_t*)args;
+    threadargs_t *t = (threadargs_t*)args;
 
-    if (t.read_mmap) {
+    if (t->read_mmap) {
         MSG_NOT_SILENT("Running readmmap test:\n");
-        retval = do_read_mmap_test(t.fd, t.tid, t.block_size, t.chunk_size,
-                       t.mapped_buffer, t.offsets,
-                       &((threadargs_t*)args)->start_time,
-                       &((threadargs_t*)args)->end_time);
+        retval = do_read_mmap_test(t);
     }
-    if (t.read_syscall) {
+    if (t->read_syscall) {
         MSG_NOT_SILENT("Running readsyscall test:\n");
-        retval = do_read_syscall_test(t.fd, t.tid, t.block_size,
-                          t.chunk_size,
-                          t.offsets,
-                          &((threadargs_t*)args)->start_time,
-                          &((threadargs_t*)args)->end_time);
+        retval = do_read_syscall_test(t);
     }
-    if (t.write_mmap) {
+    if (t->write_mmap) {
         MSG_NOT_SILENT("Running writemmap test:\n");
-        retval = do_write_mmap_test(t.fd, t.tid, t.block_size,
-                        t.chunk_size,
-                        t.mapped_buffer, t.offsets,
-                        &((threadargs_t*)args)->start_time,
-                        &((threadargs_t*)args)->end_time);
+        retval = do_write_mmap_test(t);
     }
-    if (t.write_syscall) {
+    if (t->write_syscall) {
         MSG_NOT_SILENT("Running writesyscall test:\n");
-        retval = do_write_syscall_test(t.fd, t.tid, t.block_size,
-                           t.chunk_size, t.offsets,
-                           &((threadargs_t*)args)->start_time,
-                           &((threadargs_t*)args)->end_time);
+        retval = do_write_syscall_test(t);
     }
+    if (t->read_bufpool) {
+        MSG_NOT_SILENT("Running readbufpool test:\n");
+        retval = do_bufpool_test(t, READ);
+    }
+    if (t->write_bufpool) {
+        MSG_NOT_SILENT("Running writebufpool test:\n");
+        retval = do_bufpool_test(t, WRITE);
+    }
+    t->token = retval;
     return (void*) 0;
 }
 
-#define READ 1
-#define WRITE 2
+/*
+ * Generate the offsets and sizes for the index-th of numthreads threads
+ * sharing a range of the file, with request sizes drawn from a
+ * distribution. Each thread transfers about range_len/numthreads bytes.
+ * For sequential access a thread walks its own contiguous part of the
+ * range; for random access its offsets are spread over the whole range.
+ * Offsets and sizes are multiples of the distribution's alignment, so they
+ * are valid for O_DIRECT if the range start is.
+ */
+void
+generate_ops(threadargs_t *t, const size_dist_t *sd, off_t range_start,
+             size_t range_len, int index, int numthreads, int randomaccess) {
+
+    size_t align = sd->sd_align, bytes = 0, capacity = 1024, chunk, size;
+    off_t offset, region_start;
+
+    chunk = range_len / numthreads;
+    chunk -= chunk % align;
+    region_start = range_start + chunk * index;
+
+    t->num_ops = 0;
+    t->offsets = (off_t *) malloc(capacity * sizeof(off_t));
+    t->sizes = (size_t *) malloc(capacity * sizeof(size_t));
+    if (t->offsets == NULL || t->sizes == NULL)
+        EXIT_MSG("Failed to allocate memory: %s\n", strerror(errno));
+
+    while (bytes < chunk) {
+        size = size_dist_next(sd);
+        if (bytes + size > chunk)
+            size = chunk - bytes;
+
+        if (randomaccess) {
+            /* random() gives us only 31 bits */
+            offset = range_start +
+                ((((uint64_t)random() << 31) | (uint64_t)random())
+                 % ((range_len - size) / align + 1)) * align;
+        }
+        else
+            offset = region_start + bytes;
+
+        if (t->num_ops == capacity) {
+            capacity *= 2;
+            t->offsets = (off_t *) realloc(t->offsets,
+                                           capacity * sizeof(off_t));
+            t->sizes = (size_t *) realloc(t->sizes,
+                                          capacity * sizeof(size_t));
+            if (t->offsets == NULL || t->sizes == NULL)
+                EXIT_MSG("Failed to allocate memory: %s\n", strerror(errno));
+        }
+        t->offsets[t->num_ops] = offset;
+        t->sizes[t->num_ops] = size;
+        t->num_ops++;
+        bytes += size;
+    }
+    t->chunk_size = bytes;
+}
+
+static inline void
+record_size_sample(size_bucket_stats_t *stats, size_t size, uint64_t ns) {
+
+    size_bucket_stats_t *sb = &stats[size_dist_bucket(size)];
+
+    sb->sb_ops++;
+    sb->sb_bytes += size;
+    sb->sb_ns += ns;
+}
+
+#define SLEEP_THRESHOLD_NS 100000
+
+/*
+ * Called before every request. Holds the thread back to its request
+ * rate and returns the time the request counts as started. When we are
+ * throttled that's the time it was scheduled for, so that a request
+ * delayed behind a slow one has the wait included in its latency.
+ */
+static inline uint64_t
+begin_op(threadargs_t *t, uint64_t begin_time, uint64_t op_count) {
+
+    uint64_t now, target;
+    struct timespec ts;
+
+    if (t->op_interval_ns == 0)
+        return t->timed_ops ? nano_time() : 0;
+
+    target = begin_time + op_count * t->op_interval_ns;
+    while ((now = nano_time()) < target) {
+        if (target - now > SLEEP_THRESHOLD_NS) {
+            ts.tv_sec = 0;
+            ts.tv_nsec = target - now - SLEEP_THRESHOLD_NS / 2;
+            nanosleep(&ts, NULL);
+        }
+    }
+    return target;
+}
+
+static inline void
+end_op(threadargs_t *t, size_t size, uint64_t op_begin_time) {
+
+    uint64_t ns;
+
+    if (!t->timed_ops)
+        return;
+    ns = nano_time() - op_begin_time;
+    if (t->sizes != NULL)
+        record_size_sample(t->size_stats, size, ns);
+    if (t->lat_hist != NULL)
+        lat_hist_record(t->lat_hist, ns);
+}
+
+/* With a run time we go over the requests again until it's up */
+static inline bool
+run_again(threadargs_t *t) {
+
+    return t->deadline != 0 && nano_time() < t->deadline;
+}
+
+/*
+ * Sum the per-size statistics across threads. The throughput for each
+ * bucket is per thread: bytes divided by the time spent in requests of
+ * that size.
+ */
+void
+print_size_breakdown(threadargs_t *threadargs, int numthreads) {
+
+    size_bucket_stats_t total;
+    int b, i;
+
+    printf("Results by request size:\n");
+    for (b = 0; b < SIZE_DIST_BUCKETS; b++) {
+        memset(&total, 0, sizeof(total));
+        for (i = 0; i < numthreads; i++) {
+            total.sb_ops += threadargs[i].size_stats[b].sb_ops;
+            total.sb_bytes += threadargs[i].size_stats[b].sb_bytes;
+            total.sb_ns += threadargs[i].size_stats[b].sb_ns;
+        }
+        if (total.sb_ops == 0)
+            continue;
+        printf("\t<= %10zu bytes: %10" PRIu64 " ops, %6.2f GB/s per thread, "
+               "%10.2f us/op\n", (size_t)1 << b, total.sb_ops,
+               (double)total.sb_bytes/(double)total.sb_ns
+               * NANOSECONDS_IN_SECOND / BYTES_IN_GB,
+               (double)total.sb_ns / total.sb_ops / 1000);
+    }
+}
 
 /**
  * SYSCALL TESTS
  *
  */
 uint64_t
-do_read_syscall_test(int fd, int tid, size_t block_size, size_t filesize,
-             off_t *offsets, uint64_t *begin, uint64_t *end) {
+do_read_syscall_test(threadargs_t *t) {
 
-    return do_syscall_test(fd, tid, block_size, filesize, READ, offsets,
-                   begin, end);
+    return do_syscall_test(t, READ);
 }
 
 uint64_t
-do_write_syscall_test(int fd, int tid, size_t block_size, size_t filesize,
-              off_t *offsets, uint64_t *begin, uint64_t *end) {
+do_write_syscall_test(threadargs_t *t) {
 
-    return do_syscall_test(fd, tid, block_size, filesize, WRITE, offsets,
-                   begin, end);
+    return do_syscall_test(t, WRITE);
 }
 
 uint64_t
-do_syscall_test(int fd, int tid, size_t block_size, size_t filesize, char optype,
-        off_t *offsets, uint64_t *begin, uint64_t *end) {
+do_syscall_test(threadargs_t *t, char optype) {
 
     bool done = false;
     char *buffer = NULL;
     size_t i = 0, total_bytes_transferred = 0;
-    uint64_t begin_time, end_time, ret_token = 0;
+    uint64_t begin_time, end_time, op_begin_time, ops = 0, ret_token = 0;
 
-	buffer = allocate_aligned_buffer(block_size);
-    memset((void*)buffer, 0, block_size);
+	buffer = allocate_aligned_buffer(t->block_size);
+    memset((void*)buffer, 0, t->block_size);
 
     begin_time = nano_time();
 
     while (!done) {
         size_t bytes_transferred = 0;
+        size_t op_size = (t->sizes != NULL) ? t->sizes[i] : t->block_size;
 
+        op_begin_time = begin_op(t, begin_time, ops++);
         if (optype == READ)
-            bytes_transferred = pread(fd, buffer,
-                          block_size,
-                          offsets[i++]);
-        else if (optype == WRITE)
-            bytes_transferred = pwrite(fd, buffer,
-                           block_size,
-                           offsets[i++]);
+            bytes_transferred = targets_pread(t->targets, buffer,
+                          op_size,
+                          t->offsets[i++], t->target_bytes);
+        else if (optype == WRITE) {
+            /* Checksum or otherwise prepare the data we send out */
+            ret_token += consume_data(&t->consumer, buffer, op_size);
+            bytes_transferred = targets_pwrite(t->targets, buffer,
+                           op_size,
+                           t->offsets[i++], t->target_bytes);
+        }
         if (bytes_transferred == 0)
             done = true;
         else if (bytes_transferred == -1) {
@@ -421,27 +1276,36 @@ do_syscall_test(int fd, int tid, size_t block_size, size_t filesize, char optype
         else {
             total_bytes_transferred +=  bytes_transferred;
 
-            if (optype == WRITE &&
-                total_bytes_transferred == filesize)
-                done = true;
+            /* Use the data we just read */
+            if (optype == READ)
+                ret_token += consume_data(&t->consumer, buffer,
+                                          bytes_transferred);
+            end_op(t, bytes_transferred, op_begin_time);
 
-            /* Pretend that we actually use the data */
-            ret_token += buffer[0];
+            if (optype == WRITE && t->deadline == 0 &&
+                total_bytes_transferred == t->chunk_size)
+                done = true;
+        }
+        if (i >= t->num_ops) {
+            if (run_again(t))
+                i = 0;
+            else
+                done = true;
         }
-        if (i*block_size >= filesize)
-            done = true;
     }
     end_time = nano_time();
 
     MSG_NOT_SILENT("%s: (tid %d) %.2f GB/s "
                "(%" PRIu64 " bytes in %" PRIu64 " ns).\n",
-               (optype==READ)?"readsyscall":"writesyscall", tid,
-               (double)filesize/(double)(end_time-begin_time)
+               (optype==READ)?"readsyscall":"writesyscall", t->tid,
+               (double)total_bytes_transferred/(double)(end_time-begin_time)
                * NANOSECONDS_IN_SECOND / BYTES_IN_GB,
-               (uint_least64_t)filesize, (end_time-begin_time));
+               (uint_least64_t)total_bytes_transferred, (end_time-begin_time));
 
-    *begin = begin_time;
-    *end   = end_time;
+    t->bytes_done = total_bytes_transferred;
+    t->ops_done = ops;
+    t->start_time = begin_time;
+    t->end_time   = end_time;
     return ret_token;
 }
 
@@ -450,19 +1314,15 @@ do_syscall_test(int fd, int tid, size_t block_size, size_t filesize, char optype
  */
 
 uint64_t
-do_read_mmap_test(int fd, int tid, size_t block_size, size_t filesize,
-          char *buf, off_t *offsets, uint64_t *begin, uint64_t *end) {
+do_read_mmap_test(threadargs_t *t) {
 
-    return do_mmap_test(fd, tid, block_size, filesize, buf, READ, offsets,
-            begin, end);
+    return do_mmap_test(t, READ);
 }
 
 uint64_t
-do_write_mmap_test(int fd, int tid, size_t block_size, size_t filesize,
-           char *buf, off_t *offsets, uint64_t *begin, uint64_t *end){
+do_write_mmap_test(threadargs_t *t) {
 
-    return do_mmap_test(fd, tid, block_size, filesize, buf, WRITE, offsets,
-            begin, end);
+    return do_mmap_test(t, WRITE);
 }
 
 #if SAMPLE_LATENCY
@@ -488,14 +1348,50 @@ do_write_mmap_test(int fd, int tid, size_t block_size, size_t filesize,
 
 #endif
 
+/*
+ * Copy a request between the buffer and the target mappings, one piece
+ * per stripe unit, or consume it in place for zero-copy reads.
+ */
+static inline uint64_t
+mmap_transfer(threadargs_t *t, char *buffer, off_t offset, size_t size,
+              char optype) {
+
+    const targets_t *tg = t->targets;
+    size_t done, piece;
+    off_t phys;
+    uint64_t ret_token = 0;
+    int target;
+
+    for (done = 0; done < size; done += piece) {
+        piece = targets_locate(tg, offset + done, size - done, &target, &phys);
+        if (optype == READ && t->zerocopy)
+            ret_token += consume_data(&t->consumer, &tg->tg_maps[target][phys],
+                                      piece);
+        else if (optype == READ)
+            memcpy(buffer + done, &tg->tg_maps[target][phys], piece);
+        else
+            memcpy(&tg->tg_maps[target][phys], buffer + done, piece);
+        t->target_bytes[target] += piece;
+    }
+    return ret_token;
+}
+
+static inline char
+mmap_byte(const targets_t *tg, off_t offset) {
+
+    off_t phys;
+    int target;
+
+    targets_locate(tg, offset, 1, &target, &phys);
+    return tg->tg_maps[target][phys];
+}
+
 uint64_t
-do_mmap_test(int fd, int tid, size_t block_size, size_t size,
-         char *mmapped_buffer, char optype, off_t *offsets,
-         uint64_t *begin, uint64_t *end)
+do_mmap_test(threadargs_t *t, char optype)
 {
     char *buffer = NULL;
-    uint64_t i, j, numblocks, ret;
-    uint64_t begin_time, end_time, ret_token = 0;
+    uint64_t i, op, op_size, ops = 0, bytes = 0;
+    uint64_t begin_time, end_time, op_begin_time, ret_token = 0;
 #if SAMPLE_LATENCY
     uint64_t lat_begin_time, lat_end_time;
     size_t latency_samples[MAX_LAT_SAMPLES];
@@ -504,8 +1400,8 @@ do_mmap_test(int fd, int tid, size_t block_size, size_t size,
     memset((void*)latency_samples, 0, sizeof(latency_samples));
 #endif
 
-	buffer = allocate_aligned_buffer(block_size);
-    memset((void*)buffer, 1, block_size);
+	buffer = allocate_aligned_buffer(t->block_size);
+    memset((void*)buffer, 1, t->block_size);
 
     begin_time = nano_time();
 
@@ -516,36 +1412,47 @@ do_mmap_test(int fd, int tid, size_t block_size, size_t size,
      * I don't understand why. But be careful
      * changing this loop.
      */
-    for (i = 0; i < size; i+=block_size) {
-        off_t offset = offsets[i/block_size];
-        BEGIN_LAT_SAMPLE;
-        if (optype == READ) {
-            memcpy(buffer, &mmapped_buffer[offset],
-                   block_size);
-            ret_token += buffer[0];
+    do {
+        for (i = 0, op = 0; i < t->chunk_size; i += op_size, op++) {
+            off_t offset = t->offsets[op];
+            op_size = (t->sizes != NULL) ? t->sizes[op] : t->block_size;
+            BEGIN_LAT_SAMPLE;
+            op_begin_time = begin_op(t, begin_time, ops++);
+            if (optype == READ && t->zerocopy) {
+                /* Process the bytes in place, without the bounce buffer */
+                ret_token += mmap_transfer(t, buffer, offset, op_size, READ);
+            }
+            else if (optype == READ) {
+                mmap_transfer(t, buffer, offset, op_size, READ);
+                ret_token += consume_data(&t->consumer, buffer, op_size);
+            }
+            else if (optype == WRITE) {
+                ret_token += consume_data(&t->consumer, buffer, op_size);
+                mmap_transfer(t, buffer, offset, op_size, WRITE);
+                ret_token += mmap_byte(t->targets, i);
+            }
+            end_op(t, op_size, op_begin_time);
+            END_LAT_SAMPLE;
         }
-        else if (optype == WRITE) {
-            memcpy(&mmapped_buffer[offset], buffer,
-                   block_size);
-            ret_token += mmapped_buffer[i];
-        }
-        END_LAT_SAMPLE;
-    }
+        bytes += t->chunk_size;
+    } while (run_again(t));
 
     end_time = nano_time();
 
     MSG_NOT_SILENT("%s: (tid %d) %.2f GB/s "
                "(%" PRIu64 " bytes in %" PRIu64 " ns).\n",
-               (optype==READ)?"readmmap":"writemmap", tid,
-               (double)size/(double)(end_time-begin_time)
+               (optype==READ)?"readmmap":"writemmap", t->tid,
+               (double)bytes/(double)(end_time-begin_time)
                * NANOSECONDS_IN_SECOND / BYTES_IN_GB,
-               (uint_least64_t)size, (end_time-begin_time));
+               (uint_least64_t)bytes, (end_time-begin_time));
 
-    *begin = begin_time;
-    *end   = end_time;
+    t->bytes_done = bytes;
+    t->ops_done = ops;
+    t->start_time = begin_time;
+    t->end_time   = end_time;
 
 #if SAMPLE_LATENCY
-    printf("\nSample latency for %ld byte block:\n", block_size);
+    printf("\nSample latency for %ld byte block:\n", t->block_size);
     for (i = 0; i < MAX_LAT_SAMPLES; i++)
         printf("\t%ld: %ld\n", i, latency_samples[i]);
 #endif
@@ -553,25 +1460,174 @@ do_mmap_test(int fd, int tid, size_t block_size, size_t size,
     return ret_token;
 }
 
-char *
-map_buffer(int fd, size_t size) {
+/**
+ * BUFFER POOL tests
+ */
 
-    char *mmapped_buffer = NULL;
+/*
+ * The part of a request that falls into its k-th page: returns the
+ * length and sets the offset within the page.
+ */
+static inline size_t
+page_span(off_t offset, size_t size, size_t page_size, size_t k,
+          size_t *in_page) {
 
-#ifdef __linux__ /* Assumes Linux 2.6.23 or newer */
-    mmapped_buffer = (char *)mmap(NULL, size,
-								  PROT_READ | PROT_WRITE,
-                                  MAP_SHARED, fd, 0);
-#else
-    mmapped_buffer = (char *)mmap(NULL, size,
-                      PROT_READ | PROT_WRITE,
-                      MAP_SHARED, fd, 0);
-#endif
-    if (mmapped_buffer == MAP_FAILED)
-        EXIT_MSG("Failed to mmap file of size %" PRIu64 " : %s\n",
-               (uint_least64_t)size, strerror(errno));
+    size_t start = (k == 0) ? 0 : (k * page_size - offset % page_size);
 
-    return mmapped_buffer;
+    *in_page = (k == 0) ? offset % page_size : 0;
+    return (size - start < page_size - *in_page) ?
+        size - start : page_size - *in_page;
+}
+
+/* The bytes of a request that each target holds */
+static inline void
+count_target_bytes(threadargs_t *t, off_t offset, size_t size) {
+
+    size_t done, piece;
+    off_t phys;
+    int target;
+
+    for (done = 0; done < size; done += piece) {
+        piece = targets_locate(t->targets, offset + done, size - done,
+                               &target, &phys);
+        t->target_bytes[target] += piece;
+    }
+}
+
+uint64_t
+do_bufpool_test(threadargs_t *t, char optype) {
+
+    buffer_pool_t *bp = t->pool;
+    bp_frame_t **frames;
+    char *buffer = NULL, *data;
+    size_t k, len, npages, npinned, op, op_size, in_page, done_bytes,
+        page_size = bp->bp_page_size;
+    off_t offset, first_page;
+    uint64_t begin_time, end_time, op_begin_time, ops = 0, bytes = 0,
+        ret_token = 0;
+
+	buffer = allocate_aligned_buffer(t->block_size);
+    memset((void*)buffer, 1, t->block_size);
+    frames = (bp_frame_t **)
+        malloc((t->block_size / page_size + 2) * sizeof(bp_frame_t *));
+    if (frames == NULL)
+        EXIT_MSG("Failed to allocate memory: %s\n", strerror(errno));
+
+    begin_time = nano_time();
+
+    do {
+        for (op = 0; op < t->num_ops; op++) {
+            offset = t->offsets[op];
+            op_size = (t->sizes != NULL) ? t->sizes[op] : t->block_size;
+            first_page = offset / page_size;
+            npages = (offset + op_size - 1) / page_size - first_page + 1;
+            op_begin_time = begin_op(t, begin_time, ops++);
+
+            if (optype == WRITE)
+                ret_token += consume_data(&t->consumer, buffer, op_size);
+
+            /* Put all misses of this request in flight before waiting */
+            if (bp->bp_num_io_threads > 0) {
+                for (k = 0; k < npages; k++) {
+                    len = page_span(offset, op_size, page_size, k, &in_page);
+                    frames[k] = bp_pin_async(bp, first_page + k,
+                                             optype == WRITE && len == page_size,
+                                             &t->bp_stats);
+                }
+            }
+
+            for (k = 0, done_bytes = 0; k < npages; k++, done_bytes += len) {
+                len = page_span(offset, op_size, page_size, k, &in_page);
+                if (bp->bp_num_io_threads == 0)
+                    frames[k] = bp_pin(bp, first_page + k,
+                                       optype == WRITE && len == page_size,
+                                       &t->bp_stats);
+                if (bp_wait(frames[k]) != 0) {
+                    /* Read ahead, the frames after this one are pinned too */
+                    npinned = (bp->bp_num_io_threads > 0) ? npages : k + 1;
+                    goto error;
+                }
+
+                data = frames[k]->bf_data + in_page;
+                if (optype == READ && t->zerocopy)
+                    ret_token += consume_data(&t->consumer, data, len);
+                else if (optype == READ)
+                    memcpy(buffer + done_bytes, data, len);
+                else
+                    memcpy(data, buffer + done_bytes, len);
+                bp_unpin(frames[k], optype == WRITE);
+            }
+
+            if (optype == READ && !t->zerocopy)
+                ret_token += consume_data(&t->consumer, buffer, op_size);
+            end_op(t, op_size, op_begin_time);
+            count_target_bytes(t, offset, op_size);
+            bytes += op_size;
+        }
+    } while (run_again(t));
+
+    end_time = nano_time();
+
+    MSG_NOT_SILENT("%s: (tid %d) %.2f GB/s "
+               "(%" PRIu64 " bytes in %" PRIu64 " ns).\n",
+               (optype==READ)?"readbufpool":"writebufpool", t->tid,
+               (double)bytes/(double)(end_time-begin_time)
+               * NANOSECONDS_IN_SECOND / BYTES_IN_GB,
+               (uint_least64_t)bytes, (end_time-begin_time));
+
+    t->bytes_done = bytes;
+    t->ops_done = ops;
+    t->start_time = begin_time;
+    t->end_time   = end_time;
+    free(frames);
+    return ret_token;
+
+error:
+    for (; k < npinned; k++)
+        bp_unpin(frames[k], 0);
+    free(frames);
+    return -1;
+}
+
+void
+print_bufpool_stats(threadargs_t *threadargs, int numthreads,
+                    uint64_t elapsed_ns) {
+
+    bp_stats_t total;
+    int i;
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < numthreads; i++) {
+        total.bs_hits += threadargs[i].bp_stats.bs_hits;
+        total.bs_misses += threadargs[i].bp_stats.bs_misses;
+        total.bs_evictions += threadargs[i].bp_stats.bs_evictions;
+        total.bs_writebacks += threadargs[i].bp_stats.bs_writebacks;
+    }
+    printf("Buffer pool: hit ratio %.2f%% (%" PRIu64 " hits, %" PRIu64
+           " misses), %" PRIu64 " evictions (%.0f/s), %" PRIu64
+           " write-backs\n",
+           100.0 * total.bs_hits / (total.bs_hits + total.bs_misses + 1e-9),
+           total.bs_hits, total.bs_misses, total.bs_evictions,
+           (double)total.bs_evictions / elapsed_ns * NANOSECONDS_IN_SECOND,
+           total.bs_writebacks);
+}
+
+/* Throughput of every target over the whole run */
+void
+print_target_stats(threadargs_t *threadargs, int numthreads,
+                   uint64_t elapsed_ns) {
+
+    const targets_t *tg = threadargs[0].targets;
+    uint64_t bytes;
+    int i, k;
+
+    for (k = 0; k < tg->tg_count; k++) {
+        for (i = 0, bytes = 0; i < numthreads; i++)
+            bytes += threadargs[i].target_bytes[k];
+        printf("\t%s: %.2f GB/s (%" PRIu64 " bytes)\n", tg->tg_names[k],
+               (double)bytes/(double)elapsed_ns
+               * NANOSECONDS_IN_SECOND / BYTES_IN_GB, bytes);
+    }
 }
 
 /*
@@ -616,13 +1672,20 @@ map_buffer_per_thread(const char* fname, off_t *offsets, int off_size,
 
 
 
-/* Allocate the buffer aligned on its size */
+/*
+ * Allocate the buffer aligned on its size, rounded up to a power of two
+ * so that the mask below works for any request size.
+ */
 void*
 allocate_aligned_buffer(size_t size) {
 
-	size_t align = size - 1;
+	size_t align = 1;
 	void *buf;
 
+	while (align < size)
+		align <<= 1;
+	align -= 1;
+
 	buf = malloc(size + align);
 	if (buf == NULL)
 		EXIT_MSG("Failed to allocate aligned buffer.\n");
@@ -670,20 +1733,48 @@ print_help_message(const char *progname) {
     basename = basename ? basename + 1 : progname;
 
     printf("usage: %s [OPTION]\n", basename);
+    printf("  --affinity\n"
+           "     With several files, give every thread one file: thread i\n"
+           "     works on file i modulo the number of files.\n");
     printf("  -h, --help\n"
            "     Print this help and exit.\n");
+    printf("  --iothreads=N\n"
+           "     In the buffer pool tests, read misses with N I/O threads,\n"
+           "     so all misses of a request are in flight at once.\n"
+           "     Defaults to zero: the requesting thread reads the page.\n");
+    printf("  --pagesize=SIZE\n"
+           "     Buffer pool page size. Defaults to %d.\n",
+           DEFAULT_POOL_PAGE_SIZE);
+    printf("  --poolsize=SIZE\n"
+           "     Buffer pool size. Defaults to %d MB.\n",
+           DEFAULT_POOL_SIZE_MB);
     printf("  -b, --block[=BLOCKSIZE]\n"
            "     Block size used for read system calls.\n"
            "     For mmap tests, the size of the stride when iterating\n"
            "     over the file.\n"
            "     Defaults to %d.\n", DEFAULT_BLOCK_SIZE);
+    printf("  -c, --consume=SPEC\n"
+           "     What to do with every block read (or before it is\n"
+           "     written). SPEC is one of:\n"
+           "         first      -- use the first byte only (default)\n"
+           "         touch      -- read one byte in every cache line\n"
+           "         crc32c     -- CRC32C, hardware-assisted if available\n"
+           "         xxhash     -- xxHash-style hash, AVX2 if available\n"
+           "         compute:NS -- spin NS nanoseconds per kilobyte\n");
 	printf("  --directio\n"
            "     Use O_DIRECT flag when opening the file.\n");
-    printf("  -f, --file[=FILENAME]\n"
-           "     Perform all tests on this file (defaults to %s).\n",
+    printf("  -f, --file[=FILENAME[,FILENAME...]]\n"
+           "     Perform all tests on this file (defaults to %s).\n"
+           "     Several comma-separated files or devices are used as one\n"
+           "     target: concatenated, striped with --stripe, or one per\n"
+           "     thread with --affinity. Each contributes as many bytes\n"
+           "     as the smallest has, and is also reported separately.\n",
            DEFAULT_FNAME);
 	printf("  --randomaccess\n"
            "     Access the file randomly. Default access mode is sequential.\n");
+    printf("  --readbufpool\n"
+           "     Perform a read test through a user-space buffer pool\n"
+           "     over O_DIRECT with CLOCK eviction.\n");
     printf("  --readsyscall\n"
            "     Perform a read test using system calls.\n");
     printf("  --readmmap\n"
@@ -693,10 +1784,44 @@ print_help_message(const char *progname) {
     printf("  --size\n"
            "     Size of the area to map in devdax mode.\n"
            "     Defaults to %d GB.\n", DEFAULT_SIZE_DEVDAX_GB);
+    printf("  --sizedist=SPEC\n"
+           "     Draw the size of every request from a distribution\n"
+           "     instead of using a single block size. SPEC is one of:\n"
+           "         fixed:SIZE\n"
+           "         uniform:MIN:MAX\n"
+           "         bimodal:SMALL:LARGE:P_SMALL\n"
+           "         hist:FILE (lines of \"size weight\")\n"
+           "     Sizes take K, M and G suffixes. With --directio sizes\n"
+           "     and offsets are rounded to the file system block size.\n"
+           "     Results are also reported per power-of-two size bucket.\n");
+    printf("  --stripe=SIZE\n"
+           "     Stripe the files RAID0-style, SIZE bytes on each in turn.\n");
     printf("  --threads\n"
            "     The number of threads to use. Defaults to one.\n");
     printf("  --writesyscall\n"
            "     Perform a write test using system calls.\n");
+    printf("  --writebufpool\n"
+           "     Perform a write test through the buffer pool.\n");
     printf("  --writemmap\n"
            "     Perform a write test using mmap.\n");
+    printf("  --zerocopy\n"
+           "     In the readmmap and readbufpool tests, consume the data\n"
+           "     directly from the mapping or the buffer pool frame instead\n"
+           "     of copying it into a buffer first.\n");
+    printf("  --group=SPEC\n"
+           "     Run a group of threads with its own settings; repeat to\n"
+           "     run several groups concurrently against the same file.\n"
+           "     SPEC is a comma-separated list of key=value pairs:\n"
+           "         name=NAME, engine=readmmap|readsyscall|writemmap|\n"
+           "         writesyscall|readbufpool|writebufpool, threads=N,\n"
+           "         access=seq|random, block=SIZE, sizedist=SPEC,\n"
+           "         range=START:END (sizes or percent of the file),\n"
+           "         rate=REQUESTS_PER_SEC_PER_THREAD, directio=0|1,\n"
+           "         consume=SPEC\n"
+           "     Each group reports throughput and latency percentiles.\n");
+    printf("  --jobfile=FILE\n"
+           "     Read group specs from FILE, one per line.\n");
+    printf("  --runtime=SECONDS\n"
+           "     Repeat the requests until this much time has passed,\n"
+           "     so that groups with different amounts of work overlap.\n");
 }
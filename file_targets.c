@@ -0,0 +1,176 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "file_targets.h"
+
+/* Create a target set from a comma-separated list of file names */
+targets_t *
+targets_create(const char *list) {
+
+    targets_t *tg;
+    char *buf = NULL, *name, *saveptr;
+
+    if ((tg = (targets_t *) calloc(1, sizeof(targets_t))) == NULL)
+        return NULL;
+    if ((buf = strdup(list)) == NULL)
+        goto error;
+
+    for (name = strtok_r(buf, ",", &saveptr); name != NULL;
+         name = strtok_r(NULL, ",", &saveptr)) {
+        if (tg->tg_count == MAX_TARGETS) {
+            printf("No more than %d targets, please.\n", MAX_TARGETS);
+            goto error;
+        }
+        tg->tg_fds[tg->tg_count] = -1;
+        tg->tg_names[tg->tg_count++] = name;
+    }
+    if (tg->tg_count == 0)
+        goto error;
+    return tg;
+
+error:
+    free(buf);
+    free(tg);
+    return NULL;
+}
+
+/* Same files and layout, but not opened or mapped */
+targets_t *
+targets_clone(const targets_t *tg) {
+
+    targets_t *clone;
+    int i;
+
+    if ((clone = (targets_t *) malloc(sizeof(targets_t))) == NULL)
+        return NULL;
+    memcpy(clone, tg, sizeof(targets_t));
+    for (i = 0; i < clone->tg_count; i++) {
+        clone->tg_fds[i] = -1;
+        clone->tg_maps[i] = NULL;
+    }
+    return clone;
+}
+
+/*
+ * Use target_size bytes of every target. A non-zero stripe selects the
+ * stripe layout; the used size is then rounded down to whole stripes.
+ */
+void
+targets_set_layout(targets_t *tg, size_t target_size, size_t stripe) {
+
+    tg->tg_stripe = stripe;
+    tg->tg_layout = (stripe > 0) ? TARGETS_STRIPE : TARGETS_CONCAT;
+    if (stripe > 0)
+        target_size -= target_size % stripe;
+    tg->tg_target_size = target_size;
+    tg->tg_size = target_size * tg->tg_count;
+}
+
+int
+targets_open(targets_t *tg, int flags, mode_t mode) {
+
+    int i;
+
+    for (i = 0; i < tg->tg_count; i++) {
+        tg->tg_fds[i] = open(tg->tg_names[i], flags, mode);
+        if (tg->tg_fds[i] < 0) {
+            printf("Could not open/create file %s: %s\n",
+                   tg->tg_names[i], strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+targets_map(targets_t *tg) {
+
+    int i;
+
+    for (i = 0; i < tg->tg_count; i++) {
+        tg->tg_maps[i] = (char *)mmap(NULL, tg->tg_target_size,
+                                      PROT_READ | PROT_WRITE, MAP_SHARED,
+                                      tg->tg_fds[i], 0);
+        if (tg->tg_maps[i] == MAP_FAILED) {
+            printf("Failed to mmap %s, %" PRIu64 " bytes: %s\n",
+                   tg->tg_names[i], (uint64_t)tg->tg_target_size,
+                   strerror(errno));
+            tg->tg_maps[i] = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void
+targets_close(targets_t *tg) {
+
+    int i;
+
+    for (i = 0; i < tg->tg_count; i++) {
+        if (tg->tg_maps[i] != NULL)
+            munmap(tg->tg_maps[i], tg->tg_target_size);
+        if (tg->tg_fds[i] >= 0)
+            close(tg->tg_fds[i]);
+        tg->tg_maps[i] = NULL;
+        tg->tg_fds[i] = -1;
+    }
+}
+
+/*
+ * Read or write at a logical offset, one system call per stripe piece.
+ * Adds the bytes moved to or from every target to target_bytes, if given.
+ * Returns the number of bytes transferred, which is short only at the
+ * end of the targets, or -1 on error.
+ */
+static ssize_t
+targets_io(const targets_t *tg, char *buf, size_t len, off_t off,
+           uint64_t *target_bytes, int write) {
+
+    size_t done = 0, piece;
+    ssize_t ret;
+    off_t phys;
+    int target;
+
+    if (off >= (off_t)tg->tg_size)
+        return 0;
+    if (len > tg->tg_size - off)
+        len = tg->tg_size - off;
+
+    while (done < len) {
+        piece = targets_locate(tg, off + done, len - done, &target, &phys);
+        if (write)
+            ret = pwrite(tg->tg_fds[target], buf + done, piece, phys);
+        else
+            ret = pread(tg->tg_fds[target], buf + done, piece, phys);
+        if (ret < 0)
+            return -1;
+        if (target_bytes != NULL)
+            target_bytes[target] += ret;
+        done += ret;
+        if ((size_t)ret < piece)
+            break;
+    }
+    return done;
+}
+
+ssize_t
+targets_pread(const targets_t *tg, char *buf, size_t len, off_t off,
+              uint64_t *target_bytes) {
+
+    return targets_io(tg, buf, len, off, target_bytes, 0);
+}
+
+ssize_t
+targets_pwrite(const targets_t *tg, const char *buf, size_t len, off_t off,
+               uint64_t *target_bytes) {
+
+    return targets_io(tg, (char *)buf, len, off, target_bytes, 1);
+}
@@ -0,0 +1,70 @@
+#ifndef _FILE_TARGETS_H
+#define _FILE_TARGETS_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/*
+ * A set of files or devices that the benchmark treats as one logical
+ * target. With the stripe layout, consecutive stripe units go round-robin
+ * across the targets, like RAID0. With the concat layout the targets
+ * follow one another, so a thread working on one region of the logical
+ * space talks to one target only. Every target contributes the same
+ * number of bytes: the size of the smallest one.
+ */
+typedef enum {TARGETS_CONCAT, TARGETS_STRIPE} targets_layout_t;
+
+#define MAX_TARGETS 64
+
+typedef struct {
+    int     tg_count;
+    char   *tg_names[MAX_TARGETS];
+    int     tg_fds[MAX_TARGETS];
+    char   *tg_maps[MAX_TARGETS];   /* mapping of each target, if mapped */
+    size_t  tg_target_size;         /* bytes used on each target */
+    size_t  tg_size;                /* logical size */
+    size_t  tg_stripe;              /* stripe unit for TARGETS_STRIPE */
+    targets_layout_t tg_layout;
+} targets_t;
+
+/*
+ * Find where a logical offset lives. Returns how many of the len bytes
+ * starting there are contiguous on that target.
+ */
+static inline size_t
+targets_locate(const targets_t *tg, off_t off, size_t len, int *target,
+               off_t *phys) {
+
+    size_t unit, in_unit;
+
+    if (tg->tg_count == 1) {
+        *target = 0;
+        *phys = off;
+        return len;
+    }
+    if (tg->tg_layout == TARGETS_CONCAT) {
+        *target = off / tg->tg_target_size;
+        *phys = off % tg->tg_target_size;
+        return (len < tg->tg_target_size - *phys) ?
+            len : tg->tg_target_size - *phys;
+    }
+    unit = off / tg->tg_stripe;
+    in_unit = off % tg->tg_stripe;
+    *target = unit % tg->tg_count;
+    *phys = (unit / tg->tg_count) * tg->tg_stripe + in_unit;
+    return (len < tg->tg_stripe - in_unit) ? len : tg->tg_stripe - in_unit;
+}
+
+targets_t *targets_create(const char *list);
+targets_t *targets_clone(const targets_t *tg);
+void       targets_set_layout(targets_t *tg, size_t target_size,
+                              size_t stripe);
+int        targets_open(targets_t *tg, int flags, mode_t mode);
+int        targets_map(targets_t *tg);
+void       targets_close(targets_t *tg);
+ssize_t    targets_pread(const targets_t *tg, char *buf, size_t len,
+                         off_t off, uint64_t *target_bytes);
+ssize_t    targets_pwrite(const targets_t *tg, const char *buf, size_t len,
+                          off_t off, uint64_t *target_bytes);
+
+#endif
@@ -1,149 +1,500 @@
 #include <sys/types.h>
 #include <errno.h>
-#ifdef __linux__
-#include <memkind.h>
-#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "hash_table.h"
 #include "nano_time.h"
 
-#define BYTES_IN_GB (1024 * 1024 * 1024)
-#define DEFAULT_BLOCK_SIZE 4096
-#define DEFAULT_CACHE_SIZE_GB 32
-#define HASHTABLE_NUM_BUCKETS 4*1024*1024
-#define NANOSECONDS_IN_SECOND 1000000000
-
-void
-print_help_message(const char *progname) {
-
-    /* take only the last portion of the path */
-    const char *basename = strrchr(progname, '/');
-    basename = basename ? basename + 1 : progname;
-
-    printf("usage: %s\n", basename);
-
+/*
+ * The table grows when the load factor goes over HT_MAX_LOAD and, with
+ * HT_SHRINK, shrinks when it drops under HT_MIN_LOAD. A resize doesn't
+ * copy the table at once: the old bucket array stays around and every
+ * put, get and remove moves the next HT_REHASH_STEP of its buckets over,
+ * so that no single operation pays for the whole table. Until the move is
+ * done, lookups check both arrays.
+ */
+#define HT_MAX_LOAD 1
+#define HT_MIN_LOAD 8		/* shrink below one item per this many buckets */
+#define HT_MIN_SIZE 64
+#define HT_REHASH_STEP 4
+#define HT_SHRINK 1
+
+#define BYTES_IN_MB (1024 * 1024)
+
+int ht_use_slabs = 1;
+int ht_use_vlog = 0;
+int ht_use_filter = 0;
+size_t ht_cache_budget = 0;
+
+/*
+ * Calloc rather than malloc and memset: a large array then comes as fresh
+ * zero pages, and the resize that asks for it doesn't touch them all.
+ */
+static ht_bucket_t *ht_alloc_buckets(size_t num_buckets) {
+
+    return (ht_bucket_t *)CALLOC_METADATA(num_buckets, sizeof(ht_bucket_t));
 }
 
-#define EXIT_HELP_MSG(...)		       \
-    do {                                       \
-	    printf(__VA_ARGS__);	       \
-	    print_help_message(argv[0]);       \
-	    _exit(-1);			       \
-    } while (0)
+static ht_bucket_t *ht_alloc_node(hashtable_t *ht_ptr) {
 
-#define EXIT_MSG(...)                          \
-    do {                                       \
-            printf(__VA_ARGS__);               \
-            _exit(-1);                         \
-    } while (0)
+    if (ht_ptr->ht_node_slab != NULL)
+	return (ht_bucket_t *)slab_alloc(ht_ptr->ht_node_slab,
+					 sizeof(ht_bucket_t));
+    return (ht_bucket_t *)ALLOC_METADATA(sizeof(ht_bucket_t));
+}
 
-/* Use macros, so we can easily replace allocators */
-#define FSDAX 1
+static void ht_free_node(hashtable_t *ht_ptr, ht_bucket_t *node) {
 
-#if FSDAX
-struct memkind *pmem_kind = NULL;
+    if (ht_ptr->ht_node_slab != NULL)
+	slab_free(ht_ptr->ht_node_slab, node, sizeof(ht_bucket_t));
+    else
+	FREE_METADATA(node);
+}
 
-const char DEFAULT_MEMKIND_PATH[] = "/mnt/pmem/sasha";
-#define BYTES_IN_GB (1024 * 1024 * 1024)
-#define DEFAULT_SIZE_GB 32
+static inline int ht_value_in_slab(hashtable_t *ht_ptr, size_t size) {
 
-#define ALLOC_DATA(size) memkind_malloc(pmem_kind, size)
-#define ALLOC_METADATA(size) memkind_malloc(pmem_kind, size)
-#define FREE_DATA(ptr) memkind_free(pmem_kind, ptr)
-#define FREE_METADATA(ptr) memkind_free(pmem_kind, ptr)
+    return ht_ptr->ht_value_slab != NULL && slab_fits(size);
+}
 
-#else
+static inline int ht_value_in_vlog(hashtable_t *ht_ptr, size_t size) {
 
-#define ALLOC_DATA(size) malloc(size)
-#define ALLOC_METADATA(size) malloc(size)
-#define FREE(ptr) free(ptr)
-#define FREE_METADATA(ptr) free(ptr)
+    return ht_ptr->ht_vlog != NULL && vlog_fits(size);
+}
 
-#endif
+/* The log needs the key, to find who points at a value it moves */
+static void *ht_alloc_value(hashtable_t *ht_ptr, size_t key, size_t size) {
 
+    if (ht_value_in_vlog(ht_ptr, size))
+	return vlog_append(ht_ptr->ht_vlog, key, size);
+    if (ht_value_in_slab(ht_ptr, size))
+	return slab_alloc(ht_ptr->ht_value_slab, size);
+    return ALLOC_DATA(size);
+}
 
-typedef struct ht_bucket {
-    size_t htb_key;
-    size_t htb_value_size;
-    void*  htb_value_address;
-    struct ht_bucket *htb_next;
-} ht_bucket_t;
+static void ht_free_value(hashtable_t *ht_ptr, void *addr, size_t size) {
 
-typedef struct {
-    size_t ht_size;
-    ht_bucket_t *ht_buckets;
-} hashtable_t;
+    if (ht_value_in_vlog(ht_ptr, size))
+	vlog_free(ht_ptr->ht_vlog, addr);
+    else if (ht_value_in_slab(ht_ptr, size))
+	slab_free(ht_ptr->ht_value_slab, addr, size);
+    else
+	FREE_DATA(addr);
+}
 
 hashtable_t *ht_allocate(size_t num_items) {
 
     hashtable_t *ht_ptr;
     ht_bucket_t *ht_buckets;
 
-    ht_buckets = (ht_bucket_t *)ALLOC_METADATA(sizeof(ht_bucket_t) * num_items);
+    if (num_items < HT_MIN_SIZE)
+	num_items = HT_MIN_SIZE;
+
+    ht_buckets = ht_alloc_buckets(num_items);
     if (ht_buckets == NULL)
 	return NULL;
 
-    memset(ht_buckets, 0, sizeof(ht_bucket_t) * num_items);
-
     ht_ptr = (hashtable_t *)ALLOC_METADATA(sizeof(hashtable_t));
     if (ht_ptr == NULL) {
 	FREE_METADATA(ht_buckets);
 	return NULL;
     }
+    memset(ht_ptr, 0, sizeof(hashtable_t));
 
     ht_ptr->ht_size = num_items;
     ht_ptr->ht_buckets = ht_buckets;
-
+    ht_ptr->ht_cache_budget = ht_cache_budget;
+
+    if (ht_use_slabs) {
+	ht_ptr->ht_node_slab = slab_create(1);
+	if (!ht_use_vlog)
+	    ht_ptr->ht_value_slab = slab_create(0);
+	if (ht_ptr->ht_node_slab == NULL ||
+	    (!ht_use_vlog && ht_ptr->ht_value_slab == NULL)) {
+	    ht_destroy(ht_ptr);
+	    return NULL;
+	}
+    }
+    if (ht_use_vlog && (ht_ptr->ht_vlog = vlog_create()) == NULL) {
+	ht_destroy(ht_ptr);
+	return NULL;
+    }
+    if (ht_use_filter &&
+	(ht_ptr->ht_filter = cfilter_create(num_items * HT_MAX_LOAD)) == NULL) {
+	ht_destroy(ht_ptr);
+	return NULL;
+    }
     return ht_ptr;
 }
 
-void *ht_get(hashtable_t *ht_ptr, size_t key, size_t *size) {
+/*
+ * Put an existing entry into the new bucket array. The head of every
+ * chain lives in the array itself, so an entry that was a chain node is
+ * either copied into an empty head and freed, or linked in after the head.
+ */
+static void ht_move_entry(hashtable_t *ht_ptr, ht_bucket_t *entry,
+			  int is_node) {
+
+    ht_bucket_t *head, *node;
+    uint64_t hash;
+
+    head = &ht_ptr->ht_buckets[entry->htb_key % ht_ptr->ht_size];
+    if (ht_ptr->ht_filter != NULL) {
+	hash = ht_hash(entry->htb_key);
+	cfilter_add(ht_ptr->ht_filter, hash);
+	cfilter_remove(ht_ptr->ht_old_filter, hash);
+    }
 
-    ht_bucket_t *htb;
+    if (head->htb_key == 0) {
+	head->htb_key = entry->htb_key;
+	head->htb_value_size = entry->htb_value_size;
+	head->htb_value_address = entry->htb_value_address;
+	if (is_node)
+	    ht_free_node(ht_ptr, entry);
+	return;
+    }
+    if (is_node)
+	node = entry;
+    else {
+	node = ht_alloc_node(ht_ptr);
+	if (node == NULL)
+	    EXIT_MSG("Could not allocate a bucket while resizing: %s\n",
+		     strerror(errno));
+	node->htb_key = entry->htb_key;
+	node->htb_value_size = entry->htb_value_size;
+	node->htb_value_address = entry->htb_value_address;
+    }
+    node->htb_next = head->htb_next;
+    head->htb_next = node;
+}
 
-    htb = &ht_ptr->ht_buckets[key % ht_ptr->ht_size];
+/* Move up to HT_REHASH_STEP old buckets into the new array */
+static void ht_rehash_step(hashtable_t *ht_ptr) {
+
+    ht_bucket_t *htb, *next;
+    size_t moved = 0, visited = 0;
+
+    while (ht_ptr->ht_old_buckets != NULL && moved < HT_REHASH_STEP &&
+	   visited < HT_REHASH_STEP * 16) {
+	htb = &ht_ptr->ht_old_buckets[ht_ptr->ht_rehash_idx++];
+	visited++;
+
+	if (htb->htb_key != 0) {
+	    ht_move_entry(ht_ptr, htb, 0);
+	    moved++;
+	}
+	for (next = htb->htb_next; next != NULL; moved++) {
+	    ht_bucket_t *node = next;
+
+	    next = node->htb_next;
+	    /* Removed chain heads leave an empty entry behind */
+	    if (node->htb_key == 0)
+		ht_free_node(ht_ptr, node);
+	    else
+		ht_move_entry(ht_ptr, node, 1);
+	}
+	memset(htb, 0, sizeof(ht_bucket_t));
+
+	if (ht_ptr->ht_rehash_idx == ht_ptr->ht_old_size) {
+	    FREE_METADATA(ht_ptr->ht_old_buckets);
+	    ht_ptr->ht_old_buckets = NULL;
+	    ht_ptr->ht_old_size = 0;
+	    ht_ptr->ht_rehash_idx = 0;
+	    if (ht_ptr->ht_old_filter != NULL) {
+		cfilter_destroy(ht_ptr->ht_old_filter);
+		ht_ptr->ht_old_filter = NULL;
+	    }
+	}
+    }
+}
+
+/*
+ * Start moving the items into a bucket array of new_size buckets. If we
+ * can't get the memory we simply keep the current array.
+ */
+static void ht_resize(hashtable_t *ht_ptr, size_t new_size) {
+
+    ht_bucket_t *ht_buckets;
+    cfilter_t *filter;
+
+    if (ht_ptr->ht_old_buckets != NULL)
+	return;
+    if ((ht_buckets = ht_alloc_buckets(new_size)) == NULL)
+	return;
+    if (ht_ptr->ht_filter != NULL) {
+	if ((filter = cfilter_create(new_size * HT_MAX_LOAD)) == NULL) {
+	    FREE_METADATA(ht_buckets);
+	    return;
+	}
+	ht_ptr->ht_old_filter = ht_ptr->ht_filter;
+	ht_ptr->ht_filter = filter;
+	ht_ptr->ht_filter_rebuilds++;
+    }
+
+    ht_ptr->ht_old_buckets = ht_ptr->ht_buckets;
+    ht_ptr->ht_old_size = ht_ptr->ht_size;
+    ht_ptr->ht_rehash_idx = 0;
+    ht_ptr->ht_buckets = ht_buckets;
+    ht_ptr->ht_size = new_size;
+    ht_ptr->ht_resizes++;
+}
+
+static void ht_check_load(hashtable_t *ht_ptr) {
+
+    if (ht_ptr->ht_old_buckets != NULL)
+	return;
+    if (ht_ptr->ht_items > ht_ptr->ht_size * HT_MAX_LOAD)
+	ht_resize(ht_ptr, ht_ptr->ht_size * 2);
+#if HT_SHRINK
+    else if (ht_ptr->ht_size > HT_MIN_SIZE &&
+	     ht_ptr->ht_items < ht_ptr->ht_size / HT_MIN_LOAD)
+	ht_resize(ht_ptr, ht_ptr->ht_size / 2);
+#endif
+    else if (ht_ptr->ht_filter != NULL && ht_ptr->ht_filter->cf_overflowed)
+	ht_resize(ht_ptr, ht_ptr->ht_size);
+}
+
+/* A key in the old array may not have been moved into the new filter */
+static inline int ht_filter_may_contain(hashtable_t *ht_ptr, size_t key) {
+
+    uint64_t hash;
+
+    if (ht_ptr->ht_filter == NULL)
+	return 1;
+    hash = ht_hash(key);
+    return cfilter_may_contain(ht_ptr->ht_filter, hash) ||
+	(ht_ptr->ht_old_filter != NULL &&
+	 cfilter_may_contain(ht_ptr->ht_old_filter, hash));
+}
+
+/* The filter of the array the key was in */
+static inline void ht_filter_remove(cfilter_t *filter, size_t key) {
+
+    if (filter != NULL)
+	cfilter_remove(filter, ht_hash(key));
+}
+
+static ht_bucket_t *ht_find(ht_bucket_t *htb, size_t key,
+			    uint64_t *probes) {
+
+    uint64_t n = 0;
 
     /*
      * Traverse the linked list in the bucket until we find the
      * items with the requested key.
      */
     while(htb != NULL) {
-	if (htb->htb_key == key) {
-	    *size = htb->htb_value_size;
-	    return htb->htb_value_address;
-	}
+	n++;
+	if (htb->htb_key == key)
+	    break;
 	htb = htb->htb_next;
     }
+    *probes += n;
+    return htb;
+}
+
+/* Look in the new array, then in the old one if we're resizing */
+static ht_bucket_t *ht_locate(hashtable_t *ht_ptr, size_t key,
+			      uint64_t *probes) {
+
+    ht_bucket_t *htb;
+
+    htb = ht_find(&ht_ptr->ht_buckets[key % ht_ptr->ht_size], key, probes);
+    if (htb == NULL && ht_ptr->ht_old_buckets != NULL)
+	htb = ht_find(&ht_ptr->ht_old_buckets[key % ht_ptr->ht_old_size],
+		      key, probes);
+    return htb;
+}
+
+/* A lookup of the workload's, which the stats count */
+static ht_bucket_t *ht_lookup(hashtable_t *ht_ptr, size_t key) {
+
+    ht_bucket_t *htb;
+
+    if (ht_ptr->ht_filter != NULL) {
+	ht_ptr->ht_filter_lookups++;
+	if (!ht_filter_may_contain(ht_ptr, key)) {
+	    ht_ptr->ht_filter_negatives++;
+	    return NULL;
+	}
+    }
+    ht_ptr->ht_lookups++;
+    htb = ht_locate(ht_ptr, key, &ht_ptr->ht_probes);
+    if (htb == NULL && ht_ptr->ht_filter != NULL)
+	ht_ptr->ht_filter_false_positives++;
+    return htb;
+}
+
+/* The compactor's moves aren't lookups, and leave the stats alone */
+static int ht_vlog_relocate(void *arg, uint64_t key, void *old_addr,
+			    void *new_addr) {
+
+    uint64_t probes = 0;
+    ht_bucket_t *htb = ht_locate((hashtable_t *)arg, key, &probes);
+
+    if (htb == NULL || htb->htb_value_address != old_addr)
+	return 0;
+    htb->htb_value_address = new_addr;
+    return 1;
+}
+
+/* Take what the log's compactor moved, before we look anything up */
+static inline void ht_vlog_step(hashtable_t *ht_ptr) {
+
+    if (ht_ptr->ht_vlog != NULL)
+	vlog_apply(ht_ptr->ht_vlog, ht_vlog_relocate, ht_ptr);
+}
+
+/* Only write the bit if it's clear, so that hot entries stay clean */
+static inline void ht_cache_hit(hashtable_t *ht_ptr, ht_bucket_t *htb) {
+
+    if (ht_ptr->ht_cache_budget == 0)
+	return;
+    /* An empty head, which a key of 0 finds, has nothing cached */
+    if (htb->htb_key == 0) {
+	ht_ptr->ht_misses++;
+	return;
+    }
+    ht_ptr->ht_hits++;
+    if (!(htb->htb_value_size & HTB_REFERENCED))
+	htb->htb_value_size |= HTB_REFERENCED;
+}
+
+static inline void ht_cache_miss(hashtable_t *ht_ptr) {
+
+    if (ht_ptr->ht_cache_budget != 0)
+	ht_ptr->ht_misses++;
+}
+
+void *ht_get(hashtable_t *ht_ptr, size_t key, size_t *size) {
+
+    ht_bucket_t *htb;
+
+    ht_rehash_step(ht_ptr);
+    ht_vlog_step(ht_ptr);
+
+    if ((htb = ht_lookup(ht_ptr, key)) != NULL) {
+	ht_cache_hit(ht_ptr, htb);
+	*size = HTB_SIZE(htb);
+	return htb->htb_value_address;
+    }
+    ht_cache_miss(ht_ptr);
     *size = 0;
     return NULL;
 }
 
+/*
+ * Evict the entries of a chain whose reference bits are clear, and clear
+ * the others. An evicted head stays in the array, empty, as a removed
+ * one does.
+ */
+static void ht_cache_sweep(hashtable_t *ht_ptr, ht_bucket_t *head,
+			   cfilter_t *filter) {
+
+    ht_bucket_t *htb, *prev = head, *next;
+
+    for (htb = head; htb != NULL; htb = next) {
+	next = htb->htb_next;
+	if (htb->htb_key == 0) {
+	    prev = htb;
+	    continue;
+	}
+	if (htb->htb_value_size & HTB_REFERENCED) {
+	    htb->htb_value_size &= ~HTB_REFERENCED;
+	    prev = htb;
+	    continue;
+	}
+	ht_free_value(ht_ptr, htb->htb_value_address, htb->htb_value_size);
+	ht_ptr->ht_cache_bytes -= htb->htb_value_size;
+	ht_ptr->ht_items--;
+	ht_ptr->ht_evictions++;
+	ht_filter_remove(filter, htb->htb_key);
+	if (htb == head) {
+	    htb->htb_key = 0;
+	    htb->htb_value_size = 0;
+	    htb->htb_value_address = NULL;
+	} else {
+	    prev->htb_next = next;
+	    ht_free_node(ht_ptr, htb);
+	}
+    }
+}
+
+/*
+ * Sweep until size more bytes fit with the slack to spare. While a
+ * resize is going on the hand visits the same index in both arrays.
+ * Two turns clear every bit, so if there's still no room then, the
+ * table is empty.
+ */
+static void ht_cache_evict(hashtable_t *ht_ptr, size_t size) {
+
+    size_t target, turn, end, hand;
+    uint64_t begin_time = nano_time();
+
+    target = ht_ptr->ht_cache_budget - ht_ptr->ht_cache_budget /
+	HT_CACHE_SLACK;
+    target = size < target ? target - size : 0;
+    end = ht_ptr->ht_size > ht_ptr->ht_old_size ? ht_ptr->ht_size :
+	ht_ptr->ht_old_size;
+
+    for (turn = 0; turn < 2 * end && ht_ptr->ht_cache_bytes > target;
+	 turn++) {
+	hand = ht_ptr->ht_clock_hand++ % end;
+	if (hand < ht_ptr->ht_size)
+	    ht_cache_sweep(ht_ptr, &ht_ptr->ht_buckets[hand],
+			   ht_ptr->ht_filter);
+	if (ht_ptr->ht_old_buckets != NULL && hand < ht_ptr->ht_old_size)
+	    ht_cache_sweep(ht_ptr, &ht_ptr->ht_old_buckets[hand],
+			   ht_ptr->ht_old_filter);
+    }
+    ht_ptr->ht_eviction_batches++;
+    ht_ptr->ht_eviction_ns += nano_time() - begin_time;
+    ht_check_load(ht_ptr);
+}
+
 void *ht_put(hashtable_t *ht_ptr, size_t key, size_t size) {
 
     ht_bucket_t *htb, *htb_prev = NULL, *htb_new;
 
+    ht_rehash_step(ht_ptr);
+    ht_vlog_step(ht_ptr);
+
+    /* We don't allow duplicate keys for now */
+    if (ht_lookup(ht_ptr, key) != NULL)
+	return NULL;
+
+    if (ht_ptr->ht_cache_budget != 0) {
+	/* Such a value would never stay, and NULL means a duplicate */
+	if (size > ht_ptr->ht_cache_budget)
+	    EXIT_MSG("A value of %zu bytes is larger than the cache of "
+		     "%zu bytes\n", size, ht_ptr->ht_cache_budget);
+	if (ht_ptr->ht_cache_bytes + size > ht_ptr->ht_cache_budget)
+	    ht_cache_evict(ht_ptr, size);
+    }
+    if (ht_ptr->ht_filter != NULL)
+	cfilter_add(ht_ptr->ht_filter, ht_hash(key));
+
+    /* New items always go into the new array */
     htb = &ht_ptr->ht_buckets[key % ht_ptr->ht_size];
 
     /*
      * Find the empty bucket in the hashtable
      */
     while(htb != NULL) {
-	if (htb->htb_key == key) {
-	    /* We don't allow duplicate keys for now */
-	    return NULL;
-	}
-	else if(htb->htb_key == 0) {
+	if(htb->htb_key == 0) {
 	    /* Allocate space for the value */
-	    htb->htb_value_address = ALLOC_DATA(size);
+	    htb->htb_value_address = ht_alloc_value(ht_ptr, key, size);
 	    if (htb->htb_value_address == NULL)
 		EXIT_MSG("Could not allocate %ld bytes: %s\n",
 			 size, strerror(errno));
 
 	    htb->htb_key = key;
 	    htb->htb_value_size = size;
+	    ht_ptr->ht_items++;
+	    ht_ptr->ht_cache_bytes += size;
+	    ht_check_load(ht_ptr);
 	    return htb->htb_value_address;
 	}
 	else {
@@ -153,13 +504,13 @@ void *ht_put(hashtable_t *ht_ptr, size_t key, size_t size) {
     }
 
     /* Allocate a new bucket in the chain */
-    htb_new = (ht_bucket_t*)ALLOC_METADATA(sizeof(ht_bucket_t));
+    htb_new = ht_alloc_node(ht_ptr);
     if (htb_new == NULL)
 	return NULL;
 
-    htb_new->htb_value_address = ALLOC_DATA(size);
+    htb_new->htb_value_address = ht_alloc_value(ht_ptr, key, size);
     if (htb_new->htb_value_address == NULL) {
-	FREE_METADATA(htb_new);
+	ht_free_node(ht_ptr, htb_new);
 	return NULL;
     }
     htb_new->htb_key = key;
@@ -167,24 +518,62 @@ void *ht_put(hashtable_t *ht_ptr, size_t key, size_t size) {
     htb_new->htb_next = NULL;
 
     htb_prev->htb_next = htb_new;
+    ht_ptr->ht_items++;
+    ht_ptr->ht_cache_bytes += size;
+    ht_check_load(ht_ptr);
 
     return htb_new->htb_value_address;
 }
 
-void ht_remove(hashtable_t *ht_ptr, size_t key, size_t size) {
+/*
+ * A put for bulk loads, from threads that each own a range of buckets of
+ * a table that isn't resizing: no duplicate check, no resize, and no
+ * counting, which the caller does once it's done.
+ */
+void *ht_put_in_bucket(hashtable_t *ht_ptr, size_t key, size_t size) {
 
-    ht_bucket_t *htb, *htb_prev = NULL, *htb_new;
+    ht_bucket_t *head = &ht_ptr->ht_buckets[key % ht_ptr->ht_size], *node;
+    void *addr;
 
-    htb = &ht_ptr->ht_buckets[key % ht_ptr->ht_size];
+    if ((addr = ht_alloc_value(ht_ptr, key, size)) == NULL)
+	return NULL;
+    if (ht_ptr->ht_filter != NULL)
+	cfilter_add(ht_ptr->ht_filter, ht_hash(key));
+    if (head->htb_key == 0) {
+	head->htb_key = key;
+	head->htb_value_size = size;
+	head->htb_value_address = addr;
+	return addr;
+    }
+    if ((node = ht_alloc_node(ht_ptr)) == NULL) {
+	ht_free_value(ht_ptr, addr, size);
+	return NULL;
+    }
+    node->htb_key = key;
+    node->htb_value_size = size;
+    node->htb_value_address = addr;
+    node->htb_next = head->htb_next;
+    head->htb_next = node;
+    return addr;
+}
+
+/* Returns 0 if the key was in this bucket array */
+static int ht_remove_from(hashtable_t *ht_ptr, ht_bucket_t *ht_buckets,
+			  size_t num_buckets, size_t key, size_t size) {
+
+    ht_bucket_t *htb, *htb_prev = NULL;
+
+    htb = &ht_buckets[key % num_buckets];
 
     while(htb != NULL) {
 	if (htb->htb_key == key) {
-	    if (htb->htb_value_size != size)
+	    if (HTB_SIZE(htb) != size)
 		EXIT_MSG("Found key, unmatched size: key %zu, "
 			 "hashbtable size: %zu, new item size: %zu\n",
-			 key, htb->htb_value_size, size);
+			 key, HTB_SIZE(htb), size);
 	    else{ /* Remove */
-		FREE_DATA(htb->htb_value_address);
+		ht_free_value(ht_ptr, htb->htb_value_address, size);
+		ht_ptr->ht_cache_bytes -= size;
 		if (htb_prev == NULL) { /* first item in chain */
 		    htb->htb_key = 0;
 		    htb->htb_value_size = 0;
@@ -192,24 +581,131 @@ void ht_remove(hashtable_t *ht_ptr, size_t key, size_t size) {
 		}
 		else {
 		    htb_prev->htb_next = htb->htb_next;
-		    FREE_METADATA(htb);
+		    ht_free_node(ht_ptr, htb);
 		}
-		return;
+		return 0;
 	    }
 	}
 	htb_prev = htb;
 	htb = htb->htb_next;
     }
+    return -1;
+}
+
+void ht_remove(hashtable_t *ht_ptr, size_t key, size_t size) {
+
+    cfilter_t *filter = NULL;
+    int found = 0;
+
+    ht_rehash_step(ht_ptr);
+    ht_vlog_step(ht_ptr);
+
+    if (ht_filter_may_contain(ht_ptr, key)) {
+	if (ht_remove_from(ht_ptr, ht_ptr->ht_buckets, ht_ptr->ht_size, key,
+			   size) == 0) {
+	    found = 1;
+	    filter = ht_ptr->ht_filter;
+	} else if (ht_ptr->ht_old_buckets != NULL &&
+		   ht_remove_from(ht_ptr, ht_ptr->ht_old_buckets,
+				  ht_ptr->ht_old_size, key, size) == 0) {
+	    found = 1;
+	    filter = ht_ptr->ht_old_filter;
+	}
+    }
+    if (found) {
+	ht_filter_remove(filter, key);
+	ht_ptr->ht_items--;
+	ht_check_load(ht_ptr);
+	return;
+    }
     printf("Remove can't find requested item: key %zu, size %zu\n",
 	   key, size);
 }
 
+/*
+ * Group prefetching: the first stage prefetches the buckets of a group,
+ * the second the node after every bucket that holds another key, and the
+ * last walks the chains as a single get or put would, by which time the
+ * first two links of every chain should be in the cache. Gets skip the
+ * keys the filter rules out; a put writes their buckets anyway.
+ */
+static void ht_prefetch_group(hashtable_t *ht_ptr, const size_t *keys,
+			      size_t n, int gets) {
+
+    ht_bucket_t *htb;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+	if (gets && !ht_filter_may_contain(ht_ptr, keys[i]))
+	    continue;
+	__builtin_prefetch(&ht_ptr->ht_buckets[keys[i] % ht_ptr->ht_size]);
+	if (ht_ptr->ht_old_buckets != NULL)
+	    __builtin_prefetch(&ht_ptr->ht_old_buckets[keys[i] %
+						       ht_ptr->ht_old_size]);
+    }
+    for (i = 0; i < n; i++) {
+	htb = &ht_ptr->ht_buckets[keys[i] % ht_ptr->ht_size];
+	if (htb->htb_key != keys[i] && htb->htb_next != NULL)
+	    __builtin_prefetch(htb->htb_next);
+    }
+}
+
+/*
+ * The rehash steps of the whole batch are taken first, so that the
+ * bucket arrays stay put while the stages run. The values found are
+ * prefetched too, for the caller that reads them next.
+ */
+void ht_multi_get(hashtable_t *ht_ptr, const size_t *keys, size_t n,
+		  void **values, size_t *sizes) {
+
+    ht_bucket_t *htb;
+    size_t i, j, group;
+
+    for (i = 0; i < n; i++)
+	ht_rehash_step(ht_ptr);
+    ht_vlog_step(ht_ptr);
+
+    for (i = 0; i < n; i += group) {
+	group = n - i < HT_MULTI_GROUP ? n - i : HT_MULTI_GROUP;
+	ht_prefetch_group(ht_ptr, keys + i, group, 1);
+	for (j = i; j < i + group; j++) {
+	    if ((htb = ht_lookup(ht_ptr, keys[j])) != NULL) {
+		ht_cache_hit(ht_ptr, htb);
+		sizes[j] = HTB_SIZE(htb);
+		values[j] = htb->htb_value_address;
+		__builtin_prefetch(values[j]);
+	    } else {
+		ht_cache_miss(ht_ptr);
+		sizes[j] = 0;
+		values[j] = NULL;
+	    }
+	}
+    }
+}
+
+/*
+ * A put may start a resize halfway through a group, which only makes
+ * the rest of its prefetches useless.
+ */
+void ht_multi_put(hashtable_t *ht_ptr, const size_t *keys,
+		  const size_t *sizes, size_t n, void **values) {
+
+    size_t i, j, group;
+
+    for (i = 0; i < n; i += group) {
+	group = n - i < HT_MULTI_GROUP ? n - i : HT_MULTI_GROUP;
+	ht_prefetch_group(ht_ptr, keys + i, group, 0);
+	for (j = i; j < i + group; j++)
+	    values[j] = ht_put(ht_ptr, keys[j], sizes[j]);
+    }
+}
+
 void ht_bucket_print(ht_bucket_t *htb, size_t idx) {
 
     printf("Bucket %ld: \n", idx);
     while (htb != NULL) {
 	printf("\t Key = %ld, value_address = %p, size = %ld\n",
-	       htb->htb_key, htb->htb_value_address, htb->htb_value_size);
+	       htb->htb_key, htb->htb_value_address, HTB_SIZE(htb));
      	htb = htb->htb_next;
     }
     printf("\n");
@@ -219,86 +715,208 @@ void hashtable_print(hashtable_t *ht_ptr) {
 
     size_t i;
 
+    printf("%zu items in %zu buckets, %zu resizes\n", ht_ptr->ht_items,
+	   ht_ptr->ht_size, ht_ptr->ht_resizes);
     for (i = 0; i < ht_ptr->ht_size; i++)
 	ht_bucket_print(&ht_ptr->ht_buckets[i], i);
+
+    if (ht_ptr->ht_old_buckets == NULL)
+	return;
+    printf("Not yet moved from the old %zu buckets:\n", ht_ptr->ht_old_size);
+    for (i = ht_ptr->ht_rehash_idx; i < ht_ptr->ht_old_size; i++)
+	ht_bucket_print(&ht_ptr->ht_old_buckets[i], i);
 }
 
+void ht_print_slab_stats(hashtable_t *ht_ptr) {
 
-#define MAX_KEY 1000000
-#define MAX_SIZE 32768
+    if (ht_ptr->ht_node_slab != NULL)
+	slab_print_stats(ht_ptr->ht_node_slab, "Node");
+    if (ht_ptr->ht_value_slab != NULL)
+	slab_print_stats(ht_ptr->ht_value_slab, "Value");
+}
 
-typedef struct {
-    size_t key;
-    size_t size;
-} ht_item_t;
+void ht_print_vlog_stats(hashtable_t *ht_ptr) {
 
-int main(void) {
+    if (ht_ptr->ht_vlog != NULL)
+	vlog_print_stats(ht_ptr->ht_vlog);
+}
 
-    ht_item_t *items_put;
-    int i, num_items = 1024;
-    size_t key, size, ret_size;
-    void *addr;
-    uint64_t begin_time, end_time;
+void ht_print_filter_stats(hashtable_t *ht_ptr) {
+
+    uint64_t absent;
+
+    if (ht_ptr->ht_filter == NULL)
+	return;
+    absent = ht_ptr->ht_filter_negatives + ht_ptr->ht_filter_false_positives;
+    printf("Filter: %.1f MB, %.1f bits per item, %" PRIu64 " lookups, "
+	   "%.2f%% answered by the filter, %.3f%% false positives, %" PRIu64
+	   " rebuilds\n", (double)cfilter_bytes(ht_ptr->ht_filter) / BYTES_IN_MB,
+	   ht_ptr->ht_items ?
+	   8.0 * cfilter_bytes(ht_ptr->ht_filter) / ht_ptr->ht_items : 0.0,
+	   ht_ptr->ht_filter_lookups,
+	   ht_ptr->ht_filter_lookups ? 100.0 * ht_ptr->ht_filter_negatives /
+	   ht_ptr->ht_filter_lookups : 0.0,
+	   absent ? 100.0 * ht_ptr->ht_filter_false_positives / absent : 0.0,
+	   ht_ptr->ht_filter_rebuilds);
+}
 
-#if FSDAX
-    if (memkind_create_pmem(DEFAULT_MEMKIND_PATH, 0, &pmem_kind) != 0)
-	EXIT_MSG("Could not create pmem device: %s\n", strerror(errno));
-#endif
-    /*
-     * Allocate the space to remember the keys and sizes we add
-     * to the hashtable.
-     */
-    items_put = (ht_item_t *)malloc(num_items * sizeof(ht_item_t));
-    if (items_put == NULL)
-	EXIT_MSG("Could not allocate items array of %d items.\n", num_items);
-
-    hashtable_t *ht = ht_allocate(num_items);
-    if (ht == NULL)
-	EXIT_MSG("Could not allocate hash table of %d items.\n", num_items);
-
-    /* Put a bunch of items */
-    printf("Putting the following items:\n");
-    begin_time = nano_time();
-    for (i = 0; i < num_items; i++) {
-	key = random() % MAX_KEY;
-	size = random() % MAX_SIZE;
-
-	addr = ht_put(ht, key, size);
-	/* Duplicate key not allowed. Try again */
-	if (addr == NULL) {
-	    i--;
-	    continue;
-	}
+void ht_stats(hashtable_t *ht_ptr, ht_stats_t *stats) {
+
+    size_t i, idx, len;
+    ht_bucket_t *htb;
 
-	items_put[i].key = key;
-	items_put[i].size = size;
+    memset(stats, 0, sizeof(*stats));
+    stats->hts_items = ht_ptr->ht_items;
+    stats->hts_buckets = ht_ptr->ht_size;
+    stats->hts_sampled = ht_ptr->ht_size < HT_STATS_SAMPLE ?
+	ht_ptr->ht_size : HT_STATS_SAMPLE;
+    for (i = 0; i < stats->hts_sampled; i++) {
+	idx = (ht_ptr->ht_stats_hand + i) % ht_ptr->ht_size;
+	len = 0;
+	for (htb = &ht_ptr->ht_buckets[idx]; htb != NULL; htb = htb->htb_next)
+	    if (htb->htb_key != 0)
+		len++;
+	stats->hts_chains[len < HT_STATS_CHAINS ? len : HT_STATS_CHAINS - 1]++;
+	if (len > stats->hts_longest)
+	    stats->hts_longest = len;
     }
-    end_time = nano_time();
-    printf("Put time for %d items is %ld ns\n", num_items,
-	   (end_time - begin_time));
-
-    /* Check that they are there */
-    for (i = 0; i < num_items; i++) {
-	addr = ht_get(ht, items_put[i].key, &ret_size);
-	printf("\t [%d] key: %ld, size: %ld\n", i, items_put[i].key,
-	       items_put[i].size);
-	if (addr == NULL || (items_put[i].size != ret_size))
-	    EXIT_MSG("Expected item %ld of size %ld not found.\n",
-		     items_put[i].key, items_put[i].size);
+    ht_ptr->ht_stats_hand = (ht_ptr->ht_stats_hand + i) % ht_ptr->ht_size;
+    stats->hts_lookups = ht_ptr->ht_lookups;
+    stats->hts_probes = ht_ptr->ht_probes;
+    stats->hts_value_bytes = ht_ptr->ht_cache_bytes;
+    stats->hts_mem = mt_stats;
+}
+
+/*
+ * Chains are shown as the percentage of the sample of each length, and
+ * the values' bytes against what their tiers hold for them, slab and log
+ * slack included.
+ */
+void ht_print_stats(const ht_stats_t *stats, const ht_stats_t *prev) {
+
+    uint64_t lookups = stats->hts_lookups, probes = stats->hts_probes;
+    size_t held = stats->hts_mem.mts_dram_bytes[MT_DATA] +
+	stats->hts_mem.mts_pmem_bytes[MT_DATA];
+    int i;
+
+    if (prev != NULL) {
+	lookups -= prev->hts_lookups;
+	probes -= prev->hts_probes;
     }
+    printf("Table: %zu items in %zu buckets, load %.2f, %.2f probes per "
+	   "lookup, chains", stats->hts_items, stats->hts_buckets,
+	   (double)stats->hts_items / stats->hts_buckets,
+	   lookups ? (double)probes / lookups : 0.0);
+    for (i = 0; i < HT_STATS_CHAINS; i++)
+	printf(" %d%s:%.1f%%", i, i == HT_STATS_CHAINS - 1 ? "+" : "",
+	       100.0 * stats->hts_chains[i] / stats->hts_sampled);
+    printf(", longest %zu; values %.1f MB in %.1f MB\n", stats->hts_longest,
+	   (double)stats->hts_value_bytes / BYTES_IN_MB,
+	   (double)held / BYTES_IN_MB);
+}
 
-    printf("\n\nHASHTABLE:\n");
-    hashtable_print(ht);
+void ht_print_cache_stats(hashtable_t *ht_ptr) {
 
-    /* Remove all items */
-    for (i = 0; i < num_items; i++) {
-	ht_remove(ht, items_put[i].key, items_put[i].size);
+    uint64_t lookups = ht_ptr->ht_hits + ht_ptr->ht_misses;
 
-	if (ht_get(ht, items_put[i].key, &ret_size) != NULL)
-	    printf("Removed item (key: %ld, size: %ld) was found.\n",
-		   items_put[i].key, items_put[i].size);
+    if (ht_ptr->ht_cache_budget == 0)
+	return;
+    printf("Cache: %.1f MB of %.1f MB, %.2f%% hits, %" PRIu64 " evictions "
+	   "in %" PRIu64 " batches, %.0f ns per eviction\n",
+	   (double)ht_ptr->ht_cache_bytes / BYTES_IN_MB,
+	   (double)ht_ptr->ht_cache_budget / BYTES_IN_MB,
+	   lookups ? 100.0 * ht_ptr->ht_hits / lookups : 0.0,
+	   ht_ptr->ht_evictions, ht_ptr->ht_eviction_batches,
+	   ht_ptr->ht_evictions ?
+	   (double)ht_ptr->ht_eviction_ns / ht_ptr->ht_evictions : 0.0);
+}
+
+/*
+ * Only what isn't in a slab is freed one by one; the slabs go in one
+ * piece at the end.
+ */
+static void ht_destroy_buckets(hashtable_t *ht_ptr, ht_bucket_t *ht_buckets,
+			       size_t num_buckets) {
+
+    ht_bucket_t *htb, *next;
+    size_t i;
+
+    for (i = 0; i < num_buckets; i++) {
+	for (htb = &ht_buckets[i]; htb != NULL; htb = next) {
+	    next = htb->htb_next;
+	    if (htb->htb_key != 0 &&
+		!ht_value_in_slab(ht_ptr, HTB_SIZE(htb)) &&
+		!ht_value_in_vlog(ht_ptr, HTB_SIZE(htb)))
+		FREE_DATA(htb->htb_value_address);
+	    if (htb != &ht_buckets[i] && ht_ptr->ht_node_slab == NULL)
+		FREE_METADATA(htb);
+	}
     }
+    FREE_METADATA(ht_buckets);
+}
+
+void ht_destroy(hashtable_t *ht_ptr) {
+
+    ht_destroy_buckets(ht_ptr, ht_ptr->ht_buckets, ht_ptr->ht_size);
+    if (ht_ptr->ht_old_buckets != NULL)
+	ht_destroy_buckets(ht_ptr, ht_ptr->ht_old_buckets,
+			   ht_ptr->ht_old_size);
+    if (ht_ptr->ht_node_slab != NULL)
+	slab_destroy(ht_ptr->ht_node_slab);
+    if (ht_ptr->ht_value_slab != NULL)
+	slab_destroy(ht_ptr->ht_value_slab);
+    if (ht_ptr->ht_vlog != NULL)
+	vlog_destroy(ht_ptr->ht_vlog);
+    if (ht_ptr->ht_filter != NULL)
+	cfilter_destroy(ht_ptr->ht_filter);
+    if (ht_ptr->ht_old_filter != NULL)
+	cfilter_destroy(ht_ptr->ht_old_filter);
+    FREE_METADATA(ht_ptr);
+}
+
+static void *chained_allocate(size_t num_items) {
+
+    return ht_allocate(num_items);
+}
+
+static void *chained_get(void *ht, size_t key, size_t *size) {
+
+    return ht_get((hashtable_t *)ht, key, size);
+}
+
+static void *chained_put(void *ht, size_t key, size_t size) {
+
+    return ht_put((hashtable_t *)ht, key, size);
+}
+
+static void chained_remove(void *ht, size_t key, size_t size) {
 
-    printf("\n\nHASHTABLE:\n");
-    hashtable_print(ht);
+    ht_remove((hashtable_t *)ht, key, size);
 }
+
+static void chained_print(void *ht) {
+
+    hashtable_print((hashtable_t *)ht);
+}
+
+static void chained_destroy(void *ht) {
+
+    ht_destroy((hashtable_t *)ht);
+}
+
+static void chained_multi_get(void *ht, const size_t *keys, size_t n,
+			      void **values, size_t *sizes) {
+
+    ht_multi_get((hashtable_t *)ht, keys, n, values, sizes);
+}
+
+static void chained_multi_put(void *ht, const size_t *keys,
+			      const size_t *sizes, size_t n, void **values) {
+
+    ht_multi_put((hashtable_t *)ht, keys, sizes, n, values);
+}
+
+const ht_ops_t ht_chained_ops = {
+    "chained", 0, chained_allocate, chained_get, chained_put, chained_remove,
+    chained_print, chained_destroy, chained_multi_get, chained_multi_put
+};
@@ -0,0 +1,480 @@
+#ifndef _HASH_TABLE_H
+#define _HASH_TABLE_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cfilter.h"
+#include "slab.h"
+#include "vlog.h"
+
+#define EXIT_MSG(...)                          \
+    do {                                       \
+            printf(__VA_ARGS__);               \
+            _exit(-1);                         \
+    } while (0)
+
+/*
+ * Use macros, so we can easily replace allocators. The tiers decide
+ * where memory goes, and mt_dram_al which allocator DRAM comes from.
+ */
+#include "mem_tier.h"
+
+#define ALLOC_DATA(size) mt_alloc_data(size)
+#define ALLOC_METADATA(size) mt_alloc_metadata(size)
+#define CALLOC_METADATA(num, size) mt_calloc_metadata(num, size)
+#define FREE_DATA(ptr) mt_free_data(ptr)
+#define FREE_METADATA(ptr) mt_free_metadata(ptr)
+#define ALLOC_SLAB_DATA(object_size, size) \
+    mt_alloc_block(MT_DATA, object_size, size)
+#define ALLOC_SLAB_METADATA(size) mt_alloc_block(MT_METADATA, 0, size)
+
+/* The finalizer of MurmurHash3: keys that differ a little end up far apart */
+static inline uint64_t ht_hash(size_t key) {
+
+    uint64_t h = key;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * The chained table. Key 0 marks an empty bucket.
+ *
+ * With a byte budget, the table is a cache: a put that would take the
+ * values over the budget first evicts a batch of them, enough to get
+ * HT_CACHE_SLACK below it, so that most puts don't evict at all. The
+ * victims are picked by CLOCK: a get sets the entry's reference bit, the
+ * top bit of its value size, and the hand sweeping the buckets clears
+ * set bits and evicts the entries whose bits are clear.
+ *
+ * With ht_use_filter, a cuckoo filter in front of the chains answers
+ * most lookups of absent keys, gets and the duplicate check of puts
+ * alike, without touching the buckets. A resize fills a filter of the new
+ * size as it moves the entries, and asks the old one too until it's
+ * done. A table whose filter overflowed rehashes in place for a new one.
+ */
+#define HT_CACHE_SLACK 64	/* a batch frees a 64th of the budget */
+
+typedef struct ht_bucket {
+    size_t htb_key;
+    size_t htb_value_size;	/* and the reference bit */
+    void*  htb_value_address;
+    struct ht_bucket *htb_next;
+} ht_bucket_t;
+
+#define HTB_REFERENCED ((size_t)1 << 63)
+#define HTB_SIZE(htb) ((htb)->htb_value_size & ~HTB_REFERENCED)
+
+typedef struct {
+    size_t ht_size;
+    ht_bucket_t *ht_buckets;
+    size_t ht_items;
+    /* Incremental resize */
+    size_t ht_old_size;
+    ht_bucket_t *ht_old_buckets;	/* NULL unless a resize is going on */
+    size_t ht_rehash_idx;		/* next old bucket to move */
+    size_t ht_resizes;
+    /* Chain nodes and small values, unless ht_use_slabs is off */
+    slab_t *ht_node_slab;
+    slab_t *ht_value_slab;
+    /* Or the values go to a log, with ht_use_vlog */
+    vlog_t *ht_vlog;
+    /* Cache mode, if ht_cache_budget isn't 0 */
+    size_t ht_cache_budget;		/* bytes of values */
+    size_t ht_cache_bytes;		/* counted even with no budget */
+    size_t ht_clock_hand;
+    uint64_t ht_hits;
+    uint64_t ht_misses;
+    uint64_t ht_evictions;
+    uint64_t ht_eviction_batches;
+    uint64_t ht_eviction_ns;
+    /* The filter, and during a resize the old array's */
+    cfilter_t *ht_filter;
+    cfilter_t *ht_old_filter;
+    uint64_t ht_filter_lookups;
+    uint64_t ht_filter_negatives;	/* answered by the filter */
+    uint64_t ht_filter_false_positives;
+    uint64_t ht_filter_rebuilds;
+    /* Statistics, see ht_stats() */
+    uint64_t ht_lookups;		/* that got past the filter */
+    uint64_t ht_probes;			/* entries they compared */
+    size_t ht_stats_hand;		/* next bucket ht_stats() samples */
+} hashtable_t;
+
+/*
+ * Statistics of the chained table, cheap enough to take as it runs, from
+ * the thread that uses it: the counters are kept all along, and the
+ * chain lengths come from HT_STATS_SAMPLE buckets at most, from where
+ * the last sample stopped, so that successive samples go round the whole
+ * array. Lengths count entries, and a resize's old array isn't sampled.
+ * The memory is the tiers', for all the tables there are.
+ */
+#define HT_STATS_SAMPLE 4096
+#define HT_STATS_CHAINS 8		/* the last counts the longer ones too */
+
+typedef struct {
+    size_t     hts_items;
+    size_t     hts_buckets;
+    size_t     hts_sampled;
+    uint64_t   hts_chains[HT_STATS_CHAINS];	/* sampled, by length */
+    size_t     hts_longest;			/* of the sampled */
+    uint64_t   hts_lookups;
+    uint64_t   hts_probes;
+    size_t     hts_value_bytes;			/* the sizes put */
+    mt_stats_t hts_mem;
+} ht_stats_t;
+
+extern int ht_use_slabs;
+extern int ht_use_vlog;
+extern int ht_use_filter;
+/* The budget of the tables allocated from now on; 0 for no cache mode */
+extern size_t ht_cache_budget;
+
+hashtable_t *ht_allocate(size_t num_items);
+void        *ht_get(hashtable_t *ht_ptr, size_t key, size_t *size);
+void        *ht_put(hashtable_t *ht_ptr, size_t key, size_t size);
+void         ht_remove(hashtable_t *ht_ptr, size_t key, size_t size);
+void         hashtable_print(hashtable_t *ht_ptr);
+void         ht_print_slab_stats(hashtable_t *ht_ptr);
+void         ht_print_cache_stats(hashtable_t *ht_ptr);
+void         ht_print_vlog_stats(hashtable_t *ht_ptr);
+void         ht_print_filter_stats(hashtable_t *ht_ptr);
+void         ht_stats(hashtable_t *ht_ptr, ht_stats_t *stats);
+/* One line; the lookups since prev, if there's one */
+void         ht_print_stats(const ht_stats_t *stats, const ht_stats_t *prev);
+void         ht_destroy(hashtable_t *ht_ptr);
+/*
+ * The same as n gets or puts, one after the other, but the keys go
+ * through in groups of HT_MULTI_GROUP a stage at a time, so that the
+ * cache misses of a group overlap instead of following one another.
+ */
+#define HT_MULTI_GROUP 16
+void         ht_multi_get(hashtable_t *ht_ptr, const size_t *keys, size_t n,
+                          void **values, size_t *sizes);
+void         ht_multi_put(hashtable_t *ht_ptr, const size_t *keys,
+                          const size_t *sizes, size_t n, void **values);
+/* For bulk loads, see ht_put_in_bucket() */
+void        *ht_put_in_bucket(hashtable_t *ht_ptr, size_t key, size_t size);
+
+/*
+ * Snapshots of the chained table. The file is a header, an index with the
+ * offset of every bucket's entries, and the entries, sorted by the bucket
+ * they have in a table with one bucket per item, and cut into parts that
+ * are written and checksummed by one thread each. A snapshot is either
+ * loaded into a new table of that size, a part per thread, or mapped and
+ * read in place, by the mapped design.
+ */
+#define HT_SNAP_MAX_THREADS 64
+
+typedef struct ht_snap ht_snap_t;
+
+/* For the generic allocate of the mapped design */
+extern const char *ht_snap_path;
+
+/* Returns the bytes written; exits if it can't write them */
+ssize_t      ht_snapshot_write(hashtable_t *ht_ptr, const char *path,
+                               int threads);
+/* NULL if the file is damaged */
+hashtable_t *ht_snapshot_load(const char *path, int threads);
+ht_snap_t   *ht_snap_open(const char *path, int verify);
+void         ht_snap_close(ht_snap_t *snap);
+size_t       ht_snap_items(ht_snap_t *snap);
+void        *ht_snap_get(ht_snap_t *snap, size_t key, size_t *size);
+void         ht_snap_print(ht_snap_t *snap);
+
+/*
+ * The open-addressing table. Slots are kept in groups that start with one
+ * tag byte per slot, so a probe compares all tags of a group with one SIMD
+ * instruction and only looks at the keys whose tags match. Any key,
+ * including 0, can be stored.
+ */
+#if defined(__AVX2__)
+#define HT_OPEN_GROUP_SLOTS 32
+#else
+#define HT_OPEN_GROUP_SLOTS 16
+#endif
+
+typedef struct {
+    size_t   hos_key;
+    size_t   hos_value_size;
+    void    *hos_value_address;
+    uint32_t hos_hits;          /* gets, halved on every tier sweep */
+} ht_open_slot_t;
+
+typedef struct {
+    uint8_t        hog_tags[HT_OPEN_GROUP_SLOTS];
+    ht_open_slot_t hog_slots[HT_OPEN_GROUP_SLOTS];
+} __attribute__((aligned(64))) ht_open_group_t;
+
+typedef struct {
+    size_t           hto_num_groups;    /* a power of two */
+    ht_open_group_t *hto_groups;        /* cache line aligned... */
+    void            *hto_groups_mem;    /* ...inside this allocation */
+    size_t           hto_items;
+    size_t           hto_tombstones;
+    /* Incremental resize, as in the chained table */
+    size_t           hto_old_num_groups;
+    ht_open_group_t *hto_old_groups;
+    void            *hto_old_groups_mem;
+    size_t           hto_rehash_idx;
+    size_t           hto_resizes;
+    size_t           hto_tier_hand;     /* next slot the tier sweep visits */
+} ht_open_t;
+
+ht_open_t *ht_open_allocate(size_t num_items);
+void      *ht_open_get(ht_open_t *ht_ptr, size_t key, size_t *size);
+void      *ht_open_put(ht_open_t *ht_ptr, size_t key, size_t size);
+/* Put the value at addr in place of the key's, or in a new slot */
+void       ht_open_replace(ht_open_t *ht_ptr, size_t key, size_t size,
+                           void *addr);
+void       ht_open_remove(ht_open_t *ht_ptr, size_t key, size_t size);
+void       ht_open_print(ht_open_t *ht_ptr);
+void       ht_open_destroy(ht_open_t *ht_ptr);
+
+/*
+ * Zero-copy access to values, for any design: see ht_view_get() and
+ * ht_view_reserve() below. A view is the value's address and size, for
+ * as long as the view is held, and whatever the design keeps to commit
+ * or abort a reservation.
+ */
+typedef struct {
+    size_t  hv_key;
+    void   *hv_addr;
+    size_t  hv_size;
+    void   *hv_priv;		/* the design's */
+} ht_view_t;
+
+/*
+ * The concurrent table: a fixed array of chains, sized when the table is
+ * allocated. Readers walk the chains without locks, inside an epoch;
+ * writers lock one of HT_CONC_LOCKS stripes and retire what they unlink
+ * to the epoch reclaimer, so a reader never sees freed memory. A caller
+ * that uses the value a get returns while other threads may remove it
+ * does so between epoch_enter() and epoch_exit().
+ */
+#define HT_CONC_LOCKS 1024
+
+typedef struct ht_conc_node {
+    size_t htn_key;
+    size_t htn_value_size;
+    void  *htn_value_address;
+    struct ht_conc_node *htn_next;
+} ht_conc_node_t;
+
+typedef struct {
+    pthread_mutex_t htl_lock;
+} __attribute__((aligned(64))) ht_conc_lock_t;
+
+typedef struct {
+    size_t           htc_size;          /* a power of two */
+    ht_conc_node_t **htc_buckets;
+    ht_conc_lock_t  *htc_locks;
+    size_t           htc_items;
+} ht_conc_t;
+
+ht_conc_t *ht_conc_allocate(size_t num_items);
+void      *ht_conc_get(ht_conc_t *ht_ptr, size_t key, size_t *size);
+void      *ht_conc_put(ht_conc_t *ht_ptr, size_t key, size_t size);
+void       ht_conc_remove(ht_conc_t *ht_ptr, size_t key, size_t size);
+/*
+ * A reservation is a node and value of its own, which no reader can
+ * reach until the commit swaps it for the key's node, if there is one,
+ * in one store.
+ */
+void      *ht_conc_reserve(ht_conc_t *ht_ptr, size_t key, size_t size,
+                           ht_view_t *view);
+void       ht_conc_commit(ht_conc_t *ht_ptr, ht_view_t *view);
+void       ht_conc_abort(ht_conc_t *ht_ptr, ht_view_t *view);
+void       ht_conc_print(ht_conc_t *ht_ptr);
+/* Only once no other thread uses the table */
+void       ht_conc_destroy(ht_conc_t *ht_ptr);
+
+/*
+ * The sharded table. Every shard is an open-addressing table owned by
+ * one thread, pinned to its own CPU, whose memory comes from the kind of
+ * that CPU's NUMA node. Nobody else touches a shard: client threads send
+ * requests to the owner of a key through single-producer single-consumer
+ * rings and collect the completions from rings going the other way, so
+ * they can keep many requests in flight. A reservation is a value the
+ * owner allocates and the client fills; its commit has the owner put it
+ * in place of the key's old one in one step.
+ */
+#define HT_SHARD_MAX_CLIENTS 64
+#define HT_SHARD_MAX_NODES 64
+
+enum {HT_SHARD_GET, HT_SHARD_PUT, HT_SHARD_REMOVE, HT_SHARD_RESERVE,
+      HT_SHARD_COMMIT, HT_SHARD_ABORT};
+
+typedef struct {
+    int      hsr_op;
+    size_t   hsr_key;
+    size_t   hsr_size;          /* in: put/remove size; out: value size */
+    void    *hsr_addr;          /* out: value address, NULL if none; in:
+                                   the reservation, to commit or abort */
+    uint64_t hsr_cookie;        /* the client's, returned untouched */
+} ht_shard_req_t;
+
+typedef struct ht_sharded ht_sharded_t;
+
+/* Memory kinds for the shards on each NUMA node, NULL for the default */
+extern struct memkind *ht_node_kinds[HT_SHARD_MAX_NODES];
+/* How many shards the generic allocate makes */
+extern int ht_sharded_num_shards;
+
+ht_sharded_t *ht_sharded_allocate(size_t num_items, int num_shards);
+int           ht_sharded_client(ht_sharded_t *hs);
+int           ht_sharded_submit(ht_sharded_t *hs, int client,
+                                const ht_shard_req_t *req);
+int           ht_sharded_poll(ht_sharded_t *hs, int client,
+                              ht_shard_req_t *done, int max);
+
+/*
+ * The persistent table lives in a file, mapped: a header, a fixed array
+ * of buckets and a heap of records, each a key, a size and the value
+ * right after them. Links are offsets into the file, so the file can be
+ * mapped anywhere. Every change is made visible with one 8-byte store
+ * that is flushed and fenced after what it publishes, so a crash at any
+ * point leaves a consistent table, at worst leaking the record being
+ * put or removed. Opening an existing file only checks its header.
+ * Values are copied in by ht_persist_put(), or zeroed without one; a
+ * caller that writes one later flushes it itself with ht_persist_flush().
+ * A write reservation instead links its record, in place of the key's
+ * old one, only once the value is durable.
+ */
+typedef struct ht_persist ht_persist_t;
+
+/* For the generic allocate */
+extern const char *ht_persist_path;
+extern size_t      ht_persist_file_size;
+/* Exit at this flush, to test recovery; 0 never does */
+extern uint64_t    ht_persist_crash_at;
+
+ht_persist_t *ht_persist_open(const char *path, size_t file_size,
+                              size_t num_items);
+void          ht_persist_close(ht_persist_t *hp);
+void         *ht_persist_get(ht_persist_t *hp, size_t key, size_t *size);
+void         *ht_persist_put(ht_persist_t *hp, size_t key, size_t size,
+                             const void *value);
+void          ht_persist_remove(ht_persist_t *hp, size_t key, size_t size);
+void          ht_persist_flush(const void *addr, size_t len);
+size_t        ht_persist_items(ht_persist_t *hp);
+/*
+ * Walk the whole table; returns the items, or -1 if it's inconsistent or
+ * check_value, if not NULL, doesn't return 0 for a value
+ */
+ssize_t       ht_persist_check(ht_persist_t *hp,
+                               int (*check_value)(size_t key,
+                                                  const void *value,
+                                                  size_t size));
+void          ht_persist_print(ht_persist_t *hp);
+
+/*
+ * The B+tree: an ordered index of the same items, for range scans. Nodes
+ * hold HT_BTREE_KEYS keys, four cache lines of them, which a search
+ * compares all at once, with AVX2 where there is. With OLC, optimistic
+ * lock coupling, any number of threads can use the tree; without, one.
+ * Nodes come from the metadata allocator and values from the data one,
+ * as in the tables.
+ */
+#define HT_BTREE_KEYS 32
+
+typedef struct ht_btree ht_btree_t;
+
+ht_btree_t *ht_btree_allocate(int olc);
+void       *ht_btree_get(ht_btree_t *bt, size_t key, size_t *size);
+void       *ht_btree_put(ht_btree_t *bt, size_t key, size_t size);
+void        ht_btree_remove(ht_btree_t *bt, size_t key, size_t size);
+void       *ht_btree_reserve(ht_btree_t *bt, size_t key, size_t size,
+                             ht_view_t *view);
+void        ht_btree_commit(ht_btree_t *bt, ht_view_t *view);
+void        ht_btree_abort(ht_btree_t *bt, ht_view_t *view);
+/* Up to n items from key start up; returns how many */
+size_t      ht_btree_scan(ht_btree_t *bt, size_t start, size_t n,
+                          size_t *keys, void **values, size_t *sizes);
+void        ht_btree_print(ht_btree_t *bt);
+void        ht_btree_print_stats(ht_btree_t *bt);
+void        ht_btree_destroy(ht_btree_t *bt);
+
+/*
+ * The same operations for every table design, so that the driver can
+ * pick one at run time.
+ */
+typedef struct {
+    const char *hop_name;
+    int hop_thread_safe;
+    void *(*hop_allocate)(size_t num_items);
+    void *(*hop_get)(void *ht, size_t key, size_t *size);
+    void *(*hop_put)(void *ht, size_t key, size_t size);
+    void  (*hop_remove)(void *ht, size_t key, size_t size);
+    void  (*hop_print)(void *ht);
+    /* Free the table and everything in it; NULL if a design can't */
+    void  (*hop_destroy)(void *ht);
+    /* Many gets or puts in one call; NULL where the caller should loop */
+    void  (*hop_multi_get)(void *ht, const size_t *keys, size_t n,
+                           void **values, size_t *sizes);
+    void  (*hop_multi_put)(void *ht, const size_t *keys, const size_t *sizes,
+                           size_t n, void **values);
+    /* Up to n items from key start up, in order; NULL if unordered */
+    size_t (*hop_scan)(void *ht, size_t start, size_t n, size_t *keys,
+                       void **values, size_t *sizes);
+    /* Write reservations of the design's own; NULL to put in place */
+    void *(*hop_reserve)(void *ht, size_t key, size_t size, ht_view_t *view);
+    /* Whatever publishing takes beyond the fence; NULL for nothing */
+    void  (*hop_commit)(void *ht, ht_view_t *view);
+    void  (*hop_abort)(void *ht, ht_view_t *view);
+} ht_ops_t;
+
+extern const ht_ops_t ht_chained_ops;
+extern const ht_ops_t ht_open_ops;
+extern const ht_ops_t ht_conc_ops;
+extern const ht_ops_t ht_sharded_ops;
+extern const ht_ops_t ht_persist_ops;
+extern const ht_ops_t ht_mapped_ops;
+extern const ht_ops_t ht_btree_ops;
+extern const ht_ops_t ht_btree_olc_ops;
+
+/*
+ * A read view pins the value it finds, which the caller can then read
+ * in place, however other threads remove or replace the key, until it
+ * releases the view: it holds an epoch, which keeps whatever the designs
+ * retire to the epoch reclaimer from being freed. The sharded design's
+ * owners move values between tiers under their clients; its views are
+ * no safer than its gets. A miss returns NULL and needs no release.
+ *
+ * A write reservation is a value of size bytes for key that no reader
+ * sees until it's committed. The writer fills it, with the stream
+ * functions if it won't read it back soon, and the commit fences those
+ * stores and publishes the value, replacing the key's old one, if any.
+ * Designs without hop_reserve remove the key's old value and put the
+ * new one at once, for the writer to fill in place, which is only unseen
+ * where one thread has the table and no crash matters; their abort
+ * leaves the key with none. Thread-safe designs must have their own.
+ */
+void        *ht_view_get(const ht_ops_t *ops, void *ht, size_t key,
+                         ht_view_t *view);
+void         ht_view_release(const ht_ops_t *ops, void *ht, ht_view_t *view);
+void        *ht_view_reserve(const ht_ops_t *ops, void *ht, size_t key,
+                             size_t size, ht_view_t *view);
+void         ht_view_commit(const ht_ops_t *ops, void *ht, ht_view_t *view);
+void         ht_view_abort(const ht_ops_t *ops, void *ht, ht_view_t *view);
+
+/*
+ * Copy or fill with non-temporal stores, which skip the caches on the way
+ * to memory, where there's SSE2; short lengths aren't worth it and get
+ * plain stores. The stores must be fenced before whatever publishes
+ * them, which ht_view_commit() does.
+ */
+#define HT_STREAM_MIN 256
+void         ht_stream_copy(void *dst, const void *src, size_t len);
+void         ht_stream_set(void *dst, int c, size_t len);
+
+#endif
@@ -0,0 +1,1257 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "epoch.h"
+#include "hash_table.h"
+#include "latency_hist.h"
+#include "nano_time.h"
+#include "size_dist.h"
+#include "ycsb.h"
+
+#define BYTES_IN_GB (1024 * 1024 * 1024)
+#define DEFAULT_BLOCK_SIZE 4096
+#define DEFAULT_CACHE_SIZE_GB 32
+#define DEFAULT_NUM_ITEMS 1024
+#define DEFAULT_NUM_OPS 1000000
+#define DEFAULT_VALUE_SIZE 64
+#define HASHTABLE_NUM_BUCKETS 4*1024*1024
+#define NANOSECONDS_IN_SECOND 1000000000
+#define BYTES_IN_MB (1024 * 1024)
+#define POLL_BATCH 64
+#define POLL_IDLE_SPINS 1000
+#define MULTI_MAX 256
+#define YCSB_SIZES 4096
+#define DEFAULT_WARMUP_OPS 100000
+#define DEFAULT_SNAP_THREADS 4
+
+const char DEFAULT_MEMKIND_PATH[] = "/mnt/pmem/sasha";
+const char DEFAULT_ALLOCATOR[] = "memkind";
+#define DEFAULT_SIZE_GB 32
+
+static const ht_ops_t *designs[] = {&ht_chained_ops, &ht_open_ops,
+				    &ht_conc_ops, &ht_sharded_ops,
+				    &ht_persist_ops, &ht_mapped_ops,
+				    &ht_btree_ops, &ht_btree_olc_ops, NULL};
+
+void
+print_help_message(const char *progname) {
+
+    /* take only the last portion of the path */
+    const char *basename = strrchr(progname, '/');
+    basename = basename ? basename + 1 : progname;
+
+    printf("usage: %s [OPTION]\n", basename);
+    printf("  -d, --design=DESIGN\n"
+	   "     The hash table to use: chained (default), open, an\n"
+	   "     open-addressing table probed with SIMD tag compares, or\n"
+	   "     concurrent, with lock-free reads and striped write locks, or\n"
+	   "     sharded, with a pinned owner thread per shard that serves\n"
+	   "     requests sent to it over rings, or persistent, kept in a\n"
+	   "     mapped file that it reopens on the next run, or mapped,\n"
+	   "     which reads the snapshot from --load in place, or btree,\n"
+	   "     an ordered B+tree whose scans are range scans, or btree-olc,\n"
+	   "     the same with optimistic lock coupling for many threads.\n");
+    printf("  --allocator=SPEC\n"
+	   "     The allocator of the DRAM tier, one of\n"
+	   "     %s.\n"
+	   "     Defaults to %s. PMEM always comes from --pmemdir; with\n"
+	   "     --placement=dram and no --dram-budget, everything comes from\n"
+	   "     the allocator.\n",
+	   al_names(), DEFAULT_ALLOCATOR);
+    printf("  --batch=N\n"
+	   "     With --threads and the sharded design, keep N requests in\n"
+	   "     flight per thread instead of waiting for each one. The\n"
+	   "     latency is from submit to completion.\n");
+    printf("  --cache[=MB]\n"
+	   "     Make the chained table a cache of MB of values, %d GB if\n"
+	   "     not given, that evicts what hasn't been read lately.\n"
+	   "     With --workload, a read that misses puts the record back.\n",
+	   DEFAULT_CACHE_SIZE_GB);
+    printf("  --crash-at=N\n"
+	   "     With the persistent design, exit at the Nth flush, so that\n"
+	   "     the next run can check the table survived.\n");
+    printf("  --dram-budget=MB\n"
+	   "     Keep no more than MB of values in DRAM; the rest go to PMEM.\n");
+    printf("  --filter\n"
+	   "     Put a cuckoo filter in DRAM in front of the chained table's\n"
+	   "     chains, so that most lookups of absent keys touch only the\n"
+	   "     filter, and report how often it answered.\n");
+    printf("  -h, --help\n"
+	   "     Print this help and exit.\n");
+    printf("  --keydist=DIST\n"
+	   "     With --workload, how records are picked: uniform, zipfian\n"
+	   "     or latest. Defaults to the workload's.\n");
+    printf("  --load=PATH\n"
+	   "     With --workload, load the records from the snapshot in PATH\n"
+	   "     instead of putting them, with --snap-threads threads, or\n"
+	   "     one with --vlog or --filter. The mapped design takes only\n"
+	   "     reads and scans.\n");
+    printf("  --mix=GET:PUT:REMOVE\n"
+	   "     With --threads, the percentages of each operation.\n"
+	   "     Defaults to 90:5:5.\n");
+    printf("  --multi=N\n"
+	   "     With --threads, draw N operations at a time and make their\n"
+	   "     gets and their puts in one call each, which the chained\n"
+	   "     design batches with prefetching; the others loop. Every\n"
+	   "     operation's latency is that of its call. At most %d.\n",
+	   MULTI_MAX);
+    printf("  --no-slabs\n"
+	   "     Allocate the chained table's nodes and small values one by one\n"
+	   "     rather than from slabs.\n");
+    printf("  -n, --items=N\n"
+	   "     Put, get and remove N items. Defaults to %d.\n"
+	   "     With --threads, the table starts with N items out of 2N\n"
+	   "     possible keys.\n",
+	   DEFAULT_NUM_ITEMS);
+    printf("  -o, --ops=N\n"
+	   "     With --threads, the operations per thread. Defaults to %d.\n",
+	   DEFAULT_NUM_OPS);
+    printf("  --placement=POLICY\n"
+	   "     Where memory comes from: dram, pmem (default), split, with\n"
+	   "     metadata in DRAM and values in PMEM, or size:BYTES, like split\n"
+	   "     but with values smaller than BYTES in DRAM.\n");
+    printf("  --pmem=PATH[,PATH...]\n"
+	   "     With the sharded design, the pmem directory for the shards\n"
+	   "     on each NUMA node, in node order. Shards on other nodes use\n"
+	   "     --pmemdir.\n");
+    printf("  --pmemdir=DIR\n"
+	   "     The directory PMEM comes from. Defaults to %s; a\n"
+	   "     directory on any filesystem emulates PMEM.\n",
+	   DEFAULT_MEMKIND_PATH);
+    printf("  --promote=HITS\n"
+	   "     With the open and sharded designs, move a value to DRAM once\n"
+	   "     it's been read HITS times recently, and move cold values\n"
+	   "     back when the DRAM budget runs short.\n");
+    printf("  --pfile=PATH\n"
+	   "     The file of the persistent design. Defaults to %s.\n",
+	   ht_persist_path);
+    printf("  --psize=MB\n"
+	   "     The size of a new file for the persistent design. Defaults\n"
+	   "     to %zu.\n", ht_persist_file_size / BYTES_IN_MB);
+    printf("  --shards=N\n"
+	   "     The number of shards of the sharded design. Defaults to %d.\n",
+	   ht_sharded_num_shards);
+    printf("  --silent\n"
+	   "     Don't print the items and the table.\n");
+    printf("  --sizes=SPEC\n"
+	   "     With --workload, the value sizes: fixed:SIZE, uniform:MIN:MAX,\n"
+	   "     bimodal:SMALL:LARGE:P_SMALL or hist:FILE. Defaults to\n"
+	   "     fixed:VALUESIZE.\n");
+    printf("  --skew=HOT_OPS:HOT_KEYS\n"
+	   "     With --threads, send HOT_OPS percent of the operations to\n"
+	   "     HOT_KEYS percent of the keys. Uniform by default.\n");
+    printf("  --snapshot=PATH\n"
+	   "     With --workload and the chained design, write the loaded\n"
+	   "     records to a snapshot in PATH before the run.\n");
+    printf("  --snap-threads=N\n"
+	   "     The threads that write or load a snapshot. Defaults to %d,\n"
+	   "     at most %d.\n", DEFAULT_SNAP_THREADS, HT_SNAP_MAX_THREADS);
+    printf("  --stats=N\n"
+	   "     With the chained design and --threads or --workload, print\n"
+	   "     the load, the chain lengths of a sample of buckets, the\n"
+	   "     probes per lookup and the memory held every N operations.\n");
+    printf("  -t, --threads=N\n"
+	   "     Instead of putting, getting and removing every item in\n"
+	   "     turn, run N threads of randomly mixed operations and report\n"
+	   "     throughput and latency. More than one thread needs the\n"
+	   "     concurrent or the sharded design.\n");
+    printf("  --valuesize=SIZE\n"
+	   "     With --threads, the size of every value. Defaults to %d.\n",
+	   DEFAULT_VALUE_SIZE);
+    printf("  --vlog\n"
+	   "     Append the chained table's values to a log of large\n"
+	   "     segments, which a background thread compacts.\n");
+    printf("  --warmup=N\n"
+	   "     With --workload, the untimed operations every thread runs\n"
+	   "     first. Defaults to %d.\n", DEFAULT_WARMUP_OPS);
+    printf("  --workload=A|B|C|D|E|F|READ:UPDATE:INSERT:DELETE:SCAN:RMW\n"
+	   "     Load N records and run a YCSB core workload, or the given\n"
+	   "     percentages of each operation, on --threads threads, one by\n"
+	   "     default, for --ops timed operations each.\n");
+}
+
+#define EXIT_HELP_MSG(...)		       \
+    do {                                       \
+	    printf(__VA_ARGS__);	       \
+	    print_help_message(argv[0]);       \
+	    _exit(-1);			       \
+    } while (0)
+
+#define MAX_KEY 1000000
+#define MAX_SIZE 32768
+
+typedef struct {
+    size_t key;
+    size_t size;
+} ht_item_t;
+
+static int silent = 0;
+static const char *snapshot_path = NULL, *load_path = NULL;
+static int snap_threads = DEFAULT_SNAP_THREADS;
+
+/*
+ * The chained table's statistics every --stats operations of a run, with
+ * the lookups since the last ones, and at its end with all of them
+ */
+static size_t stats_every = 0;
+static ht_stats_t last_stats;
+
+static void sample_stats(hashtable_t *ht, int since_last) {
+
+    ht_stats_t stats;
+
+    ht_stats(ht, &stats);
+    ht_print_stats(&stats, since_last && last_stats.hts_buckets != 0 ?
+		   &last_stats : NULL);
+    last_stats = stats;
+}
+
+/*
+ * MIXED WORKLOAD
+ *
+ * Every thread draws keys from a key space twice the size of the initial
+ * table, so about half the gets hit and puts and removes keep the table
+ * at about the same size. Keys are uniform, unless --skew sends most
+ * operations to a few hot keys. A get reads the value it finds.
+ */
+/* In the same order as the sharded table's requests */
+enum {OP_GET, OP_PUT, OP_REMOVE, OP_TYPES};
+static const char *op_names[OP_TYPES] = {"get", "put", "remove"};
+static int hot_ops_pct = 0, hot_keys_pct = 100;
+
+typedef struct {
+    int tid;
+    const ht_ops_t *ops;
+    void *ht;
+    size_t num_keys;
+    size_t num_ops;
+    size_t value_size;
+    int batch;			/* requests in flight, sharded only */
+    int multi;			/* operations drawn at a time */
+    int read_values;
+    uint64_t checksum;		/* of the values read, so that we read them */
+    int mix[OP_TYPES];		/* cumulative percentages */
+    latency_hist_t lat_hist[OP_TYPES];
+    uint64_t start_time;
+    uint64_t end_time;
+} mixed_args_t;
+
+/* Per-thread xorshift, since random() takes a lock */
+static inline uint64_t xorshift64(uint64_t *state) {
+
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static inline int draw_op(mixed_args_t *m, uint64_t *rnd) {
+
+    int op, pct = xorshift64(rnd) % 100;
+
+    for (op = 0; op < OP_TYPES - 1 && pct >= m->mix[op]; op++)
+	;
+    return op;
+}
+
+static inline size_t draw_key(mixed_args_t *m, uint64_t *rnd) {
+
+    size_t hot_keys = m->num_keys * hot_keys_pct / 100;
+
+    if (hot_keys > 0 && (int)(xorshift64(rnd) % 100) < hot_ops_pct)
+	return xorshift64(rnd) % hot_keys;
+    return xorshift64(rnd) % m->num_keys;
+}
+
+static inline uint64_t read_value(const void *addr, size_t size) {
+
+    const uint64_t *word = (const uint64_t *)addr;
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < size / sizeof(uint64_t); i++)
+	sum += word[i];
+    return sum;
+}
+
+/*
+ * The values of the persistent table are the low byte of their key all
+ * through, which the check on open looks for.
+ */
+#define VALUE_BYTE(key) ((int)((key) & 0xff))
+
+static int check_value(size_t key, const void *value, size_t size) {
+
+    const unsigned char *byte = (const unsigned char *)value;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+	if (byte[i] != VALUE_BYTE(key))
+	    return -1;
+    return 0;
+}
+
+/*
+ * The persistent table's puts go through a reservation, so that a crash
+ * never leaves a key linked without its value; the other designs' values
+ * are left as they come.
+ */
+static void *put_value(const ht_ops_t *ops, void *ht, size_t key,
+		       size_t size) {
+
+    ht_view_t view;
+    size_t old_size;
+    void *addr;
+
+    if (ops != &ht_persist_ops)
+	return ops->hop_put(ht, key, size);
+    /* Like the other puts, not over a key that's there */
+    if (ops->hop_get(ht, key, &old_size) != NULL)
+	return NULL;
+    if ((addr = ht_view_reserve(ops, ht, key, size, &view)) == NULL)
+	return NULL;
+    ht_stream_set(addr, VALUE_BYTE(key), size);
+    ht_view_commit(ops, ht, &view);
+    return addr;
+}
+
+/*
+ * Keep m->batch requests in flight, topping up as completions come in.
+ * The sharded table checks removes itself, and the time a request spends
+ * queued counts towards its latency.
+ */
+static void run_mixed_async(mixed_args_t *m, uint64_t *rnd) {
+
+    ht_sharded_t *hs = (ht_sharded_t *)m->ht;
+    ht_shard_req_t req, done[POLL_BATCH];
+    size_t issued = 0, completed = 0;
+    uint64_t end;
+    int client = ht_sharded_client(hs), in_flight = 0, drawn = 0, idle = 0,
+	n, j;
+
+    while (completed < m->num_ops) {
+	while (in_flight < m->batch && issued < m->num_ops) {
+	    /* A request the ring had no room for is sent next time */
+	    if (!drawn) {
+		req.hsr_key = draw_key(m, rnd);
+		req.hsr_op = draw_op(m, rnd);
+		req.hsr_size = m->value_size;
+		req.hsr_addr = NULL;
+		drawn = 1;
+	    }
+	    req.hsr_cookie = nano_time();
+	    if (ht_sharded_submit(hs, client, &req) != 0)
+		break;
+	    drawn = 0;
+	    issued++;
+	    in_flight++;
+	}
+	/* Let the owners run if they share our CPU */
+	if ((n = ht_sharded_poll(hs, client, done, POLL_BATCH)) == 0 &&
+	    ++idle > POLL_IDLE_SPINS) {
+	    sched_yield();
+	    idle = 0;
+	}
+	end = nano_time();
+	for (j = 0; j < n; j++)
+	    lat_hist_record(&m->lat_hist[done[j].hsr_op],
+			    end - done[j].hsr_cookie);
+	in_flight -= n;
+	completed += n;
+    }
+}
+
+static void multi_get(mixed_args_t *m, const size_t *keys, size_t n,
+		      void **values, size_t *sizes) {
+
+    size_t i;
+
+    if (m->ops->hop_multi_get != NULL) {
+	m->ops->hop_multi_get(m->ht, keys, n, values, sizes);
+	return;
+    }
+    for (i = 0; i < n; i++)
+	values[i] = m->ops->hop_get(m->ht, keys[i], &sizes[i]);
+}
+
+static void multi_put(mixed_args_t *m, const size_t *keys,
+		      const size_t *sizes, size_t n, void **values) {
+
+    size_t i;
+
+    if (m->ops->hop_multi_put != NULL) {
+	m->ops->hop_multi_put(m->ht, keys, sizes, n, values);
+	return;
+    }
+    for (i = 0; i < n; i++)
+	values[i] = put_value(m->ops, m->ht, keys[i], sizes[i]);
+}
+
+/*
+ * Draw m->multi operations, then make all their gets, then all their
+ * puts, each in one call, then the removes one by one.
+ */
+static void run_mixed_multi(mixed_args_t *m, uint64_t *rnd) {
+
+    size_t keys[OP_TYPES][MULTI_MAX], sizes[MULTI_MAX], count[OP_TYPES];
+    size_t i, j, n, key, size;
+    void *values[MULTI_MAX];
+    uint64_t begin, end;
+    int op;
+
+    for (j = 0; j < MULTI_MAX; j++)
+	sizes[j] = m->value_size;
+    for (i = 0; i < m->num_ops; i += n) {
+	n = m->num_ops - i < (size_t)m->multi ? m->num_ops - i :
+	    (size_t)m->multi;
+	memset(count, 0, sizeof(count));
+	for (j = 0; j < n; j++) {
+	    key = draw_key(m, rnd);
+	    op = draw_op(m, rnd);
+	    keys[op][count[op]++] = key;
+	}
+
+	if (count[OP_GET] > 0) {
+	    begin = nano_time();
+	    epoch_enter();
+	    multi_get(m, keys[OP_GET], count[OP_GET], values, sizes);
+	    for (j = 0; j < count[OP_GET] && m->read_values; j++)
+		if (values[j] != NULL)
+		    m->checksum += read_value(values[j], sizes[j]);
+	    epoch_exit();
+	    end = nano_time();
+	    for (j = 0; j < count[OP_GET]; j++) {
+		lat_hist_record(&m->lat_hist[OP_GET], end - begin);
+		sizes[j] = m->value_size;
+	    }
+	}
+	if (count[OP_PUT] > 0) {
+	    begin = nano_time();
+	    multi_put(m, keys[OP_PUT], sizes, count[OP_PUT], values);
+	    end = nano_time();
+	    for (j = 0; j < count[OP_PUT]; j++)
+		lat_hist_record(&m->lat_hist[OP_PUT], end - begin);
+	}
+	for (j = 0; j < count[OP_REMOVE]; j++) {
+	    begin = nano_time();
+	    if (m->ops->hop_get(m->ht, keys[OP_REMOVE][j], &size) != NULL)
+		m->ops->hop_remove(m->ht, keys[OP_REMOVE][j], m->value_size);
+	    end = nano_time();
+	    lat_hist_record(&m->lat_hist[OP_REMOVE], end - begin);
+	}
+    }
+}
+
+void *run_mixed(void *args) {
+
+    mixed_args_t *m = (mixed_args_t *)args;
+    uint64_t rnd = 0x9E3779B97F4A7C15ULL * (m->tid + 1), begin, end;
+    size_t i, key, size;
+    ht_view_t view;
+    int op;
+
+    m->start_time = nano_time();
+    if (m->batch > 0 || m->multi > 0) {
+	if (m->batch > 0)
+	    run_mixed_async(m, &rnd);
+	else
+	    run_mixed_multi(m, &rnd);
+	m->end_time = nano_time();
+	return (void *)0;
+    }
+    for (i = 0; i < m->num_ops; i++) {
+	key = draw_key(m, &rnd);
+	op = draw_op(m, &rnd);
+
+	begin = nano_time();
+	if (op == OP_GET) {
+	    /* Nobody can free the value while we read it */
+	    if (ht_view_get(m->ops, m->ht, key, &view) != NULL) {
+		if (m->read_values)
+		    m->checksum += read_value(view.hv_addr, view.hv_size);
+		ht_view_release(m->ops, m->ht, &view);
+	    }
+	} else if (op == OP_PUT)
+	    put_value(m->ops, m->ht, key, m->value_size);
+	/* Some designs complain about removing what's not there */
+	else if (m->ops->hop_get(m->ht, key, &size) != NULL)
+	    m->ops->hop_remove(m->ht, key, m->value_size);
+	end = nano_time();
+	lat_hist_record(&m->lat_hist[op], end - begin);
+	if (stats_every != 0 && (i + 1) % stats_every == 0)
+	    sample_stats((hashtable_t *)m->ht, 1);
+    }
+    m->end_time = nano_time();
+    return (void *)0;
+}
+
+static void parse_mix(const char *spec, int *mix) {
+
+    int get, put, remove;
+
+    if (sscanf(spec, "%d:%d:%d", &get, &put, &remove) != 3 ||
+	get < 0 || put < 0 || remove < 0 || get + put + remove != 100)
+	EXIT_MSG("The mix must be three percentages adding up to 100\n");
+    mix[OP_GET] = get;
+    mix[OP_PUT] = get + put;
+    mix[OP_REMOVE] = 100;
+}
+
+/*
+ * A persistent table may come with the items of an earlier run, or of
+ * one that crashed: say how long it took to open, and check it.
+ */
+static void *allocate_table(const ht_ops_t *ops, size_t num_items) {
+
+    uint64_t begin_time = nano_time(), open_time;
+    size_t counted;
+    ssize_t items;
+    void *ht;
+
+    if ((ht = ops->hop_allocate(num_items)) == NULL)
+	EXIT_MSG("Could not allocate hash table of %zu items.\n", num_items);
+    if (ops != &ht_persist_ops)
+	return ht;
+
+    open_time = nano_time() - begin_time;
+    counted = ht_persist_items((ht_persist_t *)ht);
+    begin_time = nano_time();
+    if ((items = ht_persist_check((ht_persist_t *)ht, check_value)) < 0)
+	EXIT_MSG("The table in %s is inconsistent\n", ht_persist_path);
+    printf("Opened %s with %zu items in %" PRIu64 " ns, checked %zd items "
+	   "in %" PRIu64 " ns\n", ht_persist_path, counted, open_time, items,
+	   nano_time() - begin_time);
+    return ht;
+}
+
+void run_mixed_threads(const ht_ops_t *ops, int num_threads,
+		       size_t num_items, size_t num_ops, size_t value_size,
+		       int batch, int multi, const int *mix) {
+
+    pthread_t *threads;
+    mixed_args_t *margs;
+    latency_hist_t total;
+    uint64_t min_start_time, max_end_time = 0, ops_done = 0;
+    size_t i, num_keys = num_items * 2;
+    void *ht;
+    int t, op, ret;
+
+    if (num_threads > 1 && !ops->hop_thread_safe)
+	EXIT_MSG("The %s hash table is not thread-safe; use one thread or "
+		 "the concurrent or sharded design.\n", ops->hop_name);
+
+    ht = allocate_table(ops, num_items);
+    /* Every other key is in the table to begin with */
+    for (i = 0; i < num_keys; i += 2)
+	put_value(ops, ht, i, value_size);
+
+    threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    margs = (mixed_args_t *)calloc(num_threads, sizeof(mixed_args_t));
+    if (threads == NULL || margs == NULL)
+	EXIT_MSG("Could not allocate thread array for %d threads.\n",
+		 num_threads);
+
+    for (t = 0; t < num_threads; t++) {
+	margs[t].tid = t;
+	margs[t].ops = ops;
+	margs[t].ht = ht;
+	margs[t].num_keys = num_keys;
+	margs[t].num_ops = num_ops;
+	margs[t].value_size = value_size;
+	margs[t].batch = batch;
+	margs[t].multi = multi;
+	/* An owner may move a value to another tier while a client reads it */
+	margs[t].read_values = ops != &ht_sharded_ops;
+	memcpy(margs[t].mix, mix, sizeof(margs[t].mix));
+	ret = pthread_create(&threads[t], NULL, run_mixed, &margs[t]);
+	if (ret != 0)
+	    EXIT_MSG("pthread_create for %dth thread failed: %s\n",
+		     t, strerror(ret));
+    }
+    for (t = 0; t < num_threads; t++) {
+	ret = pthread_join(threads[t], NULL);
+	if (ret != 0)
+	    EXIT_MSG("Thread %d failed: %s\n", t, strerror(ret));
+    }
+
+    min_start_time = margs[0].start_time;
+    for (t = 0; t < num_threads; t++) {
+	if (margs[t].start_time < min_start_time)
+	    min_start_time = margs[t].start_time;
+	if (margs[t].end_time > max_end_time)
+	    max_end_time = margs[t].end_time;
+	ops_done += margs[t].num_ops;
+    }
+    printf("%d: \t %.2f Mops/s\n", num_threads,
+	   (double)ops_done / (double)(max_end_time - min_start_time)
+	   * NANOSECONDS_IN_SECOND / 1000000);
+    for (op = 0; op < OP_TYPES; op++) {
+	char prefix[32];
+
+	memset(&total, 0, sizeof(total));
+	for (t = 0; t < num_threads; t++)
+	    lat_hist_merge(&total, &margs[t].lat_hist[op]);
+	snprintf(prefix, sizeof(prefix), "\t%s ", op_names[op]);
+	lat_hist_print(&total, prefix);
+    }
+    mt_print_stats();
+    if (ops == &ht_chained_ops) {
+	ht_print_slab_stats((hashtable_t *)ht);
+	ht_print_vlog_stats((hashtable_t *)ht);
+	ht_print_cache_stats((hashtable_t *)ht);
+	ht_print_filter_stats((hashtable_t *)ht);
+	sample_stats((hashtable_t *)ht, 0);
+    }
+    if (ops == &ht_btree_ops || ops == &ht_btree_olc_ops)
+	ht_btree_print_stats((ht_btree_t *)ht);
+    epoch_reclaim_all();
+    if (ops->hop_destroy != NULL) {
+	uint64_t begin_time = nano_time();
+
+	ops->hop_destroy(ht);
+	printf("Destroy time %" PRIu64 " ns\n", nano_time() - begin_time);
+    }
+    free(threads);
+    free(margs);
+}
+
+/*
+ * YCSB WORKLOADS
+ *
+ * The table is loaded with records 0 to N-1, under keys 1 to N, since
+ * the chained table can't hold key 0, with sizes from --sizes. Every
+ * thread then runs its warmup operations, waits for the others, and runs
+ * the timed ones. An update writes over the value in place, or puts it
+ * anew where values can't be touched or may be moved behind our back; a
+ * scan is a range scan where the design keeps keys in order, and gets
+ * consecutive keys one by one where it doesn't.
+ */
+typedef struct {
+    int tid;
+    const ht_ops_t *ops;
+    void *ht;
+    const ycsb_workload_t *yw;
+    size_t num_ops;
+    size_t warmup;
+    const size_t *sizes;	/* YCSB_SIZES drawn from --sizes */
+    pthread_barrier_t *barrier;
+    int touch_values;		/* read and write values in place */
+    int update_in_place;	/* or write a new one and commit it */
+    uint64_t checksum;
+    size_t scan_keys[YCSB_SCAN_MAX];
+    void *scan_values[YCSB_SCAN_MAX];
+    size_t scan_sizes[YCSB_SCAN_MAX];
+    uint64_t counts[YCSB_OPS];
+    latency_hist_t lat_hist[YCSB_OPS];
+    uint64_t start_time;
+    uint64_t end_time;
+} ycsb_args_t;
+
+/* Loaded and inserted so far */
+static uint64_t ycsb_records;
+
+static void write_value(ycsb_args_t *y, void *addr, size_t size) {
+
+    memset(addr, (int)y->tid, size);
+}
+
+static void ycsb_op(ycsb_args_t *y, int op, uint64_t *rnd) {
+
+    uint64_t records = __atomic_load_n(&ycsb_records, __ATOMIC_RELAXED);
+    size_t key, size, i, len;
+    ht_view_t view;
+    void *addr;
+
+    switch (op) {
+    case YCSB_INSERT:
+	key = __atomic_fetch_add(&ycsb_records, 1, __ATOMIC_RELAXED) + 1;
+	put_value(y->ops, y->ht, key, y->sizes[xorshift64(rnd) % YCSB_SIZES]);
+	return;
+    case YCSB_SCAN:
+	len = 1 + xorshift64(rnd) % YCSB_SCAN_MAX;
+	key = ycsb_next_record(y->yw, records, xorshift64(rnd));
+	epoch_enter();
+	if (y->ops->hop_scan != NULL) {
+	    len = y->ops->hop_scan(y->ht, key + 1, len, y->scan_keys,
+				   y->scan_values, y->scan_sizes);
+	    for (i = 0; i < len && y->touch_values; i++)
+		y->checksum += read_value(y->scan_values[i], y->scan_sizes[i]);
+	    epoch_exit();
+	    return;
+	}
+	for (i = 0; i < len; i++, key = (key + 1) % records)
+	    if ((addr = y->ops->hop_get(y->ht, key + 1, &size)) != NULL &&
+		y->touch_values)
+		y->checksum += read_value(addr, size);
+	epoch_exit();
+	return;
+    case YCSB_DELETE:
+	key = ycsb_next_record(y->yw, records, xorshift64(rnd)) + 1;
+	if (y->ops->hop_get(y->ht, key, &size) != NULL)
+	    y->ops->hop_remove(y->ht, key, size);
+	return;
+    }
+
+    key = ycsb_next_record(y->yw, records, xorshift64(rnd)) + 1;
+    if (ht_view_get(y->ops, y->ht, key, &view) == NULL) {
+	/* As if from the slower storage the cache is in front of */
+	if (ht_cache_budget != 0 && op != YCSB_UPDATE)
+	    put_value(y->ops, y->ht, key,
+		      y->sizes[xorshift64(rnd) % YCSB_SIZES]);
+	return;
+    }
+    size = view.hv_size;
+    if (y->touch_values) {
+	if (op != YCSB_UPDATE)
+	    y->checksum += read_value(view.hv_addr, size);
+	if (op != YCSB_READ && y->update_in_place)
+	    write_value(y, view.hv_addr, size);
+    }
+    ht_view_release(y->ops, y->ht, &view);
+    if (op == YCSB_READ || y->update_in_place)
+	return;
+    /* Readers see the old value or the new one, whole */
+    if ((addr = ht_view_reserve(y->ops, y->ht, key, size, &view)) == NULL)
+	return;
+    if (y->touch_values)
+	ht_stream_set(addr, VALUE_BYTE(key), size);
+    ht_view_commit(y->ops, y->ht, &view);
+}
+
+void *run_ycsb(void *args) {
+
+    ycsb_args_t *y = (ycsb_args_t *)args;
+    uint64_t rnd = 0x9E3779B97F4A7C15ULL * (y->tid + 1), begin, end;
+    size_t i;
+    int op;
+
+    for (i = 0; i < y->warmup; i++)
+	ycsb_op(y, ycsb_next_op(y->yw, xorshift64(&rnd) % 100), &rnd);
+    pthread_barrier_wait(y->barrier);
+
+    y->start_time = nano_time();
+    for (i = 0; i < y->num_ops; i++) {
+	op = ycsb_next_op(y->yw, xorshift64(&rnd) % 100);
+	begin = nano_time();
+	ycsb_op(y, op, &rnd);
+	end = nano_time();
+	lat_hist_record(&y->lat_hist[op], end - begin);
+	y->counts[op]++;
+	if (stats_every != 0 && (i + 1) % stats_every == 0)
+	    sample_stats((hashtable_t *)y->ht, 1);
+    }
+    y->end_time = nano_time();
+    return (void *)0;
+}
+
+/*
+ * The records of a snapshot are keys 1 to N, as the load below puts
+ * them: the chained table is built from the file, the mapped one reads
+ * it in place. A snapshot of a cache has only the records it had kept,
+ * which the run still picks from the first N keys.
+ */
+static void *load_snapshot(const ht_ops_t *ops, size_t *num_items) {
+
+    void *ht;
+
+    if (ops == &ht_mapped_ops) {
+	if ((ht = ops->hop_allocate(0)) == NULL)
+	    EXIT_MSG("Could not map the snapshot in %s\n", load_path);
+	*num_items = ht_snap_items((ht_snap_t *)ht);
+    } else {
+	if ((ht = ht_snapshot_load(load_path, snap_threads)) == NULL)
+	    EXIT_MSG("Could not load the snapshot in %s\n", load_path);
+	*num_items = ((hashtable_t *)ht)->ht_items;
+    }
+    if (*num_items == 0)
+	EXIT_MSG("The snapshot in %s is empty\n", load_path);
+    return ht;
+}
+
+static void write_snapshot(hashtable_t *ht_ptr) {
+
+    uint64_t begin_time = nano_time(), elapsed;
+    ssize_t bytes;
+
+    bytes = ht_snapshot_write(ht_ptr, snapshot_path, snap_threads);
+    elapsed = nano_time() - begin_time;
+    printf("Wrote %zd bytes to %s in %" PRIu64 " ns, %.2f MB/s\n", bytes,
+	   snapshot_path, elapsed,
+	   (double)bytes / BYTES_IN_MB / elapsed * NANOSECONDS_IN_SECOND);
+}
+
+void run_ycsb_threads(const ht_ops_t *ops, int num_threads,
+		      size_t num_items, size_t num_ops, size_t warmup,
+		      ycsb_workload_t *yw, const size_dist_t *sd) {
+
+    pthread_t *threads;
+    pthread_barrier_t barrier;
+    ycsb_args_t *yargs;
+    latency_hist_t total;
+    uint64_t begin_time, min_start_time, max_end_time = 0, counts, elapsed;
+    size_t i, sizes[YCSB_SIZES];
+    void *ht;
+    int t, op, ret;
+
+    if (num_threads > 1 && !ops->hop_thread_safe)
+	EXIT_MSG("The %s hash table is not thread-safe; use one thread or "
+		 "the concurrent or sharded design.\n", ops->hop_name);
+
+    begin_time = nano_time();
+    if (load_path != NULL) {
+	ht = load_snapshot(ops, &num_items);
+	printf("Loaded %zu records from %s in %" PRIu64 " ns\n", num_items,
+	       load_path, nano_time() - begin_time);
+    } else {
+	ht = allocate_table(ops, num_items);
+	for (i = 0; i < num_items; i++)
+	    if (put_value(ops, ht, i + 1, size_dist_next(sd)) == NULL)
+		EXIT_MSG("Could not load record %zu\n", i);
+	printf("Loaded %zu records in %" PRIu64 " ns\n", num_items,
+	       nano_time() - begin_time);
+    }
+    ycsb_zipf_init(&yw->yw_zipf, num_items, YCSB_ZIPF_THETA);
+    ycsb_records = num_items;
+    for (i = 0; i < YCSB_SIZES; i++)
+	sizes[i] = size_dist_next(sd);
+    if (snapshot_path != NULL)
+	write_snapshot((hashtable_t *)ht);
+
+    threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    yargs = (ycsb_args_t *)calloc(num_threads, sizeof(ycsb_args_t));
+    if (threads == NULL || yargs == NULL)
+	EXIT_MSG("Could not allocate thread array for %d threads.\n",
+		 num_threads);
+    pthread_barrier_init(&barrier, NULL, num_threads);
+
+    for (t = 0; t < num_threads; t++) {
+	yargs[t].tid = t;
+	yargs[t].ops = ops;
+	yargs[t].ht = ht;
+	yargs[t].yw = yw;
+	yargs[t].num_ops = num_ops;
+	yargs[t].warmup = warmup;
+	yargs[t].sizes = sizes;
+	yargs[t].barrier = &barrier;
+	/* An owner may move a value to another tier while a client reads it */
+	yargs[t].touch_values = ops != &ht_sharded_ops;
+	/*
+	 * The log's compactor may be copying the value, a snapshot's are
+	 * read-only, and readers of a design with reservations are better
+	 * off with a new value committed than with one written under them
+	 */
+	yargs[t].update_in_place = yargs[t].touch_values && !ht_use_vlog &&
+	    ops != &ht_mapped_ops && ops->hop_reserve == NULL;
+	ret = pthread_create(&threads[t], NULL, run_ycsb, &yargs[t]);
+	if (ret != 0)
+	    EXIT_MSG("pthread_create for %dth thread failed: %s\n",
+		     t, strerror(ret));
+    }
+    for (t = 0; t < num_threads; t++) {
+	ret = pthread_join(threads[t], NULL);
+	if (ret != 0)
+	    EXIT_MSG("Thread %d failed: %s\n", t, strerror(ret));
+    }
+
+    min_start_time = yargs[0].start_time;
+    for (t = 0; t < num_threads; t++) {
+	if (yargs[t].start_time < min_start_time)
+	    min_start_time = yargs[t].start_time;
+	if (yargs[t].end_time > max_end_time)
+	    max_end_time = yargs[t].end_time;
+    }
+    elapsed = max_end_time - min_start_time;
+    printf("%d: \t %.2f Mops/s\n", num_threads,
+	   (double)num_ops * num_threads / (double)elapsed
+	   * NANOSECONDS_IN_SECOND / 1000000);
+    for (op = 0; op < YCSB_OPS; op++) {
+	char prefix[64];
+
+	memset(&total, 0, sizeof(total));
+	counts = 0;
+	for (t = 0; t < num_threads; t++) {
+	    lat_hist_merge(&total, &yargs[t].lat_hist[op]);
+	    counts += yargs[t].counts[op];
+	}
+	snprintf(prefix, sizeof(prefix), "\t%s %.2f Mops/s, ",
+		 ycsb_op_names[op],
+		 (double)counts / elapsed * NANOSECONDS_IN_SECOND / 1000000);
+	lat_hist_print(&total, prefix);
+    }
+    printf("%" PRIu64 " records loaded and inserted\n", ycsb_records);
+    mt_print_stats();
+    if (ops == &ht_chained_ops) {
+	ht_print_slab_stats((hashtable_t *)ht);
+	ht_print_vlog_stats((hashtable_t *)ht);
+	ht_print_cache_stats((hashtable_t *)ht);
+	ht_print_filter_stats((hashtable_t *)ht);
+	sample_stats((hashtable_t *)ht, 0);
+    }
+    if (ops == &ht_btree_ops || ops == &ht_btree_olc_ops)
+	ht_btree_print_stats((ht_btree_t *)ht);
+    epoch_reclaim_all();
+    if (ops->hop_destroy != NULL) {
+	begin_time = nano_time();
+	ops->hop_destroy(ht);
+	printf("Destroy time %" PRIu64 " ns\n", nano_time() - begin_time);
+    }
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+    free(yargs);
+}
+
+int main(int argc, char **argv) {
+
+    ht_item_t *items_put;
+    int c, i, num_items = DEFAULT_NUM_ITEMS, option_index, num_threads = 0,
+	batch = 0, multi = 0, mix[OP_TYPES], keydist = -1;
+    size_t num_ops = DEFAULT_NUM_OPS, value_size = DEFAULT_VALUE_SIZE,
+	warmup = DEFAULT_WARMUP_OPS;
+    const char *workload = NULL, *sizes_spec = NULL;
+    char fixed_spec[32];
+    ycsb_workload_t yw;
+    size_dist_t sd;
+    size_t key, size, ret_size;
+    void *addr, *ht;
+    uint64_t begin_time, end_time, op_time, max_op_time = 0;
+    const ht_ops_t *ops = &ht_chained_ops;
+    const char *pmem_dir = DEFAULT_MEMKIND_PATH,
+	*allocator = DEFAULT_ALLOCATOR;
+    char al_error[AL_ERROR_SIZE];
+    char *pmem_paths = NULL, *path, *saveptr;
+    int node;
+
+    static struct option long_options[] =
+	{
+	    {"silent", no_argument, &silent, 1},
+	    {"no-slabs", no_argument, &ht_use_slabs, 0},
+	    {"vlog", no_argument, &ht_use_vlog, 1},
+	    {"filter", no_argument, &ht_use_filter, 1},
+	    {"allocator", required_argument, 0, 'A'},
+	    {"batch", required_argument, 0, 'b'},
+	    {"cache", optional_argument, 0, 'c'},
+	    {"crash-at", required_argument, 0, 'C'},
+	    {"design", required_argument, 0, 'd'},
+	    {"dram-budget", required_argument, 0, 'B'},
+	    {"help", no_argument, 0, 'h'},
+	    {"items", required_argument, 0, 'n'},
+	    {"keydist", required_argument, 0, 'K'},
+	    {"load", required_argument, 0, 'L'},
+	    {"mix", required_argument, 0, 'm'},
+	    {"multi", required_argument, 0, 'M'},
+	    {"ops", required_argument, 0, 'o'},
+	    {"placement", required_argument, 0, 'P'},
+	    {"pmem", required_argument, 0, 'p'},
+	    {"pmemdir", required_argument, 0, 'D'},
+	    {"promote", required_argument, 0, 'r'},
+	    {"pfile", required_argument, 0, 'F'},
+	    {"psize", required_argument, 0, 'Z'},
+	    {"shards", required_argument, 0, 's'},
+	    {"sizes", required_argument, 0, 'S'},
+	    {"skew", required_argument, 0, 'k'},
+	    {"snapshot", required_argument, 0, 'X'},
+	    {"snap-threads", required_argument, 0, 'T'},
+	    {"stats", required_argument, 0, 'I'},
+	    {"threads", required_argument, 0, 't'},
+	    {"valuesize", required_argument, 0, 'v'},
+	    {"warmup", required_argument, 0, 'w'},
+	    {"workload", required_argument, 0, 'W'},
+	    {0, 0, 0, 0}
+	};
+
+    parse_mix("90:5:5", mix);
+    while ((c = getopt_long(argc, argv, "d:hn:o:t:", long_options,
+			    &option_index)) != -1) {
+	switch (c) {
+	case 0:
+	    break;
+	case 'A':
+	    allocator = optarg;
+	    break;
+	case 'b':
+	    batch = atoi(optarg);
+	    break;
+	case 'c':
+	    ht_cache_budget = optarg == NULL ?
+		(size_t)DEFAULT_CACHE_SIZE_GB * BYTES_IN_GB :
+		strtoull(optarg, NULL, 10) * BYTES_IN_MB;
+	    break;
+	case 'C':
+	    ht_persist_crash_at = strtoull(optarg, NULL, 10);
+	    break;
+	case 'F':
+	    ht_persist_path = optarg;
+	    break;
+	case 'Z':
+	    ht_persist_file_size = strtoul(optarg, NULL, 10) * BYTES_IN_MB;
+	    break;
+	case 'B':
+	    mt_dram_budget = strtoul(optarg, NULL, 10) * BYTES_IN_MB;
+	    break;
+	case 'D':
+	    pmem_dir = optarg;
+	    break;
+	case 'P':
+	    if (mt_parse_policy(optarg) != 0)
+		EXIT_HELP_MSG("Unknown placement %s\n", optarg);
+	    break;
+	case 'r':
+	    mt_promote_hits = strtoul(optarg, NULL, 10);
+	    break;
+	case 'd':
+	    for (i = 0; designs[i] != NULL; i++)
+		if (strcmp(designs[i]->hop_name, optarg) == 0)
+		    break;
+	    if (designs[i] == NULL)
+		EXIT_HELP_MSG("Unknown hash table design %s\n", optarg);
+	    ops = designs[i];
+	    break;
+	case 'h':
+	    print_help_message(argv[0]);
+	    _exit(0);
+	case 'k':
+	    if (sscanf(optarg, "%d:%d", &hot_ops_pct, &hot_keys_pct) != 2 ||
+		hot_ops_pct < 0 || hot_ops_pct > 100 || hot_keys_pct <= 0 ||
+		hot_keys_pct > 100)
+		EXIT_HELP_MSG("The skew must be two percentages\n");
+	    break;
+	case 'm':
+	    parse_mix(optarg, mix);
+	    break;
+	case 'M':
+	    multi = atoi(optarg);
+	    break;
+	case 'n':
+	    num_items = atoi(optarg);
+	    break;
+	case 'o':
+	    num_ops = strtoul(optarg, NULL, 10);
+	    break;
+	case 'p':
+	    pmem_paths = optarg;
+	    break;
+	case 's':
+	    ht_sharded_num_shards = atoi(optarg);
+	    break;
+	case 't':
+	    num_threads = atoi(optarg);
+	    break;
+	case 'v':
+	    value_size = strtoul(optarg, NULL, 10);
+	    break;
+	case 'w':
+	    warmup = strtoul(optarg, NULL, 10);
+	    break;
+	case 'W':
+	    workload = optarg;
+	    break;
+	case 'K':
+	    if ((keydist = ycsb_parse_keydist(optarg)) < 0)
+		EXIT_HELP_MSG("Unknown key distribution %s\n", optarg);
+	    break;
+	case 'S':
+	    sizes_spec = optarg;
+	    break;
+	case 'L':
+	    load_path = ht_snap_path = optarg;
+	    break;
+	case 'X':
+	    snapshot_path = optarg;
+	    break;
+	case 'T':
+	    snap_threads = atoi(optarg);
+	    break;
+	case 'I':
+	    stats_every = strtoul(optarg, NULL, 10);
+	    break;
+	default:
+	    EXIT_HELP_MSG("Invalid option\n");
+	}
+    }
+    /* Only the single run draws keys out of MAX_KEY */
+    if (num_items <= 0 || (num_threads == 0 && workload == NULL &&
+			   num_items > MAX_KEY / 2))
+	EXIT_HELP_MSG("The number of items must be between 1 and %d\n",
+		      MAX_KEY / 2);
+    if (workload != NULL) {
+	if (ycsb_parse_workload(workload, &yw) != 0)
+	    EXIT_HELP_MSG("Unknown workload %s\n", workload);
+	if (keydist >= 0)
+	    yw.yw_keydist = keydist;
+	if (sizes_spec == NULL) {
+	    snprintf(fixed_spec, sizeof(fixed_spec), "fixed:%zu", value_size);
+	    sizes_spec = fixed_spec;
+	}
+	if (size_dist_parse(sizes_spec, &sd) != 0)
+	    EXIT_HELP_MSG("Bad value sizes %s\n", sizes_spec);
+	if (num_threads == 0)
+	    num_threads = 1;
+	if (batch > 0 || multi > 0)
+	    EXIT_HELP_MSG("--workload takes neither --batch nor --multi\n");
+    }
+    if (ht_sharded_num_shards < 1)
+	EXIT_HELP_MSG("There must be at least one shard\n");
+    if (batch < 0 ||
+	(batch > 0 && (ops != &ht_sharded_ops || num_threads == 0)))
+	EXIT_HELP_MSG("--batch needs --threads and the sharded design\n");
+    if (ht_cache_budget > 0 &&
+	(ops != &ht_chained_ops || (num_threads == 0 && workload == NULL)))
+	EXIT_HELP_MSG("--cache needs the chained design, and --threads or "
+		      "--workload\n");
+    if (ht_use_vlog && ops != &ht_chained_ops)
+	EXIT_HELP_MSG("Only the chained design has a value log\n");
+    if (ht_use_filter && ops != &ht_chained_ops)
+	EXIT_HELP_MSG("Only the chained design has a filter\n");
+    if (stats_every != 0 &&
+	(ops != &ht_chained_ops || (num_threads == 0 && workload == NULL) ||
+	 batch > 0 || multi > 0))
+	EXIT_HELP_MSG("--stats needs the chained design, and --threads or "
+		      "--workload without --batch or --multi\n");
+    if ((snapshot_path != NULL || load_path != NULL) && workload == NULL)
+	EXIT_HELP_MSG("--snapshot and --load need --workload\n");
+    if (snapshot_path != NULL && ops != &ht_chained_ops)
+	EXIT_HELP_MSG("Only the chained design writes snapshots\n");
+    if (load_path != NULL && ops != &ht_chained_ops && ops != &ht_mapped_ops)
+	EXIT_HELP_MSG("Only the chained and mapped designs load snapshots\n");
+    if (snap_threads < 1 || snap_threads > HT_SNAP_MAX_THREADS)
+	EXIT_HELP_MSG("--snap-threads must be between 1 and %d\n",
+		      HT_SNAP_MAX_THREADS);
+    /* The cumulative mix: nothing but reads and scans */
+    if (ops == &ht_mapped_ops &&
+	(load_path == NULL || yw.yw_mix[YCSB_READ] != yw.yw_mix[YCSB_DELETE] ||
+	 yw.yw_mix[YCSB_SCAN] != 100))
+	EXIT_HELP_MSG("The mapped design needs --load and a workload of only "
+		      "reads and scans\n");
+    if (multi < 0 || multi > MULTI_MAX || (multi > 0 && num_threads == 0) ||
+	(multi > 0 && batch > 0))
+	EXIT_HELP_MSG("--multi needs --threads, no --batch, and at most %d\n",
+		      MULTI_MAX);
+
+    if ((mt_dram_al = al_open(allocator, al_error, sizeof(al_error))) == NULL)
+	EXIT_MSG("Could not open allocator %s: %s\n", allocator,
+		      al_error);
+    /* With everything in DRAM, there's no need for PMEM to be there */
+    if (mt_policy != MT_DRAM || mt_dram_budget != 0) {
+	if (memkind_create_pmem(pmem_dir, 0, &pmem_kind) != 0)
+	    EXIT_MSG("Could not create pmem device: %s\n", strerror(errno));
+	node = 0;
+	for (path = pmem_paths ? strtok_r(pmem_paths, ",", &saveptr) : NULL;
+	     path != NULL; path = strtok_r(NULL, ",", &saveptr), node++) {
+	    if (node == HT_SHARD_MAX_NODES)
+		EXIT_MSG("No more than %d pmem paths, please.\n",
+			 HT_SHARD_MAX_NODES);
+	    if (memkind_create_pmem(path, 0, &ht_node_kinds[node]) != 0)
+		EXIT_MSG("Could not create pmem device %s: %s\n", path,
+			 strerror(errno));
+	}
+    }
+
+    if (workload != NULL) {
+	printf("Using the %s hash table\n", ops->hop_name);
+	run_ycsb_threads(ops, num_threads, num_items, num_ops, warmup, &yw,
+			 &sd);
+	return 0;
+    }
+    if (num_threads > 0) {
+	printf("Using the %s hash table\n", ops->hop_name);
+	run_mixed_threads(ops, num_threads, num_items, num_ops, value_size,
+			  batch, multi, mix);
+	return 0;
+    }
+    /*
+     * Allocate the space to remember the keys and sizes we add
+     * to the hashtable.
+     */
+    items_put = (ht_item_t *)malloc(num_items * sizeof(ht_item_t));
+    if (items_put == NULL)
+	EXIT_MSG("Could not allocate items array of %d items.\n", num_items);
+
+    /*
+     * Start small, so that the table has to grow as we put, but the
+     * concurrent table's array never grows and is sized for them all
+     */
+    ht = allocate_table(ops, ops == &ht_conc_ops ? num_items : 0);
+    printf("Using the %s hash table\n", ops->hop_name);
+
+    /* Put a bunch of items */
+    if (!silent)
+	printf("Putting the following items:\n");
+    begin_time = nano_time();
+    for (i = 0; i < num_items; i++) {
+	key = random() % MAX_KEY;
+	size = random() % MAX_SIZE;
+
+	op_time = nano_time();
+	addr = put_value(ops, ht, key, size);
+	op_time = nano_time() - op_time;
+	if (op_time > max_op_time)
+	    max_op_time = op_time;
+	/* Duplicate key not allowed. Try again */
+	if (addr == NULL) {
+	    i--;
+	    continue;
+	}
+
+	items_put[i].key = key;
+	items_put[i].size = size;
+    }
+    end_time = nano_time();
+    printf("Put time for %d items is %ld ns, longest put %ld ns\n",
+	   num_items, (end_time - begin_time), max_op_time);
+
+    /* Check that they are there */
+    begin_time = nano_time();
+    for (i = 0; i < num_items; i++) {
+	addr = ops->hop_get(ht, items_put[i].key, &ret_size);
+	if (!silent)
+	    printf("\t [%d] key: %ld, size: %ld\n", i, items_put[i].key,
+		   items_put[i].size);
+	if (addr == NULL || (items_put[i].size != ret_size))
+	    EXIT_MSG("Expected item %ld of size %ld not found.\n",
+		     items_put[i].key, items_put[i].size);
+    }
+    end_time = nano_time();
+    printf("Get time for %d items is %ld ns\n", num_items,
+	   (end_time - begin_time));
+    mt_print_stats();
+    if (ops == &ht_chained_ops) {
+	ht_print_slab_stats((hashtable_t *)ht);
+	ht_print_vlog_stats((hashtable_t *)ht);
+	ht_print_cache_stats((hashtable_t *)ht);
+	ht_print_filter_stats((hashtable_t *)ht);
+	sample_stats((hashtable_t *)ht, 0);
+    }
+    if (ops == &ht_btree_ops || ops == &ht_btree_olc_ops)
+	ht_btree_print_stats((ht_btree_t *)ht);
+
+    if (!silent) {
+	printf("\n\nHASHTABLE:\n");
+	ops->hop_print(ht);
+    }
+
+    /* Remove all items */
+    for (i = 0; i < num_items; i++) {
+	ops->hop_remove(ht, items_put[i].key, items_put[i].size);
+
+	if (ops->hop_get(ht, items_put[i].key, &ret_size) != NULL)
+	    printf("Removed item (key: %ld, size: %ld) was found.\n",
+		   items_put[i].key, items_put[i].size);
+    }
+
+    if (!silent) {
+	printf("\n\nHASHTABLE:\n");
+	ops->hop_print(ht);
+    }
+    if (ops->hop_destroy != NULL)
+	ops->hop_destroy(ht);
+    free(items_put);
+}
@@ -0,0 +1,698 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "epoch.h"
+#include "hash_table.h"
+
+#define LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+/*
+ * Empty key slots hold BT_NO_KEY, which is never below a key we look for,
+ * so a search can count the keys below it over the whole array without
+ * looking at the count first.
+ */
+#define BT_NO_KEY UINT64_MAX
+#define BT_LOCKED 2		/* in the version; unlocking adds it again */
+
+typedef struct {
+    uint64_t btn_version;
+    uint16_t btn_count;
+    uint16_t btn_leaf;
+} bt_node_t;
+
+/* Keys, count of them; children, one more */
+typedef struct {
+    bt_node_t  bti_node;
+    uint64_t   bti_keys[HT_BTREE_KEYS];
+    bt_node_t *bti_children[HT_BTREE_KEYS + 1];
+} bt_inner_t;
+
+typedef struct bt_leaf {
+    bt_node_t       btl_node;
+    uint64_t        btl_keys[HT_BTREE_KEYS];
+    size_t          btl_sizes[HT_BTREE_KEYS];
+    void           *btl_values[HT_BTREE_KEYS];
+    struct bt_leaf *btl_next;
+} bt_leaf_t;
+
+struct ht_btree {
+    bt_node_t *bt_root;
+    int        bt_olc;
+    size_t     bt_items;
+    size_t     bt_inner_nodes;
+    size_t     bt_leaves;
+    uint64_t   bt_restarts;
+};
+
+/* The number of keys below key: where it is, or would go */
+static inline int bt_lower_bound(const uint64_t *keys, uint64_t key) {
+
+    int i, pos = 0;
+#if defined(__AVX2__)
+    /* No unsigned 64-bit compare: flip the sign bits and compare signed */
+    const __m256i flip = _mm256_set1_epi64x(INT64_MIN);
+    __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)key), flip);
+    __m256i ks;
+
+    for (i = 0; i < HT_BTREE_KEYS; i += 4) {
+	ks = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + i)),
+			      flip);
+	pos += __builtin_popcount(_mm256_movemask_pd(
+	    _mm256_castsi256_pd(_mm256_cmpgt_epi64(k, ks))));
+    }
+#else
+    for (i = 0; i < HT_BTREE_KEYS; i++)
+	pos += keys[i] < key;
+#endif
+    return pos;
+}
+
+/*
+ * Optimistic lock coupling, after Leis et al.: readers take no locks,
+ * but note a node's version before they read it and check it hasn't
+ * changed after; a writer locks only the nodes it changes, by moving
+ * their versions from the one it read, and bumps them as it unlocks. Any
+ * failed check restarts the operation from the root. Nodes are never
+ * merged or freed before the tree is, so a reader always lands on a node,
+ * if maybe not the right one; the version tells it which. Without OLC,
+ * for one thread, these all succeed and do nothing.
+ */
+static inline int bt_read_lock(ht_btree_t *bt, bt_node_t *node,
+			       uint64_t *version) {
+
+    if (!bt->bt_olc)
+	return 0;
+    *version = LOAD(&node->btn_version);
+    return (*version & BT_LOCKED) ? -1 : 0;
+}
+
+/* After optimistic reads of the node */
+static inline int bt_check(ht_btree_t *bt, bt_node_t *node, uint64_t version) {
+
+    if (!bt->bt_olc)
+	return 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&node->btn_version, __ATOMIC_RELAXED) == version ?
+	0 : -1;
+}
+
+static inline int bt_upgrade(ht_btree_t *bt, bt_node_t *node,
+			     uint64_t version) {
+
+    if (!bt->bt_olc)
+	return 0;
+    return __atomic_compare_exchange_n(&node->btn_version, &version,
+				       version + BT_LOCKED, 0,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ?
+	0 : -1;
+}
+
+static inline void bt_unlock(ht_btree_t *bt, bt_node_t *node) {
+
+    if (bt->bt_olc)
+	__atomic_fetch_add(&node->btn_version, BT_LOCKED, __ATOMIC_RELEASE);
+}
+
+static void bt_restart(ht_btree_t *bt) {
+
+    __atomic_fetch_add(&bt->bt_restarts, 1, __ATOMIC_RELAXED);
+#if defined(__SSE2__)
+    _mm_pause();
+#endif
+}
+
+static bt_node_t *bt_alloc_node(ht_btree_t *bt, int leaf) {
+
+    size_t size = leaf ? sizeof(bt_leaf_t) : sizeof(bt_inner_t);
+    bt_node_t *node;
+    uint64_t *keys;
+    int i;
+
+    if ((node = (bt_node_t *)ALLOC_METADATA(size)) == NULL)
+	EXIT_MSG("Could not allocate a B+tree node: %s\n", strerror(errno));
+    memset(node, 0, size);
+    node->btn_leaf = leaf;
+    keys = leaf ? ((bt_leaf_t *)node)->btl_keys :
+	((bt_inner_t *)node)->bti_keys;
+    for (i = 0; i < HT_BTREE_KEYS; i++)
+	keys[i] = BT_NO_KEY;
+    __atomic_fetch_add(leaf ? &bt->bt_leaves : &bt->bt_inner_nodes, 1,
+		       __ATOMIC_RELAXED);
+    return node;
+}
+
+ht_btree_t *ht_btree_allocate(int olc) {
+
+    ht_btree_t *bt;
+
+    if ((bt = (ht_btree_t *)ALLOC_METADATA(sizeof(ht_btree_t))) == NULL)
+	return NULL;
+    memset(bt, 0, sizeof(ht_btree_t));
+    bt->bt_olc = olc;
+    bt->bt_root = bt_alloc_node(bt, 1);
+    return bt;
+}
+
+/*
+ * Descend to the leaf that holds key. Returns NULL if the caller must
+ * restart; otherwise the leaf, its version, and its parent's, if any.
+ */
+static bt_leaf_t *bt_find_leaf(ht_btree_t *bt, size_t key, uint64_t *version,
+			       bt_node_t **parent, uint64_t *parent_version) {
+
+    bt_node_t *node, *child;
+    uint64_t v = 0;
+
+    *parent = NULL;
+    node = LOAD(&bt->bt_root);
+    if (bt_read_lock(bt, node, &v) != 0 || node != LOAD(&bt->bt_root))
+	return NULL;
+    while (!node->btn_leaf) {
+	child = ((bt_inner_t *)node)->bti_children[
+	    bt_lower_bound(((bt_inner_t *)node)->bti_keys, key)];
+	if (bt_check(bt, node, v) != 0 || child == NULL)
+	    return NULL;
+	*parent = node;
+	*parent_version = v;
+	node = child;
+	/* A split between the two would leave us left of the key */
+	if (bt_read_lock(bt, node, &v) != 0 ||
+	    bt_check(bt, *parent, *parent_version) != 0)
+	    return NULL;
+    }
+    *version = v;
+    return (bt_leaf_t *)node;
+}
+
+void *ht_btree_get(ht_btree_t *bt, size_t key, size_t *size) {
+
+    bt_node_t *parent;
+    bt_leaf_t *leaf;
+    uint64_t v, pv;
+    void *addr;
+    size_t value_size;
+    int pos;
+
+    for (;; bt_restart(bt)) {
+	if ((leaf = bt_find_leaf(bt, key, &v, &parent, &pv)) == NULL)
+	    continue;
+	addr = NULL;
+	value_size = 0;
+	pos = bt_lower_bound(leaf->btl_keys, key);
+	/* A torn count is caught by the check */
+	if (pos < leaf->btl_node.btn_count && pos < HT_BTREE_KEYS &&
+	    leaf->btl_keys[pos] == key) {
+	    value_size = leaf->btl_sizes[pos];
+	    addr = leaf->btl_values[pos];
+	}
+	if (bt_check(bt, &leaf->btl_node, v) != 0)
+	    continue;
+	*size = value_size;
+	return addr;
+    }
+}
+
+/* The upper half moves to a new node; sep is the largest key left */
+static bt_node_t *bt_split_leaf(ht_btree_t *bt, bt_leaf_t *leaf,
+				uint64_t *sep) {
+
+    bt_leaf_t *right = (bt_leaf_t *)bt_alloc_node(bt, 1);
+    int half = leaf->btl_node.btn_count / 2;
+    int moved = leaf->btl_node.btn_count - half, i;
+
+    memcpy(right->btl_keys, leaf->btl_keys + half, moved * sizeof(uint64_t));
+    memcpy(right->btl_sizes, leaf->btl_sizes + half, moved * sizeof(size_t));
+    memcpy(right->btl_values, leaf->btl_values + half, moved * sizeof(void *));
+    right->btl_node.btn_count = moved;
+    right->btl_next = leaf->btl_next;
+    for (i = half; i < HT_BTREE_KEYS; i++)
+	leaf->btl_keys[i] = BT_NO_KEY;
+    leaf->btl_node.btn_count = half;
+    STORE(&leaf->btl_next, right);
+    *sep = leaf->btl_keys[half - 1];
+    return &right->btl_node;
+}
+
+/* The middle key goes up as sep */
+static bt_node_t *bt_split_inner(ht_btree_t *bt, bt_inner_t *inner,
+				 uint64_t *sep) {
+
+    bt_inner_t *right = (bt_inner_t *)bt_alloc_node(bt, 0);
+    int count = inner->bti_node.btn_count, half = count / 2, i;
+
+    *sep = inner->bti_keys[half];
+    right->bti_node.btn_count = count - half - 1;
+    memcpy(right->bti_keys, inner->bti_keys + half + 1,
+	   (count - half - 1) * sizeof(uint64_t));
+    memcpy(right->bti_children, inner->bti_children + half + 1,
+	   (count - half) * sizeof(bt_node_t *));
+    for (i = half; i < HT_BTREE_KEYS; i++) {
+	inner->bti_keys[i] = BT_NO_KEY;
+	inner->bti_children[i + 1] = NULL;
+    }
+    inner->bti_node.btn_count = half;
+    return &right->bti_node;
+}
+
+/* The parent is locked and, as inner nodes split on the way down, not full */
+static void bt_insert_inner(bt_inner_t *inner, uint64_t sep,
+			    bt_node_t *right) {
+
+    int count = inner->bti_node.btn_count;
+    int pos = bt_lower_bound(inner->bti_keys, sep);
+
+    memmove(inner->bti_keys + pos + 1, inner->bti_keys + pos,
+	    (count - pos) * sizeof(uint64_t));
+    memmove(inner->bti_children + pos + 2, inner->bti_children + pos + 1,
+	    (count - pos) * sizeof(bt_node_t *));
+    inner->bti_keys[pos] = sep;
+    inner->bti_children[pos + 1] = right;
+    inner->bti_node.btn_count = count + 1;
+}
+
+/*
+ * Split a full node, with it and its parent locked; the caller descends
+ * again either way, to find its key's node. -1 if another thread had
+ * either of them.
+ */
+static int bt_split(ht_btree_t *bt, bt_node_t *parent, uint64_t pv,
+		     bt_node_t *node, uint64_t v) {
+
+    bt_inner_t *root;
+    bt_node_t *right;
+    uint64_t sep;
+
+    if (parent != NULL && bt_upgrade(bt, parent, pv) != 0)
+	return -1;
+    if (bt_upgrade(bt, node, v) != 0) {
+	if (parent != NULL)
+	    bt_unlock(bt, parent);
+	return -1;
+    }
+    if (parent == NULL && node != LOAD(&bt->bt_root)) {
+	bt_unlock(bt, node);
+	return -1;
+    }
+    right = node->btn_leaf ? bt_split_leaf(bt, (bt_leaf_t *)node, &sep) :
+	bt_split_inner(bt, (bt_inner_t *)node, &sep);
+    if (parent != NULL) {
+	bt_insert_inner((bt_inner_t *)parent, sep, right);
+    } else {
+	root = (bt_inner_t *)bt_alloc_node(bt, 0);
+	root->bti_keys[0] = sep;
+	root->bti_children[0] = node;
+	root->bti_children[1] = right;
+	root->bti_node.btn_count = 1;
+	STORE(&bt->bt_root, &root->bti_node);
+    }
+    bt_unlock(bt, node);
+    if (parent != NULL)
+	bt_unlock(bt, parent);
+    return 0;
+}
+
+/*
+ * Like bt_find_leaf(), but splits every full node on the way, so that
+ * there's always room in the parent for a split below it. Returns NULL
+ * to restart.
+ */
+static bt_leaf_t *bt_find_leaf_for_insert(ht_btree_t *bt, size_t key,
+					  uint64_t *version,
+					  bt_node_t **parent,
+					  uint64_t *parent_version) {
+
+    bt_node_t *node, *child;
+    uint64_t v = 0, pv = 0;
+
+again:
+    *parent = NULL;
+    node = LOAD(&bt->bt_root);
+    if (bt_read_lock(bt, node, &v) != 0 || node != LOAD(&bt->bt_root))
+	return NULL;
+    for (;;) {
+	/* Only a split that lost to another thread counts as a restart */
+	if (node->btn_count == HT_BTREE_KEYS) {
+	    if (bt_split(bt, *parent, pv, node, v) == 0)
+		goto again;
+	    return NULL;
+	}
+	if (node->btn_leaf)
+	    break;
+	if (*parent != NULL && bt_check(bt, *parent, pv) != 0)
+	    return NULL;
+	child = ((bt_inner_t *)node)->bti_children[
+	    bt_lower_bound(((bt_inner_t *)node)->bti_keys, key)];
+	if (bt_check(bt, node, v) != 0 || child == NULL)
+	    return NULL;
+	*parent = node;
+	pv = v;
+	node = child;
+	if (bt_read_lock(bt, node, &v) != 0)
+	    return NULL;
+    }
+    *version = v;
+    *parent_version = pv;
+    return (bt_leaf_t *)node;
+}
+
+/*
+ * Insert key with the value at addr or, with replace, put the value in
+ * place of the key's, returning the old one in old. Returns -1 if the
+ * key is there and replace isn't set.
+ */
+static int bt_insert(ht_btree_t *bt, size_t key, size_t size, void *addr,
+		     int replace, void **old) {
+
+    bt_node_t *parent;
+    bt_leaf_t *leaf;
+    uint64_t v, pv;
+    int pos, count;
+
+    *old = NULL;
+    for (;; bt_restart(bt)) {
+	leaf = bt_find_leaf_for_insert(bt, key, &v, &parent, &pv);
+	if (leaf == NULL || bt_upgrade(bt, &leaf->btl_node, v) != 0)
+	    continue;
+	if (parent != NULL && bt_check(bt, parent, pv) != 0) {
+	    bt_unlock(bt, &leaf->btl_node);
+	    continue;
+	}
+	break;
+    }
+
+    count = leaf->btl_node.btn_count;
+    pos = bt_lower_bound(leaf->btl_keys, key);
+    if (pos < count && leaf->btl_keys[pos] == key) {
+	/* Readers see the old size and value or the new, by the version */
+	if (replace) {
+	    *old = leaf->btl_values[pos];
+	    leaf->btl_sizes[pos] = size;
+	    leaf->btl_values[pos] = addr;
+	}
+	bt_unlock(bt, &leaf->btl_node);
+	return replace ? 0 : -1;
+    }
+    memmove(leaf->btl_keys + pos + 1, leaf->btl_keys + pos,
+	    (count - pos) * sizeof(uint64_t));
+    memmove(leaf->btl_sizes + pos + 1, leaf->btl_sizes + pos,
+	    (count - pos) * sizeof(size_t));
+    memmove(leaf->btl_values + pos + 1, leaf->btl_values + pos,
+	    (count - pos) * sizeof(void *));
+    leaf->btl_keys[pos] = key;
+    leaf->btl_sizes[pos] = size;
+    leaf->btl_values[pos] = addr;
+    leaf->btl_node.btn_count = count + 1;
+    bt_unlock(bt, &leaf->btl_node);
+
+    __atomic_fetch_add(&bt->bt_items, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* NULL if the key is there already */
+void *ht_btree_put(ht_btree_t *bt, size_t key, size_t size) {
+
+    void *addr, *old;
+
+    if ((addr = ALLOC_DATA(size)) == NULL)
+	EXIT_MSG("Could not allocate %ld bytes: %s\n", size, strerror(errno));
+    if (bt_insert(bt, key, size, addr, 0, &old) != 0) {
+	FREE_DATA(addr);
+	return NULL;
+    }
+    return addr;
+}
+
+static void free_value(void *ptr) {
+
+    FREE_DATA(ptr);
+}
+
+/* With OLC a reader may still have the value */
+static void bt_free_value(ht_btree_t *bt, void *addr) {
+
+    if (bt->bt_olc)
+	epoch_retire(addr, free_value);
+    else
+	FREE_DATA(addr);
+}
+
+/* A value of its own, which the commit puts in the leaf */
+void *ht_btree_reserve(ht_btree_t *bt, size_t key, size_t size,
+		       ht_view_t *view) {
+
+    void *addr;
+
+    if ((addr = ALLOC_DATA(size)) == NULL)
+	EXIT_MSG("Could not allocate %ld bytes: %s\n", size, strerror(errno));
+    view->hv_key = key;
+    view->hv_size = size;
+    view->hv_priv = NULL;
+    return view->hv_addr = addr;
+}
+
+void ht_btree_commit(ht_btree_t *bt, ht_view_t *view) {
+
+    void *old;
+
+    bt_insert(bt, view->hv_key, view->hv_size, view->hv_addr, 1, &old);
+    if (old != NULL)
+	bt_free_value(bt, old);
+}
+
+void ht_btree_abort(ht_btree_t *bt, ht_view_t *view) {
+
+    FREE_DATA(view->hv_addr);
+}
+
+/*
+ * Leaves may go empty, but stay. With OLC a reader may still have the
+ * value, so the epoch reclaimer frees it.
+ */
+void ht_btree_remove(ht_btree_t *bt, size_t key, size_t size) {
+
+    bt_node_t *parent;
+    bt_leaf_t *leaf;
+    uint64_t v, pv;
+    void *addr;
+    int pos, count;
+
+    for (;; bt_restart(bt)) {
+	leaf = bt_find_leaf(bt, key, &v, &parent, &pv);
+	if (leaf != NULL && bt_upgrade(bt, &leaf->btl_node, v) == 0)
+	    break;
+    }
+
+    count = leaf->btl_node.btn_count;
+    pos = bt_lower_bound(leaf->btl_keys, key);
+    if (pos == count || leaf->btl_keys[pos] != key) {
+	bt_unlock(bt, &leaf->btl_node);
+	return;
+    }
+    if (leaf->btl_sizes[pos] != size)
+	EXIT_MSG("Found key, unmatched size: key %zu, "
+		 "hashbtable size: %zu, new item size: %zu\n",
+		 key, leaf->btl_sizes[pos], size);
+    addr = leaf->btl_values[pos];
+    memmove(leaf->btl_keys + pos, leaf->btl_keys + pos + 1,
+	    (count - pos - 1) * sizeof(uint64_t));
+    memmove(leaf->btl_sizes + pos, leaf->btl_sizes + pos + 1,
+	    (count - pos - 1) * sizeof(size_t));
+    memmove(leaf->btl_values + pos, leaf->btl_values + pos + 1,
+	    (count - pos - 1) * sizeof(void *));
+    leaf->btl_keys[count - 1] = BT_NO_KEY;
+    leaf->btl_node.btn_count = count - 1;
+    bt_unlock(bt, &leaf->btl_node);
+
+    __atomic_fetch_sub(&bt->bt_items, 1, __ATOMIC_RELAXED);
+    bt_free_value(bt, addr);
+}
+
+/*
+ * Up to n items from start up, in key order, a leaf at a time. A leaf
+ * that changed while we copied it is read again from the first key we
+ * don't have yet.
+ */
+size_t ht_btree_scan(ht_btree_t *bt, size_t start, size_t n, size_t *keys,
+		     void **values, size_t *sizes) {
+
+    bt_node_t *parent;
+    bt_leaf_t *leaf, *next;
+    uint64_t v, pv;
+    size_t found = 0, got;
+    int pos, count;
+
+    for (;; bt_restart(bt)) {
+	if ((leaf = bt_find_leaf(bt, start, &v, &parent, &pv)) == NULL)
+	    continue;
+	for (;;) {
+	    count = leaf->btl_node.btn_count;
+	    if (count > HT_BTREE_KEYS)
+		count = HT_BTREE_KEYS;
+	    got = found;
+	    for (pos = bt_lower_bound(leaf->btl_keys, start);
+		 pos < count && got < n; pos++, got++) {
+		keys[got] = leaf->btl_keys[pos];
+		values[got] = leaf->btl_values[pos];
+		sizes[got] = leaf->btl_sizes[pos];
+	    }
+	    next = LOAD(&leaf->btl_next);
+	    if (bt_check(bt, &leaf->btl_node, v) != 0)
+		break;
+	    if (got > found) {
+		if (keys[got - 1] == BT_NO_KEY)
+		    return got;
+		start = keys[got - 1] + 1;
+	    }
+	    found = got;
+	    if (found == n || next == NULL)
+		return found;
+	    leaf = next;
+	    if (bt_read_lock(bt, &leaf->btl_node, &v) != 0)
+		break;
+	}
+    }
+}
+
+static bt_leaf_t *bt_first_leaf(ht_btree_t *bt) {
+
+    bt_node_t *node;
+
+    for (node = bt->bt_root; !node->btn_leaf;
+	 node = ((bt_inner_t *)node)->bti_children[0])
+	;
+    return (bt_leaf_t *)node;
+}
+
+static int bt_height(ht_btree_t *bt) {
+
+    bt_node_t *node;
+    int height = 1;
+
+    for (node = bt->bt_root; !node->btn_leaf;
+	 node = ((bt_inner_t *)node)->bti_children[0])
+	height++;
+    return height;
+}
+
+void ht_btree_print(ht_btree_t *bt) {
+
+    bt_leaf_t *leaf;
+    int i;
+
+    printf("%zu items in %zu leaves, height %d\n", bt->bt_items,
+	   bt->bt_leaves, bt_height(bt));
+    for (leaf = bt_first_leaf(bt); leaf != NULL; leaf = leaf->btl_next)
+	for (i = 0; i < leaf->btl_node.btn_count; i++)
+	    printf("\t Key = %" PRIu64 ", value_address = %p, size = %ld\n",
+		   leaf->btl_keys[i], leaf->btl_values[i],
+		   leaf->btl_sizes[i]);
+}
+
+void ht_btree_print_stats(ht_btree_t *bt) {
+
+    printf("B+tree: %zu items, height %d, %zu inner nodes, %zu leaves, "
+	   "%.1f items per leaf, %" PRIu64 " restarts\n", bt->bt_items,
+	   bt_height(bt), bt->bt_inner_nodes, bt->bt_leaves,
+	   (double)bt->bt_items / bt->bt_leaves, bt->bt_restarts);
+}
+
+static void bt_free_node(bt_node_t *node) {
+
+    bt_leaf_t *leaf;
+    int i;
+
+    if (node->btn_leaf) {
+	leaf = (bt_leaf_t *)node;
+	for (i = 0; i < node->btn_count; i++)
+	    FREE_DATA(leaf->btl_values[i]);
+    } else {
+	for (i = 0; i <= node->btn_count; i++)
+	    bt_free_node(((bt_inner_t *)node)->bti_children[i]);
+    }
+    FREE_METADATA(node);
+}
+
+void ht_btree_destroy(ht_btree_t *bt) {
+
+    bt_free_node(bt->bt_root);
+    FREE_METADATA(bt);
+}
+
+static void *btree_allocate(size_t num_items) {
+
+    (void)num_items;
+    return ht_btree_allocate(0);
+}
+
+static void *btree_olc_allocate(size_t num_items) {
+
+    (void)num_items;
+    return ht_btree_allocate(1);
+}
+
+static void *btree_get(void *ht, size_t key, size_t *size) {
+
+    return ht_btree_get((ht_btree_t *)ht, key, size);
+}
+
+static void *btree_put(void *ht, size_t key, size_t size) {
+
+    return ht_btree_put((ht_btree_t *)ht, key, size);
+}
+
+static void btree_remove(void *ht, size_t key, size_t size) {
+
+    ht_btree_remove((ht_btree_t *)ht, key, size);
+}
+
+static void *btree_reserve(void *ht, size_t key, size_t size,
+			   ht_view_t *view) {
+
+    return ht_btree_reserve((ht_btree_t *)ht, key, size, view);
+}
+
+static void btree_commit(void *ht, ht_view_t *view) {
+
+    ht_btree_commit((ht_btree_t *)ht, view);
+}
+
+static void btree_abort(void *ht, ht_view_t *view) {
+
+    ht_btree_abort((ht_btree_t *)ht, view);
+}
+
+static void btree_print(void *ht) {
+
+    ht_btree_print((ht_btree_t *)ht);
+}
+
+static void btree_destroy(void *ht) {
+
+    ht_btree_destroy((ht_btree_t *)ht);
+}
+
+static size_t btree_scan(void *ht, size_t start, size_t n, size_t *keys,
+			 void **values, size_t *sizes) {
+
+    return ht_btree_scan((ht_btree_t *)ht, start, n, keys, values, sizes);
+}
+
+const ht_ops_t ht_btree_ops = {
+    "btree", 0, btree_allocate, btree_get, btree_put, btree_remove,
+    btree_print, btree_destroy, NULL, NULL, btree_scan, btree_reserve,
+    btree_commit, btree_abort
+};
+
+const ht_ops_t ht_btree_olc_ops = {
+    "btree-olc", 1, btree_olc_allocate, btree_get, btree_put, btree_remove,
+    btree_print, btree_destroy, NULL, NULL, btree_scan, btree_reserve,
+    btree_commit, btree_abort
+};
@@ -0,0 +1,303 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "epoch.h"
+#include "hash_table.h"
+
+#define HT_CONC_MIN_SIZE 64
+
+#define LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+ht_conc_t *ht_conc_allocate(size_t num_items) {
+
+    ht_conc_t *ht_ptr;
+    size_t size = HT_CONC_MIN_SIZE;
+    int i;
+
+    /* One bucket per item, rounded up to a power of two */
+    while (size < num_items)
+	size *= 2;
+
+    ht_ptr = (ht_conc_t *)ALLOC_METADATA(sizeof(ht_conc_t));
+    if (ht_ptr == NULL)
+	return NULL;
+    memset(ht_ptr, 0, sizeof(ht_conc_t));
+
+    ht_ptr->htc_buckets = (ht_conc_node_t **)
+	CALLOC_METADATA(size, sizeof(ht_conc_node_t *));
+    ht_ptr->htc_locks = (ht_conc_lock_t *)
+	aligned_alloc(sizeof(ht_conc_lock_t),
+		      HT_CONC_LOCKS * sizeof(ht_conc_lock_t));
+    if (ht_ptr->htc_buckets == NULL || ht_ptr->htc_locks == NULL)
+	EXIT_MSG("Could not allocate a concurrent hash table of %zu "
+		 "buckets\n", size);
+    for (i = 0; i < HT_CONC_LOCKS; i++)
+	pthread_mutex_init(&ht_ptr->htc_locks[i].htl_lock, NULL);
+    ht_ptr->htc_size = size;
+    return ht_ptr;
+}
+
+static inline size_t ht_conc_bucket(ht_conc_t *ht_ptr, size_t key) {
+
+    return ht_hash(key) & (ht_ptr->htc_size - 1);
+}
+
+static inline pthread_mutex_t *ht_conc_lock(ht_conc_t *ht_ptr, size_t bucket) {
+
+    return &ht_ptr->htc_locks[bucket & (HT_CONC_LOCKS - 1)].htl_lock;
+}
+
+/*
+ * Lock-free: a node's fields don't change once it is published, and a
+ * node we reach stays allocated until we leave the epoch.
+ */
+void *ht_conc_get(ht_conc_t *ht_ptr, size_t key, size_t *size) {
+
+    ht_conc_node_t *node;
+    void *addr = NULL;
+
+    *size = 0;
+    epoch_enter();
+    for (node = LOAD(&ht_ptr->htc_buckets[ht_conc_bucket(ht_ptr, key)]);
+	 node != NULL; node = LOAD(&node->htn_next)) {
+	if (node->htn_key == key) {
+	    *size = node->htn_value_size;
+	    addr = node->htn_value_address;
+	    break;
+	}
+    }
+    epoch_exit();
+    return addr;
+}
+
+static ht_conc_node_t *ht_conc_new_node(size_t key, size_t size) {
+
+    ht_conc_node_t *new_node;
+
+    new_node = (ht_conc_node_t *)ALLOC_METADATA(sizeof(ht_conc_node_t));
+    if (new_node == NULL)
+	return NULL;
+    new_node->htn_value_address = ALLOC_DATA(size);
+    if (new_node->htn_value_address == NULL)
+	EXIT_MSG("Could not allocate %ld bytes: %s\n",
+		 size, strerror(errno));
+    new_node->htn_key = key;
+    new_node->htn_value_size = size;
+    return new_node;
+}
+
+void *ht_conc_put(ht_conc_t *ht_ptr, size_t key, size_t size) {
+
+    size_t bucket = ht_conc_bucket(ht_ptr, key);
+    pthread_mutex_t *lock = ht_conc_lock(ht_ptr, bucket);
+    ht_conc_node_t *node, *new_node;
+    void *addr;
+
+    if ((new_node = ht_conc_new_node(key, size)) == NULL)
+	return NULL;
+    /* Once the lock is dropped the node may be removed and retired */
+    addr = new_node->htn_value_address;
+
+    pthread_mutex_lock(lock);
+    /* We don't allow duplicate keys for now */
+    for (node = ht_ptr->htc_buckets[bucket]; node != NULL;
+	 node = node->htn_next) {
+	if (node->htn_key == key) {
+	    pthread_mutex_unlock(lock);
+	    FREE_DATA(new_node->htn_value_address);
+	    FREE_METADATA(new_node);
+	    return NULL;
+	}
+    }
+    /* The node must be complete before readers can reach it */
+    new_node->htn_next = ht_ptr->htc_buckets[bucket];
+    STORE(&ht_ptr->htc_buckets[bucket], new_node);
+    pthread_mutex_unlock(lock);
+
+    __atomic_fetch_add(&ht_ptr->htc_items, 1, __ATOMIC_RELAXED);
+    return addr;
+}
+
+static void free_node(void *ptr) {
+
+    FREE_METADATA(ptr);
+}
+
+static void free_value(void *ptr) {
+
+    FREE_DATA(ptr);
+}
+
+/*
+ * Unlink the node and let the epoch reclaimer free it and its value.
+ * With several threads a key that isn't there is not an error: another
+ * thread may have removed it first.
+ */
+void ht_conc_remove(ht_conc_t *ht_ptr, size_t key, size_t size) {
+
+    size_t bucket = ht_conc_bucket(ht_ptr, key);
+    pthread_mutex_t *lock = ht_conc_lock(ht_ptr, bucket);
+    ht_conc_node_t *node, **prev;
+
+    pthread_mutex_lock(lock);
+    for (prev = &ht_ptr->htc_buckets[bucket]; (node = *prev) != NULL;
+	 prev = &node->htn_next) {
+	if (node->htn_key != key)
+	    continue;
+	if (node->htn_value_size != size)
+	    EXIT_MSG("Found key, unmatched size: key %zu, "
+		     "hashbtable size: %zu, new item size: %zu\n",
+		     key, node->htn_value_size, size);
+	STORE(prev, node->htn_next);
+	pthread_mutex_unlock(lock);
+
+	epoch_retire(node->htn_value_address, free_value);
+	epoch_retire(node, free_node);
+	__atomic_fetch_sub(&ht_ptr->htc_items, 1, __ATOMIC_RELAXED);
+	return;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+void *ht_conc_reserve(ht_conc_t *ht_ptr, size_t key, size_t size,
+		      ht_view_t *view) {
+
+    ht_conc_node_t *new_node;
+
+    if ((new_node = ht_conc_new_node(key, size)) == NULL)
+	return NULL;
+    view->hv_key = key;
+    view->hv_size = size;
+    view->hv_priv = new_node;
+    return view->hv_addr = new_node->htn_value_address;
+}
+
+/* The new node is complete before it's published, as in a put */
+void ht_conc_commit(ht_conc_t *ht_ptr, ht_view_t *view) {
+
+    ht_conc_node_t *new_node = (ht_conc_node_t *)view->hv_priv, *node, **prev;
+    size_t bucket = ht_conc_bucket(ht_ptr, new_node->htn_key);
+    pthread_mutex_t *lock = ht_conc_lock(ht_ptr, bucket);
+
+    pthread_mutex_lock(lock);
+    for (prev = &ht_ptr->htc_buckets[bucket]; (node = *prev) != NULL;
+	 prev = &node->htn_next)
+	if (node->htn_key == new_node->htn_key)
+	    break;
+    if (node != NULL) {
+	new_node->htn_next = node->htn_next;
+	STORE(prev, new_node);
+    } else {
+	new_node->htn_next = ht_ptr->htc_buckets[bucket];
+	STORE(&ht_ptr->htc_buckets[bucket], new_node);
+    }
+    pthread_mutex_unlock(lock);
+
+    if (node != NULL) {
+	epoch_retire(node->htn_value_address, free_value);
+	epoch_retire(node, free_node);
+    } else
+	__atomic_fetch_add(&ht_ptr->htc_items, 1, __ATOMIC_RELAXED);
+}
+
+void ht_conc_abort(ht_conc_t *ht_ptr, ht_view_t *view) {
+
+    ht_conc_node_t *new_node = (ht_conc_node_t *)view->hv_priv;
+
+    FREE_DATA(new_node->htn_value_address);
+    FREE_METADATA(new_node);
+}
+
+void ht_conc_print(ht_conc_t *ht_ptr) {
+
+    ht_conc_node_t *node;
+    size_t i;
+
+    printf("%zu items in %zu buckets\n", ht_ptr->htc_items,
+	   ht_ptr->htc_size);
+    for (i = 0; i < ht_ptr->htc_size; i++) {
+	printf("Bucket %ld: \n", i);
+	for (node = ht_ptr->htc_buckets[i]; node != NULL;
+	     node = node->htn_next)
+	    printf("\t Key = %ld, value_address = %p, size = %ld\n",
+		   node->htn_key, node->htn_value_address,
+		   node->htn_value_size);
+	printf("\n");
+    }
+}
+
+void ht_conc_destroy(ht_conc_t *ht_ptr) {
+
+    ht_conc_node_t *node, *next;
+    size_t i;
+
+    for (i = 0; i < ht_ptr->htc_size; i++)
+	for (node = ht_ptr->htc_buckets[i]; node != NULL; node = next) {
+	    next = node->htn_next;
+	    FREE_DATA(node->htn_value_address);
+	    FREE_METADATA(node);
+	}
+    for (i = 0; i < HT_CONC_LOCKS; i++)
+	pthread_mutex_destroy(&ht_ptr->htc_locks[i].htl_lock);
+    free(ht_ptr->htc_locks);
+    FREE_METADATA(ht_ptr->htc_buckets);
+    FREE_METADATA(ht_ptr);
+}
+
+static void *conc_allocate(size_t num_items) {
+
+    return ht_conc_allocate(num_items);
+}
+
+static void *conc_get(void *ht, size_t key, size_t *size) {
+
+    return ht_conc_get((ht_conc_t *)ht, key, size);
+}
+
+static void *conc_put(void *ht, size_t key, size_t size) {
+
+    return ht_conc_put((ht_conc_t *)ht, key, size);
+}
+
+static void conc_remove(void *ht, size_t key, size_t size) {
+
+    ht_conc_remove((ht_conc_t *)ht, key, size);
+}
+
+static void conc_print(void *ht) {
+
+    ht_conc_print((ht_conc_t *)ht);
+}
+
+static void conc_destroy(void *ht) {
+
+    ht_conc_destroy((ht_conc_t *)ht);
+}
+
+static void *conc_reserve(void *ht, size_t key, size_t size,
+			  ht_view_t *view) {
+
+    return ht_conc_reserve((ht_conc_t *)ht, key, size, view);
+}
+
+static void conc_commit(void *ht, ht_view_t *view) {
+
+    ht_conc_commit((ht_conc_t *)ht, view);
+}
+
+static void conc_abort(void *ht, ht_view_t *view) {
+
+    ht_conc_abort((ht_conc_t *)ht, view);
+}
+
+const ht_ops_t ht_conc_ops = {
+    "concurrent", 1, conc_allocate, conc_get, conc_put, conc_remove,
+    conc_print, conc_destroy, NULL, NULL, NULL, conc_reserve, conc_commit,
+    conc_abort
+};
@@ -0,0 +1,487 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "hash_table.h"
+
+/*
+ * A tag is the top bit plus seven bits of the hash, so a full slot never
+ * has a zero tag and a freshly calloc'ed group is all empty. A removed
+ * slot in a group without empty slots becomes a tombstone, so that the
+ * probe sequences going through the group don't stop there.
+ */
+#define TAG_EMPTY 0x00
+#define TAG_DELETED 0x7F
+#define TAG_FULL(tag) ((tag) & 0x80)
+
+#define HT_OPEN_MAX_LOAD_PCT 87		/* of the slots, tombstones included */
+#define HT_OPEN_MIN_LOAD_PCT 12
+#define HT_OPEN_MIN_GROUPS 4
+#define HT_OPEN_REHASH_STEP 1		/* groups moved per operation */
+#define HT_OPEN_SHRINK 1
+#define HT_OPEN_TIER_STEP 8		/* slots the tier sweep visits per operation */
+
+#define CACHE_LINE_SIZE 64
+
+static inline uint8_t ht_open_tag(uint64_t hash) {
+
+    return 0x80 | (hash >> 57);
+}
+
+/* One bit for every slot in the group whose tag is the given one */
+static inline uint32_t ht_open_match(const ht_open_group_t *g, uint8_t tag) {
+
+#if defined(__AVX2__)
+    __m256i tags = _mm256_load_si256((const __m256i *)g->hog_tags);
+
+    return (uint32_t)_mm256_movemask_epi8(
+	_mm256_cmpeq_epi8(tags, _mm256_set1_epi8((char)tag)));
+#elif defined(__SSE2__)
+    __m128i tags = _mm_load_si128((const __m128i *)g->hog_tags);
+
+    return (uint32_t)_mm_movemask_epi8(
+	_mm_cmpeq_epi8(tags, _mm_set1_epi8((char)tag)));
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < HT_OPEN_GROUP_SLOTS; i++)
+	if (g->hog_tags[i] == tag)
+	    mask |= 1U << i;
+    return mask;
+#endif
+}
+
+/*
+ * Allocate num_groups zeroed groups aligned to the cache line, so that
+ * the tags of a group are always in one line.
+ */
+static ht_open_group_t *ht_open_alloc_groups(size_t num_groups,
+					     void **mem) {
+
+    *mem = CALLOC_METADATA(num_groups + 1, sizeof(ht_open_group_t));
+    if (*mem == NULL)
+	return NULL;
+    return (ht_open_group_t *)
+	(((uintptr_t)*mem + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+}
+
+ht_open_t *ht_open_allocate(size_t num_items) {
+
+    ht_open_t *ht_ptr;
+    size_t num_groups = HT_OPEN_MIN_GROUPS;
+
+    /* Start at half the maximum load */
+    while (num_groups * HT_OPEN_GROUP_SLOTS * HT_OPEN_MAX_LOAD_PCT / 200 <
+	   num_items)
+	num_groups *= 2;
+
+    ht_ptr = (ht_open_t *)ALLOC_METADATA(sizeof(ht_open_t));
+    if (ht_ptr == NULL)
+	return NULL;
+    memset(ht_ptr, 0, sizeof(ht_open_t));
+
+    ht_ptr->hto_groups = ht_open_alloc_groups(num_groups,
+					      &ht_ptr->hto_groups_mem);
+    if (ht_ptr->hto_groups == NULL) {
+	FREE_METADATA(ht_ptr);
+	return NULL;
+    }
+    ht_ptr->hto_num_groups = num_groups;
+    return ht_ptr;
+}
+
+/*
+ * Find the slot of a key. Groups are probed quadratically; a group with
+ * an empty slot ends the search, since an insert would have stopped there.
+ */
+static ht_open_slot_t *ht_open_find(ht_open_group_t *groups,
+				    size_t num_groups, size_t key,
+				    ht_open_group_t **group) {
+
+    uint64_t hash = ht_hash(key);
+    uint8_t tag = ht_open_tag(hash);
+    size_t g = hash & (num_groups - 1), probe;
+    uint32_t mask;
+    int i;
+
+    for (probe = 1; probe <= num_groups; probe++) {
+	ht_open_group_t *grp = &groups[g];
+
+	for (mask = ht_open_match(grp, tag); mask != 0; mask &= mask - 1) {
+	    i = __builtin_ctz(mask);
+	    if (grp->hog_slots[i].hos_key == key) {
+		*group = grp;
+		return &grp->hog_slots[i];
+	    }
+	}
+	if (ht_open_match(grp, TAG_EMPTY) != 0)
+	    return NULL;
+	g = (g + probe) & (num_groups - 1);
+    }
+    return NULL;
+}
+
+/* Look in the new groups, then in the old ones if we're resizing */
+static ht_open_slot_t *ht_open_lookup(ht_open_t *ht_ptr, size_t key,
+				      ht_open_group_t **group) {
+
+    ht_open_slot_t *slot;
+
+    slot = ht_open_find(ht_ptr->hto_groups, ht_ptr->hto_num_groups, key,
+			group);
+    if (slot == NULL && ht_ptr->hto_old_groups != NULL)
+	slot = ht_open_find(ht_ptr->hto_old_groups,
+			    ht_ptr->hto_old_num_groups, key, group);
+    return slot;
+}
+
+/* Take the first empty or deleted slot on the key's probe sequence */
+static ht_open_slot_t *ht_open_insert(ht_open_t *ht_ptr, size_t key) {
+
+    uint64_t hash = ht_hash(key);
+    size_t g = hash & (ht_ptr->hto_num_groups - 1), probe;
+    uint32_t mask;
+    int i;
+
+    for (probe = 1; probe <= ht_ptr->hto_num_groups; probe++) {
+	ht_open_group_t *grp = &ht_ptr->hto_groups[g];
+
+	mask = ht_open_match(grp, TAG_EMPTY) | ht_open_match(grp, TAG_DELETED);
+	if (mask != 0) {
+	    i = __builtin_ctz(mask);
+	    if (grp->hog_tags[i] == TAG_DELETED)
+		ht_ptr->hto_tombstones--;
+	    grp->hog_tags[i] = ht_open_tag(hash);
+	    grp->hog_slots[i].hos_key = key;
+	    return &grp->hog_slots[i];
+	}
+	g = (g + probe) & (ht_ptr->hto_num_groups - 1);
+    }
+    EXIT_MSG("Open-addressing table of %zu groups is full\n",
+	     ht_ptr->hto_num_groups);
+}
+
+/*
+ * Move the items of the next HT_OPEN_REHASH_STEP old groups into the new
+ * ones. The moved slots become tombstones rather than empty, so the probe
+ * sequences of items not yet moved still go through their groups.
+ */
+static void ht_open_rehash_step(ht_open_t *ht_ptr) {
+
+    ht_open_group_t *grp;
+    ht_open_slot_t *slot;
+    size_t moved;
+    int i;
+
+    for (moved = 0; ht_ptr->hto_old_groups != NULL &&
+	     moved < HT_OPEN_REHASH_STEP; moved++) {
+	grp = &ht_ptr->hto_old_groups[ht_ptr->hto_rehash_idx++];
+
+	for (i = 0; i < HT_OPEN_GROUP_SLOTS; i++) {
+	    if (!TAG_FULL(grp->hog_tags[i]))
+		continue;
+	    slot = ht_open_insert(ht_ptr, grp->hog_slots[i].hos_key);
+	    slot->hos_value_size = grp->hog_slots[i].hos_value_size;
+	    slot->hos_value_address = grp->hog_slots[i].hos_value_address;
+	    slot->hos_hits = grp->hog_slots[i].hos_hits;
+	    grp->hog_tags[i] = TAG_DELETED;
+	}
+
+	if (ht_ptr->hto_rehash_idx == ht_ptr->hto_old_num_groups) {
+	    FREE_METADATA(ht_ptr->hto_old_groups_mem);
+	    ht_ptr->hto_old_groups = NULL;
+	    ht_ptr->hto_old_groups_mem = NULL;
+	    ht_ptr->hto_old_num_groups = 0;
+	    ht_ptr->hto_rehash_idx = 0;
+	}
+    }
+}
+
+static void ht_open_resize(ht_open_t *ht_ptr, size_t num_groups) {
+
+    ht_open_group_t *groups;
+    void *mem;
+
+    if ((groups = ht_open_alloc_groups(num_groups, &mem)) == NULL)
+	return;
+
+    ht_ptr->hto_old_groups = ht_ptr->hto_groups;
+    ht_ptr->hto_old_groups_mem = ht_ptr->hto_groups_mem;
+    ht_ptr->hto_old_num_groups = ht_ptr->hto_num_groups;
+    ht_ptr->hto_rehash_idx = 0;
+    ht_ptr->hto_groups = groups;
+    ht_ptr->hto_groups_mem = mem;
+    ht_ptr->hto_num_groups = num_groups;
+    ht_ptr->hto_tombstones = 0;
+    ht_ptr->hto_tier_hand = 0;
+    ht_ptr->hto_resizes++;
+}
+
+/*
+ * Grow when the slots in use, tombstones included, go over the maximum
+ * load. If most of them are tombstones, rebuild at the same size instead.
+ */
+static void ht_open_check_load(ht_open_t *ht_ptr) {
+
+    size_t capacity = ht_ptr->hto_num_groups * HT_OPEN_GROUP_SLOTS;
+
+    if (ht_ptr->hto_old_groups != NULL)
+	return;
+    if ((ht_ptr->hto_items + ht_ptr->hto_tombstones) * 100 >
+	capacity * HT_OPEN_MAX_LOAD_PCT) {
+	if (ht_ptr->hto_items * 2 < capacity)
+	    ht_open_resize(ht_ptr, ht_ptr->hto_num_groups);
+	else
+	    ht_open_resize(ht_ptr, ht_ptr->hto_num_groups * 2);
+    }
+#if HT_OPEN_SHRINK
+    else if (ht_ptr->hto_num_groups > HT_OPEN_MIN_GROUPS &&
+	     ht_ptr->hto_items * 100 < capacity * HT_OPEN_MIN_LOAD_PCT)
+	ht_open_resize(ht_ptr, ht_ptr->hto_num_groups / 2);
+#endif
+}
+
+/*
+ * A CLOCK hand over the slots of the current groups: it halves the hit
+ * counts it passes, so that they reflect recent gets, and while DRAM is
+ * short it demotes the values that have had none since its last round.
+ */
+static void ht_open_tier_step(ht_open_t *ht_ptr) {
+
+    size_t capacity = ht_ptr->hto_num_groups * HT_OPEN_GROUP_SLOTS;
+    ht_open_group_t *grp;
+    ht_open_slot_t *slot;
+    void *addr;
+    int i, n;
+
+    if (mt_promote_hits == 0)
+	return;
+    for (n = 0; n < HT_OPEN_TIER_STEP; n++) {
+	grp = &ht_ptr->hto_groups[ht_ptr->hto_tier_hand / HT_OPEN_GROUP_SLOTS];
+	i = ht_ptr->hto_tier_hand % HT_OPEN_GROUP_SLOTS;
+	if (++ht_ptr->hto_tier_hand == capacity)
+	    ht_ptr->hto_tier_hand = 0;
+	if (!TAG_FULL(grp->hog_tags[i]))
+	    continue;
+	slot = &grp->hog_slots[i];
+	if (slot->hos_hits == 0 && mt_dram_short() &&
+	    mt_in_dram(slot->hos_value_address) &&
+	    (addr = mt_demote(slot->hos_value_address,
+			      slot->hos_value_size)) != NULL)
+	    slot->hos_value_address = addr;
+	slot->hos_hits >>= 1;
+    }
+}
+
+/* Bring a value to DRAM when it gets hot enough */
+static void ht_open_hit(ht_open_slot_t *slot) {
+
+    void *addr;
+
+    if (mt_promote_hits == 0 || ++slot->hos_hits != mt_promote_hits)
+	return;
+    if (!mt_in_dram(slot->hos_value_address) &&
+	(addr = mt_promote(slot->hos_value_address,
+			   slot->hos_value_size)) != NULL)
+	slot->hos_value_address = addr;
+}
+
+/*
+ * A value may move between tiers on a later operation, so the address a
+ * get returns is good until then.
+ */
+void *ht_open_get(ht_open_t *ht_ptr, size_t key, size_t *size) {
+
+    ht_open_group_t *grp;
+    ht_open_slot_t *slot;
+
+    ht_open_rehash_step(ht_ptr);
+    ht_open_tier_step(ht_ptr);
+
+    if ((slot = ht_open_lookup(ht_ptr, key, &grp)) != NULL) {
+	ht_open_hit(slot);
+	*size = slot->hos_value_size;
+	return slot->hos_value_address;
+    }
+    *size = 0;
+    return NULL;
+}
+
+void *ht_open_put(ht_open_t *ht_ptr, size_t key, size_t size) {
+
+    ht_open_group_t *grp;
+    ht_open_slot_t *slot;
+    void *addr;
+
+    ht_open_rehash_step(ht_ptr);
+    ht_open_tier_step(ht_ptr);
+
+    /* We don't allow duplicate keys for now */
+    if (ht_open_lookup(ht_ptr, key, &grp) != NULL)
+	return NULL;
+
+    addr = ALLOC_DATA(size);
+    if (addr == NULL)
+	EXIT_MSG("Could not allocate %ld bytes: %s\n", size, strerror(errno));
+
+    /* New items always go into the new groups */
+    slot = ht_open_insert(ht_ptr, key);
+    slot->hos_value_size = size;
+    slot->hos_value_address = addr;
+    slot->hos_hits = 0;
+    ht_ptr->hto_items++;
+    ht_open_check_load(ht_ptr);
+    return addr;
+}
+
+/*
+ * Make the value at addr, allocated by the caller, the key's, freeing its
+ * old one if it had one.
+ */
+void ht_open_replace(ht_open_t *ht_ptr, size_t key, size_t size, void *addr) {
+
+    ht_open_group_t *grp;
+    ht_open_slot_t *slot;
+
+    ht_open_rehash_step(ht_ptr);
+    ht_open_tier_step(ht_ptr);
+
+    if ((slot = ht_open_lookup(ht_ptr, key, &grp)) != NULL) {
+	FREE_DATA(slot->hos_value_address);
+	slot->hos_value_size = size;
+	slot->hos_value_address = addr;
+	slot->hos_hits = 0;
+	return;
+    }
+    slot = ht_open_insert(ht_ptr, key);
+    slot->hos_value_size = size;
+    slot->hos_value_address = addr;
+    slot->hos_hits = 0;
+    ht_ptr->hto_items++;
+    ht_open_check_load(ht_ptr);
+}
+
+void ht_open_remove(ht_open_t *ht_ptr, size_t key, size_t size) {
+
+    ht_open_group_t *grp;
+    ht_open_slot_t *slot;
+    int i;
+
+    ht_open_rehash_step(ht_ptr);
+
+    if ((slot = ht_open_lookup(ht_ptr, key, &grp)) == NULL) {
+	printf("Remove can't find requested item: key %zu, size %zu\n",
+	       key, size);
+	return;
+    }
+    if (slot->hos_value_size != size)
+	EXIT_MSG("Found key, unmatched size: key %zu, "
+		 "hashbtable size: %zu, new item size: %zu\n",
+		 key, slot->hos_value_size, size);
+
+    FREE_DATA(slot->hos_value_address);
+    i = slot - grp->hog_slots;
+    /*
+     * If the group has an empty slot, no probe sequence goes on past it,
+     * so the slot can simply be emptied.
+     */
+    if (ht_open_match(grp, TAG_EMPTY) != 0)
+	grp->hog_tags[i] = TAG_EMPTY;
+    else {
+	grp->hog_tags[i] = TAG_DELETED;
+	if (grp >= ht_ptr->hto_groups &&
+	    grp < ht_ptr->hto_groups + ht_ptr->hto_num_groups)
+	    ht_ptr->hto_tombstones++;
+    }
+    ht_ptr->hto_items--;
+    ht_open_check_load(ht_ptr);
+}
+
+void ht_open_print(ht_open_t *ht_ptr) {
+
+    ht_open_group_t *grp;
+    size_t g;
+    int i;
+
+    printf("%zu items in %zu groups of %d slots, %zu tombstones, "
+	   "%zu resizes\n", ht_ptr->hto_items, ht_ptr->hto_num_groups,
+	   HT_OPEN_GROUP_SLOTS, ht_ptr->hto_tombstones, ht_ptr->hto_resizes);
+    for (g = 0; g < ht_ptr->hto_num_groups; g++) {
+	grp = &ht_ptr->hto_groups[g];
+	printf("Group %ld: \n", g);
+	for (i = 0; i < HT_OPEN_GROUP_SLOTS; i++)
+	    if (TAG_FULL(grp->hog_tags[i]))
+		printf("\t Key = %ld, value_address = %p, size = %ld\n",
+		       grp->hog_slots[i].hos_key,
+		       grp->hog_slots[i].hos_value_address,
+		       grp->hog_slots[i].hos_value_size);
+	printf("\n");
+    }
+}
+
+static void ht_open_destroy_groups(ht_open_group_t *groups,
+				   size_t num_groups) {
+
+    size_t g;
+    int i;
+
+    for (g = 0; g < num_groups; g++)
+	for (i = 0; i < HT_OPEN_GROUP_SLOTS; i++)
+	    if (TAG_FULL(groups[g].hog_tags[i]))
+		FREE_DATA(groups[g].hog_slots[i].hos_value_address);
+}
+
+void ht_open_destroy(ht_open_t *ht_ptr) {
+
+    ht_open_destroy_groups(ht_ptr->hto_groups, ht_ptr->hto_num_groups);
+    FREE_METADATA(ht_ptr->hto_groups_mem);
+    if (ht_ptr->hto_old_groups != NULL) {
+	/* The slots already moved are tombstones by now */
+	ht_open_destroy_groups(ht_ptr->hto_old_groups,
+			       ht_ptr->hto_old_num_groups);
+	FREE_METADATA(ht_ptr->hto_old_groups_mem);
+    }
+    FREE_METADATA(ht_ptr);
+}
+
+static void *open_allocate(size_t num_items) {
+
+    return ht_open_allocate(num_items);
+}
+
+static void *open_get(void *ht, size_t key, size_t *size) {
+
+    return ht_open_get((ht_open_t *)ht, key, size);
+}
+
+static void *open_put(void *ht, size_t key, size_t size) {
+
+    return ht_open_put((ht_open_t *)ht, key, size);
+}
+
+static void open_remove(void *ht, size_t key, size_t size) {
+
+    ht_open_remove((ht_open_t *)ht, key, size);
+}
+
+static void open_print(void *ht) {
+
+    ht_open_print((ht_open_t *)ht);
+}
+
+static void open_destroy(void *ht) {
+
+    ht_open_destroy((ht_open_t *)ht);
+}
+
+const ht_ops_t ht_open_ops = {
+    "open", 0, open_allocate, open_get, open_put, open_remove, open_print,
+    open_destroy
+};
@@ -0,0 +1,517 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "hash_table.h"
+
+#define HT_PERSIST_MAGIC 0x48545045525349ULL	/* "HTPERSI" */
+#define HT_PERSIST_VERSION 2
+#define HT_PERSIST_CLASSES 40		/* records of 64 bytes << class */
+#define HT_PERSIST_MIN_RECORD 64
+#define HT_PERSIST_MIN_BUCKETS 64
+#define HT_PERSIST_BYTES_PER_BUCKET 1024	/* when sized from the file */
+#define DEFAULT_PERSIST_FILE "/mnt/pmem/sasha/ht.table"
+#define DEFAULT_PERSIST_SIZE (256UL * 1024 * 1024)
+
+#define CACHE_LINE_SIZE 64
+
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE 0x03
+#endif
+#ifndef MAP_SYNC
+#define MAP_SYNC 0x80000
+#endif
+
+/* Offset 0 is the header, so it doubles as the null link */
+typedef struct {
+    uint64_t hph_magic;		/* written last when the file is made */
+    uint64_t hph_version;
+    uint64_t hph_file_size;
+    uint64_t hph_num_buckets;
+    uint64_t hph_buckets;	/* offset of the bucket array */
+    uint64_t hph_heap_top;	/* records are cut from here up */
+    uint64_t hph_items;		/* may be off by one after a crash */
+    uint64_t hph_free[HT_PERSIST_CLASSES];
+} ht_persist_header_t;
+
+typedef struct {
+    uint64_t hpr_next;
+    uint64_t hpr_key;
+    uint64_t hpr_size;
+    uint64_t hpr_pad;		/* values start 32-byte aligned */
+} ht_persist_record_t;
+
+struct ht_persist {
+    int                  hp_fd;
+    char                *hp_base;
+    size_t               hp_size;
+    ht_persist_header_t *hp_header;
+    uint64_t            *hp_buckets;
+};
+
+const char *ht_persist_path = DEFAULT_PERSIST_FILE;
+size_t ht_persist_file_size = DEFAULT_PERSIST_SIZE;
+uint64_t ht_persist_crash_at = 0;
+
+static uint64_t ht_persist_flushes = 0;
+
+/*
+ * Write the lines back and fence, so that nothing stored after this
+ * reaches the media before them. The flush count is where tests crash.
+ */
+void ht_persist_flush(const void *addr, size_t len) {
+
+    uintptr_t line = (uintptr_t)addr & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+
+    for (; line < (uintptr_t)addr + len; line += CACHE_LINE_SIZE) {
+#if defined(__CLWB__)
+	_mm_clwb((void *)line);
+#elif defined(__CLFLUSHOPT__)
+	_mm_clflushopt((void *)line);
+#elif defined(__SSE2__)
+	_mm_clflush((const void *)line);
+#endif
+    }
+#if defined(__SSE2__)
+    _mm_sfence();
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+    if (ht_persist_crash_at != 0 &&
+	++ht_persist_flushes == ht_persist_crash_at) {
+	printf("Crashing at flush %" PRIu64 "\n", ht_persist_flushes);
+	fflush(stdout);
+	_exit(-1);
+    }
+}
+
+#define PERSIST(ptr) ht_persist_flush(ptr, sizeof(*(ptr)))
+
+static inline void *ht_persist_ptr(ht_persist_t *hp, uint64_t off) {
+
+    return hp->hp_base + off;
+}
+
+static inline int ht_persist_class(size_t size) {
+
+    size_t bytes = sizeof(ht_persist_record_t) + size;
+    int c = 0;
+
+    while (((size_t)HT_PERSIST_MIN_RECORD << c) < bytes)
+	c++;
+    return c;
+}
+
+/*
+ * DAX files take MAP_SYNC, which makes the flushes enough. Anything else
+ * is only safe against the process dying, which is what the crash tests
+ * need; the page cache has the stores.
+ */
+static void *ht_persist_map(int fd, size_t size) {
+
+    void *base;
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_SHARED_VALIDATE | MAP_SYNC, fd, 0);
+    if (base != MAP_FAILED)
+	return base;
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base != MAP_FAILED)
+	printf("Not a DAX file: the table survives crashes of the process, "
+	       "not of the machine\n");
+    return base;
+}
+
+static void ht_persist_format(ht_persist_t *hp, size_t num_items) {
+
+    ht_persist_header_t *hdr = hp->hp_header;
+    size_t num_buckets = HT_PERSIST_MIN_BUCKETS;
+
+    if (num_items == 0)
+	num_items = hp->hp_size / HT_PERSIST_BYTES_PER_BUCKET;
+    while (num_buckets < num_items)
+	num_buckets *= 2;
+    if (sizeof(*hdr) + num_buckets * sizeof(uint64_t) >= hp->hp_size)
+	EXIT_MSG("A file of %zu bytes is too small for %zu buckets\n",
+		 hp->hp_size, num_buckets);
+
+    /* A fresh file is all zeroes: empty buckets, empty free lists */
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->hph_version = HT_PERSIST_VERSION;
+    hdr->hph_file_size = hp->hp_size;
+    hdr->hph_num_buckets = num_buckets;
+    hdr->hph_buckets = CACHE_LINE_SIZE *
+	((sizeof(*hdr) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE);
+    hdr->hph_heap_top = hdr->hph_buckets + num_buckets * sizeof(uint64_t);
+    hdr->hph_heap_top = (hdr->hph_heap_top + HT_PERSIST_MIN_RECORD - 1) &
+	~(uint64_t)(HT_PERSIST_MIN_RECORD - 1);
+    memset(ht_persist_ptr(hp, hdr->hph_buckets), 0,
+	   num_buckets * sizeof(uint64_t));
+    ht_persist_flush(ht_persist_ptr(hp, hdr->hph_buckets),
+		     num_buckets * sizeof(uint64_t));
+    ht_persist_flush(hdr, sizeof(*hdr));
+    hdr->hph_magic = HT_PERSIST_MAGIC;
+    PERSIST(&hdr->hph_magic);
+}
+
+/*
+ * Map the table in path, making it first if the file is new or was cut
+ * short by a crash before it was complete.
+ */
+ht_persist_t *ht_persist_open(const char *path, size_t file_size,
+			      size_t num_items) {
+
+    ht_persist_t *hp;
+    struct stat st;
+    int existing;
+
+    if ((hp = (ht_persist_t *)calloc(1, sizeof(ht_persist_t))) == NULL)
+	return NULL;
+    if ((hp->hp_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+	EXIT_MSG("Could not open %s: %s\n", path, strerror(errno));
+    if (fstat(hp->hp_fd, &st) != 0)
+	EXIT_MSG("Could not stat %s: %s\n", path, strerror(errno));
+
+    existing = (size_t)st.st_size >= sizeof(ht_persist_header_t);
+    if (existing)
+	file_size = st.st_size;
+    else if (ftruncate(hp->hp_fd, file_size) != 0)
+	EXIT_MSG("Could not size %s to %zu bytes: %s\n", path, file_size,
+		 strerror(errno));
+    hp->hp_size = file_size;
+    if ((hp->hp_base = (char *)ht_persist_map(hp->hp_fd, file_size)) ==
+	MAP_FAILED)
+	EXIT_MSG("Could not map %s: %s\n", path, strerror(errno));
+    hp->hp_header = (ht_persist_header_t *)hp->hp_base;
+
+    if (!existing || hp->hp_header->hph_magic != HT_PERSIST_MAGIC)
+	ht_persist_format(hp, num_items);
+    else if (hp->hp_header->hph_version != HT_PERSIST_VERSION ||
+	     hp->hp_header->hph_file_size != file_size)
+	EXIT_MSG("%s is not a table of this version and size\n", path);
+    hp->hp_buckets = (uint64_t *)ht_persist_ptr(hp,
+						hp->hp_header->hph_buckets);
+    return hp;
+}
+
+void ht_persist_close(ht_persist_t *hp) {
+
+    munmap(hp->hp_base, hp->hp_size);
+    close(hp->hp_fd);
+    free(hp);
+}
+
+static inline uint64_t *ht_persist_bucket(ht_persist_t *hp, size_t key) {
+
+    return &hp->hp_buckets[ht_hash(key) &
+			   (hp->hp_header->hph_num_buckets - 1)];
+}
+
+/* The link that points at the key's record, or NULL */
+static uint64_t *ht_persist_find(ht_persist_t *hp, size_t key) {
+
+    uint64_t *link = ht_persist_bucket(hp, key);
+    ht_persist_record_t *rec;
+
+    for (; *link != 0; link = &rec->hpr_next) {
+	rec = (ht_persist_record_t *)ht_persist_ptr(hp, *link);
+	if (rec->hpr_key == key)
+	    return link;
+    }
+    return NULL;
+}
+
+void *ht_persist_get(ht_persist_t *hp, size_t key, size_t *size) {
+
+    ht_persist_record_t *rec;
+    uint64_t *link;
+
+    if ((link = ht_persist_find(hp, key)) == NULL) {
+	*size = 0;
+	return NULL;
+    }
+    rec = (ht_persist_record_t *)ht_persist_ptr(hp, *link);
+    *size = rec->hpr_size;
+    return rec + 1;
+}
+
+/*
+ * Take a record off its class's free list, or from the top of the heap.
+ * A crash before the record is linked in leaks it.
+ */
+static uint64_t ht_persist_alloc(ht_persist_t *hp, size_t size) {
+
+    ht_persist_header_t *hdr = hp->hp_header;
+    int c = ht_persist_class(size);
+    uint64_t off, bytes = (uint64_t)HT_PERSIST_MIN_RECORD << c;
+
+    if (c >= HT_PERSIST_CLASSES)
+	return 0;
+    if ((off = hdr->hph_free[c]) != 0) {
+	hdr->hph_free[c] =
+	    ((ht_persist_record_t *)ht_persist_ptr(hp, off))->hpr_next;
+	PERSIST(&hdr->hph_free[c]);
+	return off;
+    }
+    if (hdr->hph_heap_top + bytes > hdr->hph_file_size)
+	return 0;
+    off = hdr->hph_heap_top;
+    hdr->hph_heap_top += bytes;
+    PERSIST(&hdr->hph_heap_top);
+    return off;
+}
+
+/* Back on its class's free list; it must be unlinked already */
+static void ht_persist_free(ht_persist_t *hp, uint64_t off, size_t size) {
+
+    ht_persist_header_t *hdr = hp->hp_header;
+    ht_persist_record_t *rec = (ht_persist_record_t *)ht_persist_ptr(hp, off);
+    int c = ht_persist_class(size);
+
+    rec->hpr_next = hdr->hph_free[c];
+    PERSIST(&rec->hpr_next);
+    hdr->hph_free[c] = off;
+    PERSIST(&hdr->hph_free[c]);
+}
+
+/* A record that nothing points at yet, with its value left to write */
+static ht_persist_record_t *ht_persist_new_record(ht_persist_t *hp,
+						  size_t key, size_t size,
+						  uint64_t *off) {
+
+    ht_persist_record_t *rec;
+
+    if ((*off = ht_persist_alloc(hp, size)) == 0)
+	EXIT_MSG("The persistent table is full: no room for %zu bytes\n",
+		 size);
+    rec = (ht_persist_record_t *)ht_persist_ptr(hp, *off);
+    rec->hpr_key = key;
+    rec->hpr_size = size;
+    rec->hpr_next = 0;
+    return rec;
+}
+
+/*
+ * The record is complete and durable before the one store that makes it
+ * reachable, in place of the key's old one if there is one, which is
+ * freed after.
+ */
+static void ht_persist_link(ht_persist_t *hp, uint64_t off) {
+
+    ht_persist_record_t *rec = (ht_persist_record_t *)ht_persist_ptr(hp, off);
+    ht_persist_record_t *old = NULL;
+    uint64_t *link, old_off = 0;
+
+    if ((link = ht_persist_find(hp, rec->hpr_key)) != NULL) {
+	old_off = *link;
+	old = (ht_persist_record_t *)ht_persist_ptr(hp, old_off);
+	rec->hpr_next = old->hpr_next;
+    } else {
+	link = ht_persist_bucket(hp, rec->hpr_key);
+	rec->hpr_next = *link;
+    }
+    ht_persist_flush(rec, sizeof(*rec) + rec->hpr_size);
+
+    *link = off;
+    PERSIST(link);
+    if (old != NULL) {
+	ht_persist_free(hp, old_off, old->hpr_size);
+	return;
+    }
+    hp->hp_header->hph_items++;
+    PERSIST(&hp->hp_header->hph_items);
+}
+
+void *ht_persist_put(ht_persist_t *hp, size_t key, size_t size,
+		     const void *value) {
+
+    ht_persist_record_t *rec;
+    uint64_t off;
+
+    /* We don't allow duplicate keys for now */
+    if (ht_persist_find(hp, key) != NULL)
+	return NULL;
+    rec = ht_persist_new_record(hp, key, size, &off);
+    /* Never garbage, even if the caller crashes before writing its own */
+    if (value != NULL)
+	memcpy(rec + 1, value, size);
+    else
+	memset(rec + 1, 0, size);
+    ht_persist_link(hp, off);
+    return rec + 1;
+}
+
+/* Unlink first, then free: a crash in between leaks the record */
+void ht_persist_remove(ht_persist_t *hp, size_t key, size_t size) {
+
+    ht_persist_header_t *hdr = hp->hp_header;
+    ht_persist_record_t *rec;
+    uint64_t *link, off;
+
+    if ((link = ht_persist_find(hp, key)) == NULL) {
+	printf("Remove can't find requested item: key %zu, size %zu\n",
+	       key, size);
+	return;
+    }
+    off = *link;
+    rec = (ht_persist_record_t *)ht_persist_ptr(hp, off);
+    if (rec->hpr_size != size)
+	EXIT_MSG("Found key, unmatched size: key %zu, "
+		 "hashbtable size: %" PRIu64 ", new item size: %zu\n",
+		 key, rec->hpr_size, size);
+
+    *link = rec->hpr_next;
+    PERSIST(link);
+    hdr->hph_items--;
+    PERSIST(&hdr->hph_items);
+    ht_persist_free(hp, off, size);
+}
+
+size_t ht_persist_items(ht_persist_t *hp) {
+
+    return hp->hp_header->hph_items;
+}
+
+/*
+ * Every link must point at a whole record inside the heap, in the bucket
+ * of its key, and no chain may be longer than the heap could hold. A
+ * crash may leave the count of items off by one; it's set from the chains.
+ */
+ssize_t ht_persist_check(ht_persist_t *hp,
+			 int (*check_value)(size_t key, const void *value,
+					    size_t size)) {
+
+    ht_persist_header_t *hdr = hp->hp_header;
+    ht_persist_record_t *rec;
+    uint64_t b, off, steps, max_steps, heap_start;
+    ssize_t items = 0;
+
+    heap_start = hdr->hph_buckets + hdr->hph_num_buckets * sizeof(uint64_t);
+    max_steps = (hdr->hph_heap_top - heap_start) / HT_PERSIST_MIN_RECORD;
+    for (b = 0; b < hdr->hph_num_buckets; b++) {
+	for (off = hp->hp_buckets[b], steps = 0; off != 0;
+	     off = rec->hpr_next, steps++) {
+	    if (off < heap_start || off % HT_PERSIST_MIN_RECORD != 0 ||
+		off + sizeof(*rec) > hdr->hph_heap_top ||
+		steps > max_steps) {
+		printf("Bucket %" PRIu64 ": bad link %" PRIu64 "\n", b, off);
+		return -1;
+	    }
+	    rec = (ht_persist_record_t *)ht_persist_ptr(hp, off);
+	    if (off + ((uint64_t)HT_PERSIST_MIN_RECORD <<
+		       ht_persist_class(rec->hpr_size)) > hdr->hph_heap_top ||
+		(ht_hash(rec->hpr_key) & (hdr->hph_num_buckets - 1)) != b) {
+		printf("Bucket %" PRIu64 ": bad record at %" PRIu64 "\n",
+		       b, off);
+		return -1;
+	    }
+	    if (check_value != NULL &&
+		check_value(rec->hpr_key, rec + 1, rec->hpr_size) != 0) {
+		printf("Bucket %" PRIu64 ": bad value of key %" PRIu64
+		       " at %" PRIu64 "\n", b, rec->hpr_key, off);
+		return -1;
+	    }
+	    items++;
+	}
+    }
+    if (hdr->hph_items != (uint64_t)items) {
+	hdr->hph_items = items;
+	PERSIST(&hdr->hph_items);
+    }
+    return items;
+}
+
+void ht_persist_print(ht_persist_t *hp) {
+
+    ht_persist_header_t *hdr = hp->hp_header;
+    ht_persist_record_t *rec;
+    uint64_t b, off;
+
+    printf("%" PRIu64 " items in %" PRIu64 " buckets, %" PRIu64
+	   " of %" PRIu64 " bytes used\n", hdr->hph_items,
+	   hdr->hph_num_buckets, hdr->hph_heap_top, hdr->hph_file_size);
+    for (b = 0; b < hdr->hph_num_buckets; b++) {
+	printf("Bucket %" PRIu64 ": \n", b);
+	for (off = hp->hp_buckets[b]; off != 0; off = rec->hpr_next) {
+	    rec = (ht_persist_record_t *)ht_persist_ptr(hp, off);
+	    printf("\t Key = %" PRIu64 ", offset = %" PRIu64 ", size = %"
+		   PRIu64 "\n", rec->hpr_key, off, rec->hpr_size);
+	}
+	printf("\n");
+    }
+}
+
+static void *persist_allocate(size_t num_items) {
+
+    return ht_persist_open(ht_persist_path, ht_persist_file_size, num_items);
+}
+
+static void *persist_get(void *ht, size_t key, size_t *size) {
+
+    return ht_persist_get((ht_persist_t *)ht, key, size);
+}
+
+/*
+ * The value is zeroed and linked; whatever the caller writes over it
+ * later, it flushes itself. A reservation publishes the value it wants.
+ */
+static void *persist_put(void *ht, size_t key, size_t size) {
+
+    return ht_persist_put((ht_persist_t *)ht, key, size, NULL);
+}
+
+static void persist_remove(void *ht, size_t key, size_t size) {
+
+    ht_persist_remove((ht_persist_t *)ht, key, size);
+}
+
+static void persist_print(void *ht) {
+
+    ht_persist_print((ht_persist_t *)ht);
+}
+
+/* Only unmaps: the table stays in its file for the next run */
+static void persist_destroy(void *ht) {
+
+    ht_persist_close((ht_persist_t *)ht);
+}
+
+/* A record of its own, linked only once its value is written and durable */
+static void *persist_reserve(void *ht, size_t key, size_t size,
+			     ht_view_t *view) {
+
+    ht_persist_record_t *rec;
+    uint64_t off;
+
+    rec = ht_persist_new_record((ht_persist_t *)ht, key, size, &off);
+    view->hv_key = key;
+    view->hv_size = size;
+    view->hv_priv = (void *)(uintptr_t)off;
+    return view->hv_addr = rec + 1;
+}
+
+static void persist_commit(void *ht, ht_view_t *view) {
+
+    ht_persist_link((ht_persist_t *)ht, (uint64_t)(uintptr_t)view->hv_priv);
+}
+
+static void persist_abort(void *ht, ht_view_t *view) {
+
+    ht_persist_free((ht_persist_t *)ht, (uint64_t)(uintptr_t)view->hv_priv,
+		    view->hv_size);
+}
+
+const ht_ops_t ht_persist_ops = {
+    "persistent", 0, persist_allocate, persist_get, persist_put,
+    persist_remove, persist_print, persist_destroy, NULL, NULL, NULL,
+    persist_reserve, persist_commit, persist_abort
+};
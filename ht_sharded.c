@@ -0,0 +1,351 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hash_table.h"
+
+#define HT_RING_SIZE 256		/* a power of two */
+#define HT_SHARD_BATCH 32		/* requests taken from a ring at once */
+#define HT_SHARD_IDLE_SPINS 1000	/* empty polls before an owner yields */
+#define DEFAULT_NUM_SHARDS 2
+
+#define LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+/*
+ * The producer and the consumer each write their own cache line and keep
+ * a copy of the other's index, so they only read each other's line when
+ * the ring looks full or empty.
+ */
+typedef struct {
+    uint64_t hr_tail __attribute__((aligned(64)));	/* producer */
+    uint64_t hr_head_cache;
+    uint64_t hr_head __attribute__((aligned(64)));	/* consumer */
+    uint64_t hr_tail_cache;
+    ht_shard_req_t hr_slots[HT_RING_SIZE] __attribute__((aligned(64)));
+} ht_ring_t;
+
+typedef struct {
+    ht_sharded_t *sh_store;
+    int           sh_index;
+    int           sh_cpu;
+    int           sh_node;
+    int           sh_ready;
+    size_t        sh_items_hint;
+    ht_open_t    *sh_table;
+    pthread_t     sh_owner;
+    ht_ring_t    *sh_requests;      /* one per client */
+    ht_ring_t    *sh_completions;   /* one per client */
+} __attribute__((aligned(64))) ht_shard_t;
+
+struct ht_sharded {
+    int         hs_num_shards;
+    int         hs_num_clients;
+    ht_shard_t *hs_shards;
+};
+
+struct memkind *ht_node_kinds[HT_SHARD_MAX_NODES];
+int ht_sharded_num_shards = DEFAULT_NUM_SHARDS;
+
+static inline int ring_push(ht_ring_t *r, const ht_shard_req_t *req) {
+
+    uint64_t tail = r->hr_tail;
+
+    if (tail - r->hr_head_cache == HT_RING_SIZE) {
+	r->hr_head_cache = LOAD(&r->hr_head);
+	if (tail - r->hr_head_cache == HT_RING_SIZE)
+	    return -1;
+    }
+    r->hr_slots[tail & (HT_RING_SIZE - 1)] = *req;
+    STORE(&r->hr_tail, tail + 1);
+    return 0;
+}
+
+static inline int ring_pop(ht_ring_t *r, ht_shard_req_t *req) {
+
+    uint64_t head = r->hr_head;
+
+    if (head == r->hr_tail_cache) {
+	r->hr_tail_cache = LOAD(&r->hr_tail);
+	if (head == r->hr_tail_cache)
+	    return 0;
+    }
+    *req = r->hr_slots[head & (HT_RING_SIZE - 1)];
+    STORE(&r->hr_head, head + 1);
+    return 1;
+}
+
+/*
+ * The top half of the hash picks the shard; the shard's table indexes
+ * its groups with the bottom half, so every group of it gets used.
+ */
+static inline int ht_shard_of(ht_sharded_t *hs, size_t key) {
+
+    return (ht_hash(key) >> 32) % hs->hs_num_shards;
+}
+
+static void ht_shard_execute(ht_open_t *table, ht_shard_req_t *req) {
+
+    size_t size;
+
+    switch (req->hsr_op) {
+    case HT_SHARD_GET:
+	req->hsr_addr = ht_open_get(table, req->hsr_key, &req->hsr_size);
+	break;
+    case HT_SHARD_PUT:
+	req->hsr_addr = ht_open_put(table, req->hsr_key, req->hsr_size);
+	break;
+    case HT_SHARD_REMOVE:
+	/* Removing what's not there is not an error for a client */
+	req->hsr_addr = ht_open_get(table, req->hsr_key, &size);
+	if (req->hsr_addr != NULL && size == req->hsr_size)
+	    ht_open_remove(table, req->hsr_key, size);
+	break;
+    /* From the owner's node, like the values it puts */
+    case HT_SHARD_RESERVE:
+	if ((req->hsr_addr = ALLOC_DATA(req->hsr_size)) == NULL)
+	    EXIT_MSG("Could not allocate %zu bytes: %s\n", req->hsr_size,
+		     strerror(errno));
+	break;
+    case HT_SHARD_COMMIT:
+	ht_open_replace(table, req->hsr_key, req->hsr_size, req->hsr_addr);
+	break;
+    case HT_SHARD_ABORT:
+	FREE_DATA(req->hsr_addr);
+	break;
+    }
+}
+
+/*
+ * Owners pin themselves, take their memory from their node and then
+ * serve their rings for as long as the process lives.
+ */
+static void *ht_shard_owner(void *arg) {
+
+    ht_shard_t *sh = (ht_shard_t *)arg;
+    ht_sharded_t *hs = sh->sh_store;
+    ht_shard_req_t req;
+    cpu_set_t cpus;
+    unsigned int cpu, node;
+    int c, n, k, idle = 0;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(sh->sh_cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+	printf("Could not pin shard %d to CPU %d\n", sh->sh_index, sh->sh_cpu);
+    if (getcpu(&cpu, &node) != 0)
+	node = 0;
+    sh->sh_node = node;
+    if (node < HT_SHARD_MAX_NODES)
+	ht_local_kind = ht_node_kinds[node];
+
+    /* First touched here, so the rings are on our node too */
+    sh->sh_requests = (ht_ring_t *)
+	aligned_alloc(64, HT_SHARD_MAX_CLIENTS * sizeof(ht_ring_t));
+    sh->sh_completions = (ht_ring_t *)
+	aligned_alloc(64, HT_SHARD_MAX_CLIENTS * sizeof(ht_ring_t));
+    sh->sh_table = ht_open_allocate(sh->sh_items_hint);
+    if (sh->sh_requests == NULL || sh->sh_completions == NULL ||
+	sh->sh_table == NULL)
+	EXIT_MSG("Could not allocate shard %d\n", sh->sh_index);
+    memset(sh->sh_requests, 0, HT_SHARD_MAX_CLIENTS * sizeof(ht_ring_t));
+    memset(sh->sh_completions, 0, HT_SHARD_MAX_CLIENTS * sizeof(ht_ring_t));
+    STORE(&sh->sh_ready, 1);
+
+    while (1) {
+	n = LOAD(&hs->hs_num_clients);
+	for (c = 0, k = 0; c < n; c++) {
+	    ht_ring_t *completions = &sh->sh_completions[c];
+	    int taken;
+
+	    for (taken = 0; taken < HT_SHARD_BATCH &&
+		     ring_pop(&sh->sh_requests[c], &req); taken++) {
+		ht_shard_execute(sh->sh_table, &req);
+		/* Clients drain completions while they wait to submit */
+		while (ring_push(completions, &req) != 0)
+		    sched_yield();
+	    }
+	    k += taken;
+	}
+	if (k > 0)
+	    idle = 0;
+	else if (++idle > HT_SHARD_IDLE_SPINS)
+	    sched_yield();
+    }
+    return (void *)0;
+}
+
+ht_sharded_t *ht_sharded_allocate(size_t num_items, int num_shards) {
+
+    ht_sharded_t *hs;
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int s, ret;
+
+    if (num_shards < 1)
+	return NULL;
+    if ((hs = (ht_sharded_t *)calloc(1, sizeof(ht_sharded_t))) == NULL)
+	return NULL;
+    hs->hs_shards = (ht_shard_t *)
+	aligned_alloc(64, num_shards * sizeof(ht_shard_t));
+    if (hs->hs_shards == NULL) {
+	free(hs);
+	return NULL;
+    }
+    memset(hs->hs_shards, 0, num_shards * sizeof(ht_shard_t));
+    hs->hs_num_shards = num_shards;
+
+    for (s = 0; s < num_shards; s++) {
+	ht_shard_t *sh = &hs->hs_shards[s];
+
+	sh->sh_store = hs;
+	sh->sh_index = s;
+	sh->sh_cpu = s % (num_cpus > 0 ? num_cpus : 1);
+	sh->sh_items_hint = num_items / num_shards;
+	ret = pthread_create(&sh->sh_owner, NULL, ht_shard_owner, sh);
+	if (ret != 0)
+	    EXIT_MSG("Could not start the owner of shard %d: %s\n", s,
+		     strerror(ret));
+    }
+    for (s = 0; s < num_shards; s++)
+	while (!LOAD(&hs->hs_shards[s].sh_ready))
+	    sched_yield();
+    return hs;
+}
+
+/* Every thread that submits requests needs a client number of its own */
+int ht_sharded_client(ht_sharded_t *hs) {
+
+    int client = __atomic_fetch_add(&hs->hs_num_clients, 1, __ATOMIC_ACQ_REL);
+
+    if (client >= HT_SHARD_MAX_CLIENTS)
+	EXIT_MSG("No more than %d clients of a sharded table, please.\n",
+		 HT_SHARD_MAX_CLIENTS);
+    return client;
+}
+
+/* Returns -1 if the owner's ring is full; poll and try again */
+int ht_sharded_submit(ht_sharded_t *hs, int client,
+		      const ht_shard_req_t *req) {
+
+    ht_shard_t *sh = &hs->hs_shards[ht_shard_of(hs, req->hsr_key)];
+
+    return ring_push(&sh->sh_requests[client], req);
+}
+
+/* Collect up to max completed requests, in no particular order */
+int ht_sharded_poll(ht_sharded_t *hs, int client, ht_shard_req_t *done,
+		    int max) {
+
+    int s, n = 0;
+
+    for (s = 0; s < hs->hs_num_shards && n < max; s++)
+	while (n < max &&
+	       ring_pop(&hs->hs_shards[s].sh_completions[client], &done[n]))
+	    n++;
+    return n;
+}
+
+/*
+ * The generic operations send one request and wait for it, from a client
+ * number each thread takes the first time it calls them.
+ */
+static __thread ht_sharded_t *sync_store = NULL;
+static __thread int sync_client;
+
+static void sharded_sync(ht_sharded_t *hs, ht_shard_req_t *req) {
+
+    int spins = 0;
+
+    if (sync_store != hs) {
+	sync_client = ht_sharded_client(hs);
+	sync_store = hs;
+    }
+    while (ht_sharded_submit(hs, sync_client, req) != 0)
+	sched_yield();
+    /* Let the owner run if it shares our CPU */
+    while (ht_sharded_poll(hs, sync_client, req, 1) == 0)
+	if (++spins > HT_SHARD_IDLE_SPINS)
+	    sched_yield();
+}
+
+static void *sharded_allocate(size_t num_items) {
+
+    return ht_sharded_allocate(num_items, ht_sharded_num_shards);
+}
+
+static void *sharded_get(void *ht, size_t key, size_t *size) {
+
+    ht_shard_req_t req = {HT_SHARD_GET, key, 0, NULL, 0};
+
+    sharded_sync((ht_sharded_t *)ht, &req);
+    *size = req.hsr_size;
+    return req.hsr_addr;
+}
+
+static void *sharded_put(void *ht, size_t key, size_t size) {
+
+    ht_shard_req_t req = {HT_SHARD_PUT, key, size, NULL, 0};
+
+    sharded_sync((ht_sharded_t *)ht, &req);
+    return req.hsr_addr;
+}
+
+static void sharded_remove(void *ht, size_t key, size_t size) {
+
+    ht_shard_req_t req = {HT_SHARD_REMOVE, key, size, NULL, 0};
+
+    sharded_sync((ht_sharded_t *)ht, &req);
+}
+
+static void *sharded_reserve(void *ht, size_t key, size_t size,
+			     ht_view_t *view) {
+
+    ht_shard_req_t req = {HT_SHARD_RESERVE, key, size, NULL, 0};
+
+    sharded_sync((ht_sharded_t *)ht, &req);
+    view->hv_key = key;
+    view->hv_size = size;
+    view->hv_priv = NULL;
+    return view->hv_addr = req.hsr_addr;
+}
+
+static void sharded_commit(void *ht, ht_view_t *view) {
+
+    ht_shard_req_t req = {HT_SHARD_COMMIT, view->hv_key, view->hv_size,
+			  view->hv_addr, 0};
+
+    sharded_sync((ht_sharded_t *)ht, &req);
+}
+
+static void sharded_abort(void *ht, ht_view_t *view) {
+
+    ht_shard_req_t req = {HT_SHARD_ABORT, view->hv_key, view->hv_size,
+			  view->hv_addr, 0};
+
+    sharded_sync((ht_sharded_t *)ht, &req);
+}
+
+static void sharded_print(void *ht) {
+
+    ht_sharded_t *hs = (ht_sharded_t *)ht;
+    int s;
+
+    /* The owners keep running; this is only a rough picture */
+    for (s = 0; s < hs->hs_num_shards; s++) {
+	printf("Shard %d on CPU %d, node %d: ", s, hs->hs_shards[s].sh_cpu,
+	       hs->hs_shards[s].sh_node);
+	ht_open_print(hs->hs_shards[s].sh_table);
+    }
+}
+
+/* No destroy: the owners serve their shards for the life of the process */
+const ht_ops_t ht_sharded_ops = {
+    "sharded", 1, sharded_allocate, sharded_get, sharded_put, sharded_remove,
+    sharded_print, NULL, NULL, NULL, NULL, sharded_reserve, sharded_commit,
+    sharded_abort
+};
@@ -0,0 +1,631 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hash_table.h"
+
+#define HT_SNAP_MAGIC "HTSNAP1"
+#define HT_SNAP_VERSION 1
+#define HT_SNAP_MIN_BUCKETS 64		/* as ht_allocate() makes them */
+#define HT_SNAP_ALIGN 4096
+#define HT_SNAP_CHUNK (4 * 1024 * 1024)	/* bytes per write */
+#define HT_SNAP_SEED 0x736e617073686f74ULL
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+/* An entry is a key, a size, and the value padded to 8 bytes */
+#define HT_SNAP_ENTRY_BYTES(size) \
+    (sizeof(ht_snap_entry_t) + ALIGN_UP((uint64_t)(size), 8))
+
+/* Buckets first_bucket up to the next part's first, at offset */
+typedef struct {
+    uint64_t hsp_first_bucket;
+    uint64_t hsp_offset;
+    uint64_t hsp_length;
+    uint64_t hsp_checksum;
+} ht_snap_part_t;
+
+typedef struct {
+    char           hsh_magic[8];
+    uint64_t       hsh_version;
+    uint64_t       hsh_file_size;
+    uint64_t       hsh_num_buckets;
+    uint64_t       hsh_items;
+    uint64_t       hsh_index;		/* offset of num_buckets + 1 offsets */
+    uint64_t       hsh_index_checksum;
+    uint64_t       hsh_num_parts;
+    ht_snap_part_t hsh_parts[HT_SNAP_MAX_THREADS];
+    uint64_t       hsh_checksum;	/* of everything above */
+} ht_snap_header_t;
+
+typedef struct {
+    uint64_t hse_key;
+    uint64_t hse_size;
+} ht_snap_entry_t;
+
+struct ht_snap {
+    char             *hs_base;
+    size_t            hs_size;
+    ht_snap_header_t *hs_header;
+    uint64_t         *hs_index;
+};
+
+const char *ht_snap_path = NULL;
+
+/* Over 8-byte words: every length here is a multiple of 8 */
+static uint64_t ht_snap_checksum(uint64_t h, const void *buf, size_t len) {
+
+    const uint64_t *w = (const uint64_t *)buf;
+    size_t i;
+
+    for (i = 0; i < len / 8; i++) {
+	h ^= w[i] * 0x9E3779B97F4A7C15ULL;
+	h = ((h << 31) | (h >> 33)) * 0xff51afd7ed558ccdULL;
+    }
+    return h;
+}
+
+/*
+ * Writing: the entries are gathered and sorted by the bucket they'd have
+ * in a table of hsh_num_buckets, which is what the loader allocates, and
+ * every thread streams one part of them to the file in HT_SNAP_CHUNK
+ * writes. The index and the header go last, and the file is renamed into
+ * place only once it's all synced, so a crash leaves the old snapshot.
+ */
+typedef struct {
+    size_t hsi_key;
+    size_t hsi_size;
+    void  *hsi_addr;
+} ht_snap_item_t;
+
+typedef struct {
+    int                   hsw_fd;
+    const ht_snap_item_t *hsw_items;
+    size_t                hsw_first;	/* items first to last */
+    size_t                hsw_last;
+    uint64_t              hsw_offset;
+    char                 *hsw_buf;
+    size_t                hsw_fill;
+    uint64_t              hsw_checksum;
+    int                   hsw_error;
+} ht_snap_writer_t;
+
+typedef void (*ht_snap_visit_fn)(void *arg, const ht_bucket_t *htb);
+
+/* Both arrays, if the table is resizing */
+static void ht_snap_walk(hashtable_t *ht_ptr, ht_snap_visit_fn visit,
+			 void *arg) {
+
+    ht_bucket_t *arrays[2] = {ht_ptr->ht_buckets, ht_ptr->ht_old_buckets};
+    size_t sizes[2] = {ht_ptr->ht_size, ht_ptr->ht_old_size}, i;
+    const ht_bucket_t *htb;
+    int a;
+
+    for (a = 0; a < 2; a++) {
+	if (arrays[a] == NULL)
+	    continue;
+	for (i = 0; i < sizes[a]; i++) {
+	    if (arrays[a][i].htb_key == 0)
+		continue;
+	    for (htb = &arrays[a][i]; htb != NULL; htb = htb->htb_next)
+		visit(arg, htb);
+	}
+    }
+}
+
+typedef struct {
+    uint64_t        hsc_num_buckets;
+    uint64_t       *hsc_first;		/* of each bucket's items */
+    uint64_t       *hsc_index;		/* of each bucket's entries */
+    ht_snap_item_t *hsc_items;
+    size_t          hsc_num_items;
+} ht_snap_collect_t;
+
+/* Counts go one bucket up, so that the sums end up where they belong */
+static void ht_snap_count(void *arg, const ht_bucket_t *htb) {
+
+    ht_snap_collect_t *sc = (ht_snap_collect_t *)arg;
+    uint64_t b = htb->htb_key % sc->hsc_num_buckets;
+
+    sc->hsc_first[b + 1]++;
+    sc->hsc_index[b + 1] += HT_SNAP_ENTRY_BYTES(HTB_SIZE(htb));
+    sc->hsc_num_items++;
+}
+
+/* hsc_first is the next free slot of each bucket until it's all placed */
+static void ht_snap_place(void *arg, const ht_bucket_t *htb) {
+
+    ht_snap_collect_t *sc = (ht_snap_collect_t *)arg;
+    ht_snap_item_t *it;
+
+    it = &sc->hsc_items[sc->hsc_first[htb->htb_key % sc->hsc_num_buckets]++];
+    it->hsi_key = htb->htb_key;
+    it->hsi_size = HTB_SIZE(htb);
+    it->hsi_addr = htb->htb_value_address;
+}
+
+static int ht_snap_pwrite(int fd, const void *buf, size_t len, uint64_t off) {
+
+    ssize_t ret;
+
+    while (len > 0) {
+	if ((ret = pwrite(fd, buf, len, off)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return errno;
+	}
+	buf = (const char *)buf + ret;
+	len -= ret;
+	off += ret;
+    }
+    return 0;
+}
+
+static void ht_snap_flush(ht_snap_writer_t *w) {
+
+    int err;
+
+    if (w->hsw_fill == 0 || w->hsw_error != 0)
+	return;
+    w->hsw_checksum = ht_snap_checksum(w->hsw_checksum, w->hsw_buf,
+				       w->hsw_fill);
+    if ((err = ht_snap_pwrite(w->hsw_fd, w->hsw_buf, w->hsw_fill,
+			      w->hsw_offset)) != 0)
+	w->hsw_error = err;
+    w->hsw_offset += w->hsw_fill;
+    w->hsw_fill = 0;
+}
+
+/* Values larger than the buffer go through it a piece at a time */
+static void ht_snap_append(ht_snap_writer_t *w, const void *src, size_t len) {
+
+    size_t n;
+
+    while (len > 0) {
+	n = HT_SNAP_CHUNK - w->hsw_fill;
+	if (n > len)
+	    n = len;
+	memcpy(w->hsw_buf + w->hsw_fill, src, n);
+	w->hsw_fill += n;
+	src = (const char *)src + n;
+	len -= n;
+	if (w->hsw_fill == HT_SNAP_CHUNK)
+	    ht_snap_flush(w);
+    }
+}
+
+static void *ht_snap_write_part(void *arg) {
+
+    static const char zeros[8];
+    ht_snap_writer_t *w = (ht_snap_writer_t *)arg;
+    const ht_snap_item_t *it;
+    ht_snap_entry_t entry;
+    size_t i;
+
+    w->hsw_checksum = HT_SNAP_SEED;
+    for (i = w->hsw_first; i < w->hsw_last && w->hsw_error == 0; i++) {
+	it = &w->hsw_items[i];
+	entry.hse_key = it->hsi_key;
+	entry.hse_size = it->hsi_size;
+	ht_snap_append(w, &entry, sizeof(entry));
+	ht_snap_append(w, it->hsi_addr, it->hsi_size);
+	ht_snap_append(w, zeros, ALIGN_UP(it->hsi_size, 8) - it->hsi_size);
+    }
+    ht_snap_flush(w);
+    return NULL;
+}
+
+/*
+ * Parts of about the same number of bytes, cut at bucket boundaries. A
+ * part may be empty.
+ */
+static void ht_snap_cut_parts(ht_snap_header_t *hdr, const uint64_t *index,
+			      int num_parts) {
+
+    uint64_t data = index[0], total = index[hdr->hsh_num_buckets] - data, b;
+    int p;
+
+    hdr->hsh_num_parts = num_parts;
+    for (p = 0, b = 0; p < num_parts; p++) {
+	while (b < hdr->hsh_num_buckets &&
+	       index[b] - data < total / num_parts * p)
+	    b++;
+	hdr->hsh_parts[p].hsp_first_bucket = b;
+	hdr->hsh_parts[p].hsp_offset = index[b];
+    }
+    for (p = 0; p < num_parts; p++)
+	hdr->hsh_parts[p].hsp_length =
+	    (p + 1 < num_parts ? hdr->hsh_parts[p + 1].hsp_offset :
+	     index[hdr->hsh_num_buckets]) - hdr->hsh_parts[p].hsp_offset;
+}
+
+ssize_t ht_snapshot_write(hashtable_t *ht_ptr, const char *path,
+			  int threads) {
+
+    ht_snap_collect_t sc;
+    ht_snap_header_t hdr;
+    ht_snap_writer_t w[HT_SNAP_MAX_THREADS];
+    pthread_t tids[HT_SNAP_MAX_THREADS];
+    uint64_t b, data;
+    char tmp_path[4096];
+    int fd, p, ret;
+
+    if (threads < 1)
+	threads = 1;
+    if (threads > HT_SNAP_MAX_THREADS)
+	threads = HT_SNAP_MAX_THREADS;
+    memset(&sc, 0, sizeof(sc));
+    sc.hsc_num_buckets = ht_ptr->ht_items < HT_SNAP_MIN_BUCKETS ?
+	HT_SNAP_MIN_BUCKETS : ht_ptr->ht_items;
+    sc.hsc_first = (uint64_t *)calloc(sc.hsc_num_buckets + 1,
+				      sizeof(uint64_t));
+    sc.hsc_index = (uint64_t *)calloc(sc.hsc_num_buckets + 1,
+				      sizeof(uint64_t));
+    if (sc.hsc_first == NULL || sc.hsc_index == NULL)
+	EXIT_MSG("Could not allocate the index of %" PRIu64 " buckets\n",
+		 sc.hsc_num_buckets);
+
+    ht_snap_walk(ht_ptr, ht_snap_count, &sc);
+    if ((sc.hsc_items = (ht_snap_item_t *)malloc(
+	     (sc.hsc_num_items + 1) * sizeof(ht_snap_item_t))) == NULL)
+	EXIT_MSG("Could not allocate %zu snapshot items\n", sc.hsc_num_items);
+    data = ALIGN_UP(HT_SNAP_ALIGN +
+		    (sc.hsc_num_buckets + 1) * sizeof(uint64_t),
+		    HT_SNAP_ALIGN);
+    sc.hsc_index[0] = data;
+    for (b = 0; b < sc.hsc_num_buckets; b++) {
+	sc.hsc_first[b + 1] += sc.hsc_first[b];
+	sc.hsc_index[b + 1] += sc.hsc_index[b];
+    }
+    ht_snap_walk(ht_ptr, ht_snap_place, &sc);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.hsh_magic, HT_SNAP_MAGIC, sizeof(hdr.hsh_magic));
+    hdr.hsh_version = HT_SNAP_VERSION;
+    hdr.hsh_file_size = sc.hsc_index[sc.hsc_num_buckets];
+    hdr.hsh_num_buckets = sc.hsc_num_buckets;
+    hdr.hsh_items = sc.hsc_num_items;
+    hdr.hsh_index = HT_SNAP_ALIGN;
+    ht_snap_cut_parts(&hdr, sc.hsc_index, threads);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	EXIT_MSG("Could not open %s: %s\n", tmp_path, strerror(errno));
+    if (ftruncate(fd, hdr.hsh_file_size) != 0)
+	EXIT_MSG("Could not size %s to %" PRIu64 " bytes: %s\n", tmp_path,
+		 hdr.hsh_file_size, strerror(errno));
+
+    /* After the sort, hsc_first[b] is where bucket b + 1 starts */
+    for (p = 0; p < threads; p++) {
+	b = hdr.hsh_parts[p].hsp_first_bucket;
+	memset(&w[p], 0, sizeof(w[p]));
+	w[p].hsw_fd = fd;
+	w[p].hsw_items = sc.hsc_items;
+	w[p].hsw_first = b == 0 ? 0 : sc.hsc_first[b - 1];
+	w[p].hsw_offset = hdr.hsh_parts[p].hsp_offset;
+	if ((w[p].hsw_buf = (char *)malloc(HT_SNAP_CHUNK)) == NULL)
+	    EXIT_MSG("Could not allocate a write buffer\n");
+    }
+    for (p = 0; p < threads; p++) {
+	w[p].hsw_last = p + 1 < threads ? w[p + 1].hsw_first :
+	    sc.hsc_num_items;
+	ret = pthread_create(&tids[p], NULL, ht_snap_write_part, &w[p]);
+	if (ret != 0)
+	    EXIT_MSG("pthread_create for %dth writer failed: %s\n", p,
+		     strerror(ret));
+    }
+    for (p = 0; p < threads; p++) {
+	pthread_join(tids[p], NULL);
+	if (w[p].hsw_error != 0)
+	    EXIT_MSG("Could not write %s: %s\n", tmp_path,
+		     strerror(w[p].hsw_error));
+	hdr.hsh_parts[p].hsp_checksum = w[p].hsw_checksum;
+	free(w[p].hsw_buf);
+    }
+
+    hdr.hsh_index_checksum = ht_snap_checksum(
+	HT_SNAP_SEED, sc.hsc_index, (sc.hsc_num_buckets + 1) * sizeof(uint64_t));
+    hdr.hsh_checksum = ht_snap_checksum(HT_SNAP_SEED, &hdr,
+					offsetof(ht_snap_header_t,
+						 hsh_checksum));
+    if ((ret = ht_snap_pwrite(fd, sc.hsc_index,
+			      (sc.hsc_num_buckets + 1) * sizeof(uint64_t),
+			      hdr.hsh_index)) != 0 ||
+	(ret = ht_snap_pwrite(fd, &hdr, sizeof(hdr), 0)) != 0)
+	EXIT_MSG("Could not write %s: %s\n", tmp_path, strerror(ret));
+    if (fsync(fd) != 0)
+	EXIT_MSG("Could not sync %s: %s\n", tmp_path, strerror(errno));
+    close(fd);
+    if (rename(tmp_path, path) != 0)
+	EXIT_MSG("Could not rename %s to %s: %s\n", tmp_path, path,
+		 strerror(errno));
+
+    free(sc.hsc_first);
+    free(sc.hsc_index);
+    free(sc.hsc_items);
+    return hdr.hsh_file_size;
+}
+
+/*
+ * Reading. The header and the index are always checked, and a bad one
+ * makes the open fail; the entries only with verify, since that reads
+ * the whole file.
+ */
+static int ht_snap_check_part(ht_snap_t *snap, int p) {
+
+    ht_snap_part_t *part = &snap->hs_header->hsh_parts[p];
+
+    return ht_snap_checksum(HT_SNAP_SEED, snap->hs_base + part->hsp_offset,
+			    part->hsp_length) == part->hsp_checksum ? 0 : -1;
+}
+
+ht_snap_t *ht_snap_open(const char *path, int verify) {
+
+    ht_snap_header_t *hdr;
+    ht_snap_t *snap;
+    struct stat st;
+    uint64_t p, end;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+	EXIT_MSG("Could not open %s: %s\n", path, strerror(errno));
+    if (fstat(fd, &st) != 0)
+	EXIT_MSG("Could not stat %s: %s\n", path, strerror(errno));
+    if ((size_t)st.st_size < HT_SNAP_ALIGN) {
+	printf("%s is too short for a snapshot\n", path);
+	close(fd);
+	return NULL;
+    }
+    if ((snap = (ht_snap_t *)calloc(1, sizeof(ht_snap_t))) == NULL)
+	EXIT_MSG("Could not allocate a snapshot\n");
+    snap->hs_size = st.st_size;
+    snap->hs_base = (char *)mmap(NULL, snap->hs_size, PROT_READ, MAP_SHARED,
+				 fd, 0);
+    if (snap->hs_base == MAP_FAILED)
+	EXIT_MSG("Could not map %s: %s\n", path, strerror(errno));
+    close(fd);
+    hdr = snap->hs_header = (ht_snap_header_t *)snap->hs_base;
+    snap->hs_index = (uint64_t *)(snap->hs_base + hdr->hsh_index);
+
+    if (memcmp(hdr->hsh_magic, HT_SNAP_MAGIC, sizeof(hdr->hsh_magic)) != 0 ||
+	hdr->hsh_version != HT_SNAP_VERSION ||
+	hdr->hsh_checksum != ht_snap_checksum(HT_SNAP_SEED, hdr,
+					      offsetof(ht_snap_header_t,
+						       hsh_checksum)) ||
+	hdr->hsh_file_size != snap->hs_size ||
+	hdr->hsh_num_parts < 1 || hdr->hsh_num_parts > HT_SNAP_MAX_THREADS ||
+	hdr->hsh_index != HT_SNAP_ALIGN ||
+	hdr->hsh_num_buckets >=
+	(snap->hs_size - HT_SNAP_ALIGN) / sizeof(uint64_t))
+	goto bad;
+    if (ht_snap_checksum(HT_SNAP_SEED, snap->hs_index,
+			 (hdr->hsh_num_buckets + 1) * sizeof(uint64_t)) !=
+	hdr->hsh_index_checksum ||
+	snap->hs_index[hdr->hsh_num_buckets] != snap->hs_size)
+	goto bad;
+    for (p = 0; p < hdr->hsh_num_parts; p++) {
+	end = hdr->hsh_parts[p].hsp_offset + hdr->hsh_parts[p].hsp_length;
+	if (hdr->hsh_parts[p].hsp_first_bucket > hdr->hsh_num_buckets ||
+	    hdr->hsh_parts[p].hsp_offset !=
+	    snap->hs_index[hdr->hsh_parts[p].hsp_first_bucket] ||
+	    end > snap->hs_size || (verify && ht_snap_check_part(snap, p) != 0))
+	    goto bad;
+    }
+    return snap;
+
+bad:
+    printf("%s is not a snapshot, or a damaged one\n", path);
+    ht_snap_close(snap);
+    return NULL;
+}
+
+void ht_snap_close(ht_snap_t *snap) {
+
+    munmap(snap->hs_base, snap->hs_size);
+    free(snap);
+}
+
+size_t ht_snap_items(ht_snap_t *snap) {
+
+    return snap->hs_header->hsh_items;
+}
+
+/* Straight from the mapping: the value is read-only */
+void *ht_snap_get(ht_snap_t *snap, size_t key, size_t *size) {
+
+    uint64_t b = key % snap->hs_header->hsh_num_buckets;
+    char *p = snap->hs_base + snap->hs_index[b];
+    char *end = snap->hs_base + snap->hs_index[b + 1];
+    ht_snap_entry_t *entry;
+
+    for (; p < end; p += HT_SNAP_ENTRY_BYTES(entry->hse_size)) {
+	entry = (ht_snap_entry_t *)p;
+	if (entry->hse_key == key) {
+	    *size = entry->hse_size;
+	    return entry + 1;
+	}
+    }
+    return NULL;
+}
+
+void ht_snap_print(ht_snap_t *snap) {
+
+    ht_snap_header_t *hdr = snap->hs_header;
+    uint64_t p;
+
+    printf("Snapshot of %" PRIu64 " items in %" PRIu64 " buckets, %" PRIu64
+	   " bytes, %" PRIu64 " parts:\n", hdr->hsh_items,
+	   hdr->hsh_num_buckets, hdr->hsh_file_size, hdr->hsh_num_parts);
+    for (p = 0; p < hdr->hsh_num_parts; p++)
+	printf("\tbuckets from %" PRIu64 ", %" PRIu64 " bytes at %" PRIu64
+	       "\n", hdr->hsh_parts[p].hsp_first_bucket,
+	       hdr->hsh_parts[p].hsp_length, hdr->hsh_parts[p].hsp_offset);
+}
+
+/*
+ * Loading: the table gets exactly the snapshot's buckets, so every part
+ * fills its own range of them and the threads need no locks. Each thread
+ * checks the parts it loads as it goes.
+ */
+typedef struct {
+    ht_snap_t   *hsl_snap;
+    hashtable_t *hsl_ht;
+    int          hsl_tid;
+    int          hsl_threads;
+    size_t       hsl_items;
+    size_t       hsl_bytes;
+    int          hsl_error;
+} ht_snap_loader_t;
+
+static int ht_snap_load_part(ht_snap_loader_t *l, uint64_t p) {
+
+    ht_snap_header_t *hdr = l->hsl_snap->hs_header;
+    ht_snap_part_t *part = &hdr->hsh_parts[p];
+    char *pos = l->hsl_snap->hs_base + part->hsp_offset;
+    char *end = pos + part->hsp_length;
+    uint64_t last_bucket, h = HT_SNAP_SEED, len, b;
+    ht_snap_entry_t *entry;
+    void *addr;
+
+    last_bucket = p + 1 < hdr->hsh_num_parts ?
+	hdr->hsh_parts[p + 1].hsp_first_bucket : hdr->hsh_num_buckets;
+    while (pos < end) {
+	entry = (ht_snap_entry_t *)pos;
+	if (end - pos < (ssize_t)sizeof(*entry) ||
+	    entry->hse_size > (uint64_t)(end - pos) - sizeof(*entry))
+	    return -1;
+	len = HT_SNAP_ENTRY_BYTES(entry->hse_size);
+	b = entry->hse_key % hdr->hsh_num_buckets;
+	if (entry->hse_key == 0 || b < part->hsp_first_bucket ||
+	    b >= last_bucket)
+	    return -1;
+	h = ht_snap_checksum(h, pos, len);
+	if ((addr = ht_put_in_bucket(l->hsl_ht, entry->hse_key,
+				     entry->hse_size)) == NULL)
+	    return -1;
+	memcpy(addr, entry + 1, entry->hse_size);
+	l->hsl_items++;
+	l->hsl_bytes += entry->hse_size;
+	pos += len;
+    }
+    return h == part->hsp_checksum ? 0 : -1;
+}
+
+static void *ht_snap_load_parts(void *arg) {
+
+    ht_snap_loader_t *l = (ht_snap_loader_t *)arg;
+    uint64_t p;
+
+    for (p = l->hsl_tid; p < l->hsl_snap->hs_header->hsh_num_parts;
+	 p += l->hsl_threads)
+	if (ht_snap_load_part(l, p) != 0) {
+	    l->hsl_error = 1;
+	    break;
+	}
+    return NULL;
+}
+
+hashtable_t *ht_snapshot_load(const char *path, int threads) {
+
+    ht_snap_loader_t l[HT_SNAP_MAX_THREADS];
+    pthread_t tids[HT_SNAP_MAX_THREADS];
+    hashtable_t *ht_ptr;
+    ht_snap_t *snap;
+    size_t items = 0, bytes = 0;
+    int t, ret, error = 0;
+
+    if ((snap = ht_snap_open(path, 0)) == NULL)
+	return NULL;
+    /* Appends to the log, and adds to the filter, take no lock */
+    if (threads < 1 || ht_use_vlog || ht_use_filter)
+	threads = 1;
+    if (threads > (int)snap->hs_header->hsh_num_parts)
+	threads = snap->hs_header->hsh_num_parts;
+    madvise(snap->hs_base, snap->hs_size, MADV_SEQUENTIAL);
+    if ((ht_ptr = ht_allocate(snap->hs_header->hsh_num_buckets)) == NULL)
+	EXIT_MSG("Could not allocate hash table of %" PRIu64 " buckets\n",
+		 snap->hs_header->hsh_num_buckets);
+    if (ht_ptr->ht_size != snap->hs_header->hsh_num_buckets) {
+	printf("%s has %" PRIu64 " buckets, the table %zu\n", path,
+	       snap->hs_header->hsh_num_buckets, ht_ptr->ht_size);
+	ht_destroy(ht_ptr);
+	ht_snap_close(snap);
+	return NULL;
+    }
+
+    for (t = 0; t < threads; t++) {
+	memset(&l[t], 0, sizeof(l[t]));
+	l[t].hsl_snap = snap;
+	l[t].hsl_ht = ht_ptr;
+	l[t].hsl_tid = t;
+	l[t].hsl_threads = threads;
+	ret = pthread_create(&tids[t], NULL, ht_snap_load_parts, &l[t]);
+	if (ret != 0)
+	    EXIT_MSG("pthread_create for %dth loader failed: %s\n", t,
+		     strerror(ret));
+    }
+    for (t = 0; t < threads; t++) {
+	pthread_join(tids[t], NULL);
+	error |= l[t].hsl_error;
+	items += l[t].hsl_items;
+	bytes += l[t].hsl_bytes;
+    }
+    ht_ptr->ht_items = items;
+    ht_ptr->ht_cache_bytes = bytes;
+    if (error || items != snap->hs_header->hsh_items) {
+	printf("%s is damaged\n", path);
+	ht_destroy(ht_ptr);
+	ht_ptr = NULL;
+    }
+    ht_snap_close(snap);
+    return ht_ptr;
+}
+
+/* The mapped design: gets served from the snapshot in ht_snap_path */
+static void *mapped_allocate(size_t num_items) {
+
+    (void)num_items;
+    return ht_snap_open(ht_snap_path, 0);
+}
+
+static void *mapped_get(void *ht, size_t key, size_t *size) {
+
+    return ht_snap_get((ht_snap_t *)ht, key, size);
+}
+
+/* A snapshot is never changed */
+static void *mapped_put(void *ht, size_t key, size_t size) {
+
+    (void)ht;
+    (void)key;
+    (void)size;
+    return NULL;
+}
+
+static void mapped_remove(void *ht, size_t key, size_t size) {
+
+    (void)ht;
+    (void)key;
+    (void)size;
+}
+
+static void mapped_print(void *ht) {
+
+    ht_snap_print((ht_snap_t *)ht);
+}
+
+static void mapped_destroy(void *ht) {
+
+    ht_snap_close((ht_snap_t *)ht);
+}
+
+const ht_ops_t ht_mapped_ops = {
+    "mapped", 1, mapped_allocate, mapped_get, mapped_put, mapped_remove,
+    mapped_print, mapped_destroy
+};
@@ -0,0 +1,129 @@
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "epoch.h"
+#include "hash_table.h"
+
+void *ht_view_get(const ht_ops_t *ops, void *ht, size_t key,
+		  ht_view_t *view) {
+
+    view->hv_key = key;
+    view->hv_priv = NULL;
+    epoch_enter();
+    if ((view->hv_addr = ops->hop_get(ht, key, &view->hv_size)) == NULL)
+	epoch_exit();
+    return view->hv_addr;
+}
+
+void ht_view_release(const ht_ops_t *ops, void *ht, ht_view_t *view) {
+
+    view->hv_addr = NULL;
+    epoch_exit();
+}
+
+void *ht_view_reserve(const ht_ops_t *ops, void *ht, size_t key,
+		      size_t size, ht_view_t *view) {
+
+    size_t old_size;
+
+    if (ops->hop_reserve != NULL)
+	return ops->hop_reserve(ht, key, size, view);
+    /* Another thread would see the key gone, then its new value unwritten */
+    if (ops->hop_thread_safe)
+	EXIT_MSG("The %s design has no write reservations\n", ops->hop_name);
+
+    view->hv_key = key;
+    view->hv_size = size;
+    view->hv_priv = NULL;
+    if (ops->hop_get(ht, key, &old_size) != NULL)
+	ops->hop_remove(ht, key, old_size);
+    return view->hv_addr = ops->hop_put(ht, key, size);
+}
+
+void ht_view_commit(const ht_ops_t *ops, void *ht, ht_view_t *view) {
+
+#if defined(__SSE2__)
+    _mm_sfence();
+#else
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+    if (ops->hop_commit != NULL)
+	ops->hop_commit(ht, view);
+    view->hv_addr = NULL;
+}
+
+void ht_view_abort(const ht_ops_t *ops, void *ht, ht_view_t *view) {
+
+    if (ops->hop_abort != NULL)
+	ops->hop_abort(ht, view);
+    else
+	ops->hop_remove(ht, view->hv_key, view->hv_size);
+    view->hv_addr = NULL;
+}
+
+/*
+ * Plain stores up to the first 16-byte boundary and after the last, and
+ * streaming ones in between, a cache line at a time while there are
+ * whole ones.
+ */
+void ht_stream_copy(void *dst, const void *src, size_t len) {
+
+#if defined(__SSE2__)
+    char *d = (char *)dst;
+    const char *s = (const char *)src;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    __m128i *out;
+
+    if (len < HT_STREAM_MIN) {
+	memcpy(dst, src, len);
+	return;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+    for (out = (__m128i *)d; len >= 64; len -= 64, out += 4, s += 64) {
+	_mm_stream_si128(out, _mm_loadu_si128((const __m128i *)s));
+	_mm_stream_si128(out + 1, _mm_loadu_si128((const __m128i *)s + 1));
+	_mm_stream_si128(out + 2, _mm_loadu_si128((const __m128i *)s + 2));
+	_mm_stream_si128(out + 3, _mm_loadu_si128((const __m128i *)s + 3));
+    }
+    for (; len >= 16; len -= 16, out++, s += 16)
+	_mm_stream_si128(out, _mm_loadu_si128((const __m128i *)s));
+    memcpy(out, s, len);
+#else
+    memcpy(dst, src, len);
+#endif
+}
+
+void ht_stream_set(void *dst, int c, size_t len) {
+
+#if defined(__SSE2__)
+    char *d = (char *)dst;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    __m128i v = _mm_set1_epi8((char)c), *out;
+
+    if (len < HT_STREAM_MIN) {
+	memset(dst, c, len);
+	return;
+    }
+    memset(d, c, head);
+    len -= head;
+    for (out = (__m128i *)(d + head); len >= 64; len -= 64, out += 4) {
+	_mm_stream_si128(out, v);
+	_mm_stream_si128(out + 1, v);
+	_mm_stream_si128(out + 2, v);
+	_mm_stream_si128(out + 3, v);
+    }
+    for (; len >= 16; len -= 16, out++)
+	_mm_stream_si128(out, v);
+    memset(out, c, len);
+#else
+    memset(dst, c, len);
+#endif
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+
+#include "latency_hist.h"
+
+void
+lat_hist_merge(latency_hist_t *dst, const latency_hist_t *src) {
+
+    int i;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        dst->lh_buckets[i] += src->lh_buckets[i];
+    dst->lh_count += src->lh_count;
+    dst->lh_sum += src->lh_sum;
+    if (src->lh_max > dst->lh_max)
+        dst->lh_max = src->lh_max;
+}
+
+/* The middle of the bucket's range */
+static uint64_t
+bucket_value(int idx) {
+
+    int shift;
+    uint64_t lower;
+
+    if (idx < LAT_HIST_SUB)
+        return idx;
+    shift = idx / LAT_HIST_SUB - 1;
+    lower = (uint64_t)(LAT_HIST_SUB + idx % LAT_HIST_SUB) << shift;
+    return lower + ((1ULL << shift) >> 1);
+}
+
+/* Percentile is between 0 and 100 */
+uint64_t
+lat_hist_percentile(const latency_hist_t *h, double percentile) {
+
+    uint64_t rank, seen = 0;
+    int i;
+
+    if (h->lh_count == 0)
+        return 0;
+    rank = (uint64_t)(percentile / 100.0 * h->lh_count);
+    if (rank >= h->lh_count)
+        return h->lh_max;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+        seen += h->lh_buckets[i];
+        if (seen > rank)
+            break;
+    }
+    /* Never report more than we've actually seen */
+    return (bucket_value(i) < h->lh_max) ? bucket_value(i) : h->lh_max;
+}
+
+void
+lat_hist_print(const latency_hist_t *h, const char *prefix) {
+
+    if (h->lh_count == 0)
+        return;
+    printf("%slatency (us): avg %.2f, p50 %.2f, p90 %.2f, p99 %.2f, "
+           "p99.9 %.2f, max %.2f\n", prefix,
+           (double)h->lh_sum / h->lh_count / 1000,
+           lat_hist_percentile(h, 50) / 1000.0,
+           lat_hist_percentile(h, 90) / 1000.0,
+           lat_hist_percentile(h, 99) / 1000.0,
+           lat_hist_percentile(h, 99.9) / 1000.0,
+           h->lh_max / 1000.0);
+}
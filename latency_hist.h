@@ -0,0 +1,50 @@
+#ifndef _LATENCY_HIST_H
+#define _LATENCY_HIST_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/*
+ * A log-linear latency histogram: every power-of-two range of
+ * nanoseconds is split into 16 equal sub-buckets, so a percentile is
+ * within about 6% of the true value. Cheap enough to record every
+ * operation.
+ */
+#define LAT_HIST_SUB_BITS 4
+#define LAT_HIST_SUB (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS (64 * LAT_HIST_SUB)
+
+typedef struct {
+    uint64_t lh_count;
+    uint64_t lh_sum;
+    uint64_t lh_max;
+    uint64_t lh_buckets[LAT_HIST_BUCKETS];
+} latency_hist_t;
+
+static inline int
+lat_hist_index(uint64_t ns) {
+
+    int msb, shift;
+
+    if (ns < LAT_HIST_SUB)
+        return (int)ns;
+    msb = 63 - __builtin_clzll(ns);
+    shift = msb - LAT_HIST_SUB_BITS;
+    return (shift + 1) * LAT_HIST_SUB + (int)((ns >> shift) & (LAT_HIST_SUB - 1));
+}
+
+static inline void
+lat_hist_record(latency_hist_t *h, uint64_t ns) {
+
+    h->lh_buckets[lat_hist_index(ns)]++;
+    h->lh_count++;
+    h->lh_sum += ns;
+    if (ns > h->lh_max)
+        h->lh_max = ns;
+}
+
+void     lat_hist_merge(latency_hist_t *dst, const latency_hist_t *src);
+uint64_t lat_hist_percentile(const latency_hist_t *h, double percentile);
+void     lat_hist_print(const latency_hist_t *h, const char *prefix);
+
+#endif
@@ -1,14 +1,15 @@
 #include <sys/types.h>
 #include <errno.h>
+#include <getopt.h>
 #include <inttypes.h>
-#include <jemalloc/jemalloc.h>
-#include <memkind.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-const char DEFAULT_MEMKIND_PATH[] = "/mnt/pmem/sasha";
+#include "allocator.h"
+
+const char DEFAULT_ALLOCATOR[] = "pmem:/mnt/pmem/sasha";
 
 #define DEFAULT_ALLOC_SIZE_GB 230
 #define DEFAULT_BLOCK_SIZE_KB 28
@@ -32,20 +33,38 @@ int jemalloc_info() {
 
 int main(int argc, char **argv) {
 
-    struct memkind *pmem_kind = NULL;
-    char error_message[MEMKIND_ERROR_MESSAGE_SIZE];
-    int err;
+    allocator_t *al;
+    char error_message[AL_ERROR_SIZE];
+    const char *spec = DEFAULT_ALLOCATOR;
+    int c, option_index;
     size_t metadata = 0, sz = sizeof(size_t);
     u_int64_t block_size, i, num_blocks, total_size;
     void **allocated_addresses;
 
-    if (argc == 3) {
-	block_size = atoi(argv[1]) * KB;
-	total_size = atoi(argv[2]) * GB;
+    static struct option long_options[] =
+	{
+	    {"allocator", required_argument, 0, 'a'},
+	    {0, 0, 0, 0}
+	};
+
+    while ((c = getopt_long(argc, argv, "a:", long_options,
+			    &option_index)) != -1) {
+	if (c != 'a') {
+	    printf("usage: %s [--allocator=SPEC] [<block size in KB> "
+		   "<total memory in GB>]\nSPEC is one of %s; defaults to "
+		   "%s.\n", argv[0], al_names(), DEFAULT_ALLOCATOR);
+	    _exit(-1);
+	}
+	spec = optarg;
+    }
+
+    if (argc - optind == 2) {
+	block_size = atoi(argv[optind]) * KB;
+	total_size = atoi(argv[optind + 1]) * GB;
 
 	if (block_size <= 0 || block_size / GB > MAX_CAPACITY_GB) {
-	    printf("usage: %s <block size in KB> <total memory in GB>\n",
-		argv[0]);
+	    printf("usage: %s [--allocator=SPEC] <block size in KB> "
+		   "<total memory in GB>\n", argv[0]);
 	    _exit(-1);
 	}
     }
@@ -54,8 +73,8 @@ int main(int argc, char **argv) {
 	total_size = DEFAULT_ALLOC_SIZE_GB * GB;
     }
 
-    if(memkind_create_pmem(DEFAULT_MEMKIND_PATH, 0, &pmem_kind)) {
-	memkind_error_message(err, error_message, MEMKIND_ERROR_MESSAGE_SIZE);
+    if ((al = al_open(spec, error_message, sizeof(error_message))) == NULL) {
+	printf("%s\n", error_message);
 	_exit(-1);
     }
 
@@ -72,7 +91,7 @@ int main(int argc, char **argv) {
 	if ( i % 1024 == 0)
 	    printf("Allocating block %" PRIu64 " of %" PRIu64 ".\n",
 		   i, num_blocks);
-	allocated_addresses[i] = (void*) memkind_malloc(pmem_kind, block_size);
+	allocated_addresses[i] = al_malloc(al, block_size);
 	if (allocated_addresses[i] == NULL) {
 	    printf("Ran out of memory after %zu blocks (%zu bytes).\n", i, i*block_size);
 	    break;
@@ -90,7 +109,7 @@ int main(int argc, char **argv) {
 	    printf("Freeing block %" PRIu64 " of %" PRIu64 ".\n",
 		   i, num_blocks);
 	if (allocated_addresses[i] != NULL)
-	    memkind_free(pmem_kind, allocated_addresses[i]);
+	    al_free(al, allocated_addresses[i]);
     }
 
 }
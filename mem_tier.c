@@ -0,0 +1,243 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem_tier.h"
+
+#define BYTES_IN_MB (1024 * 1024)
+
+#define LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define ADD(ptr, val) __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED)
+#define SUB(ptr, val) __atomic_fetch_sub(ptr, val, __ATOMIC_RELAXED)
+
+allocator_t *mt_dram_al = NULL;
+struct memkind *pmem_kind = NULL;
+__thread struct memkind *ht_local_kind = NULL;
+
+/* The old behaviour: everything from pmem_kind */
+int mt_policy = MT_PMEM;
+size_t mt_size_threshold = 0;
+size_t mt_dram_budget = 0;
+uint32_t mt_promote_hits = 0;
+
+mt_stats_t mt_stats;
+
+static const char *mt_policy_names[MT_POLICIES] = {"dram", "pmem", "split",
+						   "size"};
+
+static inline struct memkind *mt_pmem_kind(void) {
+
+    return ht_local_kind != NULL ? ht_local_kind : pmem_kind;
+}
+
+int mt_parse_policy(const char *spec) {
+
+    int i;
+
+    for (i = 0; i < MT_POLICIES; i++)
+	if (i != MT_SIZE && strcmp(spec, mt_policy_names[i]) == 0)
+	    break;
+    if (i == MT_POLICIES) {
+	if (strncmp(spec, "size:", 5) != 0 || spec[5] == '\0')
+	    return -1;
+	mt_size_threshold = strtoul(spec + 5, NULL, 10);
+	i = MT_SIZE;
+    }
+    mt_policy = i;
+    return 0;
+}
+
+/*
+ * memkind can only tell what it allocated itself, so with a DRAM
+ * allocator of another's every allocation carries its PMEM kind, or NULL
+ * for DRAM, in a header. pmem_kind is there before the first allocation.
+ */
+static inline size_t mt_header(void) {
+
+    return pmem_kind != NULL && mt_dram_al->al_kind == NULL ? MT_HEADER : 0;
+}
+
+/*
+ * Count what we got by its usable size, which is what we'll free.
+ * MEMKIND_DEFAULT stands for the DRAM tier, whatever mt_dram_al is.
+ */
+static void *mt_alloc(struct memkind *kind, size_t size, int class,
+		      int zero) {
+
+    size_t header = mt_header(), usable;
+    char *ptr;
+
+    if (kind == MEMKIND_DEFAULT) {
+	ptr = zero ? al_calloc(mt_dram_al, size + header) :
+	    al_malloc(mt_dram_al, size + header);
+	if (ptr == NULL)
+	    return NULL;
+	usable = al_usable_size(mt_dram_al, ptr);
+	ADD(&mt_stats.mts_dram_bytes[class], usable);
+    } else {
+	ptr = zero ? memkind_calloc(kind, 1, size + header) :
+	    memkind_malloc(kind, size + header);
+	if (ptr == NULL)
+	    return NULL;
+	usable = memkind_malloc_usable_size(kind, ptr);
+	ADD(&mt_stats.mts_pmem_bytes[class], usable);
+    }
+    ADD(&mt_stats.mts_requested, size);
+    ADD(&mt_stats.mts_allocated, usable);
+    if (header == 0)
+	return ptr;
+    *(struct memkind **)ptr = kind == MEMKIND_DEFAULT ? NULL : kind;
+    return ptr + header;
+}
+
+/* The PMEM kind ptr is from, or NULL if it's from DRAM */
+static struct memkind *mt_pmem_kind_of(void *ptr) {
+
+    struct memkind *kind;
+
+    if (pmem_kind == NULL)
+	return NULL;
+    if (mt_header() != 0)
+	return *(struct memkind **)((char *)ptr - MT_HEADER);
+    kind = memkind_detect_kind(ptr);
+    if (kind == MEMKIND_DEFAULT || kind == mt_dram_al->al_kind)
+	return NULL;
+    return kind;
+}
+
+static void mt_free(void *ptr, int class) {
+
+    struct memkind *kind;
+
+    if (ptr == NULL)
+	return;
+    kind = mt_pmem_kind_of(ptr);
+    ptr = (char *)ptr - mt_header();
+    if (kind == NULL) {
+	SUB(&mt_stats.mts_dram_bytes[class], al_usable_size(mt_dram_al, ptr));
+	al_free(mt_dram_al, ptr);
+	return;
+    }
+    SUB(&mt_stats.mts_pmem_bytes[class],
+	memkind_malloc_usable_size(kind, ptr));
+    memkind_free(kind, ptr);
+}
+
+static inline int mt_dram_fits(size_t size) {
+
+    return mt_dram_budget == 0 ||
+	LOAD(&mt_stats.mts_dram_bytes[MT_DATA]) + size <= mt_dram_budget;
+}
+
+/* Where size bytes of values of value_size bytes each would go */
+static struct memkind *mt_data_kind(size_t value_size, size_t size) {
+
+    int dram = mt_policy == MT_DRAM ||
+	(mt_policy == MT_SIZE && value_size < mt_size_threshold);
+
+    return dram && mt_dram_fits(size) ? MEMKIND_DEFAULT : mt_pmem_kind();
+}
+
+static inline struct memkind *mt_metadata_kind(void) {
+
+    return mt_policy == MT_PMEM ? mt_pmem_kind() : MEMKIND_DEFAULT;
+}
+
+void *mt_alloc_data(size_t size) {
+
+    return mt_alloc(mt_data_kind(size, size), size, MT_DATA, 0);
+}
+
+void *mt_alloc_metadata(size_t size) {
+
+    return mt_alloc(mt_metadata_kind(), size, MT_METADATA, 0);
+}
+
+void *mt_calloc_metadata(size_t num, size_t size) {
+
+    return mt_alloc(mt_metadata_kind(), num * size, MT_METADATA, 1);
+}
+
+void *mt_alloc_block(int class, size_t object_size, size_t size) {
+
+    if (class == MT_METADATA)
+	return mt_alloc_metadata(size);
+    return mt_alloc(mt_data_kind(object_size, size), size, MT_DATA, 0);
+}
+
+void mt_free_data(void *ptr) {
+
+    mt_free(ptr, MT_DATA);
+}
+
+void mt_free_metadata(void *ptr) {
+
+    mt_free(ptr, MT_METADATA);
+}
+
+int mt_in_dram(void *ptr) {
+
+    return mt_pmem_kind_of(ptr) == NULL;
+}
+
+static void *mt_move(void *ptr, size_t size, struct memkind *kind) {
+
+    void *new_ptr;
+
+    if ((new_ptr = mt_alloc(kind, size, MT_DATA, 0)) == NULL)
+	return NULL;
+    memcpy(new_ptr, ptr, size);
+    mt_free(ptr, MT_DATA);
+    return new_ptr;
+}
+
+void *mt_promote(void *ptr, size_t size) {
+
+    void *new_ptr;
+
+    if (!mt_dram_fits(size)) {
+	ADD(&mt_stats.mts_refused, 1);
+	return NULL;
+    }
+    if ((new_ptr = mt_move(ptr, size, MEMKIND_DEFAULT)) != NULL)
+	ADD(&mt_stats.mts_promotions, 1);
+    return new_ptr;
+}
+
+void *mt_demote(void *ptr, size_t size) {
+
+    void *new_ptr;
+
+    if ((new_ptr = mt_move(ptr, size, mt_pmem_kind())) != NULL)
+	ADD(&mt_stats.mts_demotions, 1);
+    return new_ptr;
+}
+
+/* Keep a sixteenth of the budget free for promotions */
+int mt_dram_short(void) {
+
+    return mt_dram_budget != 0 &&
+	LOAD(&mt_stats.mts_dram_bytes[MT_DATA]) + mt_dram_budget / 16 >
+	mt_dram_budget;
+}
+
+void mt_print_stats(void) {
+
+    printf("Placement %s: DRAM from %s %.1f MB values, %.1f MB metadata; "
+	   "PMEM %.1f MB values, %.1f MB metadata; %.1f%% allocator "
+	   "overhead\n",
+	   mt_policy_names[mt_policy], mt_dram_al->al_name,
+	   (double)mt_stats.mts_dram_bytes[MT_DATA] / BYTES_IN_MB,
+	   (double)mt_stats.mts_dram_bytes[MT_METADATA] / BYTES_IN_MB,
+	   (double)mt_stats.mts_pmem_bytes[MT_DATA] / BYTES_IN_MB,
+	   (double)mt_stats.mts_pmem_bytes[MT_METADATA] / BYTES_IN_MB,
+	   mt_stats.mts_requested ? 100.0 * (mt_stats.mts_allocated -
+	   mt_stats.mts_requested) / mt_stats.mts_requested : 0.0);
+    if (mt_promote_hits != 0)
+	printf("%" PRIu64 " promotions, %" PRIu64 " demotions, %" PRIu64
+	       " refused for the DRAM budget\n", mt_stats.mts_promotions,
+	       mt_stats.mts_demotions, mt_stats.mts_refused);
+}
@@ -0,0 +1,82 @@
+#ifndef _MEM_TIER_H
+#define _MEM_TIER_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#ifdef __linux__
+#include <memkind.h>
+#endif
+
+#include "allocator.h"
+
+/*
+ * Placement of the hash tables' memory on two tiers: DRAM, from
+ * mt_dram_al, and PMEM, from pmem_kind or the calling thread's
+ * ht_local_kind. A file-backed pmem kind on any filesystem will do to
+ * try it out. Frees tell the tiers apart by the kind memkind detects,
+ * so PMEM must be memkind's, and with no pmem_kind everything is DRAM.
+ * memkind knows only its own memory, so with a DRAM allocator that isn't
+ * memkind's each allocation keeps its kind in MT_HEADER bytes before it.
+ * The policy decides where new memory goes:
+ *
+ *   dram	everything in DRAM
+ *   pmem	everything in PMEM
+ *   split	metadata in DRAM, values in PMEM
+ *   size	metadata in DRAM, values of mt_size_threshold bytes or more
+ *		in PMEM and the smaller ones in DRAM
+ *
+ * Values never go over mt_dram_budget bytes of DRAM, if one is set; the
+ * rest spill to PMEM. Tables that count accesses can promote a value
+ * that has had mt_promote_hits of them to DRAM, and demote cold ones
+ * when the budget runs short, so that the hot values stay in DRAM.
+ */
+enum {MT_DRAM, MT_PMEM, MT_SPLIT, MT_SIZE, MT_POLICIES};
+/* Keeps what follows 16-byte aligned */
+#define MT_HEADER 16
+enum {MT_DATA, MT_METADATA};
+
+/* Opened before the first allocation */
+extern allocator_t *mt_dram_al;
+extern struct memkind *pmem_kind;
+/* A thread that wants its PMEM elsewhere, e.g. on its NUMA node */
+extern __thread struct memkind *ht_local_kind;
+
+extern int      mt_policy;
+extern size_t   mt_size_threshold;
+extern size_t   mt_dram_budget;		/* bytes of values, 0 for none */
+extern uint32_t mt_promote_hits;	/* 0 never promotes */
+
+typedef struct {
+    uint64_t mts_dram_bytes[2];		/* by MT_DATA and MT_METADATA */
+    uint64_t mts_pmem_bytes[2];
+    uint64_t mts_promotions;
+    uint64_t mts_demotions;
+    uint64_t mts_refused;		/* promotions over the budget */
+    /* Of every allocation so far: what was asked, and what came */
+    uint64_t mts_requested;
+    uint64_t mts_allocated;
+} mt_stats_t;
+
+extern mt_stats_t mt_stats;
+
+/* "dram", "pmem", "split" or "size:BYTES"; -1 if it's none of them */
+int   mt_parse_policy(const char *spec);
+void *mt_alloc_data(size_t size);
+void *mt_alloc_metadata(size_t size);
+void *mt_calloc_metadata(size_t num, size_t size);
+/* Memory for many objects of one size, placed as each of them would be */
+void *mt_alloc_block(int class, size_t object_size, size_t size);
+void  mt_free_data(void *ptr);
+void  mt_free_metadata(void *ptr);
+int   mt_in_dram(void *ptr);
+/*
+ * Move a value to the other tier, returning its new address, or NULL if
+ * it stays where it is. The caller updates its pointer.
+ */
+void *mt_promote(void *ptr, size_t size);
+void *mt_demote(void *ptr, size_t size);
+/* Whether cold values should make room in DRAM */
+int   mt_dram_short(void);
+void  mt_print_stats(void);
+
+#endif
@@ -1,19 +1,86 @@
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <errno.h>
-#include <memkind.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
+#include "allocator.h"
 #include "nano_time.h"
 
 const char DEFAULT_MEMKIND_PATH[] = "/mnt/pmem/sasha";
 
 #define BYTES_IN_GB (1024 * 1024 * 1024)
+#define CHASE_LINE 64
+#define CHASE_MIN_SIZE 4096
 #define DEFAULT_BLOCK_SIZE 4096
+#define DEFAULT_DELAYS "0,20,50,100,200,500,1000,2000,5000,10000"
+#define DEFAULT_LOADS (1 << 24)
+#define DEFAULT_REPEAT 5
 #define DEFAULT_SIZE_GB 32
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MAX_CPUS 1024
+#define MAX_DELAYS 32
+#define MAX_DELAY 1000000
+#define MAX_THREADS 256
+#define MAX_THREAD_COUNTS 32
 #define NANOSECONDS_IN_SECOND 1000000000
+/* A kernel saturates at the fewest threads that get this much of its best */
+#define SATURATION 0.95
+#define SCALAR 3.0
+
+/*
+ * The STREAM kernels, plus a read-only and a write-only one, over three
+ * arrays of doubles. Bandwidth is counted as STREAM does: the bytes of
+ * each array read or written, without the reads for write-allocate.
+ */
+typedef enum kernel {READ, WRITE, COPY, SCALE, TRIAD, NUM_KERNELS,
+		     POPULATE, QUIT} kernel_t;
+
+static const struct {
+    const char *k_name;
+    int         k_arrays;
+} kernels[NUM_KERNELS] = {
+    {"read", 1}, {"write", 1}, {"copy", 2}, {"scale", 2}, {"triad", 3}
+};
+
+/*
+ * Every thread gets the blocks of one contiguous stretch of the arrays,
+ * or every threads'th block starting at its own.
+ */
+typedef enum partition {CONTIGUOUS, INTERLEAVED} partition_t;
+
+typedef struct worker {
+    int        w_index;
+    int        w_threads;
+    int        w_cpu;		/* -1 if not pinned */
+    double     w_sum;		/* what read added up, so that it's done */
+    size_t     w_bytes;		/* moved while loading */
+    pthread_t  w_thread;
+} worker_t;
+
+static double *stream_a, *stream_b, *stream_c;
+static size_t num_elems;		/* in each array */
+static size_t block_elems;
+static partition_t partition = CONTIGUOUS;
+
+/* Workers and main step through the kernels together */
+static pthread_barrier_t barrier;
+static volatile kernel_t job;
+
+/*
+ * For loaded latency the workers go round their parts until loading is
+ * cleared, pausing load_delay times after every block.
+ */
+static volatile int loading;
+static int load_delay;
 
 void
 print_help_message(const char *progname) {
@@ -22,11 +89,60 @@ print_help_message(const char *progname) {
     const char *basename = strrchr(progname, '/');
     basename = basename ? basename + 1 : progname;
 
-    printf("usage: %s <mem_kind>\n", basename);
+    printf("usage: %s [options] [<mem_kind>]\n", basename);
     printf("mem_kind can be:\n");
     printf("\t 0 -- DRAM\n");
     printf("\t 1 -- NVRAM-DEVDAX\n");
     printf("\t 2 -- NVRAM-FSDAX\n");
+    printf("or the allocator, instead, one of %s.\n", al_names());
+    printf("Options are:\n");
+    printf("\t--allocator=SPEC\n"
+	   "\t\tAllocate the arrays with SPEC\n");
+    printf("\t--block=BYTES\n"
+	   "\t\tHand the arrays out to threads in blocks of BYTES. "
+	   "Default is %d.\n", DEFAULT_BLOCK_SIZE);
+    printf("\t--chase\n"
+	   "\t\tInstead of the kernels, chase pointers through a random "
+	   "cycle over\n\t\tthe cache lines of working sets from %d KB "
+	   "to --size, doubling,\n\t\tand report the latency of a load.\n",
+	   CHASE_MIN_SIZE / 1024);
+    printf("\t--cpu-node=N\n"
+	   "\t\tPin the threads to the CPUs of NUMA node N, round robin.\n");
+    printf("\t--kernels=LIST\n"
+	   "\t\tRun the comma-separated kernels of read, write, copy, "
+	   "scale and triad.\n\t\tDefault is all of them.\n");
+    printf("\t--loaded[=DELAYS]\n"
+	   "\t\tInstead of the kernels, chase pointers through one array's "
+	   "worth of\n\t\tmemory while --threads threads run the kernel "
+	   "of --kernels, read\n\t\tif not given, pausing after every "
+	   "block as many times as each of\n\t\tthe comma-separated "
+	   "DELAYS. Reports latency against bandwidth.\n\t\tDefault "
+	   "DELAYS are %s.\n", DEFAULT_DELAYS);
+    printf("\t--loads=N\n"
+	   "\t\tLoads to time for every working set of --chase, or "
+	   "delay of --loaded.\n\t\t"
+	   "Default is %d.\n", DEFAULT_LOADS);
+    printf("\t--mem-node=N\n"
+	   "\t\tFirst touch the arrays from the CPUs of NUMA node N, so "
+	   "that the\n\t\tkernel puts them there. Default is --cpu-node; "
+	   "a different node\n\t\tmeasures remote access. Allocators "
+	   "that bind their memory,\n\t\tlike kmem, ignore it.\n");
+    printf("\t--pages=4k|2m\n"
+	   "\t\tAsk for small or transparent huge pages for the "
+	   "chased memory.\n\t\tDefault is what the system gives.\n");
+    printf("\t--partition=contiguous|interleaved\n"
+	   "\t\tGive every thread one stretch of blocks, or every "
+	   "threads'th block.\n\t\tDefault is contiguous.\n");
+    printf("\t--repeat=N\n"
+	   "\t\tRun every kernel N times, and report the best and the "
+	   "average.\n\t\tDefault is %d.\n", DEFAULT_REPEAT);
+    printf("\t--size=GB\n"
+	   "\t\tThe three arrays together, or the largest working set "
+	   "of --chase;\n\t\tmay be fractional. Default is %d.\n",
+	   DEFAULT_SIZE_GB);
+    printf("\t--threads=LIST\n"
+	   "\t\tRun with each of the comma-separated thread counts, and "
+	   "report how\n\t\tthe bandwidth scales. Default is 1.\n");
 }
 
 
@@ -46,152 +162,702 @@ print_help_message(const char *progname) {
 
 typedef enum state {DRAM, DAX, FSDAX} memkindname_t;
 
-char *allocate_memory(memkindname_t kind, size_t size);
-void  copy_memory(char *buf, size_t size);
-void  populate_memory(char *buf, size_t size);
-
-int main(int argc, char **argv) {
+/*
+ * The CPUs of a NUMA node, from sysfs, e.g. "0-7,16-23". Returns how
+ * many there are, 0 if the node doesn't exist.
+ */
+static int
+node_cpus(int node, int *cpus, int max) {
+
+    char path[64], list[4096], *p, *end;
+    long lo, hi;
+    FILE *f;
+    int n = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+	     node);
+    if ((f = fopen(path, "r")) == NULL)
+	return 0;
+    if (fgets(list, sizeof(list), f) == NULL)
+	list[0] = '\0';
+    fclose(f);
+
+    for (p = list; n < max; p = end + 1) {
+	lo = strtol(p, &end, 10);
+	if (end == p)
+	    break;
+	hi = lo;
+	if (*end == '-')
+	    hi = strtol(end + 1, &end, 10);
+	for (; lo <= hi && n < max; lo++)
+	    cpus[n++] = (int)lo;
+	if (*end != ',')
+	    break;
+    }
+    return n;
+}
 
-    char *buf;
-    memkindname_t mem_name;
-    size_t size = 0;
+/*
+ * Comma-separated numbers from lo to hi; returns how many, 0 if
+ * malformed.
+ */
+static int
+parse_numbers(const char *list, int *numbers, int max, long lo, long hi) {
+
+    const char *p = list;
+    char *end;
+    long v;
+    int n = 0;
+
+    while (n < max) {
+	v = strtol(p, &end, 10);
+	if (end == p || v < lo || v > hi)
+	    return 0;
+	numbers[n++] = (int)v;
+	if (*end == '\0')
+	    return n;
+	if (*end != ',')
+	    return 0;
+	p = end + 1;
+    }
+    return 0;
+}
 
-    if (argc < 2)
-	EXIT_HELP_MSG("Missing memory kind.\n");
+/* Returns the kernels as a bit mask, 0 if a name is unknown */
+static int
+parse_kernels(char *list) {
+
+    char *name, *save;
+    int k, mask = 0;
+
+    for (name = strtok_r(list, ",", &save); name != NULL;
+	 name = strtok_r(NULL, ",", &save)) {
+	for (k = 0; k < NUM_KERNELS; k++)
+	    if (strcmp(name, kernels[k].k_name) == 0)
+		break;
+	if (k == NUM_KERNELS)
+	    return 0;
+	mask |= 1 << k;
+    }
+    return mask;
+}
 
-    switch (atoi(argv[1])) {
-    case DRAM:
-	mem_name = DRAM;
+static void
+run_range(kernel_t kernel, size_t lo, size_t hi, double *sum) {
+
+    double *restrict a = stream_a, *restrict b = stream_b,
+	*restrict c = stream_c;
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i;
+
+    switch (kernel) {
+    case READ:
+	/* Four sums, so that the adds don't hold up the loads */
+	for (i = lo; i + 4 <= hi; i += 4) {
+	    s0 += a[i];
+	    s1 += a[i + 1];
+	    s2 += a[i + 2];
+	    s3 += a[i + 3];
+	}
+	for (; i < hi; i++)
+	    s0 += a[i];
+	*sum += s0 + s1 + s2 + s3;
+	break;
+    case WRITE:
+	for (i = lo; i < hi; i++)
+	    c[i] = SCALAR;
+	break;
+    case COPY:
+	for (i = lo; i < hi; i++)
+	    c[i] = a[i];
 	break;
-    case DAX:
-	mem_name = DAX;
+    case SCALE:
+	for (i = lo; i < hi; i++)
+	    b[i] = SCALAR * c[i];
 	break;
-    case FSDAX:
-	mem_name = FSDAX;
+    case TRIAD:
+	for (i = lo; i < hi; i++)
+	    a[i] = b[i] + SCALAR * c[i];
+	break;
+    case POPULATE:
+	for (i = lo; i < hi; i++) {
+	    a[i] = 1.0;
+	    b[i] = 2.0;
+	    c[i] = 0.0;
+	}
 	break;
     default:
-	EXIT_HELP_MSG("Invalid memory kind.\n");
+	break;
     }
+}
 
-    size = (size_t)DEFAULT_SIZE_GB * (size_t)BYTES_IN_GB;
-    buf = allocate_memory(mem_name, size);
-    if (buf == NULL)
-	EXIT_MSG("Could not allocate memory.\n");
+static void
+run_part(worker_t *w, kernel_t kernel) {
+
+    size_t num_blocks = (num_elems + block_elems - 1) / block_elems;
+    size_t first, blk, last, step, lo, hi;
+    int d, loaded = loading;
+
+    if (partition == CONTIGUOUS) {
+	first = num_blocks * w->w_index / w->w_threads;
+	last = num_blocks * (w->w_index + 1) / w->w_threads;
+	step = 1;
+    } else {
+	first = w->w_index;
+	last = num_blocks;
+	step = w->w_threads;
+    }
+    do {
+	for (blk = first; blk < last; blk += step) {
+	    lo = blk * block_elems;
+	    hi = lo + block_elems < num_elems ? lo + block_elems : num_elems;
+	    run_range(kernel, lo, hi, &w->w_sum);
+	    if (!loaded)
+		continue;
+	    if (!loading)
+		return;
+	    w->w_bytes += kernels[kernel].k_arrays * (hi - lo) *
+		sizeof(double);
+	    for (d = 0; d < load_delay; d++) {
+#if defined(__SSE2__)
+		_mm_pause();
+#else
+		__asm__ __volatile__("" ::: "memory");
+#endif
+	    }
+	}
+    } while (loaded && loading);
+}
 
-    populate_memory(buf, size);
+static void
+pin_thread(int cpu) {
 
-    for (int i = 0; i < 10; i++)
-	copy_memory(buf, size);
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+	printf("Could not pin to CPU %d\n", cpu);
 }
 
-char *allocate_memory(memkindname_t m_kind, size_t size) {
+static void *
+worker(void *arg) {
 
-    int err;
-    char error_message[MEMKIND_ERROR_MESSAGE_SIZE];
-    char *ptr_default, *ptr_dax_kmem, *ptr_pmem;
+    worker_t *w = (worker_t *)arg;
 
-    if (m_kind == DRAM) {
-	ptr_default = (char *)memkind_malloc(MEMKIND_DEFAULT, size);
-	return ptr_default;
+    if (w->w_cpu >= 0)
+	pin_thread(w->w_cpu);
+    while (1) {
+	pthread_barrier_wait(&barrier);
+	if (job == QUIT)
+	    break;
+	run_part(w, job);
+	pthread_barrier_wait(&barrier);
     }
-    else if (m_kind == DAX) {
-	ptr_dax_kmem = (char *)memkind_malloc(MEMKIND_DAX_KMEM_ALL, size);
-	return ptr_dax_kmem;
+    return NULL;
+}
+
+/* cpus is NULL to leave the threads where the scheduler puts them */
+static void
+start_workers(worker_t *workers, int threads, const int *cpus, int num_cpus) {
+
+    int t;
+
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    for (t = 0; t < threads; t++) {
+	workers[t].w_index = t;
+	workers[t].w_threads = threads;
+	workers[t].w_cpu = cpus != NULL ? cpus[t % num_cpus] : -1;
+	workers[t].w_sum = 0;
+	workers[t].w_bytes = 0;
+	if (pthread_create(&workers[t].w_thread, NULL, worker,
+			   &workers[t]) != 0)
+	    EXIT_MSG("Could not start thread %d\n", t);
     }
-    else if (m_kind == FSDAX) {
+}
+
+/* Returns how long the workers took between them */
+static uint64_t
+run_step(kernel_t kernel) {
+
+    uint64_t begin_time;
+
+    job = kernel;
+    begin_time = nano_time();
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    return nano_time() - begin_time;
+}
 
-	struct memkind *pmem_kind = NULL;
+/* Returns what the read kernel added up */
+static double
+stop_workers(worker_t *workers, int threads) {
 
-	err = memkind_create_pmem(DEFAULT_MEMKIND_PATH, 0, &pmem_kind);
-	if (err)
-	    goto error;
+    double sum = 0;
+    int t;
 
-	ptr_pmem = (char *)memkind_malloc(pmem_kind, size);
-	return ptr_pmem;
+    job = QUIT;
+    pthread_barrier_wait(&barrier);
+    for (t = 0; t < threads; t++) {
+	pthread_join(workers[t].w_thread, NULL);
+	sum += workers[t].w_sum;
     }
+    pthread_barrier_destroy(&barrier);
+    return sum;
+}
 
-error:
-    memkind_error_message(err, error_message, MEMKIND_ERROR_MESSAGE_SIZE);
-    EXIT_MSG("%s\n", (char*)error_message);
+static double
+gb_per_second(kernel_t kernel, uint64_t nanoseconds) {
 
-    return NULL; /* keep the compiler happy */
+    return (double)(kernels[kernel].k_arrays * num_elems * sizeof(double)) /
+	(double)nanoseconds * NANOSECONDS_IN_SECOND / BYTES_IN_GB;
+}
+
+static void
+print_scaling(int kernel_mask, const int *counts, int num_counts,
+	      double best[][MAX_THREAD_COUNTS]) {
+
+    double top;
+    int k, i, saturated;
+
+    printf("\nScaling, best GB/s:\n%-8s", "threads");
+    for (i = 0; i < num_counts; i++)
+	printf(" %9d", counts[i]);
+    printf("   saturates at\n");
+    for (k = 0; k < NUM_KERNELS; k++) {
+	if (!(kernel_mask & (1 << k)))
+	    continue;
+	printf("%-8s", kernels[k].k_name);
+	for (i = 0, top = 0; i < num_counts; i++) {
+	    printf(" %9.2f", best[k][i]);
+	    if (best[k][i] > top)
+		top = best[k][i];
+	}
+	for (i = 0, saturated = 0; i < num_counts; i++)
+	    if (best[k][i] >= SATURATION * top &&
+		(saturated == 0 || counts[i] < saturated))
+		saturated = counts[i];
+	printf("   %d thread%s\n", saturated, saturated > 1 ? "s" : "");
+    }
 }
 
 /*
- * If we don't write anything into memory prior to reading it, the kernel
- * figures this out, and we get the throughput as if we are reading from
- * DRAM.
+ * Pointer chasing: every cache line of the working set holds the address
+ * of the next one to load, in one random cycle through all of them, so
+ * that every load waits for the one before and no prefetcher can guess.
  */
-void
-populate_memory(char *src, size_t size) {
+static void *volatile chase_end;
 
-    char buffer[DEFAULT_BLOCK_SIZE]; /* Fix this */
-    size_t i, numblocks;
-    uint64_t begin_time, end_time;
+/* Per-thread xorshift, since random() takes a lock */
+static inline uint64_t xorshift64(uint64_t *state) {
 
-    numblocks = size / DEFAULT_BLOCK_SIZE;
-    printf("Data size: %ld GB\n", (numblocks * (size_t)DEFAULT_BLOCK_SIZE)/
-	   (size_t)BYTES_IN_GB);
-    buffer[0] = 1;
+    uint64_t x = *state;
 
-    /* Write data to memory */
-    begin_time = nano_time();
-    for (i = 0; i < numblocks; i++) {
-        memcpy(&src[i * DEFAULT_BLOCK_SIZE], buffer, DEFAULT_BLOCK_SIZE);
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* Sattolo's shuffle, which leaves a single cycle */
+static void
+chase_build(char *buf, size_t lines, uint64_t *rnd) {
+
+    void **a, **b, *tmp;
+    size_t i;
+
+    for (i = 0; i < lines; i++)
+	*(void **)(buf + i * CHASE_LINE) = buf + i * CHASE_LINE;
+    for (i = lines - 1; i > 0; i--) {
+	a = (void **)(buf + i * CHASE_LINE);
+	b = (void **)(buf + xorshift64(rnd) % i * CHASE_LINE);
+	tmp = *a;
+	*a = *b;
+	*b = tmp;
     }
-    end_time = nano_time();
+}
+
+/* Returns the nanoseconds per load */
+static double
+chase(void *start, size_t loads) {
+
+    void **p = (void **)start;
+    uint64_t begin_time;
+    size_t i;
 
-    printf("Write throughput: %.2f GB/s \n", (double)size/
-	   (double)(end_time-begin_time)
-           * NANOSECONDS_IN_SECOND / BYTES_IN_GB);
+    begin_time = nano_time();
+    for (i = 0; i < loads; i += 8) {
+	p = (void **)*p; p = (void **)*p; p = (void **)*p; p = (void **)*p;
+	p = (void **)*p; p = (void **)*p; p = (void **)*p; p = (void **)*p;
+    }
+    chase_end = p;
+    return (double)(nano_time() - begin_time) / i;
 }
 
-#define BEGIN_LAT_SAMPLE			\
-    if (i%LAT_SAMPL_INTERVAL == 0)		\
-	    lat_begin_time = nano_time();
+static void
+print_size(size_t bytes) {
 
-#define END_LAT_SAMPLE				\
-    if (i%LAT_SAMPL_INTERVAL == 0) {					\
-    lat_end_time = nano_time();						\
-    latency_samples[i/LAT_SAMPL_INTERVAL % MAX_LAT_SAMPLES] =		\
-	lat_end_time - lat_begin_time;					\
-	}
+    if (bytes < 1024 * 1024)
+	printf("\t%8g KB", (double)bytes / 1024);
+    else if (bytes < BYTES_IN_GB)
+	printf("\t%8g MB", (double)bytes / (1024 * 1024));
+    else
+	printf("\t%8g GB", (double)bytes / BYTES_IN_GB);
+}
 
-void
-copy_memory(char *src, size_t size) {
+/*
+ * The buffer to chase through, touched from mem_cpu if it's not -1, with
+ * the calling thread left on run_cpu. page_size is 0 to leave it to the
+ * system. What to free is returned in raw.
+ */
+static char *
+chase_alloc(allocator_t *al, size_t size, size_t page_size, int run_cpu,
+	    int mem_cpu, char **raw) {
 
-#define MAX_LAT_SAMPLES 10
-#define LAT_SAMPL_INTERVAL 100
+    cpu_set_t cpus;
+    char *buf;
 
-    char buffer[DEFAULT_BLOCK_SIZE]; /* Fix this */
-    size_t i, numblocks;
-    uint64_t begin_time, end_time, lat_begin_time, lat_end_time,
-	meaningless_sum = 0;
-    size_t latency_samples[MAX_LAT_SAMPLES];
+    /* Aligned, so that it can be all huge pages */
+    if ((*raw = (char *)al_malloc(al, size + HUGE_PAGE_SIZE)) == NULL)
+	EXIT_MSG("Could not allocate memory.\n");
+    buf = (char *)(((uintptr_t)*raw + HUGE_PAGE_SIZE - 1) &
+		   ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+
+    /* Before the first touch, which is when the pages are picked */
+    if (page_size != 0 &&
+	madvise(buf, size, page_size == HUGE_PAGE_SIZE ?
+		MADV_HUGEPAGE : MADV_NOHUGEPAGE) != 0)
+	printf("Could not ask for %zu KB pages: %s\n", page_size / 1024,
+	       strerror(errno));
+    pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (mem_cpu >= 0)
+	pin_thread(mem_cpu);
+    memset(buf, 0, size);
+    if (run_cpu >= 0)
+	pin_thread(run_cpu);
+    else
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    return buf;
+}
 
-    numblocks = size / DEFAULT_BLOCK_SIZE;
-    printf("Data size: %ld GB\n", (numblocks * (size_t)DEFAULT_BLOCK_SIZE)/
-	   (size_t)BYTES_IN_GB);
+static void
+run_chase(allocator_t *al, size_t size, size_t page_size, size_t loads,
+	  int run_cpu, int mem_cpu) {
+
+    uint64_t rnd = nano_time() | 1;
+    char *raw, *buf;
+    size_t set;
+
+    buf = chase_alloc(al, size, page_size, run_cpu, mem_cpu, &raw);
+    printf("\nPointer chase, %zu loads per working set:\n", loads);
+    for (set = CHASE_MIN_SIZE; ; set = set < size / 2 ? set * 2 : size) {
+	chase_build(buf, set / CHASE_LINE, &rnd);
+	/* Once around first, to bring the set into the caches and TLBs */
+	chase(buf, set / CHASE_LINE < loads ? set / CHASE_LINE : loads);
+	print_size(set);
+	printf(" %9.2f ns\n", chase(buf, loads));
+	if (set == size)
+	    break;
+    }
+    al_free(al, raw);
+}
 
-    /* Read data from memory */
-    begin_time = nano_time();
-    for (i = 0; i < numblocks; i++) {
+/*
+ * Chases through a buffer the size of one array while the workers run
+ * kernel over the arrays, once for every delay, after a first time with
+ * no workers. The chaser keeps the first of cpus to itself if there are
+ * others; cpus is NULL to leave everyone where the scheduler puts them.
+ * Returns what the read kernel added up.
+ */
+static double
+run_loaded(allocator_t *al, worker_t *workers, int threads, kernel_t kernel,
+	   const int *delays, int num_delays, size_t loads, size_t page_size,
+	   const int *cpus, int num_cpus, int mem_cpu) {
+
+    size_t size = num_elems * sizeof(double), lines = size / CHASE_LINE;
+    uint64_t rnd = nano_time() | 1, begin_time, elapsed;
+    double ns, bytes, sum;
+    char *raw, *buf;
+    int i, t;
+
+    buf = chase_alloc(al, size, page_size, cpus != NULL ? cpus[0] : -1,
+		      mem_cpu, &raw);
+    chase_build(buf, lines, &rnd);
+    chase(buf, lines < loads ? lines : loads);
+
+    printf("\nLoaded latency, %s on %d thread%s, %zu loads per delay:\n",
+	   kernels[kernel].k_name, threads, threads > 1 ? "s" : "", loads);
+    printf("\t%8s %9s %9s\n", "delay", "GB/s", "ns");
+    printf("\t%8s %9.2f %9.2f\n", "idle", 0.0, chase(buf, loads));
+
+    if (cpus != NULL && num_cpus > 1)
+	start_workers(workers, threads, cpus + 1, num_cpus - 1);
+    else
+	start_workers(workers, threads, cpus, num_cpus);
+    for (i = 0; i < num_delays; i++) {
+	for (t = 0; t < threads; t++)
+	    workers[t].w_bytes = 0;
+	load_delay = delays[i];
+	loading = 1;
+	job = kernel;
+	pthread_barrier_wait(&barrier);
+	begin_time = nano_time();
+	ns = chase(buf, loads);
+	elapsed = nano_time() - begin_time;
+	loading = 0;
+	pthread_barrier_wait(&barrier);
+	for (t = 0, bytes = 0; t < threads; t++)
+	    bytes += workers[t].w_bytes;
+	printf("\t%8d %9.2f %9.2f\n", delays[i],
+	       bytes / elapsed * NANOSECONDS_IN_SECOND / BYTES_IN_GB, ns);
+    }
+    sum = stop_workers(workers, threads);
+    al_free(al, raw);
+    return sum;
+}
 
-	BEGIN_LAT_SAMPLE;
-	memcpy(buffer, &src[i * DEFAULT_BLOCK_SIZE], DEFAULT_BLOCK_SIZE);
-	END_LAT_SAMPLE;
-	meaningless_sum += buffer[0];
+int main(int argc, char **argv) {
+
+    static worker_t workers[MAX_THREADS];
+    static double best[NUM_KERNELS][MAX_THREAD_COUNTS];
+    static int run_cpus[MAX_CPUS], mem_cpus[MAX_CPUS];
+    char fsdax_spec[sizeof(DEFAULT_MEMKIND_PATH) + 8];
+    char al_error[AL_ERROR_SIZE];
+    const char *spec = NULL;
+    allocator_t *al;
+    double size_gb = DEFAULT_SIZE_GB, rate, total, sum = 0;
+    size_t block_size = DEFAULT_BLOCK_SIZE, loads = DEFAULT_LOADS;
+    size_t page_size = 0;
+    uint64_t elapsed, fastest;
+    int counts[MAX_THREAD_COUNTS] = {1}, num_counts = 1, max_threads;
+    int delays[MAX_DELAYS], num_delays = 0;
+    int cpu_node = -1, mem_node = -1, num_run_cpus = 0, num_mem_cpus = 0;
+    int kernel_mask = 0, repeat = DEFAULT_REPEAT;
+    int do_chase = 0, do_loaded = 0;
+    int c, i, k, r, option_index;
+
+    static struct option long_options[] =
+	{
+	    {"allocator", required_argument, 0, 'a'},
+	    {"block", required_argument, 0, 'b'},
+	    {"chase", no_argument, 0, 'C'},
+	    {"cpu-node", required_argument, 0, 'c'},
+	    {"help", no_argument, 0, 'h'},
+	    {"kernels", required_argument, 0, 'k'},
+	    {"loaded", optional_argument, 0, 'L'},
+	    {"loads", required_argument, 0, 'l'},
+	    {"mem-node", required_argument, 0, 'm'},
+	    {"pages", required_argument, 0, 'P'},
+	    {"partition", required_argument, 0, 'p'},
+	    {"repeat", required_argument, 0, 'r'},
+	    {"size", required_argument, 0, 's'},
+	    {"threads", required_argument, 0, 't'},
+	    {0, 0, 0, 0}
+	};
+
+    while ((c = getopt_long(argc, argv, "a:b:Cc:hk:L::l:m:P:p:r:s:t:", long_options,
+			    &option_index)) != -1) {
+	switch (c) {
+	case 'a':
+	    spec = optarg;
+	    break;
+	case 'b':
+	    block_size = strtoul(optarg, NULL, 10);
+	    if (block_size < sizeof(double) || block_size % sizeof(double))
+		EXIT_MSG("Block size must be a multiple of %zu bytes.\n",
+			 sizeof(double));
+	    break;
+	case 'C':
+	    do_chase = 1;
+	    break;
+	case 'c':
+	    cpu_node = atoi(optarg);
+	    break;
+	case 'h':
+	    print_help_message(argv[0]);
+	    _exit(0);
+	case 'k':
+	    if ((kernel_mask = parse_kernels(optarg)) == 0)
+		EXIT_HELP_MSG("Invalid kernels.\n");
+	    break;
+	case 'L':
+	    do_loaded = 1;
+	    if ((num_delays = parse_numbers(optarg != NULL ? optarg :
+					    DEFAULT_DELAYS, delays,
+					    MAX_DELAYS, 0, MAX_DELAY)) == 0)
+		EXIT_MSG("Delays must be 0 to %d, at most %d of them.\n",
+			 MAX_DELAY, MAX_DELAYS);
+	    break;
+	case 'l':
+	    if ((loads = strtoul(optarg, NULL, 10)) == 0)
+		EXIT_MSG("Loads must be positive.\n");
+	    break;
+	case 'm':
+	    mem_node = atoi(optarg);
+	    break;
+	case 'P':
+	    if (strcmp(optarg, "4k") == 0)
+		page_size = 4096;
+	    else if (strcmp(optarg, "2m") == 0)
+		page_size = HUGE_PAGE_SIZE;
+	    else
+		EXIT_HELP_MSG("Invalid page size: %s\n", optarg);
+	    break;
+	case 'p':
+	    if (strcmp(optarg, "contiguous") == 0)
+		partition = CONTIGUOUS;
+	    else if (strcmp(optarg, "interleaved") == 0)
+		partition = INTERLEAVED;
+	    else
+		EXIT_HELP_MSG("Invalid partition: %s\n", optarg);
+	    break;
+	case 'r':
+	    if ((repeat = atoi(optarg)) <= 0)
+		EXIT_MSG("Repeat must be positive.\n");
+	    break;
+	case 's':
+	    if ((size_gb = strtod(optarg, NULL)) <= 0)
+		EXIT_MSG("Size must be positive.\n");
+	    break;
+	case 't':
+	    if ((num_counts = parse_numbers(optarg, counts, MAX_THREAD_COUNTS,
+					    1, MAX_THREADS)) == 0)
+		EXIT_MSG("Thread counts must be 1 to %d, at most %d of "
+			 "them.\n", MAX_THREADS, MAX_THREAD_COUNTS);
+	    break;
+	default:
+	    EXIT_HELP_MSG("Invalid option\n");
+	}
     }
-    end_time = nano_time();
 
-    printf("Read throughput: %.2f GB/s \n", (double)size/
-	   (double)(end_time-begin_time)
-	   * NANOSECONDS_IN_SECOND / BYTES_IN_GB);
+    /* The memory kinds are allocators too */
+    if (optind < argc) {
+	switch (atoi(argv[optind])) {
+	case DRAM:
+	    spec = "memkind";
+	    break;
+	case DAX:
+	    spec = "kmem";
+	    break;
+	case FSDAX:
+	    snprintf(fsdax_spec, sizeof(fsdax_spec), "pmem:%s",
+		     DEFAULT_MEMKIND_PATH);
+	    spec = fsdax_spec;
+	    break;
+	default:
+	    EXIT_HELP_MSG("Invalid memory kind.\n");
+	}
+    }
+    if (spec == NULL)
+	EXIT_HELP_MSG("Missing memory kind.\n");
+    if (do_chase && do_loaded)
+	EXIT_MSG("Pick one of --chase and --loaded.\n");
+    if (do_chase && (num_counts > 1 || counts[0] > 1))
+	EXIT_MSG("--chase runs on one thread.\n");
+    if (do_chase && size_gb * BYTES_IN_GB < CHASE_MIN_SIZE)
+	EXIT_MSG("--chase needs at least %d KB.\n", CHASE_MIN_SIZE / 1024);
+    if (do_loaded && size_gb * BYTES_IN_GB < 3 * CHASE_MIN_SIZE)
+	EXIT_MSG("--loaded needs at least %d KB.\n",
+		 3 * CHASE_MIN_SIZE / 1024);
+    if (do_loaded && num_counts > 1)
+	EXIT_MSG("--loaded takes one thread count, for the load.\n");
+    if (do_loaded && (kernel_mask & (kernel_mask - 1)) != 0)
+	EXIT_MSG("--loaded takes one kernel.\n");
+    if (!do_chase && !do_loaded && page_size != 0)
+	EXIT_MSG("--pages is for --chase and --loaded.\n");
+    if (kernel_mask == 0)
+	kernel_mask = do_loaded ? 1 << READ : (1 << NUM_KERNELS) - 1;
+
+    if (cpu_node >= 0 &&
+	(num_run_cpus = node_cpus(cpu_node, run_cpus, MAX_CPUS)) == 0)
+	EXIT_MSG("No CPUs on node %d\n", cpu_node);
+    if (mem_node >= 0 &&
+	(num_mem_cpus = node_cpus(mem_node, mem_cpus, MAX_CPUS)) == 0)
+	EXIT_MSG("No CPUs on node %d\n", mem_node);
+    for (i = 0, max_threads = 0; i < num_counts; i++)
+	if (counts[i] > max_threads)
+	    max_threads = counts[i];
+
+    if ((al = al_open(spec, al_error, sizeof(al_error))) == NULL)
+	EXIT_MSG("%s\n", al_error);
+    printf("Allocating from %s\n", spec);
+    if (mem_node >= 0 && cpu_node >= 0 && mem_node != cpu_node)
+	printf("Memory on node %d, threads on node %d, remote\n", mem_node,
+	       cpu_node);
+    else if (mem_node >= 0 && cpu_node < 0)
+	printf("Memory on node %d, threads on any node\n", mem_node);
+    else if (cpu_node >= 0)
+	printf("Memory and threads on node %d\n", cpu_node);
+
+    if (do_chase) {
+	run_chase(al, (size_t)(size_gb * BYTES_IN_GB), page_size, loads,
+		  cpu_node >= 0 ? run_cpus[0] : -1,
+		  mem_node >= 0 ? mem_cpus[0] : -1);
+	al_close(al);
+	return 0;
+    }
 
-    printf("\nSample latency for %d byte block:\n", DEFAULT_BLOCK_SIZE);
-    for (i = 0; i < MAX_LAT_SAMPLES; i++)
-	printf("\t%ld: %ld\n", i, latency_samples[i]);
+    num_elems = (size_t)(size_gb * BYTES_IN_GB) / 3 / sizeof(double);
+    block_elems = block_size / sizeof(double);
+    if (num_elems == 0)
+	EXIT_MSG("Size is too small.\n");
+    stream_a = (double *)al_malloc(al, num_elems * sizeof(double));
+    stream_b = (double *)al_malloc(al, num_elems * sizeof(double));
+    stream_c = (double *)al_malloc(al, num_elems * sizeof(double));
+    if (stream_a == NULL || stream_b == NULL || stream_c == NULL)
+	EXIT_MSG("Could not allocate memory.\n");
 
-    printf("%ld\n", meaningless_sum);
+    printf("Data size: 3 x %.2f GB, %s %zu-byte blocks\n",
+	   (double)(num_elems * sizeof(double)) / BYTES_IN_GB,
+	   partition == CONTIGUOUS ? "contiguous" : "interleaved", block_size);
+
+    /*
+     * If we don't write anything into memory prior to reading it, the
+     * kernel figures this out, and we get the throughput as if we are
+     * reading from DRAM. Writing it first also places it, on the node
+     * of whoever touches a page first.
+     */
+    if (mem_node >= 0)
+	start_workers(workers, max_threads, mem_cpus, num_mem_cpus);
+    else
+	start_workers(workers, max_threads,
+		      cpu_node >= 0 ? run_cpus : NULL, num_run_cpus);
+    elapsed = run_step(POPULATE);
+    stop_workers(workers, max_threads);
+    printf("Populated in %.2f s\n", (double)elapsed / NANOSECONDS_IN_SECOND);
+
+    if (do_loaded)
+	sum = run_loaded(al, workers, counts[0], __builtin_ctz(kernel_mask),
+			 delays, num_delays, loads, page_size,
+			 cpu_node >= 0 ? run_cpus : NULL, num_run_cpus,
+			 mem_node >= 0 ? mem_cpus[0] : -1);
+
+    for (i = 0; i < num_counts && !do_loaded; i++) {
+	start_workers(workers, counts[i], cpu_node >= 0 ? run_cpus : NULL,
+		      num_run_cpus);
+	printf("\n%d thread%s:\n", counts[i], counts[i] > 1 ? "s" : "");
+	for (k = 0; k < NUM_KERNELS; k++) {
+	    if (!(kernel_mask & (1 << k)))
+		continue;
+	    for (r = 0, fastest = UINT64_MAX, total = 0; r < repeat; r++) {
+		elapsed = run_step(k);
+		if (elapsed < fastest)
+		    fastest = elapsed;
+		total += gb_per_second(k, elapsed);
+	    }
+	    rate = gb_per_second(k, fastest);
+	    best[k][i] = rate;
+	    printf("\t%-6s %9.2f GB/s best, %9.2f average\n",
+		   kernels[k].k_name, rate, total / repeat);
+	}
+	sum += stop_workers(workers, counts[i]);
+    }
+    if (num_counts > 1)
+	print_scaling(kernel_mask, counts, num_counts, best);
+    printf("%g\n", sum);
+
+    al_free(al, stream_a);
+    al_free(al, stream_b);
+    al_free(al, stream_c);
+    al_close(al);
 }
-
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Run the same hash table benchmark once per allocator. The ones that
+# aren't installed say so and are skipped. Then again with the values in
+# PMEM, so that frees have to tell each allocator's DRAM from memkind's
+# PMEM.
+
+ALLOCATORS="malloc memkind tcmalloc jemalloc mmap arena"
+#ALLOCATORS="memkind pmem:/mnt/pmem/sasha"
+
+#HT_ARGS="--placement=dram -d concurrent -t 8 -n 1000000 -o 1000000 --silent"
+HT_ARGS="--placement=dram --workload=A -t 8 -n 1000000 -o 1000000"
+PMEM_DIR=/mnt/pmem/sasha
+SPLIT_ARGS="--placement=split --pmemdir=$PMEM_DIR -d concurrent --workload=A -t 8
+    -n 1000000 -o 1000000"
+
+for ALLOCATOR in $ALLOCATORS
+do
+    echo "== $ALLOCATOR"
+    ./ht --allocator=$ALLOCATOR $HT_ARGS
+done
+
+for ALLOCATOR in $ALLOCATORS
+do
+    echo "== $ALLOCATOR, values in PMEM"
+    ./ht --allocator=$ALLOCATOR $SPLIT_ARGS
+done
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Crash the persistent design at every flush of a small YCSB run, until
+# the run gets to its end, and check that the next run opens the table
+# whole, with every key's value the one it was put with, crashes between
+# a put and its value included.
+
+PFILE=/tmp/ht-crash.table
+
+HT_ARGS="--placement=dram -d persistent --pfile=$PFILE --psize=16 --silent"
+RUN_ARGS="--workload=A -n 200 -o 200 --warmup=0"
+
+FLUSH=1
+while true
+do
+    rm -f $PFILE
+    if stdbuf -oL ./ht $HT_ARGS $RUN_ARGS --crash-at=$FLUSH > /dev/null
+    then
+	break
+    fi
+    if ! stdbuf -oL ./ht $HT_ARGS -n 1 > /tmp/ht-crash.out
+    then
+	echo "== Crash at flush $FLUSH"
+	cat /tmp/ht-crash.out
+	exit 1
+    fi
+    FLUSH=$((FLUSH + 1))
+done
+rm -f $PFILE
+echo "Recovered from crashes at flushes 1 to $((FLUSH - 1))"
@@ -0,0 +1,246 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "size_dist.h"
+
+#define MAX_SPEC_LEN 1024
+
+/*
+ * Parse a size with an optional K, M or G suffix. Returns zero if the
+ * string is not a valid size.
+ */
+size_t
+parse_size(const char *str) {
+
+    char *end;
+    size_t size;
+
+    errno = 0;
+    size = strtoull(str, &end, 10);
+    if (errno != 0 || end == str)
+        return 0;
+
+    switch (toupper(*end)) {
+    case 'K':
+        size *= 1024;
+        end++;
+        break;
+    case 'M':
+        size *= 1024 * 1024;
+        end++;
+        break;
+    case 'G':
+        size *= 1024 * 1024 * 1024ULL;
+        end++;
+        break;
+    default:
+        break;
+    }
+    if (*end != '\0')
+        return 0;
+    return size;
+}
+
+static int
+load_histogram(const char *fname, size_dist_t *sd) {
+
+    FILE *f;
+    char line[MAX_SPEC_LEN], size_str[MAX_SPEC_LEN];
+    double weight, total = 0, *cdf;
+    size_t *sizes;
+    int capacity = 16, n = 0;
+
+    if ((f = fopen(fname, "r")) == NULL) {
+        printf("Could not open size histogram %s: %s\n",
+               fname, strerror(errno));
+        return -1;
+    }
+
+    sd->sd_hist_sizes = (size_t *) malloc(capacity * sizeof(size_t));
+    sd->sd_hist_cdf = (double *) malloc(capacity * sizeof(double));
+    if (sd->sd_hist_sizes == NULL || sd->sd_hist_cdf == NULL)
+        goto error;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%s %lf", size_str, &weight) != 2 ||
+            parse_size(size_str) == 0 || weight < 0) {
+            printf("Malformed line in size histogram %s: %s", fname, line);
+            goto error;
+        }
+        /* On failure the old arrays are still ours, to free */
+        if (n == capacity) {
+            capacity *= 2;
+            if ((sizes = (size_t *) realloc(sd->sd_hist_sizes,
+                                            capacity * sizeof(size_t))) == NULL)
+                goto error;
+            sd->sd_hist_sizes = sizes;
+            if ((cdf = (double *) realloc(sd->sd_hist_cdf,
+                                          capacity * sizeof(double))) == NULL)
+                goto error;
+            sd->sd_hist_cdf = cdf;
+        }
+        total += weight;
+        sd->sd_hist_sizes[n] = parse_size(size_str);
+        sd->sd_hist_cdf[n] = total;
+        n++;
+    }
+    if (n == 0 || total == 0) {
+        printf("Size histogram %s has no entries with positive weight.\n",
+               fname);
+        goto error;
+    }
+    fclose(f);
+
+    /* Normalize the cumulative weights into a CDF */
+    for (int i = 0; i < n; i++)
+        sd->sd_hist_cdf[i] /= total;
+    sd->sd_hist_entries = n;
+    return 0;
+
+error:
+    fclose(f);
+    free(sd->sd_hist_sizes);
+    free(sd->sd_hist_cdf);
+    sd->sd_hist_sizes = NULL;
+    sd->sd_hist_cdf = NULL;
+    return -1;
+}
+
+/*
+ * Fill in the distribution from its spec. Returns zero on success,
+ * -1 on a malformed spec.
+ */
+int
+size_dist_parse(const char *spec, size_dist_t *sd) {
+
+    char buf[MAX_SPEC_LEN], *kind, *args[3] = {0, 0, 0};
+    int nargs = 0;
+
+    memset(sd, 0, sizeof(size_dist_t));
+    sd->sd_align = 1;
+
+    if (strlen(spec) >= MAX_SPEC_LEN)
+        return -1;
+    strcpy(buf, spec);
+
+    kind = strtok(buf, ":");
+    if (kind == NULL)
+        return -1;
+    while (nargs < 3 && (args[nargs] = strtok(NULL, ":")) != NULL)
+        nargs++;
+
+    if (strcmp(kind, "fixed") == 0 && nargs == 1) {
+        sd->sd_kind = SD_FIXED;
+        sd->sd_min = sd->sd_max = parse_size(args[0]);
+    }
+    else if (strcmp(kind, "uniform") == 0 && nargs == 2) {
+        sd->sd_kind = SD_UNIFORM;
+        sd->sd_min = parse_size(args[0]);
+        sd->sd_max = parse_size(args[1]);
+    }
+    else if (strcmp(kind, "bimodal") == 0 && nargs == 3) {
+        sd->sd_kind = SD_BIMODAL;
+        sd->sd_min = parse_size(args[0]);
+        sd->sd_max = parse_size(args[1]);
+        sd->sd_p_small = atof(args[2]);
+        if (sd->sd_p_small < 0 || sd->sd_p_small > 1)
+            return -1;
+    }
+    else if (strcmp(kind, "hist") == 0 && nargs >= 1) {
+        /* The file name may itself contain colons */
+        sd->sd_kind = SD_HISTOGRAM;
+        if (load_histogram(spec + strlen("hist:"), sd) != 0)
+            return -1;
+        sd->sd_min = sd->sd_max = sd->sd_hist_sizes[0];
+        for (int i = 1; i < sd->sd_hist_entries; i++) {
+            if (sd->sd_hist_sizes[i] < sd->sd_min)
+                sd->sd_min = sd->sd_hist_sizes[i];
+            if (sd->sd_hist_sizes[i] > sd->sd_max)
+                sd->sd_max = sd->sd_hist_sizes[i];
+        }
+    }
+    else
+        return -1;
+
+    if (sd->sd_min == 0 || sd->sd_max < sd->sd_min)
+        return -1;
+    return 0;
+}
+
+/*
+ * Make every generated size a multiple of the alignment, e.g., the file
+ * system block size for O_DIRECT.
+ */
+void
+size_dist_set_align(size_dist_t *sd, size_t align) {
+
+    sd->sd_align = (align > 0) ? align : 1;
+}
+
+static size_t
+align_up(size_t size, size_t align) {
+
+    return (size + align - 1) / align * align;
+}
+
+static size_t
+random_range(size_t n) {
+
+    /* random() gives us only 31 bits */
+    return (((uint64_t)random() << 31) | (uint64_t)random()) % n;
+}
+
+size_t
+size_dist_next(const size_dist_t *sd) {
+
+    size_t size = sd->sd_min;
+    double r;
+    int i;
+
+    switch (sd->sd_kind) {
+    case SD_FIXED:
+        break;
+    case SD_UNIFORM:
+        size = sd->sd_min + random_range(sd->sd_max - sd->sd_min + 1);
+        break;
+    case SD_BIMODAL:
+        r = (double)random() / RAND_MAX;
+        size = (r < sd->sd_p_small) ? sd->sd_min : sd->sd_max;
+        break;
+    case SD_HISTOGRAM:
+        r = (double)random() / RAND_MAX;
+        for (i = 0; i < sd->sd_hist_entries - 1; i++)
+            if (r <= sd->sd_hist_cdf[i])
+                break;
+        size = sd->sd_hist_sizes[i];
+        break;
+    }
+    return align_up(size, sd->sd_align);
+}
+
+size_t
+size_dist_min(const size_dist_t *sd) {
+
+    return align_up(sd->sd_min, sd->sd_align);
+}
+
+size_t
+size_dist_max(const size_dist_t *sd) {
+
+    return align_up(sd->sd_max, sd->sd_align);
+}
+
+int
+size_dist_bucket(size_t size) {
+
+    int b = 0;
+
+    while (b < SIZE_DIST_BUCKETS - 1 && ((size_t)1 << b) < size)
+        b++;
+    return b;
+}
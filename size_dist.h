@@ -0,0 +1,51 @@
+#ifndef _SIZE_DIST_H
+#define _SIZE_DIST_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/*
+ * Request-size distributions for the file access benchmark.
+ *
+ * A distribution is described by a short spec string:
+ *      fixed:SIZE
+ *      uniform:MIN:MAX
+ *      bimodal:SMALL:LARGE:P_SMALL
+ *      hist:FILENAME
+ * Sizes accept K, M and G suffixes. The histogram file has one
+ * "size weight" pair per line; lines starting with '#' are ignored.
+ */
+typedef enum {SD_FIXED, SD_UNIFORM, SD_BIMODAL, SD_HISTOGRAM} size_dist_kind_t;
+
+typedef struct {
+    size_dist_kind_t sd_kind;
+    size_t  sd_min;         /* fixed size, uniform min, bimodal small */
+    size_t  sd_max;         /* uniform max, bimodal large */
+    double  sd_p_small;     /* bimodal: probability of the small size */
+    size_t *sd_hist_sizes;
+    double *sd_hist_cdf;
+    int     sd_hist_entries;
+    size_t  sd_align;       /* every generated size is a multiple of this */
+} size_dist_t;
+
+/*
+ * Results are broken down by power-of-two size buckets: bucket b holds
+ * requests of size (2^(b-1), 2^b].
+ */
+#define SIZE_DIST_BUCKETS 48
+
+typedef struct {
+    uint64_t sb_ops;
+    uint64_t sb_bytes;
+    uint64_t sb_ns;
+} size_bucket_stats_t;
+
+int    size_dist_parse(const char *spec, size_dist_t *sd);
+void   size_dist_set_align(size_dist_t *sd, size_t align);
+size_t size_dist_next(const size_dist_t *sd);
+size_t size_dist_min(const size_dist_t *sd);
+size_t size_dist_max(const size_dist_t *sd);
+int    size_dist_bucket(size_t size);
+size_t parse_size(const char *str);
+
+#endif
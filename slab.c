@@ -0,0 +1,242 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hash_table.h"
+#include "slab.h"
+
+#define SLAB_HEADER 64			/* the link to the next slab, padded */
+#define SLAB_CACHE_MAX (2 * SLAB_BATCH)
+
+#define BYTES_IN_KB 1024
+
+/* Multiples of 16, so that every object is aligned for any type */
+static const uint32_t slab_sizes[SLAB_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448,
+    512, 640, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+/*
+ * A free object holds the next free object in its first word; the first
+ * object of a batch in the depot holds the next batch in its second.
+ */
+#define NEXT(obj) (((void **)(obj))[0])
+#define NEXT_BATCH(obj) (((void **)(obj))[1])
+
+struct slab_cache {
+    void    *sc_free[SLAB_CLASSES];
+    uint32_t sc_count[SLAB_CLASSES];
+    /* Only this thread writes these, so they need no atomics */
+    uint64_t sc_allocs[SLAB_CLASSES];
+    uint64_t sc_frees[SLAB_CLASSES];
+    int64_t  sc_requested[SLAB_CLASSES];	/* bytes, may go negative */
+};
+
+static int slab_num_threads = 0;
+static __thread int slab_tid = -1;
+
+static inline int slab_class(size_t size) {
+
+    int c;
+
+    /* Sixteen bytes apart up to 128, then a few per power of two */
+    if (size <= 128)
+	return (size - 1) / 16;
+    for (c = 8; slab_sizes[c] < size; c++)
+	;
+    return c;
+}
+
+static slab_cache_t *slab_my_cache(slab_t *sl) {
+
+    slab_cache_t *cache;
+
+    if (slab_tid < 0) {
+	slab_tid = __atomic_fetch_add(&slab_num_threads, 1, __ATOMIC_ACQ_REL);
+	if (slab_tid >= SLAB_MAX_THREADS)
+	    EXIT_MSG("No more than %d threads can use slabs.\n",
+		     SLAB_MAX_THREADS);
+    }
+    if ((cache = sl->sl_caches[slab_tid]) == NULL) {
+	if ((cache = (slab_cache_t *)calloc(1, sizeof(slab_cache_t))) == NULL)
+	    EXIT_MSG("Could not allocate a slab cache: %s\n", strerror(errno));
+	sl->sl_caches[slab_tid] = cache;
+    }
+    return cache;
+}
+
+slab_t *slab_create(int metadata) {
+
+    slab_t *sl;
+
+    if ((sl = (slab_t *)calloc(1, sizeof(slab_t))) == NULL)
+	return NULL;
+    sl->sl_metadata = metadata;
+    pthread_mutex_init(&sl->sl_lock, NULL);
+    return sl;
+}
+
+/* Cut up to SLAB_BATCH new objects, starting a slab if need be */
+static void *slab_carve(slab_t *sl, int c, uint32_t *count) {
+
+    slab_class_t *scl = &sl->sl_classes[c];
+    size_t size = slab_sizes[c];
+    void *slab, *head = NULL;
+
+    if (scl->scl_carve + size > scl->scl_carve_end) {
+	if (sl->sl_metadata)
+	    slab = ALLOC_SLAB_METADATA(SLAB_BYTES);
+	else
+	    slab = ALLOC_SLAB_DATA(size, SLAB_BYTES);
+	if (slab == NULL)
+	    return NULL;
+	NEXT(slab) = scl->scl_slabs;
+	scl->scl_slabs = slab;
+	scl->scl_num_slabs++;
+	scl->scl_carve = (char *)slab + SLAB_HEADER;
+	scl->scl_carve_end = (char *)slab + SLAB_BYTES;
+    }
+    for (*count = 0; *count < SLAB_BATCH &&
+	     scl->scl_carve + size <= scl->scl_carve_end; (*count)++) {
+	NEXT(scl->scl_carve) = head;
+	head = scl->scl_carve;
+	scl->scl_carve += size;
+    }
+    return head;
+}
+
+/* Fill an empty cache from the depot, or from new objects */
+static int slab_refill(slab_t *sl, slab_cache_t *cache, int c) {
+
+    slab_class_t *scl = &sl->sl_classes[c];
+    void *batch;
+
+    pthread_mutex_lock(&sl->sl_lock);
+    if ((batch = scl->scl_batches) != NULL) {
+	scl->scl_batches = NEXT_BATCH(batch);
+	cache->sc_count[c] = SLAB_BATCH;
+    } else
+	batch = slab_carve(sl, c, &cache->sc_count[c]);
+    pthread_mutex_unlock(&sl->sl_lock);
+
+    cache->sc_free[c] = batch;
+    return batch == NULL ? -1 : 0;
+}
+
+void *slab_alloc(slab_t *sl, size_t size) {
+
+    slab_cache_t *cache = slab_my_cache(sl);
+    int c = slab_class(size);
+    void *obj;
+
+    if (cache->sc_free[c] == NULL && slab_refill(sl, cache, c) != 0)
+	return NULL;
+    obj = cache->sc_free[c];
+    cache->sc_free[c] = NEXT(obj);
+    cache->sc_count[c]--;
+    cache->sc_allocs[c]++;
+    cache->sc_requested[c] += size;
+    return obj;
+}
+
+/* A full cache hands its oldest SLAB_BATCH objects to the depot */
+void slab_free(slab_t *sl, void *ptr, size_t size) {
+
+    slab_cache_t *cache = slab_my_cache(sl);
+    slab_class_t *scl;
+    int c = slab_class(size), i;
+    void *batch, *last;
+
+    NEXT(ptr) = cache->sc_free[c];
+    cache->sc_free[c] = ptr;
+    cache->sc_frees[c]++;
+    cache->sc_requested[c] -= size;
+    if (++cache->sc_count[c] < SLAB_CACHE_MAX)
+	return;
+
+    /* Keep the objects freed last, which are the likeliest in cache */
+    for (last = cache->sc_free[c], i = 1; i < SLAB_CACHE_MAX - SLAB_BATCH;
+	 i++)
+	last = NEXT(last);
+    batch = NEXT(last);
+    NEXT(last) = NULL;
+    cache->sc_count[c] -= SLAB_BATCH;
+
+    scl = &sl->sl_classes[c];
+    pthread_mutex_lock(&sl->sl_lock);
+    NEXT_BATCH(batch) = scl->scl_batches;
+    scl->scl_batches = batch;
+    pthread_mutex_unlock(&sl->sl_lock);
+}
+
+/* Every object goes with its slab; nobody may use them any more */
+void slab_destroy(slab_t *sl) {
+
+    void *slab, *next;
+    int c, t;
+
+    for (c = 0; c < SLAB_CLASSES; c++)
+	for (slab = sl->sl_classes[c].scl_slabs; slab != NULL; slab = next) {
+	    next = NEXT(slab);
+	    if (sl->sl_metadata)
+		FREE_METADATA(slab);
+	    else
+		FREE_DATA(slab);
+	}
+    for (t = 0; t < SLAB_MAX_THREADS; t++)
+	free(sl->sl_caches[t]);
+    pthread_mutex_destroy(&sl->sl_lock);
+    free(sl);
+}
+
+/*
+ * Fragmentation is the part of the slabs that doesn't hold requested
+ * bytes: free objects, and the rounding up to the size class. The
+ * overhead is what the allocator needs for itself.
+ */
+void slab_print_stats(slab_t *sl, const char *name) {
+
+    uint64_t slabs = 0, in_use, total_in_use = 0, held;
+    int64_t requested, total_requested = 0;
+    size_t overhead = sizeof(slab_t);
+    int c, t;
+
+    for (t = 0; t < SLAB_MAX_THREADS; t++)
+	if (sl->sl_caches[t] != NULL)
+	    overhead += sizeof(slab_cache_t);
+
+    printf("%s slabs:\n", name);
+    for (c = 0; c < SLAB_CLASSES; c++) {
+	if (sl->sl_classes[c].scl_num_slabs == 0)
+	    continue;
+	in_use = 0;
+	requested = 0;
+	for (t = 0; t < SLAB_MAX_THREADS; t++) {
+	    slab_cache_t *cache = sl->sl_caches[t];
+
+	    if (cache == NULL)
+		continue;
+	    in_use += cache->sc_allocs[c] - cache->sc_frees[c];
+	    requested += cache->sc_requested[c];
+	}
+	held = sl->sl_classes[c].scl_num_slabs * SLAB_BYTES;
+	printf("\t%4u bytes: %" PRIu64 " slabs, %" PRIu64 " objects, "
+	       "%.1f%% fragmentation\n", slab_sizes[c],
+	       sl->sl_classes[c].scl_num_slabs, in_use,
+	       100.0 - 100.0 * requested / held);
+	slabs += sl->sl_classes[c].scl_num_slabs;
+	total_in_use += in_use;
+	total_requested += requested;
+	overhead += sl->sl_classes[c].scl_num_slabs * SLAB_HEADER;
+    }
+    held = slabs * SLAB_BYTES;
+    printf("\ttotal: %" PRIu64 " KB in %" PRIu64 " slabs, %" PRIu64
+	   " objects, %.1f%% fragmentation, %zu KB overhead\n",
+	   held / BYTES_IN_KB, slabs, total_in_use,
+	   held ? 100.0 - 100.0 * total_requested / held : 0.0,
+	   overhead / BYTES_IN_KB);
+}
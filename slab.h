@@ -0,0 +1,53 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+/*
+ * A size-classed slab allocator for small objects. Slabs of SLAB_BYTES
+ * come from the table's allocator in one piece and are cut into objects
+ * of one size class. Every thread frees to and allocates from its own
+ * cache of free objects; full caches and new objects go through the
+ * depot, which takes the allocator's lock once per SLAB_BATCH objects.
+ * Objects are never given back to the kind one by one: slab_destroy()
+ * frees all the slabs at once. Larger objects aren't for a slab; callers
+ * check slab_fits() first.
+ */
+#define SLAB_BYTES (256 * 1024)
+#define SLAB_MAX_OBJECT 4096
+#define SLAB_CLASSES 23
+#define SLAB_BATCH 64			/* objects moved to or from the depot */
+#define SLAB_MAX_THREADS 256
+
+typedef struct slab_cache slab_cache_t;
+
+typedef struct {
+    void    *scl_slabs;		/* list of this class's slabs */
+    char    *scl_carve;		/* not yet cut into objects... */
+    char    *scl_carve_end;	/* ...up to here */
+    void    *scl_batches;	/* of SLAB_BATCH free objects */
+    uint64_t scl_num_slabs;
+} slab_class_t;
+
+typedef struct {
+    int             sl_metadata;	/* or values */
+    pthread_mutex_t sl_lock;
+    slab_class_t    sl_classes[SLAB_CLASSES];
+    slab_cache_t   *sl_caches[SLAB_MAX_THREADS];
+} slab_t;
+
+slab_t *slab_create(int metadata);
+void    slab_destroy(slab_t *sl);
+void   *slab_alloc(slab_t *sl, size_t size);
+/* The size must be the one the object was allocated with */
+void    slab_free(slab_t *sl, void *ptr, size_t size);
+void    slab_print_stats(slab_t *sl, const char *name);
+
+static inline int slab_fits(size_t size) {
+
+    return size > 0 && size <= SLAB_MAX_OBJECT;
+}
+
+#endif
@@ -0,0 +1,355 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash_table.h"
+#include "nano_time.h"
+#include "vlog.h"
+
+#define VLOG_ALIGN 16			/* as the slabs align values */
+#define VLOG_IDLE_NS (10 * 1000 * 1000)	/* between looks for victims */
+#define NANOSECONDS_IN_SECOND 1000000000
+#define BYTES_IN_MB (1024 * 1024)
+
+enum {VS_FREE, VS_OPEN, VS_FULL, VS_COMPACTING, VS_RELOCATING};
+
+typedef struct {
+    uint64_t vr_key;
+    uint32_t vr_size;
+    uint16_t vr_segment;
+    uint16_t vr_dead;
+} vlog_record_t;
+
+typedef struct {
+    char    *vs_base;
+    size_t   vs_used;		/* bytes appended */
+    uint64_t vs_live;		/* bytes of live records, headers too */
+    int      vs_state;
+} vlog_segment_t;
+
+typedef struct {
+    uint64_t vrl_key;
+    void    *vrl_old;
+    void    *vrl_new;
+} vlog_reloc_t;
+
+struct vlog {
+    pthread_mutex_t vl_lock;		/* segment states and the handoff */
+    pthread_cond_t  vl_cond;
+    pthread_t       vl_compactor;
+    int             vl_stop;
+    int             vl_open;		/* the table's segment, or -1 */
+    int             vl_copy;		/* the compactor's, or -1 */
+    int             vl_num_segments;	/* slots ever used */
+    vlog_segment_t  vl_segments[VLOG_MAX_SEGMENTS];
+    /* Relocations out of vl_victim, for the table once vl_ready is set */
+    int             vl_ready;
+    int             vl_victim;
+    vlog_reloc_t   *vl_relocs;
+    size_t          vl_num_relocs;
+    size_t          vl_max_relocs;
+    uint64_t        vl_appended;	/* bytes, headers too */
+    uint64_t        vl_compactions;
+    uint64_t        vl_copied;		/* bytes */
+    uint64_t        vl_relocated;
+    uint64_t        vl_dropped;
+    uint64_t        vl_compact_ns;
+};
+
+static inline size_t vlog_record_len(size_t size) {
+
+    return sizeof(vlog_record_t) +
+	(size + VLOG_ALIGN - 1) / VLOG_ALIGN * VLOG_ALIGN;
+}
+
+/* With the lock held; a slot freed by a compaction is used again */
+static int vlog_new_segment(vlog_t *vl, int state) {
+
+    vlog_segment_t *seg;
+    void *base;
+    int s;
+
+    for (s = 0; s < vl->vl_num_segments; s++)
+	if (vl->vl_segments[s].vs_state == VS_FREE)
+	    break;
+    if (s == VLOG_MAX_SEGMENTS)
+	return -1;
+    if ((base = ALLOC_DATA(VLOG_SEGMENT_BYTES)) == NULL)
+	return -1;
+    if (s == vl->vl_num_segments)
+	vl->vl_num_segments++;
+
+    seg = &vl->vl_segments[s];
+    seg->vs_base = (char *)base;
+    seg->vs_used = 0;
+    seg->vs_live = 0;
+    seg->vs_state = state;
+    return s;
+}
+
+/*
+ * Make *segment one with room for len more bytes, marking the old one
+ * full. Returns -1 if there's no memory for a new one.
+ */
+static int vlog_make_room(vlog_t *vl, int *segment, int state, size_t len) {
+
+    if (*segment >= 0 &&
+	vl->vl_segments[*segment].vs_used + len <= VLOG_SEGMENT_BYTES)
+	return 0;
+
+    pthread_mutex_lock(&vl->vl_lock);
+    if (*segment >= 0) {
+	vl->vl_segments[*segment].vs_state = VS_FULL;
+	pthread_cond_signal(&vl->vl_cond);
+    }
+    *segment = vlog_new_segment(vl, state);
+    pthread_mutex_unlock(&vl->vl_lock);
+    return *segment >= 0 ? 0 : -1;
+}
+
+static void *vlog_write_record(vlog_t *vl, int s, uint64_t key, size_t size) {
+
+    vlog_segment_t *seg = &vl->vl_segments[s];
+    vlog_record_t *rec = (vlog_record_t *)(seg->vs_base + seg->vs_used);
+    size_t len = vlog_record_len(size);
+
+    rec->vr_key = key;
+    rec->vr_size = size;
+    rec->vr_segment = s;
+    rec->vr_dead = 0;
+    seg->vs_used += len;
+    __atomic_fetch_add(&seg->vs_live, len, __ATOMIC_RELAXED);
+    return rec + 1;
+}
+
+void *vlog_append(vlog_t *vl, uint64_t key, size_t size) {
+
+    size_t len = vlog_record_len(size);
+
+    if (vlog_make_room(vl, &vl->vl_open, VS_OPEN, len) != 0)
+	return NULL;
+    vl->vl_appended += len;
+    return vlog_write_record(vl, vl->vl_open, key, size);
+}
+
+void vlog_free(vlog_t *vl, void *addr) {
+
+    vlog_record_t *rec = (vlog_record_t *)addr - 1;
+
+    __atomic_store_n(&rec->vr_dead, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&vl->vl_segments[rec->vr_segment].vs_live,
+		       vlog_record_len(rec->vr_size), __ATOMIC_RELAXED);
+}
+
+/* With the lock held: the full segment with the fewest live bytes */
+static int vlog_pick_victim(vlog_t *vl) {
+
+    vlog_segment_t *seg;
+    uint64_t live, best_live = 0;
+    int s, victim = -1;
+
+    for (s = 0; s < vl->vl_num_segments; s++) {
+	seg = &vl->vl_segments[s];
+	if (seg->vs_state != VS_FULL)
+	    continue;
+	live = __atomic_load_n(&seg->vs_live, __ATOMIC_RELAXED);
+	if (live * 100 >= seg->vs_used * VLOG_COMPACT_PCT)
+	    continue;
+	if (victim < 0 || live < best_live) {
+	    victim = s;
+	    best_live = live;
+	}
+    }
+    return victim;
+}
+
+/* Copy the live records of the victim, noting where each one went */
+static int vlog_compact(vlog_t *vl, int victim) {
+
+    vlog_segment_t *seg = &vl->vl_segments[victim];
+    vlog_record_t *rec;
+    vlog_reloc_t *relocs;
+    size_t off, len;
+    void *copy;
+
+    vl->vl_num_relocs = 0;
+    for (off = 0; off < seg->vs_used; off += len) {
+	rec = (vlog_record_t *)(seg->vs_base + off);
+	len = vlog_record_len(rec->vr_size);
+	if (__atomic_load_n(&rec->vr_dead, __ATOMIC_ACQUIRE))
+	    continue;
+
+	if (vl->vl_num_relocs == vl->vl_max_relocs) {
+	    vl->vl_max_relocs = vl->vl_max_relocs ? vl->vl_max_relocs * 2 :
+		1024;
+	    relocs = (vlog_reloc_t *)realloc(vl->vl_relocs,
+					     vl->vl_max_relocs *
+					     sizeof(vlog_reloc_t));
+	    if (relocs == NULL)
+		return -1;
+	    vl->vl_relocs = relocs;
+	}
+	if (vlog_make_room(vl, &vl->vl_copy, VS_OPEN, len) != 0)
+	    return -1;
+	copy = vlog_write_record(vl, vl->vl_copy, rec->vr_key, rec->vr_size);
+	memcpy(copy, rec + 1, rec->vr_size);
+	vl->vl_relocs[vl->vl_num_relocs].vrl_key = rec->vr_key;
+	vl->vl_relocs[vl->vl_num_relocs].vrl_old = rec + 1;
+	vl->vl_relocs[vl->vl_num_relocs].vrl_new = copy;
+	vl->vl_num_relocs++;
+	vl->vl_copied += len;
+    }
+    return 0;
+}
+
+/* With the lock held, until signalled or VLOG_IDLE_NS from now */
+static void vlog_nap(vlog_t *vl) {
+
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += VLOG_IDLE_NS;
+    if (until.tv_nsec >= NANOSECONDS_IN_SECOND) {
+	until.tv_sec++;
+	until.tv_nsec -= NANOSECONDS_IN_SECOND;
+    }
+    pthread_cond_timedwait(&vl->vl_cond, &vl->vl_lock, &until);
+}
+
+/* One victim at a time: the next waits until the table took the last */
+static void *vlog_compactor(void *arg) {
+
+    vlog_t *vl = (vlog_t *)arg;
+    uint64_t begin_time;
+    int victim, ret;
+
+    pthread_mutex_lock(&vl->vl_lock);
+    while (!vl->vl_stop) {
+	if (vl->vl_ready || (victim = vlog_pick_victim(vl)) < 0) {
+	    vlog_nap(vl);
+	    continue;
+	}
+	vl->vl_segments[victim].vs_state = VS_COMPACTING;
+	pthread_mutex_unlock(&vl->vl_lock);
+
+	begin_time = nano_time();
+	ret = vlog_compact(vl, victim);
+
+	pthread_mutex_lock(&vl->vl_lock);
+	vl->vl_compact_ns += nano_time() - begin_time;
+	if (ret != 0) {
+	    /* Out of memory: drop the copies, and try again later */
+	    while (vl->vl_num_relocs > 0)
+		vlog_free(vl, vl->vl_relocs[--vl->vl_num_relocs].vrl_new);
+	    vl->vl_segments[victim].vs_state = VS_FULL;
+	    vlog_nap(vl);
+	    continue;
+	}
+	vl->vl_segments[victim].vs_state = VS_RELOCATING;
+	vl->vl_victim = victim;
+	vl->vl_compactions++;
+	__atomic_store_n(&vl->vl_ready, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&vl->vl_lock);
+    return NULL;
+}
+
+vlog_t *vlog_create(void) {
+
+    vlog_t *vl;
+    int ret;
+
+    if ((vl = (vlog_t *)calloc(1, sizeof(vlog_t))) == NULL)
+	return NULL;
+    vl->vl_open = -1;
+    vl->vl_copy = -1;
+    pthread_mutex_init(&vl->vl_lock, NULL);
+    pthread_cond_init(&vl->vl_cond, NULL);
+    if ((ret = pthread_create(&vl->vl_compactor, NULL, vlog_compactor,
+			      vl)) != 0) {
+	printf("Could not start the value log compactor: %s\n",
+	       strerror(ret));
+	free(vl);
+	return NULL;
+    }
+    return vl;
+}
+
+void vlog_apply(vlog_t *vl, vlog_relocate_fn relocate, void *arg) {
+
+    vlog_segment_t *seg;
+    vlog_reloc_t *r;
+    size_t i;
+
+    if (!__atomic_load_n(&vl->vl_ready, __ATOMIC_ACQUIRE))
+	return;
+
+    for (i = 0; i < vl->vl_num_relocs; i++) {
+	r = &vl->vl_relocs[i];
+	if (relocate(arg, r->vrl_key, r->vrl_old, r->vrl_new))
+	    vl->vl_relocated++;
+	else {
+	    vlog_free(vl, r->vrl_new);
+	    vl->vl_dropped++;
+	}
+    }
+
+    pthread_mutex_lock(&vl->vl_lock);
+    seg = &vl->vl_segments[vl->vl_victim];
+    FREE_DATA(seg->vs_base);
+    seg->vs_base = NULL;
+    seg->vs_state = VS_FREE;
+    vl->vl_num_relocs = 0;
+    vl->vl_ready = 0;
+    pthread_cond_signal(&vl->vl_cond);
+    pthread_mutex_unlock(&vl->vl_lock);
+}
+
+void vlog_destroy(vlog_t *vl) {
+
+    int s;
+
+    pthread_mutex_lock(&vl->vl_lock);
+    vl->vl_stop = 1;
+    pthread_cond_signal(&vl->vl_cond);
+    pthread_mutex_unlock(&vl->vl_lock);
+    pthread_join(vl->vl_compactor, NULL);
+
+    for (s = 0; s < vl->vl_num_segments; s++)
+	if (vl->vl_segments[s].vs_state != VS_FREE)
+	    FREE_DATA(vl->vl_segments[s].vs_base);
+    free(vl->vl_relocs);
+    pthread_cond_destroy(&vl->vl_cond);
+    pthread_mutex_destroy(&vl->vl_lock);
+    free(vl);
+}
+
+void vlog_print_stats(vlog_t *vl) {
+
+    uint64_t live = 0;
+    int s, segments = 0;
+
+    pthread_mutex_lock(&vl->vl_lock);
+    for (s = 0; s < vl->vl_num_segments; s++)
+	if (vl->vl_segments[s].vs_state != VS_FREE) {
+	    segments++;
+	    live += __atomic_load_n(&vl->vl_segments[s].vs_live,
+				    __ATOMIC_RELAXED);
+	}
+    printf("Value log: %.1f MB live in %d segments of %d MB, %.1f MB "
+	   "appended\n", (double)live / BYTES_IN_MB, segments,
+	   VLOG_SEGMENT_BYTES / BYTES_IN_MB,
+	   (double)vl->vl_appended / BYTES_IN_MB);
+    printf("\t%" PRIu64 " compactions, %.1f MB copied, %" PRIu64
+	   " relocated, %" PRIu64 " dropped, %.0f us per compaction\n",
+	   vl->vl_compactions, (double)vl->vl_copied / BYTES_IN_MB,
+	   vl->vl_relocated, vl->vl_dropped,
+	   vl->vl_compactions ?
+	   (double)vl->vl_compact_ns / vl->vl_compactions / 1000 : 0.0);
+    pthread_mutex_unlock(&vl->vl_lock);
+}
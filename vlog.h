@@ -0,0 +1,49 @@
+#ifndef _VLOG_H
+#define _VLOG_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+/*
+ * A log-structured value store. Values are appended, each after a small
+ * record header, to the open segment of VLOG_SEGMENT_BYTES, which comes
+ * from the table's allocator in one piece, so that the tier underneath
+ * sees large sequential writes. Freeing a value only marks its record
+ * dead and takes its bytes off the segment's live count.
+ *
+ * A background thread compacts the full segments whose live bytes have
+ * dropped under VLOG_COMPACT_PCT: it copies their live records to a
+ * segment of its own and hands the table a list of relocations. The
+ * table's own thread applies them in vlog_apply(), moving every bucket
+ * that still points at an old record to its copy, and only then is the
+ * old segment freed. A copy that lost its record in the meantime, to a
+ * free or a new put, is dropped. Values must therefore be written right
+ * after they're appended: a later write to the old record may be lost.
+ */
+#define VLOG_SEGMENT_BYTES (4 * 1024 * 1024)
+#define VLOG_MAX_VALUE (VLOG_SEGMENT_BYTES / 4)
+#define VLOG_MAX_SEGMENTS 16384
+#define VLOG_COMPACT_PCT 50
+
+/* Point whatever holds key at new_addr if it points at old_addr */
+typedef int (*vlog_relocate_fn)(void *arg, uint64_t key, void *old_addr,
+				void *new_addr);
+
+typedef struct vlog vlog_t;
+
+vlog_t *vlog_create(void);
+/* Stops the compactor, and frees every segment */
+void    vlog_destroy(vlog_t *vl);
+void   *vlog_append(vlog_t *vl, uint64_t key, size_t size);
+void    vlog_free(vlog_t *vl, void *addr);
+/* Cheap unless the compactor has relocations ready */
+void    vlog_apply(vlog_t *vl, vlog_relocate_fn relocate, void *arg);
+void    vlog_print_stats(vlog_t *vl);
+
+static inline int vlog_fits(size_t size) {
+
+    return size > 0 && size <= VLOG_MAX_VALUE;
+}
+
+#endif
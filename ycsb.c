@@ -0,0 +1,140 @@
+#include <sys/types.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ycsb.h"
+
+const char *ycsb_op_names[YCSB_OPS] = {"read", "update", "insert", "delete",
+				       "scan", "rmw"};
+
+static const char *ycsb_keydist_names[YCSB_KEYDISTS] = {"uniform", "zipfian",
+							"latest"};
+
+/* The core workloads, in READ:UPDATE:INSERT:DELETE:SCAN:RMW percentages */
+static const struct {
+    char yc_name;
+    int  yc_pct[YCSB_OPS];
+    int  yc_keydist;
+} ycsb_core[] = {
+    {'A', {50, 50, 0, 0, 0, 0}, YCSB_ZIPFIAN},
+    {'B', {95, 5, 0, 0, 0, 0}, YCSB_ZIPFIAN},
+    {'C', {100, 0, 0, 0, 0, 0}, YCSB_ZIPFIAN},
+    {'D', {95, 0, 5, 0, 0, 0}, YCSB_LATEST},
+    {'E', {0, 0, 5, 0, 95, 0}, YCSB_ZIPFIAN},
+    {'F', {50, 0, 0, 0, 0, 50}, YCSB_ZIPFIAN},
+};
+
+#define YCSB_CORE_WORKLOADS (int)(sizeof(ycsb_core) / sizeof(ycsb_core[0]))
+
+int ycsb_parse_workload(const char *spec, ycsb_workload_t *yw) {
+
+    int pct[YCSB_OPS], i, total = 0;
+
+    memset(yw, 0, sizeof(*yw));
+    yw->yw_keydist = YCSB_ZIPFIAN;
+    if (spec[0] != '\0' && spec[1] == '\0') {
+	for (i = 0; i < YCSB_CORE_WORKLOADS; i++)
+	    if (ycsb_core[i].yc_name == (spec[0] & ~0x20))
+		break;
+	if (i == YCSB_CORE_WORKLOADS)
+	    return -1;
+	memcpy(pct, ycsb_core[i].yc_pct, sizeof(pct));
+	yw->yw_keydist = ycsb_core[i].yc_keydist;
+    } else if (sscanf(spec, "%d:%d:%d:%d:%d:%d", &pct[0], &pct[1], &pct[2],
+		      &pct[3], &pct[4], &pct[5]) != YCSB_OPS)
+	return -1;
+
+    for (i = 0; i < YCSB_OPS; i++) {
+	if (pct[i] < 0)
+	    return -1;
+	total += pct[i];
+	yw->yw_mix[i] = total;
+    }
+    return total == 100 ? 0 : -1;
+}
+
+int ycsb_parse_keydist(const char *spec) {
+
+    int i;
+
+    for (i = 0; i < YCSB_KEYDISTS; i++)
+	if (strcmp(spec, ycsb_keydist_names[i]) == 0)
+	    return i;
+    return -1;
+}
+
+/*
+ * Gray et al., "Quickly generating billion-record synthetic databases",
+ * as YCSB does it: zeta(n) once, then every draw in constant time.
+ */
+void ycsb_zipf_init(ycsb_zipf_t *yz, uint64_t n, double theta) {
+
+    double zeta2 = 1.0 + pow(0.5, theta);
+    uint64_t i;
+
+    yz->yz_n = n;
+    yz->yz_theta = theta;
+    yz->yz_alpha = 1.0 / (1.0 - theta);
+    yz->yz_zetan = 0;
+    for (i = 1; i <= n; i++)
+	yz->yz_zetan += 1.0 / pow((double)i, theta);
+    yz->yz_eta = (1.0 - pow(2.0 / n, 1.0 - theta)) /
+	(1.0 - zeta2 / yz->yz_zetan);
+}
+
+/* A rank in [0, n), 0 the most popular, for u uniform in [0, 1) */
+static uint64_t ycsb_zipf_next(const ycsb_zipf_t *yz, double u) {
+
+    double uz = u * yz->yz_zetan;
+    uint64_t rank;
+
+    if (uz < 1.0)
+	return 0;
+    if (uz < 1.0 + pow(0.5, yz->yz_theta))
+	return 1;
+    rank = (uint64_t)(yz->yz_n * pow(yz->yz_eta * u - yz->yz_eta + 1.0,
+				      yz->yz_alpha));
+    return rank < yz->yz_n ? rank : yz->yz_n - 1;
+}
+
+/* FNV-1a over the bytes of the rank, so that popular records spread out */
+static inline uint64_t ycsb_scramble(uint64_t x) {
+
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+
+    for (i = 0; i < 8; i++, x >>= 8) {
+	h ^= x & 0xff;
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int ycsb_next_op(const ycsb_workload_t *yw, int pct) {
+
+    int op;
+
+    for (op = 0; op < YCSB_OPS - 1 && pct >= yw->yw_mix[op]; op++)
+	;
+    return op;
+}
+
+uint64_t ycsb_next_record(const ycsb_workload_t *yw, uint64_t records,
+			  uint64_t rnd) {
+
+    /* The top 53 bits make a double in [0, 1) */
+    double u = (double)(rnd >> 11) * (1.0 / 9007199254740992.0);
+    uint64_t rank;
+
+    switch (yw->yw_keydist) {
+    case YCSB_ZIPFIAN:
+	return ycsb_scramble(ycsb_zipf_next(&yw->yw_zipf, u)) % records;
+    case YCSB_LATEST:
+	rank = ycsb_zipf_next(&yw->yw_zipf, u);
+	return rank < records ? records - 1 - rank : 0;
+    default:
+	return rnd % records;
+    }
+}
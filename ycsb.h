@@ -0,0 +1,60 @@
+#ifndef _YCSB_H
+#define _YCSB_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+/*
+ * YCSB-style workloads for the hash table driver. A workload is either
+ * one of the core workloads A to F or six percentages,
+ * READ:UPDATE:INSERT:DELETE:SCAN:RMW, that add up to 100:
+ *
+ *   A	50% reads, 50% updates, zipfian
+ *   B	95% reads, 5% updates, zipfian
+ *   C	reads only, zipfian
+ *   D	95% reads, 5% inserts, latest
+ *   E	95% scans, 5% inserts, zipfian
+ *   F	50% reads, 50% read-modify-writes, zipfian
+ *
+ * Records are numbered from 0 in the order they're inserted. Zipfian
+ * picks popular records scattered over all of them, as YCSB's scrambled
+ * zipfian does; latest picks the records inserted last. Both draw ranks
+ * over the records loaded at first, so records inserted later are only
+ * popular under latest.
+ */
+enum {YCSB_READ, YCSB_UPDATE, YCSB_INSERT, YCSB_DELETE, YCSB_SCAN,
+      YCSB_RMW, YCSB_OPS};
+enum {YCSB_UNIFORM, YCSB_ZIPFIAN, YCSB_LATEST, YCSB_KEYDISTS};
+
+#define YCSB_ZIPF_THETA 0.99
+#define YCSB_SCAN_MAX 100		/* records, uniform from 1 */
+
+extern const char *ycsb_op_names[YCSB_OPS];
+
+typedef struct {
+    uint64_t yz_n;
+    double   yz_theta;
+    double   yz_alpha;
+    double   yz_zetan;
+    double   yz_eta;
+} ycsb_zipf_t;
+
+typedef struct {
+    int         yw_mix[YCSB_OPS];	/* cumulative percentages */
+    int         yw_keydist;
+    ycsb_zipf_t yw_zipf;
+} ycsb_workload_t;
+
+/* A letter or six percentages; -1 if it's neither */
+int      ycsb_parse_workload(const char *spec, ycsb_workload_t *yw);
+/* "uniform", "zipfian" or "latest"; -1 if it's none of them */
+int      ycsb_parse_keydist(const char *spec);
+/* Takes time in proportion to the number of records */
+void     ycsb_zipf_init(ycsb_zipf_t *yz, uint64_t n, double theta);
+/* The op for a random number in [0, 100) */
+int      ycsb_next_op(const ycsb_workload_t *yw, int pct);
+/* One of records records, from 64 random bits */
+uint64_t ycsb_next_record(const ycsb_workload_t *yw, uint64_t records,
+			  uint64_t rnd);
+
+#endif